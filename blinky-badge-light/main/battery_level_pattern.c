@@ -1,15 +1,14 @@
-#include "battery_monitor.h"
+#include "battery_policy.h"
 #include "battery_level_pattern.h"
 #include "led_control.h"
 #include "led_utils.h"
-#include "pins.h"
 
 volatile bool show_battery_meter = false;
 int battery_meter_start_time = 0;
 
 
 void render_battery_level_pattern(uint8_t *framebuffer, int elapsed_ms) {
-    int levels = 13;
+    int levels = LED_FILL_LEVELS;
 
     // Calculate battery fill fraction (0.0 to 1.0)
     float battery_frac = (float)(current_battery_voltage - OFF_THRESH) / (MAX_BATTERY_VOLTAGE - OFF_THRESH);
@@ -37,9 +36,9 @@ void render_battery_level_pattern(uint8_t *framebuffer, int elapsed_ms) {
             v = 0; // Off
         }
         hsv_to_rgb(h, s, v, &r, &g, &b);
-        set_pixel(framebuffer, heart_fill_order[lvl][0], r, g, b);
-        if (heart_fill_order[lvl][1] != heart_fill_order[lvl][0]) {
-            set_pixel(framebuffer, heart_fill_order[lvl][1], r, g, b);
+        set_pixel(framebuffer, led_fill_order[lvl][0], r, g, b);
+        if (led_fill_order[lvl][1] != led_fill_order[lvl][0]) {
+            set_pixel(framebuffer, led_fill_order[lvl][1], r, g, b);
         }
     }
 }
@@ -6,29 +6,36 @@
 #include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 
 #include "battery_monitor.h"
 #include "pins.h"
+#include "telemetry.h"
+#include "capture.h"
 
 static const char *TAG = "BATTERY_MONITOR";
 
 static adc_oneshot_unit_handle_t adc_handle;
 static adc_cali_handle_t cali_handle;
 
-volatile bool limit_brightness = false;
-volatile bool force_safety_pattern = false;
-volatile uint16_t current_battery_voltage = 0;
+static battery_timing_t timing;
+static SemaphoreHandle_t reading_lock;  // the monitor task and the self-test both read
 
 uint16_t get_battery_voltage() {
+    xSemaphoreTake(reading_lock, portMAX_DELAY);
+    int64_t start = esp_timer_get_time();
     // Enable battery monitor n-MOSFET
     gpio_set_level(BATTERY_MONITOR_ENABLE_PIN, 1);
     vTaskDelay(pdMS_TO_TICKS(10));
 
+    int64_t adc_start = esp_timer_get_time();
     int raw_adc = 0;
     ESP_ERROR_CHECK(adc_oneshot_read(adc_handle, ADC_CHANNEL, &raw_adc));
 
     int voltage_mv = 0;
     ESP_ERROR_CHECK(adc_cali_raw_to_voltage(cali_handle, raw_adc, &voltage_mv));
+    timing.adc_us_last = (uint32_t)(esp_timer_get_time() - adc_start);
+    if (timing.adc_us_last > timing.adc_us_max) timing.adc_us_max = timing.adc_us_last;
 
     // Disable battery monitor n-MOSFET
     gpio_set_level(BATTERY_MONITOR_ENABLE_PIN, 0);
@@ -36,13 +43,22 @@ uint16_t get_battery_voltage() {
     // Calculate actual battery voltage
     uint16_t battery_voltage = (uint16_t)(voltage_mv * VOLTAGE_DIVIDER_RATIO);
     vTaskDelay(pdMS_TO_TICKS(10));
+    timing.readings++;
+    timing.reading_us_last = (uint32_t)(esp_timer_get_time() - start);
+    xSemaphoreGive(reading_lock);
 
     return battery_voltage;
 }
 
 
+void battery_get_timing(battery_timing_t *out) {
+    *out = timing;
+}
+
+
 void turn_off() {
     ESP_LOGI(TAG, "Shutting down...");
+    telemetry_flush();
 
     // Turn off battery monitor
     gpio_set_level(BATTERY_MONITOR_ENABLE_PIN, 0);
@@ -59,6 +75,8 @@ void turn_off() {
 
 
 void init_battery_monitor() {
+    reading_lock = xSemaphoreCreateMutex();
+
     // Set MOSFET gate LOW to keep power on
     gpio_set_direction(MOSFET_GATE_PIN, GPIO_MODE_OUTPUT);
     gpio_set_level(MOSFET_GATE_PIN, 0);
@@ -96,62 +114,35 @@ void init_battery_monitor() {
     ESP_LOGI(TAG, "Battery monitor initialized");
 }
 
-static int off_thresh_count = 0;
-
 void battery_monitor_task(void *param) {
     while (1) {
         vTaskDelay(pdMS_TO_TICKS(30000)); // Check every 30 seconds
 
-        current_battery_voltage = get_battery_voltage();
+        uint16_t mv = get_battery_voltage();
+        capture_battery(mv);
+        bool was_limited = limit_brightness, was_safety = force_safety_pattern;
+        bool off = battery_policy_update(mv);
 
-        // --- Brightness limiting buffer zone ---
         if (limit_brightness) {
-            if (current_battery_voltage > RECOVERY_THRESH) {
-                limit_brightness = false; // Yay! Battery voltage is back to normal
-                ESP_LOGI(TAG, "Battery recovered: %d mV. Returning to normal brightness.", current_battery_voltage);
-            }  else {
-                ESP_LOGW(TAG, "Battery low: %d mV. Limiting brightness.", current_battery_voltage);
-            }
+            ESP_LOGW(TAG, "Battery low: %d mV. Limiting brightness.", mv);
+        } else if (was_limited) {
+            ESP_LOGI(TAG, "Battery recovered: %d mV. Returning to normal brightness.", mv);
         } else {
-            if (current_battery_voltage < BRIGHT_THRESH) {
-                limit_brightness = true; // Limit brightness to extend battery life
-                ESP_LOGW(TAG, "Battery low: %d mV. Limiting brightness.", current_battery_voltage);
-            }
-            else if (current_battery_voltage > BRIGHT_THRESH) {
-                limit_brightness = false; // Just in case..
-                ESP_LOGI(TAG, "Battery is normal: %d mV", current_battery_voltage);
-            }
+            ESP_LOGI(TAG, "Battery is normal: %d mV", mv);
         }
 
-
-        // --- Safety mode buffer zone ---
         if (force_safety_pattern) {
-            if (current_battery_voltage > SAFETY_RECOVERY_THRESH) {
-                force_safety_pattern = false;
-                ESP_LOGI(TAG, "Battery recovered: %d mV. Exiting safety mode.", current_battery_voltage);
-            } else {
-                ESP_LOGE(TAG, "Battery critically low: %d mV. In safety mode.", current_battery_voltage);
-            }
-        } else {
-            if (current_battery_voltage < SAFETY_THRESH) {
-                force_safety_pattern = true; // Force safety pattern
-                ESP_LOGE(TAG, "Battery critically low: %d mV. Entering safety mode.", current_battery_voltage);
-            }
+            ESP_LOGE(TAG, "Battery critically low: %d mV. %s", mv, was_safety ? "In safety mode." : "Entering safety mode.");
+        } else if (was_safety) {
+            ESP_LOGI(TAG, "Battery recovered: %d mV. Exiting safety mode.", mv);
         }
 
-        // --- Off threshold - off after 3 checks of passing the threshold! ---
-        if (current_battery_voltage < OFF_THRESH) {
-            off_thresh_count++;
-            ESP_LOGE(TAG, "Battery extremely low: %d mV. OFF threshold count: %d", current_battery_voltage, off_thresh_count);
-            if (off_thresh_count >= 3) {
-                ESP_LOGE(TAG, "Battery extremely low: %d mV. Shutting down.", current_battery_voltage);
-                limit_brightness = true;
-                force_safety_pattern = true;
-                turn_off();
-            }
-        } else {
-            off_thresh_count = 0; // Reset count if voltage recovers
+        if (battery_policy_off_count()) {
+            ESP_LOGE(TAG, "Battery extremely low: %d mV. OFF threshold count: %d", mv, battery_policy_off_count());
+        }
+        if (off) {
+            ESP_LOGE(TAG, "Battery extremely low: %d mV. Shutting down.", mv);
+            turn_off();
         }
-
     }
 }
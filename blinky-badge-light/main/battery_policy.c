@@ -0,0 +1,40 @@
+#include "battery_policy.h"
+
+volatile bool limit_brightness = false;
+volatile bool force_safety_pattern = false;
+volatile uint16_t current_battery_voltage = 0;
+static int off_thresh_count = 0;
+
+
+bool battery_policy_update(uint16_t mv) {
+    current_battery_voltage = mv;
+
+    // --- Brightness limiting buffer zone ---
+    if (limit_brightness) {
+        if (mv > RECOVERY_THRESH) limit_brightness = false; // Yay! Battery voltage is back to normal
+    } else if (mv < BRIGHT_THRESH) {
+        limit_brightness = true; // Limit brightness to extend battery life
+    }
+
+    // --- Safety mode buffer zone ---
+    if (force_safety_pattern) {
+        if (mv > SAFETY_RECOVERY_THRESH) force_safety_pattern = false;
+    } else if (mv < SAFETY_THRESH) {
+        force_safety_pattern = true;
+    }
+
+    // --- Off threshold - off after a few checks of passing the threshold! ---
+    if (mv >= OFF_THRESH) {
+        off_thresh_count = 0; // Reset count if voltage recovers
+        return false;
+    }
+    if (++off_thresh_count < OFF_THRESH_COUNT) return false;
+    limit_brightness = true;
+    force_safety_pattern = true;
+    return true;
+}
+
+
+int battery_policy_off_count(void) {
+    return off_thresh_count;
+}
@@ -0,0 +1,28 @@
+#ifndef BATTERY_POLICY_H
+#define BATTERY_POLICY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// What battery readings do to the lights: dimming, the safety pattern and finally
+// switching off, each with some hysteresis so a reading near a threshold doesn't flap.
+// No ESP-IDF dependencies, sim/replay runs captured readings through the same code.
+
+#define MAX_BATTERY_VOLTAGE 4200 // Maximum battery voltage in mV
+#define BRIGHT_THRESH     3550 // Brightness limiting threshold in mV
+#define RECOVERY_THRESH   3700 // Must recover to 3.7V before turning off brightness limit
+#define SAFETY_THRESH     3470 // Safety mode threshold in mV
+#define SAFETY_RECOVERY_THRESH  3600 // Must recover to 3.6V before exiting safety mode
+#define OFF_THRESH        3330 // Turn off mode threshold in mV
+#define OFF_THRESH_COUNT  3    // readings in a row below OFF_THRESH before switching off
+
+extern volatile bool limit_brightness; // Flag to limit brightness when battery is low but not critical
+extern volatile bool force_safety_pattern; // Flag to force safety pattern when battery is critically low
+extern volatile uint16_t current_battery_voltage; // Current battery voltage in mV
+
+// Takes a new reading. True when it's time to switch off
+bool battery_policy_update(uint16_t mv);
+// Readings in a row below OFF_THRESH
+int battery_policy_off_count(void);
+
+#endif // BATTERY_POLICY_H
@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+#include "capture.h"
+#include "capture_format.h"
+#include "battery_policy.h"
+#include "battery_level_pattern.h"
+#include "firework_notification_pattern.h"
+#include "led_utils.h"
+#include "microphone.h"
+#include "now.h"
+#include "ota_update.h"
+#include "render.h"
+#include "show_mode.h"
+#include "storage.h"
+#include "vu_meter.h"
+
+#if CAPTURE_ENABLED
+
+static const char *TAG = "CAPTURE";
+
+// Oldest records go as new ones come in; head and tail count bytes ever written and
+// dropped, the ring length being a power of two they index it even as they wrap
+static uint8_t ring[CAPTURE_RING_LEN];
+static uint32_t head, tail;
+static capture_chain_t chain;
+static bool have_key;               // nothing is recorded before the first key
+static int64_t next_key_us;
+static portMUX_TYPE capture_lock = portMUX_INITIALIZER_UNLOCKED;
+
+
+static void drop_oldest(void) {
+    uint8_t hdr[CAP_HEADER_MAX];
+    uint32_t used = head - tail;
+    int n = used < CAP_HEADER_MAX ? used : CAP_HEADER_MAX;
+    for (int i = 0; i < n; i++) hdr[i] = ring[(tail + i) % CAPTURE_RING_LEN];
+    int len = capture_record_len(hdr, n, 0);
+    tail += len ? len : used;
+}
+
+
+static void append_locked(const uint8_t *rec, int len) {
+    while (CAPTURE_RING_LEN - (head - tail) < (uint32_t)len) drop_oldest();
+    uint32_t at = head % CAPTURE_RING_LEN;
+    int first = CAPTURE_RING_LEN - at < (uint32_t)len ? CAPTURE_RING_LEN - at : len;
+    memcpy(&ring[at], rec, first);
+    memcpy(ring, rec + first, len - first);
+    head += len;
+}
+
+
+static void append(const capture_record_t *r) {
+    uint8_t rec[64];
+    portENTER_CRITICAL(&capture_lock);
+    if (have_key) append_locked(rec, capture_encode(rec, &chain, r));
+    portEXIT_CRITICAL(&capture_lock);
+}
+
+
+void capture_keyframe(void) {
+    // Only the lighting task writes keys
+    static capture_key_t key;
+    static uint8_t rec[CAP_RECORD_MAX];
+    static sound_state_t sound;
+    int64_t now = esp_timer_get_time();
+    if (now < next_key_us) return;
+    next_key_us = now + CAP_KEY_MS * 1000LL;
+    int64_t net_offset = now_network_time_us() - now;
+
+    // Under the lock, so a sound update numbered after the key can't land before it
+    portENTER_CRITICAL(&capture_lock);
+    sound_get_state(&sound);
+    key = (capture_key_t){
+        .t_us = now,
+        .net_offset_us = net_offset,
+        .pattern_id = settings.pattern_id,
+        .brightness_index = render_brightness_index(),
+        .flash_end_ms = flash_end_time,
+        .battery_meter_start_ms = battery_meter_start_time,
+        .firework_start_ms = firework_notification_start_time,
+        .battery_mv = current_battery_voltage,
+        .flags = (limit_brightness ? CAP_F_LIMIT_BRIGHTNESS : 0) | (force_safety_pattern ? CAP_F_SAFETY_PATTERN : 0) |
+                 (flash_active ? CAP_F_FLASH : 0) | (show_battery_meter ? CAP_F_BATTERY_METER : 0) |
+                 (show_firework_notification ? CAP_F_FIREWORK : 0) | (show_mode_is_leader() ? CAP_F_SHOW_LEADER : 0),
+        .off_count = (uint8_t)battery_policy_off_count(),
+        .effective_brightness = effective_brightness,
+        .vu_level = vu_meter_level(),
+        .sound_seq = sound.seq,
+        .sound = sound.analysis,
+        .local = sound.local,
+        .remote = sound.remote,
+    };
+    memcpy(key.patterns, patterns, sizeof(key.patterns));
+    capture_record_t r = { .tag = CAP_KEY, .t_us = now, .key = &key };
+    append_locked(rec, capture_encode(rec, &chain, &r));
+    have_key = true;
+    portEXIT_CRITICAL(&capture_lock);
+}
+
+
+void capture_frame(const uint8_t *framebuffer, int64_t t_us, int64_t net_us, int loop, uint8_t flags) {
+    capture_record_t r = { .tag = CAP_FRAME, .t_us = t_us, .net_offset_us = net_us - t_us };
+    r.frame.loop = (uint8_t)loop;
+    r.frame.flags = flags;
+    r.frame.sound_seq = sound_rendered_seq();
+    r.frame.checksum = capture_checksum(framebuffer, LED_COUNT * 3, &r.frame.sum);
+    append(&r);
+}
+
+
+void capture_db(uint32_t seq, float db, int64_t block_us) {
+    int64_t now = esp_timer_get_time();
+    capture_record_t r = { .tag = CAP_DB, .t_us = now, .net_offset_us = block_us - now, .seq = seq, .db = db };
+    append(&r);
+}
+
+
+void capture_prime(uint32_t seq, const float *db, int count) {
+    capture_record_t r = { .tag = CAP_PRIME, .t_us = esp_timer_get_time(), .seq = seq };
+    r.prime.count = (uint8_t)(count < CAP_PRIME_MAX ? count : CAP_PRIME_MAX);
+    memcpy(r.prime.db, db, r.prime.count * sizeof(float));
+    append(&r);
+}
+
+
+void capture_audio(uint32_t seq, uint8_t level, uint8_t beat, uint32_t t_us) {
+    capture_record_t r = { .tag = CAP_AUDIO, .t_us = esp_timer_get_time(), .seq = seq };
+    r.audio.level = level;
+    r.audio.beat = beat;
+    r.audio.t_us = t_us;
+    append(&r);
+}
+
+
+void capture_battery(uint16_t mv) {
+    capture_record_t r = { .tag = CAP_BATTERY, .t_us = esp_timer_get_time(), .battery_mv = mv };
+    append(&r);
+}
+
+
+void capture_touch(uint8_t type, uint8_t pad, int64_t due_us) {
+    int64_t now = esp_timer_get_time();
+    capture_record_t r = { .tag = CAP_TOUCH, .t_us = now };
+    r.touch.type = type;
+    r.touch.pad = pad;
+    r.touch.age_us = now > due_us ? (uint32_t)(now - due_us) : 0;
+    append(&r);
+}
+
+
+void capture_genome(int slot, const genome *g) {
+    capture_record_t r = { .tag = CAP_GENOME, .t_us = esp_timer_get_time() };
+    r.genome.slot = (uint8_t)slot;
+    r.genome.g = *g;
+    append(&r);
+}
+
+
+void capture_firework(int64_t t_us) {
+    capture_record_t r = { .tag = CAP_FIREWORK, .t_us = t_us };
+    append(&r);
+}
+
+
+void capture_flash(int64_t t_us) {
+    capture_record_t r = { .tag = CAP_FLASH, .t_us = t_us };
+    append(&r);
+}
+
+
+static void dump(const char *what, const uint8_t *data, uint32_t len) {
+    printf("capture begin %d %s %" PRIu32 "\n", CAP_VERSION, what, len);
+    for (uint32_t off = 0; off < len; off += 32) {
+        printf("cp %05" PRIx32 " ", off);
+        for (uint32_t i = off; i < off + 32 && i < len; i++) printf("%02x", data[i]);
+        printf("\n");
+    }
+    printf("capture end\n");
+}
+
+
+// The ring from its oldest record on, in one piece; NULL without the memory for it
+static uint8_t *copy_ring(uint32_t *len) {
+    uint8_t *copy = malloc(CAPTURE_RING_LEN);
+    if (!copy) return NULL;
+    portENTER_CRITICAL(&capture_lock);
+    uint32_t n = head - tail, at = tail % CAPTURE_RING_LEN;
+    uint32_t first = CAPTURE_RING_LEN - at < n ? CAPTURE_RING_LEN - at : n;
+    memcpy(copy, &ring[at], first);
+    memcpy(copy + first, ring, n - first);
+    portEXIT_CRITICAL(&capture_lock);
+    *len = n;
+    return copy;
+}
+
+
+void capture_dump(void) {
+    uint32_t len;
+    uint8_t *copy = copy_ring(&len);
+    if (!copy) return;
+    dump("ram", copy, len);
+    free(copy);
+}
+
+
+bool capture_save(void) {
+    uint32_t len, offset;
+    const esp_partition_t *part = ota_update_scratch(CAPTURE_RING_LEN + sizeof(capture_saved_t), &offset);
+    if (!part) {
+        ESP_LOGW(TAG, "No room in the update partition, a firmware download may be using it");
+        return false;
+    }
+    uint8_t *copy = copy_ring(&len);
+    if (!copy) return false;
+    capture_saved_t h = { .magic = CAP_MAGIC, .version = CAP_VERSION, .len = len };
+    uint32_t erase = (sizeof(h) + len + part->erase_size - 1) / part->erase_size * part->erase_size;
+    // Stops both cores for a while, the LEDs freeze meanwhile
+    esp_err_t err = esp_partition_erase_range(part, offset, erase);
+    if (err == ESP_OK) err = esp_partition_write(part, offset + sizeof(h), copy, len);
+    if (err == ESP_OK) err = esp_partition_write(part, offset, &h, sizeof(h));
+    free(copy);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Saving the capture failed: %s", esp_err_to_name(err));
+        return false;
+    }
+    ESP_LOGI(TAG, "Saved %" PRIu32 " bytes to %s at 0x%" PRIx32, len, part->label, offset);
+    return true;
+}
+
+
+void capture_dump_saved(void) {
+    uint32_t offset;
+    capture_saved_t h;
+    const esp_partition_t *part = ota_update_scratch(CAPTURE_RING_LEN + sizeof(h), &offset);
+    if (!part || esp_partition_read(part, offset, &h, sizeof(h)) != ESP_OK || h.magic != CAP_MAGIC ||
+        h.version != CAP_VERSION || h.len > CAPTURE_RING_LEN) {
+        printf("no saved capture\n");
+        return;
+    }
+    uint8_t *copy = malloc(h.len);
+    if (!copy) return;
+    if (esp_partition_read(part, offset + sizeof(h), copy, h.len) == ESP_OK) dump("flash", copy, h.len);
+    free(copy);
+}
+
+#else
+
+void capture_dump(void) {
+    printf("capture is off, build with CAPTURE_ENABLED=1\n");
+}
+
+bool capture_save(void) {
+    return false;
+}
+
+void capture_dump_saved(void) {
+    capture_dump();
+}
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "genes.h"
+
+// Input capture for reproducing what the badge showed: touches acted on, microphone
+// blocks, battery readings, what the radio delivered and every frame, into a RAM ring
+// holding the last half minute or so (format in capture_format.h). The `capture`
+// console command dumps it, `capture save` keeps it in flash across a reboot, and
+// sim/replay runs it through the render code on the host and checks every frame.
+
+#ifndef CAPTURE_ENABLED
+#define CAPTURE_ENABLED 1
+#endif
+#define CAPTURE_RING_LEN 32768
+
+#if CAPTURE_ENABLED
+// Lighting task, before rendering a frame: writes a key record when one is due
+void capture_keyframe(void);
+// After the frame went out, with the times render_frame() latched
+void capture_frame(const uint8_t *framebuffer, int64_t t_us, int64_t net_us, int loop, uint8_t flags);
+// seq is the sound update number microphone.c gave each of these
+void capture_db(uint32_t seq, float db, int64_t block_us);
+void capture_prime(uint32_t seq, const float *db, int count);
+void capture_audio(uint32_t seq, uint8_t level, uint8_t beat, uint32_t t_us);
+void capture_battery(uint16_t mv);
+// Before acting on the gesture
+void capture_touch(uint8_t type, uint8_t pad, int64_t due_us);
+void capture_genome(int slot, const genome *g);
+// Started at t_us, esp_timer time
+void capture_firework(int64_t t_us);
+void capture_flash(int64_t t_us);
+#else
+static inline void capture_keyframe(void) {}
+static inline void capture_frame(const uint8_t *framebuffer, int64_t t_us, int64_t net_us, int loop, uint8_t flags) {}
+static inline void capture_db(uint32_t seq, float db, int64_t block_us) {}
+static inline void capture_prime(uint32_t seq, const float *db, int count) {}
+static inline void capture_audio(uint32_t seq, uint8_t level, uint8_t beat, uint32_t t_us) {}
+static inline void capture_battery(uint16_t mv) {}
+static inline void capture_touch(uint8_t type, uint8_t pad, int64_t due_us) {}
+static inline void capture_genome(int slot, const genome *g) {}
+static inline void capture_firework(int64_t t_us) {}
+static inline void capture_flash(int64_t t_us) {}
+#endif
+
+// Hex dump of the ring to stdout between `capture begin` and `capture end` lines
+void capture_dump(void);
+// Copies the ring to the end of the spare firmware slot, where capture_dump_saved()
+// finds it after a reboot
+bool capture_save(void);
+void capture_dump_saved(void);
+
+#endif // CAPTURE_H
@@ -0,0 +1,206 @@
+#include <string.h>
+#include "capture_format.h"
+
+
+static int put_varint(uint8_t *out, uint64_t v) {
+    int n = 0;
+    while (v >= 0x80) {
+        out[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (uint8_t)v;
+    return n;
+}
+
+
+static int put_signed(uint8_t *out, int64_t v) {
+    return put_varint(out, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+
+static bool get_varint(const uint8_t *buf, int len, int *off, uint64_t *v) {
+    *v = 0;
+    for (int shift = 0; shift < 70 && *off < len; shift += 7) {
+        uint8_t b = buf[(*off)++];
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+
+static bool get_signed(const uint8_t *buf, int len, int *off, int64_t *v) {
+    uint64_t u;
+    if (!get_varint(buf, len, off, &u)) return false;
+    *v = (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+    return true;
+}
+
+
+static bool get_u32(const uint8_t *buf, int len, int *off, uint32_t *v) {
+    uint64_t u;
+    if (!get_varint(buf, len, off, &u)) return false;
+    *v = (uint32_t)u;
+    return true;
+}
+
+
+static bool get_bytes(const uint8_t *buf, int len, int *off, void *out, int n) {
+    if (*off + n > len) return false;
+    memcpy(out, &buf[*off], n);
+    *off += n;
+    return true;
+}
+
+
+int capture_encode(uint8_t *out, capture_chain_t *chain, const capture_record_t *r) {
+    uint8_t payload[64];
+    const uint8_t *p = payload;
+    int n = 0;
+    switch (r->tag) {
+        case CAP_KEY:
+            p = (const uint8_t *)r->key;
+            n = sizeof(*r->key);
+            chain->net_offset_us = r->key->net_offset_us;
+            break;
+        case CAP_FRAME:
+            n += put_signed(&payload[n], r->net_offset_us - chain->net_offset_us);
+            chain->net_offset_us = r->net_offset_us;
+            payload[n++] = r->frame.loop;
+            payload[n++] = r->frame.flags;
+            n += put_varint(&payload[n], r->frame.sound_seq);
+            memcpy(&payload[n], &r->frame.checksum, 4);
+            n += 4;
+            n += put_varint(&payload[n], r->frame.sum);
+            break;
+        case CAP_DB:
+            n += put_signed(&payload[n], r->net_offset_us - chain->net_offset_us);
+            chain->net_offset_us = r->net_offset_us;
+            n += put_varint(&payload[n], r->seq);
+            memcpy(&payload[n], &r->db, 4);
+            n += 4;
+            break;
+        case CAP_PRIME:
+            n += put_varint(&payload[n], r->seq);
+            payload[n++] = r->prime.count;
+            memcpy(&payload[n], r->prime.db, r->prime.count * sizeof(float));
+            n += r->prime.count * sizeof(float);
+            break;
+        case CAP_AUDIO:
+            n += put_varint(&payload[n], r->seq);
+            payload[n++] = r->audio.level;
+            payload[n++] = r->audio.beat;
+            memcpy(&payload[n], &r->audio.t_us, 4);
+            n += 4;
+            break;
+        case CAP_BATTERY:
+            n += put_varint(&payload[n], r->battery_mv);
+            break;
+        case CAP_TOUCH:
+            payload[n++] = r->touch.type;
+            payload[n++] = r->touch.pad;
+            n += put_varint(&payload[n], r->touch.age_us);
+            break;
+        case CAP_GENOME:
+            payload[n++] = r->genome.slot;
+            memcpy(&payload[n], &r->genome.g, sizeof(genome));
+            n += sizeof(genome);
+            break;
+    }
+
+    int h = 0;
+    out[h++] = r->tag;
+    h += put_varint(&out[h], n);
+    h += put_signed(&out[h], r->t_us - chain->t_us);
+    chain->t_us = r->t_us;
+    memcpy(&out[h], p, n);
+    return h + n;
+}
+
+
+int capture_record_len(const uint8_t *buf, int len, int off) {
+    int start = off;
+    uint64_t n, dt;
+    if (off >= len) return 0;
+    off++;
+    if (!get_varint(buf, len, &off, &n) || !get_varint(buf, len, &off, &dt)) return 0;
+    return off - start + (int)n;
+}
+
+
+bool capture_decode(const uint8_t *buf, int len, int *off, capture_chain_t *chain, capture_record_t *r) {
+    int rec_len = capture_record_len(buf, len, *off);
+    if (!rec_len || *off + rec_len > len) return false;
+    int end = *off + rec_len;
+    uint64_t n;
+    int64_t d;
+    capture_key_t *key = r->key;
+    memset(r, 0, sizeof(*r));
+    r->key = key;
+    r->tag = buf[(*off)++];
+    get_varint(buf, len, off, &n);
+    get_signed(buf, len, off, &d);
+    chain->t_us += d;
+
+    bool ok = true;
+    switch (r->tag) {
+        case CAP_KEY: {
+            capture_key_t k;
+            ok = n == sizeof(k) && get_bytes(buf, end, off, &k, sizeof(k));
+            if (ok) {
+                chain->t_us = k.t_us;
+                chain->net_offset_us = k.net_offset_us;
+                chain->synced = true;
+                if (key) *key = k;
+            }
+            break;
+        }
+        case CAP_FRAME:
+            ok = get_signed(buf, end, off, &d) && get_bytes(buf, end, off, &r->frame.loop, 1) &&
+                 get_bytes(buf, end, off, &r->frame.flags, 1) && get_u32(buf, end, off, &r->frame.sound_seq) &&
+                 get_bytes(buf, end, off, &r->frame.checksum, 4) && get_u32(buf, end, off, &r->frame.sum);
+            chain->net_offset_us += d;
+            break;
+        case CAP_DB:
+            ok = get_signed(buf, end, off, &d) && get_u32(buf, end, off, &r->seq) && get_bytes(buf, end, off, &r->db, 4);
+            chain->net_offset_us += d;
+            break;
+        case CAP_PRIME:
+            ok = get_u32(buf, end, off, &r->seq) && get_bytes(buf, end, off, &r->prime.count, 1) &&
+                 r->prime.count <= CAP_PRIME_MAX && get_bytes(buf, end, off, r->prime.db, r->prime.count * sizeof(float));
+            break;
+        case CAP_AUDIO:
+            ok = get_u32(buf, end, off, &r->seq) && get_bytes(buf, end, off, &r->audio.level, 1) &&
+                 get_bytes(buf, end, off, &r->audio.beat, 1) && get_bytes(buf, end, off, &r->audio.t_us, 4);
+            break;
+        case CAP_BATTERY: {
+            uint32_t mv = 0;
+            ok = get_u32(buf, end, off, &mv);
+            r->battery_mv = (uint16_t)mv;
+            break;
+        }
+        case CAP_TOUCH:
+            ok = get_bytes(buf, end, off, &r->touch.type, 1) && get_bytes(buf, end, off, &r->touch.pad, 1) &&
+                 get_u32(buf, end, off, &r->touch.age_us);
+            break;
+        case CAP_GENOME:
+            ok = get_bytes(buf, end, off, &r->genome.slot, 1) && get_bytes(buf, end, off, &r->genome.g, sizeof(genome));
+            break;
+    }
+    // Unknown tags and fields added later are skipped by their length
+    *off = end;
+    r->t_us = chain->t_us;
+    r->net_offset_us = chain->net_offset_us;
+    return ok;
+}
+
+
+uint32_t capture_checksum(const uint8_t *framebuffer, int len, uint32_t *sum) {
+    uint32_t h = 2166136261u, s = 0;
+    for (int i = 0; i < len; i++) {
+        h = (h ^ framebuffer[i]) * 16777619u;
+        s += framebuffer[i];
+    }
+    *sum = s;
+    return h;
+}
@@ -0,0 +1,136 @@
+#ifndef CAPTURE_FORMAT_H
+#define CAPTURE_FORMAT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "genes.h"
+#include "led_control.h"
+#include "sound.h"
+
+// Input capture stream, recorded on the badge (capture.c) and replayed on the host
+// (sim/replay.c). Records are byte-packed: a tag, the payload length and the time
+// since the record before as varints, then the payload. A key record with the whole
+// state that frames depend on comes every CAP_KEY_MS; the ring drops its oldest
+// records as it fills, and replay starts at the first key left.
+// Every input that changes what the LEDs show is recorded as the code that acts on it
+// sees it, and every frame with a checksum of what went out, so the host can run the
+// same render code over the inputs and tell whether it got the same frames.
+// No ESP-IDF dependencies. Key records hold structs as they are in memory; badge
+// and host are both little-endian with the same alignment rules.
+
+#define CAP_MAGIC 0x54504143        // "CAPT", saved captures start with a capture_saved_t
+#define CAP_VERSION 1
+#define CAP_KEY_MS 4000
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t len;                   // bytes of records after this header
+} capture_saved_t;
+
+// Record tags
+#define CAP_KEY 0x01                // capture_key_t
+#define CAP_FRAME 0x02              // a frame on the LEDs
+#define CAP_DB 0x03                 // a microphone block
+#define CAP_PRIME 0x04              // dB history refilled after mic power-up
+#define CAP_AUDIO 0x05              // audio event from a nearby badge
+#define CAP_BATTERY 0x06            // battery reading
+#define CAP_TOUCH 0x07              // gesture acted on by the touch task
+#define CAP_GENOME 0x08             // a pattern slot got a new genome
+#define CAP_FIREWORK 0x09           // firework notification started
+#define CAP_FLASH 0x0a              // feedback flash not caused by a touch (show mode)
+
+// Key flags
+#define CAP_F_LIMIT_BRIGHTNESS 0x01
+#define CAP_F_SAFETY_PATTERN 0x02
+#define CAP_F_FLASH 0x04            // flash_active
+#define CAP_F_BATTERY_METER 0x08
+#define CAP_F_FIREWORK 0x10
+#define CAP_F_SHOW_LEADER 0x20
+
+#define CAP_PRIME_MAX 8             // dB values in a CAP_PRIME record
+
+typedef struct {
+    int64_t t_us;                   // esp_timer time
+    int64_t net_offset_us;          // network time minus t_us
+    int32_t pattern_id;
+    int32_t brightness_index;
+    int64_t flash_end_ms;
+    int32_t battery_meter_start_ms;
+    int32_t firework_start_ms;
+    uint16_t battery_mv;
+    uint8_t flags;                  // CAP_F_*
+    uint8_t off_count;              // battery readings below OFF_THRESH in a row
+    uint8_t effective_brightness;   // of the frame before, the flash goes by it
+    float vu_level;
+    uint32_t sound_seq;             // sound updates the state below includes
+    sound_analysis_t sound;
+    sound_features_t local;
+    sound_features_t remote;
+    genome patterns[NUM_PATTERNS];
+} capture_key_t;
+
+typedef struct {
+    uint8_t loop;
+    uint8_t flags;                  // RENDER_*
+    uint32_t sound_seq;             // sound updates the frame's sound level had seen
+    uint32_t checksum;              // capture_checksum() of the framebuffer
+    uint32_t sum;                   // of all channels, to tell rounding from real differences
+} capture_frame_t;
+
+typedef struct {
+    uint8_t tag;                    // CAP_*
+    int64_t t_us;                   // esp_timer time of the record
+    int64_t net_offset_us;          // CAP_FRAME and CAP_DB: network time minus t_us
+    uint32_t seq;                   // CAP_DB, CAP_PRIME, CAP_AUDIO: sound update number
+    // CAP_KEY: the key, out of line so the other records stay small on the stack.
+    // capture_decode() fills the one it points at, NULL to skip it
+    capture_key_t *key;
+    union {
+        capture_frame_t frame;
+        float db;                   // CAP_DB, the block's raw dB
+        struct {
+            uint8_t count;
+            float db[CAP_PRIME_MAX];
+        } prime;
+        struct {
+            uint8_t level;
+            uint8_t beat;
+            uint32_t t_us;          // publisher's network time, low 32 bits
+        } audio;
+        uint16_t battery_mv;
+        struct {
+            uint8_t type;           // GESTURE_*
+            uint8_t pad;
+            uint32_t age_us;        // since the gesture was due
+        } touch;
+        struct {
+            uint8_t slot;
+            genome g;
+        } genome;
+    };
+} capture_record_t;
+
+// Time and network offset carried from record to record; zero it to start
+typedef struct {
+    int64_t t_us;
+    int64_t net_offset_us;
+    bool synced;                    // decoding: a key record has been seen
+} capture_chain_t;
+
+#define CAP_HEADER_MAX 16
+#define CAP_RECORD_MAX (CAP_HEADER_MAX + sizeof(capture_key_t))
+
+// Writes r to out, at most CAP_RECORD_MAX bytes, and returns how many
+int capture_encode(uint8_t *out, capture_chain_t *chain, const capture_record_t *r);
+// Decodes the record at buf[*off], advancing *off. Records before the first key
+// decode too, but their times aren't known (chain->synced false).
+// False at the end or on a record that doesn't decode
+bool capture_decode(const uint8_t *buf, int len, int *off, capture_chain_t *chain, capture_record_t *r);
+// Length of the record at buf[off] without decoding it, 0 if it is cut short
+int capture_record_len(const uint8_t *buf, int len, int off);
+
+// FNV-1a of a framebuffer, and the sum of its channels
+uint32_t capture_checksum(const uint8_t *framebuffer, int len, uint32_t *sum);
+
+#endif // CAPTURE_FORMAT_H
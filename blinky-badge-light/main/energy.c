@@ -0,0 +1,125 @@
+#include "esp_private/esp_clk.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "energy.h"
+#include "battery_monitor.h"
+#include "led_control.h"
+#include "led_outputs.h"
+#include "microphone.h"
+#include "now.h"
+#include "standby.h"
+#include "touch_input.h"
+
+#define ENERGY_PERIOD_MS 1000
+#define ENERGY_STANDBY_PERIOD_MS 10000  // fewer wakeups; the counters don't mind
+
+// Counters at the last sample, the model takes the differences
+typedef struct {
+    int64_t t_us;
+    uint64_t led_level_us;
+    uint64_t tx_airtime_us;
+    uint64_t sleep_us;
+    configRUN_TIME_COUNTER_TYPE idle[portNUM_PROCESSORS];
+    uint64_t touch_scan_us;
+    uint64_t mic_on_us;
+    uint32_t battery_readings;
+    bool standby;
+    uint32_t standby_entries;
+} energy_counters_t;
+
+static energy_model_t model;
+static double standby_uas;          // model charge over samples wholly in standby
+static uint64_t standby_us;
+static portMUX_TYPE energy_lock = portMUX_INITIALIZER_UNLOCKED;
+
+
+static void read_counters(energy_counters_t *c) {
+    static now_stats_t radio;
+    now_get_stats(&radio);
+    standby_stats_t sb;
+    standby_get_stats(&sb);
+    touch_scan_stats_t touch;
+    touch_get_scan_stats(&touch);
+    mic_power_stats_t mic;
+    mic_get_power_stats(&mic);
+    battery_timing_t battery;
+    battery_get_timing(&battery);
+
+    c->t_us = esp_timer_get_time();
+    c->led_level_us = led_level_us();
+    c->tx_airtime_us = radio.tx_airtime_us;
+    c->sleep_us = sb.sleep_us;
+    // The idle task runs light sleep too, so its time includes it
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        c->idle[core] = ulTaskGetRunTimeCounter(xTaskGetIdleTaskHandleForCore(core));
+    }
+    c->touch_scan_us = 0;
+    for (int m = 0; m < TOUCH_SCAN_MODES; m++) {
+        if (touch.period_us[m]) c->touch_scan_us += touch.time_us[m] * touch.scan_us / touch.period_us[m];
+    }
+    c->mic_on_us = mic.on_us;
+    c->battery_readings = battery.readings;
+    c->standby = sb.active;
+    c->standby_entries = sb.entries;
+}
+
+
+void energy_task(void *param) {
+    energy_model_t m;
+    energy_model_init(&m);
+    portENTER_CRITICAL(&energy_lock);
+    model = m;
+    portEXIT_CRITICAL(&energy_lock);
+    energy_counters_t last, now;
+    read_counters(&last);
+
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(standby_active() ? ENERGY_STANDBY_PERIOD_MS : ENERGY_PERIOD_MS));
+        read_counters(&now);
+
+        energy_sample_t s = {
+            .dt_us = (uint32_t)(now.t_us - last.t_us),
+            .led_count = (uint16_t)led_outputs_total(),
+            .led_level_us = now.led_level_us - last.led_level_us,
+            .radio_tx_us = (uint32_t)(now.tx_airtime_us - last.tx_airtime_us),
+            .sleep_us = (uint32_t)(now.sleep_us - last.sleep_us),
+            .cpu_mhz = (uint16_t)(esp_clk_cpu_freq() / 1000000),
+            .touch_scan_us = (uint32_t)(now.touch_scan_us - last.touch_scan_us),
+            .mic_on_us = (uint32_t)(now.mic_on_us - last.mic_on_us),
+        };
+        for (int core = 0; core < portNUM_PROCESSORS; core++) {
+            // Run time counters are esp_timer microseconds and wrap, the difference doesn't
+            uint32_t idle = (uint32_t)(now.idle[core] - last.idle[core]);
+            if (idle < s.dt_us) s.cpu_busy_us += s.dt_us - idle;
+        }
+        energy_model_add(&m, &s);
+        if (now.battery_readings != last.battery_readings) energy_model_battery(&m, current_battery_voltage);
+        bool in_standby = last.standby && now.standby && last.standby_entries == now.standby_entries;
+        last = now;
+
+        portENTER_CRITICAL(&energy_lock);
+        model = m;
+        if (in_standby) {
+            for (int i = 0; i < ENERGY_SUBSYSTEMS; i++) standby_uas += (double)m.ua_last[i] * s.dt_us / 1e6;
+            standby_us += s.dt_us;
+        }
+        portEXIT_CRITICAL(&energy_lock);
+    }
+}
+
+
+void energy_get(energy_model_t *out) {
+    portENTER_CRITICAL(&energy_lock);
+    *out = model;
+    portEXIT_CRITICAL(&energy_lock);
+}
+
+
+uint32_t energy_standby_ua(void) {
+    portENTER_CRITICAL(&energy_lock);
+    uint32_t ua = standby_us ? (uint32_t)(standby_uas * model.scale / (standby_us / 1e6)) : 0;
+    portEXIT_CRITICAL(&energy_lock);
+    return ua;
+}
@@ -0,0 +1,15 @@
+#ifndef ENERGY_H
+#define ENERGY_H
+
+#include "energy_model.h"
+
+// Live energy accounting (energy_model.h), fed from the LED, radio, CPU, touch and
+// microphone counters and the battery readings. Type `energy` in the serial monitor.
+
+void energy_task(void *param);
+void energy_get(energy_model_t *out);
+// Average current over the samples taken wholly in standby, scaled by the battery
+// calibration; 0 until there is one
+uint32_t energy_standby_ua(void);
+
+#endif // ENERGY_H
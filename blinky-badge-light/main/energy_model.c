@@ -0,0 +1,130 @@
+#include <string.h>
+
+#include "energy_model.h"
+
+// ESP32-S3 in modem sleep (radio figures come on top): both cores idle, and what
+// each busy core adds, by CPU clock
+static const struct {
+    uint16_t mhz;
+    uint16_t idle_ua_1000;
+    uint16_t core_ua_1000;
+} cpu_table[] = {
+    { 40, 13, 5 },
+    { 80, 22, 8 },
+    { 160, 27, 13 },
+    { 240, 32, 20 },
+};
+#define CPU_POINTS (int)(sizeof(cpu_table) / sizeof(cpu_table[0]))
+
+// Resting voltage to charge left, typical Li-ion
+static const struct {
+    uint16_t mv;
+    uint8_t soc;
+} soc_table[] = {
+    { 4200, 100 }, { 4100, 90 }, { 4000, 78 }, { 3900, 63 }, { 3800, 48 },
+    { 3700, 30 }, { 3600, 15 }, { 3500, 7 }, { 3400, 3 }, { 3300, 0 },
+};
+#define SOC_POINTS (int)(sizeof(soc_table) / sizeof(soc_table[0]))
+
+
+void energy_model_init(energy_model_t *m) {
+    memset(m, 0, sizeof(*m));
+    m->scale = 1.0f;
+}
+
+
+static void cpu_currents(int mhz, float *idle_ua, float *core_ua) {
+    int i = 1;
+    while (i < CPU_POINTS - 1 && mhz > cpu_table[i].mhz) i++;
+    float f = (float)(mhz - cpu_table[i - 1].mhz) / (cpu_table[i].mhz - cpu_table[i - 1].mhz);
+    if (f < 0) f = 0;
+    if (f > 1) f = 1;
+    *idle_ua = 1000.0f * (cpu_table[i - 1].idle_ua_1000 + f * (cpu_table[i].idle_ua_1000 - cpu_table[i - 1].idle_ua_1000));
+    *core_ua = 1000.0f * (cpu_table[i - 1].core_ua_1000 + f * (cpu_table[i].core_ua_1000 - cpu_table[i - 1].core_ua_1000));
+}
+
+
+void energy_model_add(energy_model_t *m, const energy_sample_t *s) {
+    if (!s->dt_us) return;
+    double dt = s->dt_us / 1e6;
+    double sleep = s->sleep_us < s->dt_us ? s->sleep_us / 1e6 : dt;
+    double tx = s->radio_tx_us / 1e6;
+    double awake = dt - sleep;
+    float idle_ua, core_ua;
+    cpu_currents(s->cpu_mhz, &idle_ua, &core_ua);
+
+    double uas[ENERGY_SUBSYSTEMS];
+    uas[ENERGY_LEDS] = s->led_level_us / 1e6 * LED_CHANNEL_UA / 255 + dt * s->led_count * LED_QUIESCENT_UA;
+    // Outside standby the receiver never sleeps; in standby it listens in windows while
+    // the CPU is awake anyway, so awake time stands in for both
+    uas[ENERGY_RADIO] = (awake > tx ? awake - tx : 0) * RADIO_RX_UA + tx * RADIO_TX_UA;
+    uas[ENERGY_CPU] = awake * idle_ua + s->cpu_busy_us / 1e6 * core_ua + sleep * CPU_SLEEP_UA;
+    uas[ENERGY_TOUCH] = s->touch_scan_us / 1e6 * TOUCH_SCAN_UA;
+    uas[ENERGY_MIC] = s->mic_on_us / 1e6 * (MIC_ON_UA + I2S_ON_UA);
+    uas[ENERGY_BASE] = dt * BASE_UA;
+
+    for (int i = 0; i < ENERGY_SUBSYSTEMS; i++) {
+        m->uas[i] += uas[i];
+        m->ua_last[i] = (float)(uas[i] / dt);
+        if (m->window_open) m->window_uas += uas[i];
+    }
+    m->time_us += s->dt_us;
+}
+
+
+float energy_model_soc(float mv) {
+    if (mv >= soc_table[0].mv) return soc_table[0].soc;
+    for (int i = 1; i < SOC_POINTS; i++) {
+        if (mv >= soc_table[i].mv) {
+            float f = (mv - soc_table[i].mv) / (soc_table[i - 1].mv - soc_table[i].mv);
+            return soc_table[i].soc + f * (soc_table[i - 1].soc - soc_table[i].soc);
+        }
+    }
+    return 0;
+}
+
+
+static void open_window(energy_model_t *m, float soc) {
+    m->window_open = true;
+    m->window_start_us = m->time_us;
+    m->window_soc = soc;
+    m->window_uas = 0;
+}
+
+
+void energy_model_battery(energy_model_t *m, uint16_t mv) {
+    // The voltage sags with the load and readings are noisy; only the trend over
+    // a long window says anything about the charge
+    m->readings++;
+    if (m->readings == 1) m->mv_smooth = mv;
+    else m->mv_smooth += (mv - m->mv_smooth) / CAL_SMOOTH_READINGS;
+    if (m->readings < CAL_SMOOTH_READINGS) return;
+
+    float soc = energy_model_soc(m->mv_smooth);
+    if (!m->window_open || soc > m->window_soc + CAL_CHARGE_SOC) {
+        open_window(m, soc);
+        return;
+    }
+    float drop = m->window_soc - soc;
+    if (drop < CAL_MIN_SOC_DROP || m->time_us - m->window_start_us < CAL_MIN_S * 1000000ULL) return;
+
+    double battery_uas = drop / 100.0 * BATTERY_CAPACITY_MAH * 3600.0 * 1000.0;
+    float ratio = m->window_uas > 0 ? (float)(battery_uas / m->window_uas) : 0;
+    if (ratio >= CAL_RATIO_MIN && ratio <= CAL_RATIO_MAX) {
+        // The first window stands alone, later ones move the factor a quarter of the way
+        m->scale = m->windows ? m->scale + (ratio - m->scale) / 4 : ratio;
+        m->windows++;
+    }
+    open_window(m, soc);
+}
+
+
+float energy_model_mah(const energy_model_t *m, energy_subsystem_t sub) {
+    return (float)(m->uas[sub] * m->scale / 3600.0 / 1000.0);
+}
+
+
+const char *energy_subsystem_name(energy_subsystem_t sub) {
+    static const char *const names[ENERGY_SUBSYSTEMS] = { "leds", "radio", "cpu", "touch", "mic", "base" };
+    return sub < ENERGY_SUBSYSTEMS ? names[sub] : "?";
+}
@@ -0,0 +1,84 @@
+#ifndef ENERGY_MODEL_H
+#define ENERGY_MODEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Where the battery goes: the charge each subsystem draws, from what it did over an
+// interval (energy.c samples the counters once a second) times typical currents for it.
+// The currents are datasheet typicals, so the totals are scaled by a factor fitted to
+// the battery itself: the charge its voltage drop says went out over a long stretch
+// against the charge the model counted over the same stretch.
+// No ESP-IDF dependencies.
+
+typedef enum {
+    ENERGY_LEDS,        // PWM by channel value, plus every LED's quiescent draw
+    ENERGY_RADIO,       // receiver listening, frames on air
+    ENERGY_CPU,         // awake at the clock of the moment, busy cores, light sleep
+    ENERGY_TOUCH,
+    ENERGY_MIC,         // mic and I2S while clocked
+    ENERGY_BASE,        // regulator and the rest, always
+    ENERGY_SUBSYSTEMS
+} energy_subsystem_t;
+
+// Typical currents, the one set the firmware uses (standby and microphone stats too)
+#define LED_CHANNEL_UA 12000        // one WS2812B channel at 255, it scales with the value
+#define LED_QUIESCENT_UA 600        // per LED, dark
+#define RADIO_RX_UA 60000           // receiver on, on top of the awake CPU
+#define RADIO_TX_UA 300000          // 802.11b at 20 dBm, on top of the awake CPU
+#define CPU_SLEEP_UA 250            // light sleep, touch sensor on
+#define TOUCH_SCAN_UA 500           // while a scan is measuring
+#define MIC_ON_UA 600               // I2S MEMS mic while clocked, next to nothing when stopped
+#define I2S_ON_UA 1000              // I2S clocks and DMA while the mic runs
+#define BASE_UA 150                 // regulator quiescent, battery charger, pull-ups
+
+// Calibration against the battery
+#ifndef BATTERY_CAPACITY_MAH
+#define BATTERY_CAPACITY_MAH 2500   // typical 18650
+#endif
+#define CAL_SMOOTH_READINGS 8       // readings the voltage is smoothed over, load steps move it
+#define CAL_MIN_SOC_DROP 5.0f       // percent of charge a window must see go, the table is coarse
+#define CAL_MIN_S 1800              // and for at least this long
+#define CAL_CHARGE_SOC 2.0f         // charge coming back by this much means a charger, start over
+#define CAL_RATIO_MIN 0.25f         // windows further off than this are taken as bad readings
+#define CAL_RATIO_MAX 4.0f
+
+// What happened over one interval
+typedef struct {
+    uint32_t dt_us;
+    uint16_t led_count;         // on all outputs
+    uint64_t led_level_us;      // channel values summed over the strip, times how long they were on
+    uint32_t radio_tx_us;       // our frames on air
+    uint32_t sleep_us;          // light sleep, the radio is off too
+    uint32_t cpu_busy_us;       // not in the idle task, both cores added up
+    uint16_t cpu_mhz;
+    uint32_t touch_scan_us;     // sensor measuring
+    uint32_t mic_on_us;
+} energy_sample_t;
+
+typedef struct {
+    uint64_t time_us;
+    double uas[ENERGY_SUBSYSTEMS];      // model charge, uA s
+    float ua_last[ENERGY_SUBSYSTEMS];   // average current over the last interval
+    float scale;                        // battery over model, 1 until a window completes
+    uint32_t windows;                   // calibration windows completed
+    uint32_t readings;
+    float mv_smooth;
+    bool window_open;
+    uint64_t window_start_us;
+    float window_soc;                   // percent, at its start
+    double window_uas;                  // model charge since its start
+} energy_model_t;
+
+void energy_model_init(energy_model_t *m);
+void energy_model_add(energy_model_t *m, const energy_sample_t *s);
+// A battery reading in mV, taken at m->time_us
+void energy_model_battery(energy_model_t *m, uint16_t mv);
+
+// Charge left in percent for a resting voltage, from a typical Li-ion discharge curve
+float energy_model_soc(float mv);
+// Calibrated charge drawn since start
+float energy_model_mah(const energy_model_t *m, energy_subsystem_t sub);
+const char *energy_subsystem_name(energy_subsystem_t sub);
+
+#endif // ENERGY_MODEL_H
@@ -3,15 +3,19 @@
 #include <stdlib.h>
 #include <math.h>
 #include "firework_notification_pattern.h"
-#include "led_utils.h" // for set_pixel, hsv_to_rgb, etc.
-#include "pins.h"      // for LED_COUNT
+#include "led_utils.h" // for set_pixel, hsv_to_rgb, LED_COUNT
 #include "genes.h"     // for genome struct
 #include "led_control.h"
-#include "battery_monitor.h" // for effective_brightness
+#include "battery_policy.h" // for limit_brightness
 
 volatile bool show_firework_notification = false;
 int firework_notification_start_time = 0;
 
+void firework_notification_start(int now_ms) {
+    show_firework_notification = true;
+    firework_notification_start_time = now_ms;
+}
+
 void render_firework_notification_pattern(uint8_t *framebuffer, int elapsed_ms, const genome *g, int loop) {
     uint8_t brightness = effective_brightness;
     if (!limit_brightness) {
@@ -11,6 +11,8 @@ extern int firework_notification_start_time;
 // Duration constants (ms)
 #define FIREWORK_NOTIFICATION_TOTAL_MS 5000 // Total duration of the firework notification
 
+// Starts the notification at now_ms (esp_timer time), from the top if one is showing
+void firework_notification_start(int now_ms);
 void render_firework_notification_pattern(uint8_t *framebuffer, int elapsed_ms, const genome *g, int loop);
 
 #endif // FIREWORK_NOTIFICATION_PATTERN_H
\ No newline at end of file
@@ -0,0 +1,134 @@
+#include <string.h>
+#include "gesture.h"
+
+
+void gesture_init(gesture_t *g, const gesture_pad_config_t pads[GESTURE_PADS], const gesture_chord_t *chords, int chord_count) {
+    memset(g, 0, sizeof(*g));
+    memcpy(g->pads, pads, sizeof(g->pads));
+    g->chord_count = chord_count < GESTURE_CHORDS ? chord_count : GESTURE_CHORDS;
+    memcpy(g->chords, chords, g->chord_count * sizeof(gesture_chord_t));
+}
+
+
+static void emit(gesture_out_t *out, int *n, uint8_t type, uint8_t pad, int64_t due_us) {
+    out[*n].type = type;
+    out[*n].pad = pad;
+    out[*n].due_us = due_us;
+    (*n)++;
+}
+
+
+int gesture_poll(gesture_t *g, int64_t now_us, gesture_out_t *out) {
+    int n = 0;
+    for (int p = 0; p < GESTURE_PADS; p++) {
+        uint8_t bit = 1 << p;
+        int64_t long_due = g->down_us[p] + (int64_t)g->pads[p].long_ms * 1000;
+        if ((g->down_mask & bit) && g->pads[p].long_ms && !(g->long_fired & bit) && now_us >= long_due) {
+            g->long_fired |= bit;
+            emit(out, &n, GESTURE_LONG_PRESS, (uint8_t)p, long_due);
+        }
+        int64_t tap_due = g->tap_us[p] + (int64_t)g->pads[p].double_ms * 1000;
+        if ((g->tap_pending & bit) && now_us >= tap_due) {
+            g->tap_pending &= ~bit;
+            emit(out, &n, GESTURE_TAP, (uint8_t)p, tap_due);
+        }
+    }
+    for (int c = 0; c < g->chord_count; c++) {
+        const gesture_chord_t *ch = &g->chords[c];
+        int64_t due = g->chord_us[c] + (int64_t)ch->hold_ms * 1000;
+        if ((g->down_mask & ch->mask) == ch->mask && !(g->chord_fired & (1 << c)) && now_us >= due) {
+            g->chord_fired |= 1 << c;
+            g->long_fired |= ch->mask; // those touches are spent, no taps when they let go
+            emit(out, &n, GESTURE_CHORD, (uint8_t)c, due);
+        }
+    }
+    return n;
+}
+
+
+int gesture_feed(gesture_t *g, const gesture_event_t *ev, gesture_out_t *out) {
+    if (ev->pad >= GESTURE_PADS) return 0;
+    // A late task still sees holds and tap windows end before the event that followed them
+    int n = gesture_poll(g, ev->t_us, out);
+    uint8_t bit = 1 << ev->pad;
+    const gesture_pad_config_t *cfg = &g->pads[ev->pad];
+
+    if (ev->down) {
+        g->down_mask |= bit;
+        g->down_us[ev->pad] = ev->t_us;
+        g->long_fired &= ~bit;
+        emit(out, &n, GESTURE_PRESS, ev->pad, ev->t_us);
+        if (g->tap_pending & bit) {
+            // Second touch inside the window: told on the press, the rest of this touch is spent
+            g->tap_pending &= ~bit;
+            g->long_fired |= bit;
+            emit(out, &n, GESTURE_DOUBLE_TAP, ev->pad, ev->t_us);
+        }
+        for (int c = 0; c < g->chord_count; c++) {
+            if ((g->chords[c].mask & bit) && (g->down_mask & g->chords[c].mask) == g->chords[c].mask) {
+                g->chord_us[c] = ev->t_us;
+            }
+        }
+        return n;
+    }
+
+    if (!(g->down_mask & bit)) return n; // release without a press, the ring overflowed
+    g->down_mask &= ~bit;
+    for (int c = 0; c < g->chord_count; c++) {
+        if (g->chords[c].mask & bit) g->chord_fired &= ~(1 << c);
+    }
+    if (g->long_fired & bit) return n;
+    if (cfg->double_ms) {
+        g->tap_pending |= bit;
+        g->tap_us[ev->pad] = ev->t_us;
+    } else {
+        emit(out, &n, GESTURE_TAP, ev->pad, ev->t_us);
+    }
+    return n;
+}
+
+
+int64_t gesture_next_due_us(const gesture_t *g) {
+    int64_t next = INT64_MAX;
+    for (int p = 0; p < GESTURE_PADS; p++) {
+        uint8_t bit = 1 << p;
+        if ((g->down_mask & bit) && g->pads[p].long_ms && !(g->long_fired & bit)) {
+            int64_t due = g->down_us[p] + (int64_t)g->pads[p].long_ms * 1000;
+            if (due < next) next = due;
+        }
+        if (g->tap_pending & bit) {
+            int64_t due = g->tap_us[p] + (int64_t)g->pads[p].double_ms * 1000;
+            if (due < next) next = due;
+        }
+    }
+    for (int c = 0; c < g->chord_count; c++) {
+        const gesture_chord_t *ch = &g->chords[c];
+        if ((g->down_mask & ch->mask) == ch->mask && !(g->chord_fired & (1 << c))) {
+            int64_t due = g->chord_us[c] + (int64_t)ch->hold_ms * 1000;
+            if (due < next) next = due;
+        }
+    }
+    return next;
+}
+
+
+void gesture_record_latency(gesture_t *g, const gesture_out_t *out, int64_t done_us) {
+    if (out->type >= GESTURE_TYPES) return;
+    gesture_latency_t *l = &g->latency[out->type];
+    uint32_t us = done_us > out->due_us ? (uint32_t)(done_us - out->due_us) : 0;
+    l->count++;
+    l->latency_sum_us += us;
+    if (us > l->latency_max_us) l->latency_max_us = us;
+}
+
+
+const char *gesture_name(uint8_t type) {
+    switch (type) {
+        case GESTURE_PRESS: return "press";
+        case GESTURE_TAP: return "tap";
+        case GESTURE_DOUBLE_TAP: return "double tap";
+        case GESTURE_LONG_PRESS: return "long press";
+        case GESTURE_CHORD: return "chord";
+        default: return "?";
+    }
+}
@@ -0,0 +1,110 @@
+#ifndef GESTURE_H
+#define GESTURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Touch gestures: the touch ISR only timestamps press and release events into a
+// lock-free ring; the touch task drains it and the recognizer here turns the events
+// into taps, long presses, double taps and chords of several pads held together.
+// Time-based gestures (a hold running out, a double tap window closing) come from
+// gesture_poll(), called whenever gesture_next_due_us() says something is due.
+// No ESP-IDF dependencies, the same code replays scripted traces on the host (sim/).
+
+#define GESTURE_PADS 8
+#define GESTURE_RING_LEN 32         // power of two; press and release of every pad several times over
+#define GESTURE_CHORDS 4
+#define GESTURE_OUT_MAX (GESTURE_PADS + GESTURE_CHORDS + 2) // gestures one call can report
+
+// What a gesture_out_t reports. PRESS comes right away on every touch, the rest once decided
+#define GESTURE_PRESS 0
+#define GESTURE_TAP 1               // released before the long press time, no second tap followed
+#define GESTURE_DOUBLE_TAP 2
+#define GESTURE_LONG_PRESS 3        // still held after long_ms, reported while held
+#define GESTURE_CHORD 4             // all pads of a chord held for its hold_ms
+#define GESTURE_TYPES 5
+
+typedef struct {
+    int64_t t_us;                   // when the ISR saw it
+    uint8_t pad;
+    bool down;
+} gesture_event_t;
+
+// Single producer (the touch ISR), single consumer (the touch task)
+typedef struct {
+    volatile uint32_t head;         // written by the producer only
+    volatile uint32_t tail;         // written by the consumer only
+    uint32_t dropped;               // events lost to a full ring
+    gesture_event_t ev[GESTURE_RING_LEN];
+} gesture_ring_t;
+
+typedef struct {
+    uint16_t long_ms;               // 0 = no long press
+    uint16_t double_ms;             // max gap for a double tap; 0 = taps reported on release
+} gesture_pad_config_t;
+
+typedef struct {
+    uint8_t mask;                   // bit per pad
+    uint16_t hold_ms;
+} gesture_chord_t;
+
+typedef struct {
+    uint8_t type;                   // GESTURE_*
+    uint8_t pad;                    // chord index for GESTURE_CHORD
+    int64_t due_us;                 // when it could first be told: the event that completed it, or the hold running out
+} gesture_out_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t latency_max_us;
+    uint64_t latency_sum_us;
+} gesture_latency_t;
+
+typedef struct {
+    gesture_pad_config_t pads[GESTURE_PADS];
+    gesture_chord_t chords[GESTURE_CHORDS];
+    int chord_count;
+
+    uint8_t down_mask;
+    int64_t down_us[GESTURE_PADS];
+    uint8_t long_fired;             // bit per pad, this touch already made a long press, double tap or chord
+    uint8_t tap_pending;            // bit per pad, waiting out double_ms for a second tap
+    int64_t tap_us[GESTURE_PADS];
+    uint8_t chord_fired;            // bit per chord
+    int64_t chord_us[GESTURE_CHORDS]; // when its last pad went down
+
+    gesture_latency_t latency[GESTURE_TYPES];
+} gesture_t;
+
+// Producer side, safe in an ISR: no locks, no allocation. False if the ring is full
+static inline bool gesture_ring_push(gesture_ring_t *r, const gesture_event_t *ev) {
+    uint32_t head = r->head;
+    if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == GESTURE_RING_LEN) {
+        r->dropped++;
+        return false;
+    }
+    r->ev[head % GESTURE_RING_LEN] = *ev;
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static inline bool gesture_ring_pop(gesture_ring_t *r, gesture_event_t *ev) {
+    uint32_t tail = r->tail;
+    if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == tail) return false;
+    *ev = r->ev[tail % GESTURE_RING_LEN];
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+void gesture_init(gesture_t *g, const gesture_pad_config_t pads[GESTURE_PADS], const gesture_chord_t *chords, int chord_count);
+// Both write at most GESTURE_OUT_MAX gestures to out and return how many. Events go in
+// in ring order; feeding one also reports whatever fell due before it
+int gesture_feed(gesture_t *g, const gesture_event_t *ev, gesture_out_t *out);
+int gesture_poll(gesture_t *g, int64_t now_us, gesture_out_t *out);
+int64_t gesture_next_due_us(const gesture_t *g);
+
+// Input-to-action time, once the gesture was acted on at done_us
+void gesture_record_latency(gesture_t *g, const gesture_out_t *out, int64_t done_us);
+const char *gesture_name(uint8_t type);
+
+#endif // GESTURE_H
@@ -1,264 +1,323 @@
-#include <math.h>
+#include <assert.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "driver/rmt_tx.h"
+#include "driver/gpio.h"
 #include "esp_timer.h"
 #include "esp_log.h"
 #include "led_strip.h"
 #include "led_utils.h"
 
-#include "battery_monitor.h"
-#include "genes.h"
 #include "led_control.h"
+#include "led_outputs.h"
+#include "render.h"
 #include "microphone.h"
 #include "pins.h"
-#include "vu_meter.h"
-#include "battery_level_pattern.h"
-#include "firework_notification_pattern.h"
-#include "storage.h"
 #include "testing_routine.h"
+#include "now.h"
+#include "show_mode.h"
+#include "trace.h"
+#include "capture.h"
 
 static const char *TAG = "LED_CONTROL";
 
-static led_strip_handle_t strip;
-static int current_pattern = 0; // Active pattern ID
-uint8_t brightness = MAX_BRIGHTNESS;
-uint8_t effective_brightness = MAX_BRIGHTNESS;
-static const uint8_t brightness_levels[] = { //gamma corrected brightness levels for better perceived change between levels
-    20,    
-    35,   
-    69,   
-    121, 
-    200  
-};
+#define LOOP_PERIOD_MS 20 // one hue animation step
+#define RESUME_BUDGET_US 50000  // wake touch to the pattern back, see touch_input.c
+
+static led_strip_handle_t strips[LED_OUTPUTS_MAX];     // led_outputs[] order, the heart first
+static int outputs;
+static TaskHandle_t output_tasks[LED_OUTPUTS_MAX];      // senders of the extra outputs
+static SemaphoreHandle_t output_sent[LED_OUTPUTS_MAX];  // given by an output's task once its strip is out
+static bool output_busy[LED_OUTPUTS_MAX];               // sending, output_sent not taken for it yet
+static int64_t refresh_start_us;
+static led_output_stats_t output_stats[LED_OUTPUTS_MAX];
+static volatile uint8_t frame_power = 0;    // see led_frame_power()
+static uint64_t level_us;                   // see led_level_us(), up to level_since_us
+static uint32_t level_sum;                  // of the frame on the LEDs
+static int64_t level_since_us;
+static portMUX_TYPE level_lock = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t lighting_task_handle = NULL;
+static int64_t pending_input_us = 0;    // oldest input not on the LEDs yet, 0 if none
+static photon_latency_t photon_latency;
+static portMUX_TYPE latency_lock = portMUX_INITIALIZER_UNLOCKED;
+static volatile bool standby = false;
+static bool resuming = false;           // first frame after standby not shown yet
+static uint32_t resume_last_us, resume_max_us;
+static uint32_t reopen_us;              // making the strips again on the last wake
+static lighting_frame_stats_t frame_stats;
+static uint16_t fps_count;
+static int64_t fps_window_us;
+
+// Smoothed over 16 frames, with the worst kept
+static void frame_time(uint32_t *avg, uint32_t *max, int64_t us) {
+    *avg = *avg ? (*avg * 15 + (uint32_t)us) / 16 : (uint32_t)us;
+    if (us > *max) *max = (uint32_t)us;
+}
 
 
-static int brightness_index = 0; // Index for the current brightness level
-volatile bool flash_active = false;
-int64_t flash_end_time = 0;
+// Returns once the RMT has sent the output's strip
+static void refresh_output(int out) {
+    esp_err_t err = led_strip_refresh(strips[out]);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to refresh LED output %d: %s", out, esp_err_to_name(err));
+    }
+    led_output_stats_t *st = &output_stats[out];
+    st->wire_us_last = (uint32_t)(esp_timer_get_time() - refresh_start_us);
+    frame_time(&st->wire_us_avg, &st->wire_us_max, st->wire_us_last);
+}
 
-// Initialize LED strip
-void init_leds() {
-    ESP_LOGI(TAG, "Initializing LEDs");
-
-    // Configure LED strip
-    led_strip_config_t strip_config = {
-        .strip_gpio_num = LED_PIN,
-        .max_leds = LED_COUNT,
-    };
-    led_strip_rmt_config_t rmt_config = {
-        .resolution_hz = 10 * 1000 * 1000, // 10MHz
-        .flags.with_dma = false,
-    };
-    ESP_ERROR_CHECK(led_strip_new_rmt_device(&strip_config, &rmt_config, &strip));
 
+// Sends an extra output's strip alongside the heart's whenever the lighting task says so
+static void output_task(void *param) {
+    int out = (int)(intptr_t)param;
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        refresh_output(out);
+        xSemaphoreGive(output_sent[out]);
+    }
 }
 
-// Set the active pattern
-void set_pattern(int pattern_id) {
-    ESP_LOGI(TAG, "Updating LEDs with pattern %d", pattern_id);
-    current_pattern = pattern_id % NUM_PATTERNS;
-}
 
-// Set LED brightness
-void set_brightness(int index) {
-    ESP_LOGI(TAG, "Updating LEDs with brightness %d", index);
-    brightness_index = index % (sizeof(brightness_levels) / sizeof(brightness_levels[0]));
-    brightness = brightness_levels[brightness_index];
+static int output_gpio(int out) {
+    return led_outputs[out].gpio < 0 ? LED_PIN : led_outputs[out].gpio;
 }
 
-void update_leds(uint8_t *framebuffer) {
-    if (!strip) {
-        ESP_LOGE(TAG, "LED strip not initialized");
-        return;
-    }
-    esp_err_t err;
-    // Update each pixel in the LED strip
-    for (int i = 0; i < LED_COUNT; i++) {
-        uint8_t g = framebuffer[i * 3 + 0]; // Green
-        uint8_t r = framebuffer[i * 3 + 1]; // Red
-        uint8_t b = framebuffer[i * 3 + 2]; // Blue
-        err = led_strip_set_pixel(strip, i, r, g, b);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to set pixel %d: %s", i, esp_err_to_name(err));
-        }
-    }
 
-    // Refresh the strip to apply the changes
-    err = led_strip_refresh(strip);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to refresh LED strip: %s", esp_err_to_name(err));
+// An RMT channel holds the APB clock at full speed while it's enabled, which keeps the
+// chip out of light sleep, so in standby the strips are let go of and made again on wake
+static void open_strips(void) {
+    bool dma_free = true;
+    for (int out = 0; out < outputs; out++) {
+        const led_output_t *o = &led_outputs[out];
+        // Configure LED strip
+        led_strip_config_t strip_config = {
+            .strip_gpio_num = output_gpio(out),
+            .max_leds = o->count,
+        };
+        // Short strips fit the RMT's own memory; longer ones would refill it from an
+        // interrupt every few LEDs. Only one channel can have DMA
+        bool dma = dma_free && o->count > 64;
+        led_strip_rmt_config_t rmt_config = {
+            .resolution_hz = 10 * 1000 * 1000, // 10MHz
+            .flags.with_dma = dma,
+        };
+        ESP_ERROR_CHECK(led_strip_new_rmt_device(&strip_config, &rmt_config, &strips[out]));
+        if (dma) dma_free = false;
     }
 }
 
 
-uint8_t hue_table[24] = {
-      0,   // 0
-     21,   // 1
-     42,   // 2
-     63,   // 3
-     85,   // 4
-    106,   // 5
-    127,   // 6
-    148,   // 7
-    170,   // 8
-    191,   // 9
-    212,   // 10
-    233,   // 11
-    255,   // 12  
-    233,   // 13
-    212,   // 14
-    191,   // 15
-    170,   // 16
-    148,   // 17
-    127,   // 18
-    106,   // 19
-     85,   // 20
-     63,   // 21
-     42,   // 22
-     21    // 23
-};
-
-
-uint8_t calculate_pattern_hue(const genome *g, int led_index, int loop) {
-    int dir = (g->hue_dir == 0) ? 1 : -1;
-    float frac_offset = ((float)(dir * loop * g->hue_rate) / 256.0f) * LED_COUNT;
-    while (frac_offset < 0) frac_offset += LED_COUNT;
-    while (frac_offset >= LED_COUNT) frac_offset -= LED_COUNT;
-
-    uint8_t hue;
-    if ((g->hue_base == 0) && (g->hue_bound == 255)) {
-        // Full rainbow
-        uint32_t base_hue = (255 * led_index) / LED_COUNT;
-        int32_t animated_hue = base_hue + dir * (loop * g->hue_rate);
-        hue = (uint8_t)(((animated_hue % 256) + 256) % 256);
-    } else {
-        // Limited hue range, triangle wave
-        float shifted = (led_index + frac_offset);
-        int idx0 = ((int)shifted) % LED_COUNT;
-        int idx1 = (idx0 + 1) % LED_COUNT;
-        float frac = shifted - (int)shifted;
-        uint8_t base_hue = (uint8_t)((1.0f - frac) * hue_table[idx0] + frac * hue_table[idx1]);
-        hue = map_16(base_hue, 0, 255, g->hue_base, g->hue_bound);
+// After the dark frame is out. The data lines are held low, as the RMT leaves them, so
+// the strips see no stray bit while released
+static void close_strips(void) {
+    for (int out = 0; out < outputs; out++) {
+        if (output_busy[out]) {
+            xSemaphoreTake(output_sent[out], portMAX_DELAY);
+            output_busy[out] = false;
+        }
+        led_strip_del(strips[out]);
+        strips[out] = NULL;
+        gpio_set_direction(output_gpio(out), GPIO_MODE_OUTPUT);
+        gpio_set_level(output_gpio(out), 0);
     }
-    return hue;
 }
 
 
-void render_pattern(int index, uint8_t *framebuffer, int loop) {
-    genome *g = &patterns[index];
-
-    // Limit brightness if battery is low but not critical
-    if (limit_brightness) {
-        effective_brightness = brightness_levels[0];
-    } else {
-        effective_brightness = brightness;
+// Initialize LED strips
+void init_leds() {
+    outputs = led_output_count < LED_OUTPUTS_MAX ? led_output_count : LED_OUTPUTS_MAX;
+    if (outputs < led_output_count) {
+        ESP_LOGE(TAG, "Only %d LED outputs, one RMT channel each; leaving out the rest", LED_OUTPUTS_MAX);
     }
-
-    // notification from esp-now pattern
-    if (show_firework_notification) {
-        int elapsed = (esp_timer_get_time() / 1000) - firework_notification_start_time;
-        if (elapsed >= FIREWORK_NOTIFICATION_TOTAL_MS) {
-            show_firework_notification = false;
-        } else {
-            render_firework_notification_pattern(framebuffer, elapsed, g, loop);
-            return;
+    ESP_LOGI(TAG, "Initializing %d LEDs on %d outputs", led_outputs_total(), outputs);
+    led_layout_init();
+
+    open_strips();
+    for (int out = 0; out < outputs; out++) {
+        const led_output_t *o = &led_outputs[out];
+        output_stats[out] = (led_output_stats_t){ .gpio = output_gpio(out), .count = o->count, .mode = o->mode };
+        if (out) {
+            output_sent[out] = xSemaphoreCreateBinary();
+            xTaskCreatePinnedToCore(output_task, "LED Output", 2048, (void *)(intptr_t)out, 6, &output_tasks[out], 1);
         }
     }
+}
 
-    // Show battery meter patern if enabled and timer didn't run out, otherwise, turn it off
-    if (show_battery_meter) {
-        int elapsed = (esp_timer_get_time() / 1000) - battery_meter_start_time;
-        if (elapsed >= BATTERY_TOTAL_MS) {
-            show_battery_meter = false;
+void update_leds(uint8_t *framebuffer, int leds) {
+    if (!strips[0]) {
+        ESP_LOGE(TAG, "LED strip not initialized");
+        return;
+    }
+    esp_err_t err, pixel_err = ESP_OK;
+    uint32_t sum = 0;
+    // Update each pixel of every output from the frame
+    for (int out = 0; out < outputs; out++) {
+        const led_output_t *o = &led_outputs[out];
+        int start = led_output_start(out);
+        // Still sending the last frame after the wait below gave up: its pixels can't
+        // change under the RMT, so finish that first
+        if (output_busy[out]) {
+            xSemaphoreTake(output_sent[out], portMAX_DELAY);
+            output_busy[out] = false;
         }
-        else {
-            render_battery_level_pattern(framebuffer, elapsed);
-            return;
+        for (int j = 0; j < o->count; j++) {
+            const uint8_t *p = &framebuffer[led_output_source(o, start, j, leds) * 3];
+            uint8_t g = p[0]; // Green
+            uint8_t r = p[1]; // Red
+            uint8_t b = p[2]; // Blue
+            err = led_strip_set_pixel(strips[out], j, r, g, b);
+            if (err != ESP_OK) pixel_err = err;
+            sum += g + r + b;
         }
     }
+    // Once per frame rather than per pixel, a log line costs more than the whole frame
+    if (pixel_err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to set pixels: %s", esp_err_to_name(pixel_err));
+    }
 
-    // VU meter pattern shortcut
-    if (index == NUM_PATTERNS - 1) {
-        render_vu_meter_pattern(framebuffer, g, loop);
-        return;
+    // Refresh the strips to apply the changes, all at once: the extra outputs from their
+    // own tasks, which get going first, the heart from here
+    trace_event(TRACE_RMT_START, 0);
+    refresh_start_us = esp_timer_get_time();
+    for (int out = 1; out < outputs; out++) {
+        output_busy[out] = true;
+        xTaskNotifyGive(output_tasks[out]);
     }
+    refresh_output(0);
+    for (int out = 1; out < outputs; out++) {
+        if (xSemaphoreTake(output_sent[out], pdMS_TO_TICKS(100)) == pdTRUE) output_busy[out] = false;
+    }
+    trace_event(TRACE_RMT_DONE, 0);
 
-    // Main pattern loop
-    int tau = map_16(g->cd_rate, 0, 255, 700, 8000); // ms
-    int64_t curtime = esp_timer_get_time() / 1000; // ms
-    float twopi = 2.0f * (float)M_PI;
-    float anim = twopi * ((float)(curtime) / tau);
-
-    for (int i = 0; i < LED_COUNT; i++) {
-        // ---- HUE calculation ----
-        uint8_t hue = calculate_pattern_hue(g, i, loop);
-
-        // ---- VALUE (brightness sinusoid) ----
-        float t = (float)i / (float)(LED_COUNT - 1);
-        float phase = twopi * g->cd_period * t;
-        float spacetime = (g->cd_dir > 128) ? (phase + anim) : (phase - anim);
-        float base_val = 127.0f * (1.0f + cosf(spacetime)); // 0..254
-        uint8_t val = (uint8_t)base_val;
-
-        // ---- NONLINEARITY/GAMMA ----
-        if (g->nonlin > 127)
-            val = (uint8_t)(((uint16_t)val * (uint16_t)val) >> 8);
-
-        // ---- APPLY EFFECTIVE BRIGHTNESS ----
-        // Sound-reactive pattern brightness + effective_brightness for basic sound reactive pattern
-        if (index == NUM_PATTERNS - 2) {
-            // Scale brightness by smooth_dB_brightness_level and effective_brightness
-            val = (uint8_t)(smooth_dB_brightness_level * effective_brightness * (val / 255.0f));
-        } else {
-            val = (uint8_t)((val * effective_brightness) / 255);
-        }
-        
-        // ---- HSV to RGB ----
-        uint8_t r, gr, b;
-        hsv_to_rgb(hue, g->sat, val, &r, &gr, &b);
+    frame_power = (uint8_t)(sum / (led_outputs_total() * 3));
+
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&level_lock);
+    level_us += (uint64_t)level_sum * (now - level_since_us);
+    level_sum = sum;
+    level_since_us = now;
+    portEXIT_CRITICAL(&level_lock);
+}
 
-        // ---- Write to framebuffer ----
-        set_pixel(framebuffer, i, r, gr, b);
+
+uint8_t led_frame_power(void) {
+    return frame_power;
+}
+
+
+uint64_t led_level_us(void) {
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&level_lock);
+    uint64_t us = level_us + (uint64_t)level_sum * (now - level_since_us);
+    portEXIT_CRITICAL(&level_lock);
+    return us;
+}
+
+
+// ---- render.h ----
+
+int64_t render_hal_time_us(void) {
+    return esp_timer_get_time();
+}
+
+
+int64_t render_hal_network_time_us(void) {
+    return now_network_time_us();
+}
+
+
+float render_hal_sound_level(uint32_t now_us) {
+    return get_render_sound_level(now_us);
+}
+
+
+bool render_hal_show(uint8_t *framebuffer, int loop) {
+    return show_mode_render(framebuffer, loop);
+}
+
+
+// Lighting task
+void lighting_show_input(int64_t input_us) {
+    portENTER_CRITICAL(&latency_lock);
+    if (pending_input_us == 0) pending_input_us = input_us;
+    portEXIT_CRITICAL(&latency_lock);
+    if (lighting_task_handle) {
+        xTaskNotifyGive(lighting_task_handle);
     }
 }
 
 
-void flash_feedback_pattern() {
-    flash_active = true;
-    flash_end_time = esp_timer_get_time() / 1000 + 125; // 125ms from now
+void lighting_standby(bool on) {
+    standby = on;
+    if (lighting_task_handle) xTaskNotifyGive(lighting_task_handle);
 }
 
 
-void safety_pattern(uint8_t *framebuffer) {
-    uint8_t dim_red = brightness_levels[0] * 0.2f;
-    uint8_t full_red = brightness_levels[0];;
-
-    int64_t ms = esp_timer_get_time() / 1000;
-    int slowdown_factor = 150; // Adjust for speed
-    int shifted = (ms / slowdown_factor);
-
-    for (int i = 0; i < LED_COUNT; i++) {
-        int pattern_index = (i + shifted) % 4;
-        switch (pattern_index) {
-            case 0: // Off
-                set_pixel(framebuffer, i, 0, 0, 0);
-                break;
-            case 1: // Dim
-            case 3: // Dim
-                set_pixel(framebuffer, i, dim_red, 0, 0);
-                break;
-            case 2: // Bright
-                set_pixel(framebuffer, i, full_red, 0, 0);
-                break;
-        }
+static void count_frame(int64_t now) {
+    frame_stats.frames++;
+    fps_count++;
+    if (now - fps_window_us >= 1000000) {
+        frame_stats.fps = fps_count;
+        fps_count = 0;
+        fps_window_us = now;
     }
 }
 
-// Lighting task
+
+void lighting_get_frame_stats(lighting_frame_stats_t *out) {
+    *out = frame_stats;
+}
+
+
+int lighting_get_output_stats(led_output_stats_t *out) {
+    memcpy(out, output_stats, outputs * sizeof(*out));
+    return outputs;
+}
+
+
+void lighting_get_resume_latency(uint32_t *last_us, uint32_t *max_us) {
+    *last_us = resume_last_us;
+    *max_us = resume_max_us;
+}
+
+
+void lighting_get_latency(photon_latency_t *out) {
+    portENTER_CRITICAL(&latency_lock);
+    *out = photon_latency;
+    portEXIT_CRITICAL(&latency_lock);
+}
+
+
+// After the refresh of a frame rendered from state that includes the input
+static void record_photon_latency(int64_t input_us) {
+    int64_t us = esp_timer_get_time() - input_us;
+    if (us < 0) us = 0;
+    int bucket = 0;
+    while (bucket < LATENCY_BUCKETS - 1 && us >= (1000LL << bucket)) bucket++;
+    portENTER_CRITICAL(&latency_lock);
+    photon_latency.buckets[bucket]++;
+    photon_latency.count++;
+    photon_latency.sum_us += us;
+    if (us > photon_latency.max_us) photon_latency.max_us = (uint32_t)us;
+    portEXIT_CRITICAL(&latency_lock);
+    ESP_LOGD(TAG, "Input on the LEDs after %" PRId64 " us", us);
+}
+
+
 void lighting_task(void *param) {
     int loop = 0;
-    uint8_t framebuffer[LED_COUNT * 3];
+    // Off the stack and sized at boot, extension strips can be long
+    int leds = led_frame_leds();
+    uint8_t *framebuffer = calloc(leds, 3);
+    assert(framebuffer);
+    render_set_frame_leds(leds);
+    lighting_task_handle = xTaskGetCurrentTaskHandle();
 
     while (1) {
         if (show_testing_routine) {
@@ -266,32 +325,53 @@ void lighting_task(void *param) {
             continue;
         }
 
-        if (flash_active) {
-            // Don't make flash too bright, 50 is the max
-             uint8_t flash_brightness = (effective_brightness < 50) ? effective_brightness : 50;
-
-            // Render flash pattern
-            for (int i = 0; i < LED_COUNT; i++) {
-                set_pixel(framebuffer, i, flash_brightness, flash_brightness, flash_brightness);
-            }
-            update_leds(framebuffer);
+        if (standby) {
+            // Dark until the next notification, which comes from lighting_show_input() on wake
+            memset(framebuffer, 0, leds * 3);
+            update_leds(framebuffer, leds);
+            close_strips();
+            mic_want(MIC_USER_LIGHTS, false);
+            resuming = true;
+            while (standby) ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            // Part of the resume, which is timed from the wake touch to this frame's end
+            int64_t t0 = esp_timer_get_time();
+            open_strips();
+            reopen_us = (uint32_t)(esp_timer_get_time() - t0);
+        }
 
-            // Check if flash duration has passed
-            int64_t now = esp_timer_get_time() / 1000;
-            if (now >= flash_end_time) {
-                flash_active = false;
-            }
-        } else {
-            // Normal rendering
-            if (force_safety_pattern) {
-                safety_pattern(framebuffer);
-            } else {
-                render_pattern(settings.pattern_id, framebuffer, loop);
+        // Inputs from here on may or may not make it into this frame, so count them from the next
+        portENTER_CRITICAL(&latency_lock);
+        int64_t input_us = pending_input_us;
+        pending_input_us = 0;
+        portEXIT_CRITICAL(&latency_lock);
+
+        trace_event(TRACE_FRAME_START, (uint16_t)frame_stats.frames);
+        capture_keyframe();
+        int64_t render_start = esp_timer_get_time();
+        uint8_t flags = render_frame(framebuffer, loop);
+        int64_t refresh_start = esp_timer_get_time();
+        update_leds(framebuffer, leds);
+        int64_t refresh_end = esp_timer_get_time();
+        capture_frame(framebuffer, render_frame_time_us(), render_frame_network_time_us(), loop, flags);
+        if (!(flags & RENDER_FLASH)) {
+            frame_time(&frame_stats.render_us_avg, &frame_stats.render_us_max, refresh_start - render_start);
+            frame_time(&frame_stats.refresh_us_avg, &frame_stats.refresh_us_max, refresh_end - refresh_start);
+            count_frame(refresh_end);
+            mic_want(MIC_USER_LIGHTS, flags & RENDER_SOUND);
+        }
+        trace_event(TRACE_FRAME_END, 0);
+        if (input_us) record_photon_latency(input_us);
+        if (resuming && input_us) {
+            resuming = false;
+            resume_last_us = (uint32_t)(esp_timer_get_time() - input_us);
+            if (resume_last_us > resume_max_us) resume_max_us = resume_last_us;
+            if (resume_last_us > RESUME_BUDGET_US) {
+                ESP_LOGW(TAG, "Resume took %" PRIu32 " us, %" PRIu32 " us of it making the strips", resume_last_us, reopen_us);
             }
-            update_leds(framebuffer);
-
-            loop = (loop + 1) % 256;
         }
-        vTaskDelay(20 / portTICK_PERIOD_MS);
+        // Hue animation step from network time rather than a frame count, so it lines up across badges
+        loop = (now_network_time_us() / 1000 / LOOP_PERIOD_MS) % 256;
+        // Next frame in 20 ms, or right away when an input changed what we show
+        ulTaskNotifyTake(pdTRUE, 20 / portTICK_PERIOD_MS);
     }
 }
\ No newline at end of file
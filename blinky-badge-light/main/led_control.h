@@ -8,15 +8,63 @@
 void init_leds(void);
 void set_pattern(int pattern_id);
 void set_brightness(int index);
-void update_leds(uint8_t *framebuffer);
+// framebuffer holds leds LEDs, see led_frame_leds()
+void update_leds(uint8_t *framebuffer, int leds);
+// Average channel level of the frame on the LEDs, 0-255; LED current follows it
+uint8_t led_frame_power(void);
+// Channel values summed over the strip, times how long each frame was on, since boot
+uint64_t led_level_us(void);
 uint8_t calculate_pattern_hue(const genome *g, int led_index, int loop);
 void render_pattern(int index, uint8_t *framebuffer, int loop);
+// render_pattern() with someone else's genome, brightness capped at max_level (show mode)
+void render_genome(int index, const genome *g, uint8_t max_level, uint8_t *framebuffer, int loop);
 void lighting_task(void *param);
 
+// Input-to-photon latency: time from a touch to the end of the first LED refresh that shows it
+#define LATENCY_BUCKETS 10      // bucket i counts latencies under 2^i ms, the last one everything longer
+typedef struct {
+    uint32_t buckets[LATENCY_BUCKETS];
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t sum_us;
+} photon_latency_t;
+
+// The lighting state changed because of an input at input_us (esp_timer time):
+// render it now instead of at the next frame, and time it
+void lighting_show_input(int64_t input_us);
+void lighting_get_latency(photon_latency_t *out);
+typedef struct {
+    uint32_t frames;
+    uint16_t fps;               // frames in the last full second
+    uint32_t render_us_avg;     // pattern into the framebuffer, smoothed
+    uint32_t render_us_max;
+    uint32_t refresh_us_avg;    // framebuffer out to the strip, smoothed
+    uint32_t refresh_us_max;
+} lighting_frame_stats_t;
+void lighting_get_frame_stats(lighting_frame_stats_t *out);
+// Each LED output (led_outputs.h) from the start of a refresh until its strip was sent
+#define LED_OUTPUTS_MAX 4       // RMT TX channels on the ESP32-S3
+typedef struct {
+    int gpio;
+    uint16_t count;
+    uint8_t mode;               // LED_OUT_*
+    uint32_t wire_us_last;
+    uint32_t wire_us_avg;       // smoothed
+    uint32_t wire_us_max;
+} led_output_stats_t;
+// Fills out with up to LED_OUTPUTS_MAX, returns how many
+int lighting_get_output_stats(led_output_stats_t *out);
+
+// Standby: a dark frame, then the lighting task sleeps until it's switched back off
+void lighting_standby(bool on);
+// Touch to the first frame after standby, last and worst
+void lighting_get_resume_latency(uint32_t *last_us, uint32_t *max_us);
+
 void flash_feedback_pattern(void);
 void safety_pattern(uint8_t *framebuffer);
 
 extern volatile bool flash_active; 
+extern uint8_t brightness;
 extern uint8_t effective_brightness;
 
 
@@ -0,0 +1,94 @@
+#include <math.h>
+
+#include "led_geometry.h"
+
+// Quarter wave of 127 * sin, 64 steps to the quarter turn
+static const int8_t sin_quarter[65] = {
+    0, 3, 6, 9, 12, 16, 19, 22, 25, 28, 31, 34, 37, 40, 43, 46, 49, 51, 54, 57, 60, 63,
+    65, 68, 71, 73, 76, 78, 81, 83, 85, 88, 90, 92, 94, 96, 98, 100, 102, 104, 106, 107,
+    109, 111, 112, 113, 115, 116, 117, 118, 120, 121, 122, 122, 123, 124, 125, 125, 126,
+    126, 126, 127, 127, 127, 127,
+};
+
+#if LED_GEOMETRY_FROM_BOARD
+
+// D1 to D24 about their centroid (150, -91.1 mm). LEDs 5 and 6 are the widest, 49 mm
+// out at x = 127; LED 4 at (117, 62) is the furthest, 132 units or 51 mm
+static const led_point_t heart_geometry[LED_COUNT] = {
+    {    0,   62,   0, 120,   0,  8 },  // 0, top centre
+    {   31,   78,  15, 162,  12,  9 },
+    {   62,   88,  25, 208,  23, 11 },
+    {   93,   83,  34, 241,  34, 10 },
+    {  117,   62,  44, 255,  45,  8 },
+    {  127,   34,  53, 253,  55,  7 },
+    {  127,    5,  62, 245,  65,  6 },
+    {  117,  -21,  71, 228,  75,  5 },
+    {  103,  -44,  80, 216,  84,  4 },
+    {   83,  -67,  92, 206,  94,  3 },
+    {   60,  -88, 104, 205, 105,  2 },
+    {   31, -105, 116, 211, 117,  1 },
+    {    0, -116, 128, 224, 128,  0 },  // 12, bottom tip
+    {  -31, -105, 140, 211, 139,  1 },
+    {  -60,  -88, 152, 205, 151,  2 },
+    {  -83,  -67, 164, 206, 162,  3 },
+    { -103,  -44, 176, 216, 172,  4 },
+    { -117,  -21, 185, 228, 181,  5 },
+    { -127,    5, 194, 245, 191,  6 },
+    { -127,   34, 203, 253, 201,  7 },
+    { -117,   62, 212, 255, 211,  8 },
+    {  -93,   83, 222, 241, 222, 10 },
+    {  -62,   88, 231, 208, 233, 11 },
+    {  -31,   78, 241, 162, 244,  9 },
+};
+
+const led_point_t *led_geometry = heart_geometry;
+uint16_t led_geometry_heights = 12;
+
+
+void led_geometry_init(void) {
+}
+
+#else
+
+static led_point_t generated[LED_COUNT];
+const led_point_t *led_geometry = generated;
+uint16_t led_geometry_heights;
+
+
+void led_geometry_init(void) {
+    int n = led_layout.count;
+    for (int i = 0; i < n; i++) {
+        led_point_t *p = &generated[i];
+        p->arc = (uint8_t)(256 * i / n);
+        if (led_layout.shape == LED_SHAPE_RING) {
+            // Round a circle from the top, clockwise; heights count up from the tip
+            float a = 2.0f * (float)M_PI * i / n;
+            p->x = (int8_t)lroundf(127 * sinf(a));
+            p->y = (int8_t)lroundf(127 * cosf(a));
+            p->angle = p->arc;
+            p->radius = 255;
+            p->height = (uint8_t)(i <= n / 2 ? n / 2 - i : i - n / 2);
+        } else {
+            // Straight up through the centre
+            p->x = 0;
+            p->y = (int8_t)(-127 + 254 * i / (n - 1));
+            p->angle = p->y < 0 ? 128 : 0;
+            p->radius = (uint8_t)(255 * (p->y < 0 ? -p->y : p->y) / 127);
+            p->height = (uint8_t)(i < 255 ? i : 255);
+        }
+    }
+    led_geometry_heights = LED_FILL_LEVELS < 256 ? LED_FILL_LEVELS : 256;
+}
+
+#endif
+
+
+int8_t led_sin8(uint8_t angle) {
+    uint8_t q = angle & 63;
+    switch (angle >> 6) {
+        case 0: return sin_quarter[q];
+        case 1: return sin_quarter[64 - q];
+        case 2: return (int8_t)-sin_quarter[q];
+        default: return (int8_t)-sin_quarter[64 - q];
+    }
+}
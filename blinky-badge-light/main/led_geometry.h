@@ -0,0 +1,48 @@
+#ifndef LED_GEOMETRY_H
+#define LED_GEOMETRY_H
+
+#include <stdint.h>
+#include "led_layout.h"
+
+// Where each LED actually sits. On the heart the hue ramp, the meters' fill order
+// (led_layout.h) and the patterns' spacing come from it; spatial effects can use it
+// too: radial, sweeps, gradients. All fixed point and looked up, no trig per pixel per
+// frame. The heart's table is in flash, taken from the LED positions on the board
+// (hardware/.../production/positions.csv); other layouts (led_layout.h) get one
+// generated at boot: a ring round a circle, a strip straight up.
+// Angles are 256 to the turn, 0 straight up and going clockwise as seen from the front,
+// so they wrap like hues do. No ESP-IDF dependencies.
+
+typedef struct {
+    int8_t x, y;                    // about the centre, y up, scaled so the largest is 127
+    uint8_t angle;                  // about the centre
+    uint8_t radius;                 // 255 the furthest LED, on the heart LED 4 at 132 units
+    uint8_t arc;                    // along the outline from LED 0, 256 once round
+    uint8_t height;                 // rank bottom up, 0 the tip; LEDs level with each other share one
+} led_point_t;
+
+// The heart's table is measured, checked against the board by sim/geometry-check;
+// generated ones are evenly spaced, where the LED index says the same at full resolution
+#define LED_GEOMETRY_FROM_BOARD (LED_COUNT == 24 && LED_SHAPE == LED_SHAPE_RING)
+
+#define LED_GEOMETRY_UM 386         // one unit of x and y on the heart, in micrometres; sim/geometry-check
+
+extern const led_point_t *led_geometry;     // LED_COUNT of them
+extern uint16_t led_geometry_heights;       // distinct height ranks
+
+// Sets up led_geometry; led_layout_init() does it
+void led_geometry_init(void);
+
+// 127 * sin, angle 256 to the turn
+int8_t led_sin8(uint8_t angle);
+static inline int8_t led_cos8(uint8_t angle) {
+    return led_sin8((uint8_t)(angle + 64));
+}
+// How far along direction dir the LED is, no more than its distance from the centre
+// (132 at most on the heart, 127 generated); a gradient or a sweep
+// line moving across the heart at any angle
+static inline int led_gradient(const led_point_t *p, uint8_t dir) {
+    return (p->x * led_sin8(dir) + p->y * led_cos8(dir)) / 127;
+}
+
+#endif // LED_GEOMETRY_H
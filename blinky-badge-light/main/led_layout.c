@@ -0,0 +1,51 @@
+#include "led_layout.h"
+#include "led_geometry.h"
+
+const led_layout_t led_layout = {
+    .count = LED_COUNT,
+    .shape = LED_SHAPE,
+    .tip = LED_SHAPE == LED_SHAPE_RING ? LED_COUNT / 2 : 0,
+};
+
+uint16_t led_fill_order[LED_FILL_LEVELS][2];
+uint8_t led_hue_ramp[LED_COUNT];
+
+
+void led_layout_init(void) {
+    led_geometry_init();
+    for (int i = 0; i < led_layout.count; i++) {
+#if LED_GEOMETRY_FROM_BOARD
+        // By how far round the outline the LED really is
+        int arc = led_geometry[i].arc;
+        led_hue_ramp[i] = (uint8_t)(255 * (arc <= 128 ? arc : 256 - arc) / 128);
+#else
+        int half = led_layout.count / 2;
+        int from_top = i <= half ? i : led_layout.count - i;
+        led_hue_ramp[i] = (uint8_t)(255 * from_top / half);
+#endif
+    }
+
+    for (int lvl = 0; lvl < LED_FILL_LEVELS; lvl++) {
+        if (led_layout.shape == LED_SHAPE_RING) {
+            // Up both sides from the tip, meeting at the top
+            led_fill_order[lvl][0] = (uint16_t)(led_layout.tip - lvl);
+            led_fill_order[lvl][1] = (uint16_t)((led_layout.tip + lvl) % led_layout.count);
+        } else {
+            led_fill_order[lvl][0] = led_fill_order[lvl][1] = (uint16_t)(led_layout.tip + lvl);
+        }
+    }
+#if LED_GEOMETRY_FROM_BOARD
+    // The heart's lobes rise above its top centre, so order the pairs by how high they
+    // really are; stable, so pairs level with each other keep their order
+    for (int lvl = 1; lvl < LED_FILL_LEVELS; lvl++) {
+        uint16_t pair[2] = { led_fill_order[lvl][0], led_fill_order[lvl][1] };
+        int j = lvl;
+        for (; j > 0 && led_geometry[led_fill_order[j - 1][0]].height > led_geometry[pair[0]].height; j--) {
+            led_fill_order[j][0] = led_fill_order[j - 1][0];
+            led_fill_order[j][1] = led_fill_order[j - 1][1];
+        }
+        led_fill_order[j][0] = pair[0];
+        led_fill_order[j][1] = pair[1];
+    }
+#endif
+}
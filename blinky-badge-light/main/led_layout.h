@@ -0,0 +1,55 @@
+#ifndef LED_LAYOUT_H
+#define LED_LAYOUT_H
+
+#include <stdint.h>
+
+// How the LEDs are laid out, which the hue ramp and the fill order are generated from
+// at boot. The badge's heart is a ring of 24: 0 at the top centre, going round to the
+// bottom tip at LED_COUNT / 2 and back up the other side. For a strip clipped on
+// instead, build with e.g. -DLED_COUNT=144 -DLED_SHAPE=LED_SHAPE_STRIP: 0 at the bottom.
+// Only the heart's layout is fixed at build time. The lighting framebuffer is allocated
+// at boot, 3 bytes for each of led_frame_leds() (led_outputs.h), which adds any
+// extension strips to LED_COUNT.
+// No ESP-IDF dependencies.
+
+#define LED_SHAPE_RING 0
+#define LED_SHAPE_STRIP 1
+
+#ifndef LED_COUNT
+#define LED_COUNT 24
+#endif
+#ifndef LED_SHAPE
+#define LED_SHAPE LED_SHAPE_RING
+#endif
+
+#if LED_COUNT < 2
+#error "LED_COUNT must be at least 2"
+#endif
+
+typedef struct {
+    uint16_t count;
+    uint8_t shape;                  // LED_SHAPE_*
+    uint16_t tip;                   // bottom, where fills start
+} led_layout_t;
+
+extern const led_layout_t led_layout;
+
+// Fill order bottom up (battery meter, VU meter): each level lights one LED, or a
+// pair on either side of the ring, both entries the same for one; on the heart in the
+// order of their height on the board (led_geometry)
+#if LED_SHAPE == LED_SHAPE_RING
+#define LED_FILL_LEVELS (LED_COUNT / 2 + 1)
+#else
+#define LED_FILL_LEVELS LED_COUNT
+#endif
+extern uint16_t led_fill_order[LED_FILL_LEVELS][2];
+
+// Hue of each LED for limited hue range patterns, 0 at LED 0 up to 255 halfway round
+// and back down, so it has no seam where the animation wraps; on the heart halfway
+// round is by the outline (led_geometry), not the index
+extern uint8_t led_hue_ramp[LED_COUNT];
+
+// Sets up led_geometry (led_geometry.h) and the tables above from it; before the first frame
+void led_layout_init(void);
+
+#endif // LED_LAYOUT_H
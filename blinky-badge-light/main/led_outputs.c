@@ -0,0 +1,37 @@
+#include "led_outputs.h"
+
+const led_output_t led_outputs[] = {
+    { .gpio = -1, .count = LED_COUNT, .mode = LED_OUT_MIRROR },
+    LED_OUTPUTS_EXTRA
+};
+const int led_output_count = sizeof(led_outputs) / sizeof(led_outputs[0]);
+
+
+int led_frame_leds(void) {
+    return led_output_start(led_output_count);
+}
+
+
+int led_output_start(int out) {
+    int start = LED_COUNT;
+    for (int i = 1; i < out && i < led_output_count; i++) {
+        if (led_outputs[i].mode == LED_OUT_EXTEND) start += led_outputs[i].count;
+    }
+    return out ? start : 0;
+}
+
+
+int led_outputs_total(void) {
+    int total = 0;
+    for (int i = 0; i < led_output_count; i++) total += led_outputs[i].count;
+    return total;
+}
+
+
+int led_outputs_longest(void) {
+    int longest = 0;
+    for (int i = 0; i < led_output_count; i++) {
+        if (led_outputs[i].count > longest) longest = led_outputs[i].count;
+    }
+    return longest;
+}
@@ -0,0 +1,47 @@
+#ifndef LED_OUTPUTS_H
+#define LED_OUTPUTS_H
+
+#include <stdint.h>
+#include "led_layout.h"
+
+// Every LED output: the heart on LED_PIN first, then strips clipped on to spare pins.
+// Each has its own RMT channel and pixel buffer, and all of them are sent at the same
+// time, so a refresh takes as long as the longest strip rather than all of them added
+// up. A mirror shows the heart's frame stretched over its own length; an extension
+// carries on along the pattern where the heart (or the extension before it) stops,
+// so the frame is rendered that much longer than the heart (led_frame_leds()).
+// None on the badge as it comes; list them at build time, e.g.
+//   -DLED_OUTPUTS_EXTRA="{ 4, 144, LED_OUT_EXTEND }, { 5, 60, LED_OUT_MIRROR },"
+// The ESP32-S3 has 4 RMT TX channels, so up to 3 extra; only one of them can use DMA.
+// No ESP-IDF dependencies.
+
+#define LED_OUT_MIRROR 0
+#define LED_OUT_EXTEND 1
+
+typedef struct {
+    int gpio;                       // -1 for LED_PIN
+    uint16_t count;
+    uint8_t mode;                   // LED_OUT_*
+} led_output_t;
+
+#ifndef LED_OUTPUTS_EXTRA
+#define LED_OUTPUTS_EXTRA
+#endif
+
+extern const led_output_t led_outputs[];
+extern const int led_output_count;
+
+// LEDs in a rendered frame: the heart's, then every extension's in turn
+int led_frame_leds(void);
+// Where an output's LEDs start along the pattern, for led_output_source()
+int led_output_start(int out);
+// Which LED of a rendered frame of leds LEDs an output's LED j shows. A full frame
+// has room for every extension; one with only the heart's (self-test) repeats it
+static inline int led_output_source(const led_output_t *o, int start, int j, int leds) {
+    return o->mode == LED_OUT_MIRROR ? j * LED_COUNT / o->count : (start + j) % leds;
+}
+// LEDs on all outputs together, and on the longest one
+int led_outputs_total(void);
+int led_outputs_longest(void);
+
+#endif // LED_OUTPUTS_H
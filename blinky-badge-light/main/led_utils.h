@@ -2,6 +2,7 @@
 #define LED_UTILS_H
 
 #include <stdint.h>
+#include "led_layout.h"
 
 // RGB Color Structure
 typedef struct {
@@ -12,24 +13,6 @@ typedef struct {
 
 Color Wheel(uint8_t wheelPos);
 
-// Order LEDs from bottom tip up both sides to top center
-static const uint8_t heart_fill_order[13][2] = {
-    {12, 12},
-    {11, 13}, 
-    {10, 14},
-    {9, 15},
-    {8, 16},
-    {7, 17},
-    {6, 18},
-    {5, 19},    
-    {4, 20},
-    {3, 21},
-    {2, 22},
-    {1, 23},
-    {0, 0},   
-};
-
-
 void set_pixel(uint8_t *framebuffer, int index, uint8_t r, uint8_t g, uint8_t b);
 void hsv_to_rgb(uint8_t h, uint8_t s, uint8_t v, uint8_t *r, uint8_t *g, uint8_t *b);
 int16_t map_16(int16_t x, int16_t in_min, int16_t in_max, int16_t out_min, int16_t out_max);
@@ -15,6 +15,11 @@
 #include "microphone.h"
 #include "now.h"
 #include "testing_routine.h"
+#include "ota_update.h"
+#include "standby.h"
+#include "stats_console.h"
+#include "telemetry.h"
+#include "energy.h"
 
 void app_main() {
     esp_reset_reason_t reason = esp_reset_reason();
@@ -35,8 +40,13 @@ void app_main() {
     init_touch();
     init_microphone();
     now_init();
+    for (int i = 0; i < NUM_PATTERNS; i++) {
+        now_share_genome(i, &patterns[i], false);
+    }
     init_storage();
     init_battery_monitor();
+    standby_init();
+    telemetry_init();
 
     load_settings(&settings);
     set_pattern(settings.pattern_id);
@@ -49,4 +59,12 @@ void app_main() {
     xTaskCreatePinnedToCore(battery_monitor_task, "Battery Monitor Task", 4096, NULL, 5, NULL, 0);
     xTaskCreatePinnedToCore(microphone_task, "Microphone Task", 4096, NULL, 5, NULL, 0);
     xTaskCreatePinnedToCore(touch_task, "Touch Task", 4096, NULL, 5, NULL, 0);
+    xTaskCreatePinnedToCore(radio_task, "Radio Task", 4096, NULL, 5, NULL, 0);
+    xTaskCreatePinnedToCore(telemetry_task, "Telemetry Task", 4096, NULL, 1, NULL, 0);
+    xTaskCreatePinnedToCore(energy_task, "Energy Task", 3072, NULL, 1, NULL, 0);
+
+    stats_console_init();
+
+    // Everything came up, so a freshly received firmware is good to keep
+    ota_update_mark_valid();
 }
\ No newline at end of file
@@ -4,12 +4,18 @@
 #include <string.h>
 #include "driver/i2s_std.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
 #include "pins.h"
 #include "microphone.h"
+#include "energy_model.h"
+#include "sound.h"
+#include "capture.h"
+#include "now.h"
 #include "testing_routine.h"
+#include "trace.h"
 
 #define TAG "MICROPHONE"
 
@@ -17,15 +23,45 @@
 static i2s_chan_handle_t rx_chan; 
 #define SAMPLE_BUFF_SIZE 2048
 
+// The I2S clock and the analysis only run while someone wants sound. Without a clock
+// the MEMS mic sleeps too. Once the last user lets go we keep going a little longer,
+// so stepping through the patterns doesn't cycle the mic on every press
+#define MIC_HOLD_MS 2000
+#define MIC_SETTLE_BLOCKS 5         // thrown away after power-up while the mic starts, ~12 ms each
+#define MIC_PRIME_BLOCKS 5          // read back to back to refill the dB history
+static TaskHandle_t mic_task_handle = NULL;
+static volatile uint32_t mic_users = 0;      // bit per mic_user_t
+static portMUX_TYPE mic_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool mic_on = true;
+static int64_t mic_since_us;        // last power-up or power-down
+static int64_t last_read_us;        // when the last block came back from the driver
+static mic_power_stats_t mic_stats;
+
 // variables for sound level
-#define DB_HISTORY_LEN 100
 volatile float current_dB_level = 0.0f;
-static float dbHistory[DB_HISTORY_LEN];
-static int dbHistoryIdx = 0;
 volatile float dB_brightness_level = 0.0f; 
 volatile float smooth_dB_brightness_level = 0.0f;
-float avg_low_db = 30.0f;
-float avg_high_db = 150.0f;
+
+// Offer our sound features to nearby badges over ESP-NOW; the radio side only sends
+// the ones that say something new, leaves each neighbourhood to one publisher and
+// caps the airtime (audio_may_send() in now_proto.c)
+#ifndef AUDIO_SHARE_ENABLED
+#define AUDIO_SHARE_ENABLED 1
+#endif
+#define AUDIO_LEVEL_INTERVAL_MS 100 // level-only updates between beats
+static int64_t last_publish_ms = 0;
+
+// The analysis and the latest sound features, local and from the loudest nearby badge.
+// Written by the microphone and radio tasks, read by the lighting task. features_seq
+// counts the updates, so a capture can tell which of them a frame saw
+static sound_analysis_t analysis;
+static sound_features_t local_features;
+static sound_features_t remote_features;
+static uint32_t features_seq;
+static uint32_t rendered_seq;
+static uint32_t remote_rendered_t_us;
+static sound_remote_stats_t remote_stats;
+static portMUX_TYPE features_lock = portMUX_INITIALIZER_UNLOCKED;
 
 
 void init_microphone(void) {
@@ -51,27 +87,47 @@ void init_microphone(void) {
     
     ESP_ERROR_CHECK(i2s_channel_init_std_mode(rx_chan, &rx_std_cfg));
     ESP_ERROR_CHECK(i2s_channel_enable(rx_chan));
+    sound_init(&analysis);
+    mic_since_us = esp_timer_get_time();
     ESP_LOGI(TAG, "Microphone initialized successfully");
 }
 
 
+void mic_want(mic_user_t user, bool want) {
+    uint32_t bit = 1u << user;
+    portENTER_CRITICAL(&mic_lock);
+    bool changed = ((mic_users & bit) != 0) != want;
+    if (want) mic_users |= bit;
+    else mic_users &= ~bit;
+    portEXIT_CRITICAL(&mic_lock);
+    if (changed && mic_task_handle) xTaskNotifyGive(mic_task_handle);
+}
+
+
+void mic_get_power_stats(mic_power_stats_t *out) {
+    *out = mic_stats;
+    out->on = mic_on;
+    int64_t in_state = esp_timer_get_time() - mic_since_us;
+    if (mic_on) out->on_us += in_state;
+    else out->off_us += in_state;
+    // What the blocks we didn't read would have cost, at the rate we read them while on
+    if (out->blocks && out->on_us) {
+        double blocks_skipped = (double)out->off_us * out->blocks / out->on_us;
+        out->saved_cpu_ms = (uint32_t)(blocks_skipped * out->cpu_sum_us / out->blocks / 1000);
+    }
+    out->saved_uah = (uint32_t)(out->off_us * (MIC_ON_UA + I2S_ON_UA) / 3600000000LL);
+}
+
+
 float get_sound_level(void) {
     uint8_t *r_buf = (uint8_t *)calloc(1, SAMPLE_BUFF_SIZE);
     assert(r_buf);
     size_t r_bytes = 0;
 
     if (i2s_channel_read(rx_chan, r_buf, SAMPLE_BUFF_SIZE, &r_bytes, 1000) == ESP_OK) {
-        int32_t *samples = (int32_t *)r_buf;
-        int sample_count = r_bytes / sizeof(int32_t);
-        double sum_squares = 0.0;
-
-        for (int i = 0; i < sample_count; i+=2) {
-            float normalized_to_1 = ((float)(samples[i] << 1)) / ((float)(1 << 31));
-            sum_squares += normalized_to_1 * normalized_to_1;
-        }
-        float rms = sqrtf(sum_squares / sample_count / 2); // Divide by 2 because we are using mono input
-        float dbfs = 20.0f * log10f(rms + 1e-8f);
-        float dbspl = dbfs + 120.0f;
+        last_read_us = esp_timer_get_time();
+        trace_event(TRACE_I2S_BLOCK, (uint16_t)r_bytes);
+        float dbspl = sound_block_db((const int32_t *)r_buf, r_bytes / sizeof(int32_t));
 
         free(r_buf);
         return dbspl;
@@ -83,103 +139,145 @@ float get_sound_level(void) {
 }
 
 
-// Returns a smoothed brightness level [0.0, 1.0]
-void calculate_sound_brightness(void)
-{
-    // clamp dB range
-    if (avg_high_db == avg_low_db) {
-        // Avoid divide by zero
-        dB_brightness_level = 0.2f;
-        return;
+static void update_local_features(float db, int64_t block_us) {
+    portENTER_CRITICAL(&features_lock);
+    uint8_t beat = sound_block(&analysis, db, block_us, &local_features);
+    uint32_t seq = ++features_seq;
+    current_dB_level = analysis.db;
+    dB_brightness_level = analysis.brightness_level;
+    smooth_dB_brightness_level = analysis.smooth_level;
+    portEXIT_CRITICAL(&features_lock);
+    capture_db(seq, db, block_us);
+
+#if AUDIO_SHARE_ENABLED
+    int64_t now_ms = block_us / 1000;
+    if (beat || now_ms - last_publish_ms >= AUDIO_LEVEL_INTERVAL_MS) {
+        last_publish_ms = now_ms;
+        uint8_t db_u8 = db < 0.0f ? 0 : db > 255.0f ? 255 : (uint8_t)db;
+        now_publish_audio(db_u8, (uint8_t)(smooth_dB_brightness_level * 255.0f), beat, (uint32_t)block_us);
     }
+#endif
+}
+
 
-    if (current_dB_level > avg_high_db) current_dB_level = avg_high_db;
-    if (current_dB_level < avg_low_db) current_dB_level = avg_low_db;
+// Called from the radio task for each audio event from a nearby badge
+void sound_remote_event(uint8_t level, uint8_t beat, uint32_t t_us) {
+    portENTER_CRITICAL(&features_lock);
+    sound_remote(&remote_features, level, beat, t_us);
+    uint32_t seq = ++features_seq;
+    portEXIT_CRITICAL(&features_lock);
+    capture_audio(seq, level, beat, t_us);
+}
 
-    // Normalize to [0, 1]
-    float level = (current_dB_level - avg_low_db) / (avg_high_db - avg_low_db);
-    if (level < 0.01f) level = 0.01f;
 
-    // rolling average
-    static float avgs[2] = {0, 0};
-    static int idx = 0;
-    avgs[idx++ % 2] = level;
-    dB_brightness_level = (avgs[0] + avgs[1]) / 2.0f;
-    
-    // make it more uniform
-    smooth_dB_brightness_level = powf(dB_brightness_level, 1.4f);
-    //printf("Raw dB Brightness Level: %.2f\n", smooth_dB_brightness_level);
-
-    // Clamp to [0.05, 0.8] for brightness so it won't be completely dark or too bright
-    float min_bright = 0.05f;
-    float max_bright = 0.8f;
-    dB_brightness_level = min_bright + (max_bright - min_bright) * dB_brightness_level;
-    //printf("dB Brightness Level: %.2f\n", dB_brightness_level);
+// Sound level for the sound-reactive patterns [0.0, 1.0], see sound_mix()
+float get_render_sound_level(uint32_t now_us) {
+    portENTER_CRITICAL(&features_lock);
+    sound_features_t local = local_features;
+    sound_features_t remote = remote_features;
+    rendered_seq = features_seq;
+    portEXIT_CRITICAL(&features_lock);
+
+    uint32_t remote_age_ms = (now_us - remote.t_us) / 1000;
+    // First frame showing this event: audio block to photons, as far as we can see it
+    if (remote.t_us != 0 && remote_age_ms < REMOTE_HOLD_MS && remote.t_us != remote_rendered_t_us) {
+        remote_rendered_t_us = remote.t_us;
+        uint32_t latency = now_us - remote.t_us;
+        remote_stats.events++;
+        remote_stats.latency_last_us = latency;
+        if (latency > remote_stats.latency_max_us) remote_stats.latency_max_us = latency;
+        remote_stats.latency_avg_us = remote_stats.latency_avg_us ? (remote_stats.latency_avg_us * 7 + latency) / 8 : latency;
+        if (latency > AUDIO_LATENCY_BUDGET_US) remote_stats.over_budget++;
+    }
+    return sound_mix(&local, &remote, now_us);
 }
 
 
+uint32_t sound_rendered_seq(void) {
+    return rendered_seq;
+}
 
-static void dbHistory_add(float val) {
-    dbHistory[dbHistoryIdx] = val;
-    dbHistoryIdx = (dbHistoryIdx + 1) % DB_HISTORY_LEN;
+
+void sound_get_state(sound_state_t *out) {
+    portENTER_CRITICAL(&features_lock);
+    out->analysis = analysis;
+    out->local = local_features;
+    out->remote = remote_features;
+    out->seq = features_seq;
+    portEXIT_CRITICAL(&features_lock);
 }
 
 
-static void db_get_low_high(void) {
-    int i, j;
-    int sample_count = 5;
-    float lowest[sample_count];
-    float highest[sample_count];
-    for (i = 0; i < sample_count; i++) {
-        lowest[i] = 150.0f; // Initialize with a high value
-    }
-    for (i = 0; i < sample_count; i++) {
-        highest[i] = 30.0f; // Initialize with a low value
-    }
+void sound_get_remote_stats(sound_remote_stats_t *out) {
+    *out = remote_stats;
+}
 
-    for (i = 0; i < DB_HISTORY_LEN; i++) {
-        float val = dbHistory[i];
-        // Find lowest
-        for (j = 0; j < sample_count; j++) {
-            if (val < lowest[j]) {
-                float tmp = lowest[j];
-                lowest[j] = val;
-                val = tmp;
-            }
-        }
-        // Find highest
-        val = dbHistory[i];
-        for (j = 0; j < sample_count; j++) {
-            if (val > highest[j]) {
-                float tmp = highest[j];
-                highest[j] = val;
-                val = tmp;
-            }
-        }
-    }
-    // Compute averages
-    float sum_low = 0, sum_high = 0;
-    for (i = 0; i < sample_count; i++) {
-        sum_low += lowest[i];
-        sum_high += highest[i];
-    }
-    avg_low_db = sum_low / sample_count;
-    avg_high_db = sum_high / sample_count;
+
+static void mic_power_down(void) {
+    ESP_ERROR_CHECK(i2s_channel_disable(rx_chan));
+    int64_t now = esp_timer_get_time();
+    mic_stats.on_us += now - mic_since_us;
+    mic_since_us = now;
+    mic_on = false;
+    mic_power_stats_t st;
+    mic_get_power_stats(&st);
+    ESP_LOGI(TAG, "Microphone off, nothing is listening. %" PRIu64 " us CPU per block; so far %" PRIu32
+             " ms CPU and %" PRIu32 " uAh saved", st.blocks ? st.cpu_sum_us / st.blocks : 0, st.saved_cpu_ms, st.saved_uah);
 }
 
 
+// Start the clock, let the mic settle and refill the dB history from a few blocks read back
+// to back, so the level range is right from the first block rather than after two seconds
+static void mic_power_up(void) {
+    int64_t start = esp_timer_get_time();
+    ESP_ERROR_CHECK(i2s_channel_enable(rx_chan));
+    mic_stats.off_us += start - mic_since_us;
+    mic_since_us = start;
+    mic_on = true;
+    mic_stats.power_ups++;
+
+    for (int i = 0; i < MIC_SETTLE_BLOCKS; i++) get_sound_level();
+    float primed[MIC_PRIME_BLOCKS];
+    for (int i = 0; i < MIC_PRIME_BLOCKS; i++) primed[i] = get_sound_level();
+    portENTER_CRITICAL(&features_lock);
+    sound_prime(&analysis, primed, MIC_PRIME_BLOCKS);
+    uint32_t seq = ++features_seq;
+    portEXIT_CRITICAL(&features_lock);
+    capture_prime(seq, primed, MIC_PRIME_BLOCKS);
+
+    mic_stats.warmup_us = (uint32_t)(esp_timer_get_time() - start);
+    ESP_LOGI(TAG, "Microphone on, ready in %" PRIu32 " ms", mic_stats.warmup_us / 1000);
+}
+
 
 void microphone_task(void *param) {
+    mic_task_handle = xTaskGetCurrentTaskHandle();
+    int64_t wanted_us = 0;
     while (1) {
+        int64_t now = esp_timer_get_time();
+        if (mic_users) wanted_us = now;
+        if (!mic_users && (!mic_on || now - wanted_us >= MIC_HOLD_MS * 1000LL)) {
+            if (mic_on) mic_power_down();
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        if (!mic_on) mic_power_up();
+
         if (show_testing_routine) {
             vTaskDelay(20 / portTICK_PERIOD_MS);
             continue;
         }
 
-        current_dB_level = get_sound_level();
-        dbHistory_add(current_dB_level); 
-        db_get_low_high(); // Update low and high averages
-        calculate_sound_brightness(); // Update dB brightness level
+        float raw_db = get_sound_level();
+        trace_event(TRACE_AUDIO_START, 0);
+        int64_t block_us = now_network_time_us(); // the read returns as the block completes
+        update_local_features(raw_db, block_us);
+        // CPU the block cost us, not counting the wait for the driver
+        uint32_t cpu_us = (uint32_t)(esp_timer_get_time() - last_read_us);
+        mic_stats.blocks++;
+        mic_stats.cpu_sum_us += cpu_us;
+        if (cpu_us > mic_stats.cpu_max_us) mic_stats.cpu_max_us = cpu_us;
+        trace_event(TRACE_AUDIO_END, 0);
         //ESP_LOGI(TAG, "Sound Level: %.2f dB", current_dB_level);
         vTaskDelay(pdMS_TO_TICKS(20));
     }
@@ -188,6 +286,7 @@ void microphone_task(void *param) {
 // for debugging
 void i2s_matrix_dump_task(void *param) {
     const int NUM_SAMPLES = 6;
+    mic_want(MIC_USER_DEBUG, true);
     while (1) {
         uint8_t *r_buf = (uint8_t *)calloc(1, NUM_SAMPLES * sizeof(int32_t));
         if (!r_buf) {
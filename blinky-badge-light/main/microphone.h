@@ -2,14 +2,65 @@
 #define MICROPHONE_H
 
 #include <stdint.h>
+#include <stdbool.h>
+#include "sound.h"
 
 extern volatile float current_dB_level;
 extern volatile float dB_brightness_level;
 extern volatile float smooth_dB_brightness_level;
 
+// Remote sound events should reach the LEDs within one frame of the lighting task
+#define AUDIO_LATENCY_BUDGET_US 20000
+
+typedef struct {
+    uint32_t events;          // remote audio events rendered
+    uint32_t latency_last_us; // publisher's audio block to the first frame showing it
+    uint32_t latency_avg_us;
+    uint32_t latency_max_us;
+    uint32_t over_budget;     // events slower than AUDIO_LATENCY_BUDGET_US
+} sound_remote_stats_t;
+
+// Who needs the microphone. It only runs while at least one of them says so
+typedef enum {
+    MIC_USER_LIGHTS,        // a sound-reactive pattern is on the LEDs
+    MIC_USER_TEST,          // factory test
+    MIC_USER_DEBUG,         // i2s_matrix_dump_task
+    MIC_USERS
+} mic_user_t;
+
+typedef struct {
+    bool on;
+    uint32_t power_ups;
+    uint32_t warmup_us;     // last power-up until the dB history was primed
+    uint64_t on_us;
+    uint64_t off_us;
+    uint32_t blocks;        // analysed while on
+    uint64_t cpu_sum_us;    // their analysis time
+    uint32_t cpu_max_us;
+    uint32_t saved_cpu_ms;  // analysis we skipped while off
+    uint32_t saved_uah;     // mic and I2S current we didn't draw while off, typical figures (energy_model.h)
+} mic_power_stats_t;
+
 void init_microphone(void);
+void mic_want(mic_user_t user, bool want);
+void mic_get_power_stats(mic_power_stats_t *out);
 float get_sound_level(void); // Returns decibel level
 void microphone_task(void *param);
 void i2s_matrix_dump_task(void *param);
 
+float get_render_sound_level(uint32_t now_us); // local and nearby sound blended at network time now_us, [0.0, 1.0]
+void sound_remote_event(uint8_t level, uint8_t beat, uint32_t t_us);
+void sound_get_remote_stats(sound_remote_stats_t *out);
+
+// The analysis and features as of update number seq, for capture keyframes
+typedef struct {
+    uint32_t seq;
+    sound_analysis_t analysis;
+    sound_features_t local;
+    sound_features_t remote;
+} sound_state_t;
+void sound_get_state(sound_state_t *out);
+// Update number the last get_render_sound_level() saw
+uint32_t sound_rendered_seq(void);
+
 #endif // MICROPHONE_H
\ No newline at end of file
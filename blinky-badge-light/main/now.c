@@ -7,97 +7,317 @@
 #include "esp_system.h"
 #include "esp_timer.h"
 #include "esp_random.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
 #include "firework_notification_pattern.h"
+#include "capture.h"
+#include "microphone.h"
+#include "show_mode.h"
+#include "ota_update.h"
 #include "now.h"
+#include "now_hal.h"
+#include "trace.h"
 
 static const char *TAG = "ESP_NOW";
-#define NONCE_HISTORY_SIZE 32
 
-// Firework packet definition
-#define FIREWORK_MSG 0x42
 static const uint8_t broadcast_addr[6] = {0xFF,0xFF,0xFF,0xFF,0xFF,0xFF}; //everyone
 
-static uint32_t recent_nonces[NONCE_HISTORY_SIZE] = {0};
-static uint8_t nonce_index = 0;
+// Protocol state lives in now_proto.c; this file is the ESP-IDF side of it
+static now_proto_t proto;
 
-#define MAX_SEND_PER_WINDOW 4
-#define WINDOW_MS (40 * 1000)  // 40 seconds
 
-static int64_t last_sent_times[MAX_SEND_PER_WINDOW] = {0};
-static uint8_t last_sent_idx = 0;
+// ---- Radio task plumbing ----
+// The touch task and the Wi-Fi callbacks only ever push into these queues and
+// poke the radio task; everything that touches the air happens in radio_task().
 
-// Helper to make notifications work immediately after startup
-void reset_sent_history(void) {
-    int64_t now = esp_timer_get_time() / 1000; // ms
-    for (int i = 0; i < MAX_SEND_PER_WINDOW; ++i) {
-        last_sent_times[i] = now - WINDOW_MS - 1;
+#define NOW_TX_QUEUE_LEN 16
+#define NOW_RX_QUEUE_LEN 16
+#define NOW_SEND_TIMEOUT_MS 100     // give up on a send-complete callback after this
+// Standby: listen STANDBY_WINDOW_MS out of every STANDBY_INTERVAL_MS. Fireworks and
+// beacons are repeated by the mesh, so a badge in standby still hears nearly all of them
+#define STANDBY_INTERVAL_MS 100
+#define STANDBY_WINDOW_MS 50
+#define WAKE_WINDOW_ALWAYS 65535    // never sleeps between windows
+
+typedef struct {
+    int64_t rx_us;
+    uint8_t src_addr[6];
+    int8_t rssi;
+    uint8_t len;
+    uint8_t data[NOW_MAX_MSG_LEN];
+} now_rx_item_t;
+
+static QueueHandle_t now_tx_queue = NULL;
+static QueueHandle_t now_rx_queue = NULL;
+static TaskHandle_t radio_task_handle = NULL;
+
+// Set by now_send_cb() for the frame in flight
+static volatile bool tx_done = false;
+static volatile bool tx_done_ok = false;
+static volatile int64_t tx_done_us = 0;
+
+// Radio counters for other tasks: proto.stats belongs to the radio task, which publishes
+// a copy after every pass. The queues are fed from other tasks, which count here instead.
+static now_stats_t stats_copy;
+static uint32_t enqueue_queued;
+static uint32_t enqueue_dropped;
+static uint8_t enqueue_peak;
+static uint32_t recv_dropped;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Copy of proto.sync.clock for the render tasks, refreshed by the radio task
+static now_sync_clock_t network_clock;
+static portMUX_TYPE network_clock_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Genome gossip hand-over: favourites from the touch task go in, genomes from
+// other badges come out, the radio task moves them in and out of proto.gossip
+#define COLLECTED_KEEP 8
+static genome own_genomes[GOSSIP_OWN];
+static uint16_t own_born[GOSSIP_OWN];
+static uint8_t own_dirty;           // bit per slot
+static genome collected[COLLECTED_KEEP]; // oldest first
+static int collected_count;
+static portMUX_TYPE gossip_lock = portMUX_INITIALIZER_UNLOCKED;
+
+
+static inline void radio_task_wake(void) {
+    if (radio_task_handle) {
+        xTaskNotifyGive(radio_task_handle);
     }
 }
 
-bool can_send_firework(void) {
-    int64_t now = esp_timer_get_time() / 1000; // ms
-    int send_count = 0;
-    for (int i = 0; i < MAX_SEND_PER_WINDOW; i++) {
-        if (now - last_sent_times[i] < WINDOW_MS) {
-            send_count++;
-        }
-    }
-    return send_count < MAX_SEND_PER_WINDOW;
+
+// Non-blocking hand-off to the radio task, safe to call from any task
+static bool now_enqueue(const void *msg, uint8_t len, uint8_t repeats, uint16_t interval_ms) {
+    if (!now_tx_queue || len > NOW_MAX_MSG_LEN) return false;
+
+    now_tx_item_t item = {
+        .enqueue_us = esp_timer_get_time(),
+        .interval_ms = interval_ms,
+        .repeats = repeats,
+        .len = len,
+    };
+    memcpy(item.data, msg, len);
+
+    bool ok = xQueueSend(now_tx_queue, &item, 0) == pdPASS;
+    UBaseType_t depth = uxQueueMessagesWaiting(now_tx_queue);
+    portENTER_CRITICAL(&stats_lock);
+    if (ok) enqueue_queued++;
+    else enqueue_dropped++;
+    if (depth > enqueue_peak) enqueue_peak = depth;
+    portEXIT_CRITICAL(&stats_lock);
+    if (!ok) return false;
+    radio_task_wake();
+    return true;
 }
 
-void record_sent_firework(void) {
-    int64_t now = esp_timer_get_time() / 1000;
-    last_sent_times[last_sent_idx] = now;
-    last_sent_idx = (last_sent_idx + 1) % MAX_SEND_PER_WINDOW;
+
+// ---- now_hal.h ----
+
+int64_t now_hal_time_us(void) {
+    return esp_timer_get_time();
 }
 
+uint32_t now_hal_random(void) {
+    return esp_random();
+}
 
-static bool nonce_seen(uint32_t nonce) {
-    for (int i = 0; i < NONCE_HISTORY_SIZE; ++i) {
-        if (recent_nonces[i] == nonce) return true;
+bool now_hal_send(now_proto_t *np, const uint8_t *frame, int len) {
+    tx_done = false;
+    trace_event(TRACE_RADIO_TX, (uint16_t)len);
+    esp_err_t err = esp_now_send(broadcast_addr, frame, len);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to send ESP-NOW frame: %s", esp_err_to_name(err));
+        return false;
+    }
+    return true;
+}
+
+void now_hal_firework(now_proto_t *np, const firework_packet_t *pkt) {
+    if (!show_firework_notification) {
+        ESP_LOGI(TAG, "Received FIREWORK from %02x:%02x:%02x:%02x:%02x:%02x",
+            pkt->origin[0], pkt->origin[1], pkt->origin[2],
+            pkt->origin[3], pkt->origin[4], pkt->origin[5]);
+        int64_t now = esp_timer_get_time();
+        firework_notification_start(now / 1000);
+        capture_firework(now);
     }
-    return false;
 }
 
 
-static void nonce_store(uint32_t nonce) {
-    recent_nonces[nonce_index] = nonce;
-    nonce_index = (nonce_index + 1) % NONCE_HISTORY_SIZE;
+void now_hal_audio(now_proto_t *np, const audio_packet_t *pkt) {
+    sound_remote_event(pkt->level, pkt->beat, pkt->t_us);
 }
 
 
-// Callback for receiving ESP-NOW data
+void now_hal_show(now_proto_t *np, const uint8_t src_addr[6], const show_keyframe_t *pkt, int64_t rx_us) {
+    show_mode_rx(src_addr, pkt, (uint32_t)(now_proto_network_time_us(np, rx_us) / 1000));
+}
+
+
+void now_hal_genome(now_proto_t *np, const genome *g, uint16_t born_min) {
+    portENTER_CRITICAL(&gossip_lock);
+    if (collected_count == COLLECTED_KEEP) {
+        memmove(&collected[0], &collected[1], (COLLECTED_KEEP - 1) * sizeof(genome));
+        collected_count--;
+    }
+    collected[collected_count++] = *g;
+    portEXIT_CRITICAL(&gossip_lock);
+}
+
+
+// Callback for receiving ESP-NOW data (Wi-Fi task context: parse and hand off only)
 static void now_recv_cb(const esp_now_recv_info_t *recv_info, const uint8_t *data, int len) {
-    if (len != sizeof(firework_packet_t)) return;
-    const firework_packet_t *pkt = (const firework_packet_t *)data;
-    if (pkt->type != FIREWORK_MSG) return;
-    if (nonce_seen(pkt->msg_id)) return;
+    // Timestamp here rather than in the radio task; queueing delay would land in the time sync error
+    int64_t rx_us = esp_timer_get_time();
+    trace_event(TRACE_RADIO_RX, (uint16_t)len);
 
-    nonce_store(pkt->msg_id);
+    // A frame carries one or more back-to-back messages
+    int off = 0;
+    while (off < len) {
+        int msg_len = now_proto_msg_len(data[off]);
+        if (msg_len == 0 || off + msg_len > len) break;
 
-    if (!show_firework_notification) {
-        ESP_LOGI(TAG, "Received FIREWORK from %02x:%02x:%02x:%02x:%02x:%02x",
-            recv_info->src_addr[0], recv_info->src_addr[1], recv_info->src_addr[2],
-            recv_info->src_addr[3], recv_info->src_addr[4], recv_info->src_addr[5]);
-        show_firework_notification = true;
-        firework_notification_start_time = esp_timer_get_time() / 1000; // ms
+        now_rx_item_t rx = { .rx_us = rx_us, .len = msg_len, .rssi = recv_info->rx_ctrl->rssi };
+        memcpy(rx.src_addr, recv_info->src_addr, 6);
+        memcpy(rx.data, &data[off], msg_len);
+        if (xQueueSend(now_rx_queue, &rx, 0) != pdPASS) {
+            portENTER_CRITICAL(&stats_lock);
+            recv_dropped++;
+            portEXIT_CRITICAL(&stats_lock);
+        }
+        off += msg_len;
+    }
+    radio_task_wake();
+}
+
+
+// Callback for ESP-NOW send completion (Wi-Fi task context)
+static void now_send_cb(const esp_now_send_info_t *tx_info, esp_now_send_status_t status) {
+    tx_done_us = esp_timer_get_time();
+    tx_done_ok = (status == ESP_NOW_SEND_SUCCESS);
+    trace_event(TRACE_RADIO_TX_DONE, tx_done_ok);
+    tx_done = true;
+    radio_task_wake();
+}
+
+
+// How long the radio task may sleep before something is due
+static TickType_t next_wait_ticks(int64_t now) {
+    if (proto.tx_in_flight) return pdMS_TO_TICKS(NOW_SEND_TIMEOUT_MS);
+
+    int64_t next_due = now_proto_next_due_us(&proto);
+    if (next_due == INT64_MAX) return portMAX_DELAY;
+    if (next_due <= now) return 0;
+
+    TickType_t ticks = pdMS_TO_TICKS((next_due - now + 999) / 1000);
+    return ticks > 0 ? ticks : 1;
+}
+
+
+static void apply_own_genomes(int64_t now) {
+    genome g[GOSSIP_OWN];
+    uint16_t born[GOSSIP_OWN];
+    portENTER_CRITICAL(&gossip_lock);
+    uint8_t dirty = own_dirty;
+    own_dirty = 0;
+    memcpy(g, own_genomes, sizeof(g));
+    memcpy(born, own_born, sizeof(born));
+    portEXIT_CRITICAL(&gossip_lock);
+
+    for (int slot = 0; dirty; slot++, dirty >>= 1) {
+        if ((dirty & 1) && !now_gossip_set_own(&proto.gossip, slot, &g[slot], born[slot], now, esp_random())) {
+            ESP_LOGW(TAG, "Pattern %d can't be shared, genome out of range", slot);
+        }
     }
+}
+
+
+void radio_task(void *param) {
+    radio_task_handle = xTaskGetCurrentTaskHandle();
+    now_rx_item_t rx;
+    now_tx_item_t tx;
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, next_wait_ticks(esp_timer_get_time()));
+        int64_t now = esp_timer_get_time();
 
-    // Relay the firework packet to other badges if TTL > 0, for extended reach
-    if (pkt->ttl > 0) {
-        firework_packet_t relay = *pkt;
-        relay.ttl--;
-        esp_err_t err = esp_now_send(broadcast_addr, (uint8_t*)&relay, sizeof(relay));
-        if (err != ESP_OK) {
-            ESP_LOGW(TAG, "Failed to relay firework: %s", esp_err_to_name(err));
+        if (proto.tx_in_flight) {
+            if (tx_done) {
+                now_proto_send_done(&proto, tx_done_ok, tx_done_us);
+            } else if (now - proto.tx_started_us > NOW_SEND_TIMEOUT_MS * 1000) {
+                ESP_LOGW(TAG, "ESP-NOW send-complete timed out");
+                now_proto_send_done(&proto, false, now);
+            }
         }
+
+        bool ota_check, ota_ok;
+        while (ota_update_take_result(&ota_check, &ota_ok)) {
+            if (ota_check) now_proto_ota_checked(&proto, ota_ok);
+            else now_proto_ota_flash_done(&proto, ota_ok);
+        }
+        while (xQueueReceive(now_rx_queue, &rx, 0) == pdPASS) {
+            now_proto_rx_msg(&proto, rx.src_addr, rx.rssi, rx.rx_us, rx.data, rx.len);
+        }
+        while (xQueueReceive(now_tx_queue, &tx, 0) == pdPASS) {
+            now_proto_submit(&proto, &tx);
+        }
+        proto.stats.tx_queue_depth = uxQueueMessagesWaiting(now_tx_queue);
+        apply_own_genomes(now);
+
+        now_proto_poll(&proto);
+
+        portENTER_CRITICAL(&network_clock_lock);
+        network_clock = proto.sync.clock;
+        portEXIT_CRITICAL(&network_clock_lock);
+
+        static now_stats_t stats; // off the stack, only this task uses it
+        now_proto_get_stats(&proto, &stats);
+        portENTER_CRITICAL(&stats_lock);
+        stats_copy = stats;
+        portEXIT_CRITICAL(&stats_lock);
     }
 }
 
+
+void now_wake(void) {
+    radio_task_wake();
+}
+
+
+// Time shared by every badge in radio range (and their neighbours), for animations
+// that should line up across badges. Falls back to local time until synced.
+int64_t now_network_time_us(void) {
+    portENTER_CRITICAL(&network_clock_lock);
+    now_sync_clock_t clock = network_clock;
+    portEXIT_CRITICAL(&network_clock_lock);
+    return now_sync_network_time_us(&clock, esp_timer_get_time());
+}
+
+
+void now_set_standby(bool on) {
+    if (on) ESP_ERROR_CHECK(esp_wifi_connectionless_module_set_wake_interval(STANDBY_INTERVAL_MS));
+    ESP_ERROR_CHECK(esp_now_set_wake_window(on ? STANDBY_WINDOW_MS : WAKE_WINDOW_ALWAYS));
+}
+
+
+void now_get_stats(now_stats_t *out) {
+    portENTER_CRITICAL(&stats_lock);
+    *out = stats_copy;
+    out->tx_queued = enqueue_queued;
+    out->tx_dropped += enqueue_dropped;
+    out->tx_queue_peak = enqueue_peak;
+    out->rx_dropped = recv_dropped;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+
 // Initialize ESP-NOW and Wi-Fi in station mode (required)
 void now_init(void) {
     ESP_LOGI(TAG, "Initializing ESP-NOW");
-    reset_sent_history();
+    now_tx_queue = xQueueCreate(NOW_TX_QUEUE_LEN, sizeof(now_tx_item_t));
+    now_rx_queue = xQueueCreate(NOW_RX_QUEUE_LEN, sizeof(now_rx_item_t));
 
     // 1. Initialize Wi-Fi in STA mode (but not connected to any AP)
     ESP_ERROR_CHECK(esp_netif_init());
@@ -108,6 +328,13 @@ void now_init(void) {
     ESP_ERROR_CHECK(esp_wifi_start());
     ESP_ERROR_CHECK(esp_wifi_set_protocol(WIFI_IF_STA, WIFI_PROTOCOL_11B | WIFI_PROTOCOL_LR)); // use long range protocol
 
+    // fireworks are deduplicated per origin, so the protocol needs our MAC
+    uint8_t own_mac[6];
+    ESP_ERROR_CHECK(esp_wifi_get_mac(WIFI_IF_STA, own_mac));
+    now_proto_init(&proto, own_mac);
+    ota_update_init(&proto);
+    now_gossip_init(&proto.gossip, esp_timer_get_time(), esp_random());
+
     // 2. Init ESP-NOW
     ESP_ERROR_CHECK(esp_now_init());
     // Add the broadcast address as a peer
@@ -124,34 +351,69 @@ void now_init(void) {
     }
 
     ESP_ERROR_CHECK(esp_now_register_recv_cb(now_recv_cb));
+    ESP_ERROR_CHECK(esp_now_register_send_cb(now_send_cb));
 }
 
-#define FIREWORK_RETRIES 3
-#define FIREWORK_RETRY_DELAY_MS 20
-
-// Send a firework message to all peers (broadcast)
+// Send a firework message to all peers (broadcast), never blocks the caller
 void now_send_firework(void) {
-    if (!can_send_firework()) {
+    firework_packet_t packet;
+    if (!now_proto_launch_firework(&proto, &packet)) {
         ESP_LOGI(TAG, "Rate limit reached: You can send up to %d fireworks every %d seconds.",
                  MAX_SEND_PER_WINDOW, WINDOW_MS / 1000);
         return;
     }
 
-    firework_packet_t packet = {
-        .type = FIREWORK_MSG,
-        .msg_id = esp_random(),
-        .ttl = 4,
+    // sending the same notification multiple times to ensure delivery, spaced out by the radio task
+    if (!now_enqueue(&packet, sizeof(packet), FIREWORK_RETRIES, FIREWORK_RETRY_DELAY_MS)) {
+        ESP_LOGW(TAG, "ESP-NOW TX queue full, firework dropped");
+        return;
+    }
+    ESP_LOGI(TAG, "Sending ESP-NOW firework with ID %" PRIu32, packet.msg_id);
+}
+
+
+// Offer our sound features to nearby badges; the radio task decides whether they go out
+void now_publish_audio(uint8_t db, uint8_t level, uint8_t beat, uint32_t t_us) {
+    static uint8_t seq = 0;
+    audio_packet_t packet = {
+        .type = AUDIO_MSG,
+        .seq = seq++,
+        .db = db,
+        .level = level,
+        .beat = beat,
+        .t_us = t_us,
     };
-    nonce_store(packet.msg_id); // Record our own sent firework so we don't get triggered by badges further relaying it
+    now_enqueue(&packet, sizeof(packet), 1, 0);
+}
 
-    // sending the same notification multiple times to ensure delivery
-    for (int i = 0; i < FIREWORK_RETRIES; ++i) {
-        esp_err_t err = esp_now_send(broadcast_addr, (uint8_t *)&packet, sizeof(packet));
-        if (err != ESP_OK) {
-            ESP_LOGW(TAG, "Failed to send ESP-NOW firework: %s", esp_err_to_name(err));
-        }
-        vTaskDelay(FIREWORK_RETRY_DELAY_MS / portTICK_PERIOD_MS);  // short delay between retries
+
+// The radio task picks it up on its next pass. Genomes loaded from storage count
+// as old (born 0), so a freshly picked favourite anywhere around beats them.
+void now_share_genome(int slot, const genome *g, bool fresh) {
+    if (slot < 0 || slot >= GOSSIP_OWN) return;
+    uint16_t born = fresh ? (uint16_t)(now_network_time_us() / 60000000) : 0;
+    portENTER_CRITICAL(&gossip_lock);
+    own_genomes[slot] = *g;
+    own_born[slot] = born;
+    own_dirty |= 1 << slot;
+    portEXIT_CRITICAL(&gossip_lock);
+    radio_task_wake();
+}
+
+
+bool now_take_shared_genome(genome *out) {
+    portENTER_CRITICAL(&gossip_lock);
+    bool ok = collected_count > 0;
+    if (ok) *out = collected[--collected_count];
+    portEXIT_CRITICAL(&gossip_lock);
+    return ok;
+}
+
+
+// Broadcast a show keyframe; repeats cover frame loss, followers drop the copies
+void now_send_show(const show_keyframe_t *pkt) {
+    uint8_t repeats = pkt->overlay != SHOW_OVERLAY_NONE ? SHOW_OVERLAY_REPEATS : SHOW_REPEATS;
+    if (!now_enqueue(pkt, sizeof(*pkt), repeats, SHOW_REPEAT_MS)) {
+        ESP_LOGW(TAG, "ESP-NOW TX queue full, show keyframe dropped");
     }
-    ESP_LOGI(TAG, "Sending ESP-NOW firework with ID %" PRIu32, packet.msg_id);
-    record_sent_firework(); // Record the sent firework for rate limiting
 }
@@ -3,14 +3,24 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "now_proto.h"
 
 void now_init(void);
 void now_send_firework(void);
+void now_publish_audio(uint8_t db, uint8_t level, uint8_t beat, uint32_t t_us);
+void now_send_show(const show_keyframe_t *pkt);
+// Offer a favourite genome (pattern slot) to nearby badges; fresh if the user just picked it
+void now_share_genome(int slot, const genome *g, bool fresh);
+// Newest favourite collected from other badges that we haven't handed out yet
+bool now_take_shared_genome(genome *out);
+void radio_task(void *param);
+// Pokes the radio task from another task that left it something, e.g. the OTA flash writer
+void now_wake(void);
+// In standby the radio only listens in short windows, so the CPU can light sleep in between
+void now_set_standby(bool on);
 
-typedef struct {
-    uint8_t type;        // Message type (e.g., FIREWORK_MSG_TYPE)
-    uint32_t msg_id;     // Random nonce for deduplication
-    uint8_t ttl;         // Hop limit
-} __attribute__((packed)) firework_packet_t;
+void now_get_stats(now_stats_t *out);
+// Mesh-wide time base for animations, use instead of esp_timer_get_time()
+int64_t now_network_time_us(void);
 
-#endif // NOW_H
\ No newline at end of file
+#endif // NOW_H
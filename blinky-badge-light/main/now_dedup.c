@@ -0,0 +1,68 @@
+#include <string.h>
+#include "now_dedup.h"
+
+_Static_assert((NOW_DEDUP_SLOTS & (NOW_DEDUP_SLOTS - 1)) == 0, "NOW_DEDUP_SLOTS must be a power of two");
+
+
+static inline bool entry_live(const now_dedup_entry_t *e, uint32_t now_ms) {
+    return e->used && (uint32_t)(now_ms - e->seen_ms) < NOW_DEDUP_WINDOW_MS;
+}
+
+// FNV-1a over the MAC, then a murmur-style finalizer with the message ID mixed in
+static uint32_t dedup_hash(const uint8_t mac[6], uint32_t msg_id) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < 6; i++) {
+        h = (h ^ mac[i]) * 16777619u;
+    }
+    h ^= msg_id;
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+
+void now_dedup_init(now_dedup_t *d) {
+    memset(d, 0, sizeof(*d));
+}
+
+
+bool now_dedup_check_and_insert(now_dedup_t *d, const uint8_t mac[6], uint32_t msg_id, uint32_t now_ms) {
+    uint32_t idx = dedup_hash(mac, msg_id) & (NOW_DEDUP_SLOTS - 1);
+    now_dedup_entry_t *free_slot = NULL;
+    now_dedup_entry_t *oldest = NULL;
+
+    // Triangular steps visit every slot of a power-of-two table and don't pile
+    // neighbouring home slots into one long run the way linear probing does
+    for (int probe = 0; probe < NOW_DEDUP_MAX_PROBE; probe++) {
+        now_dedup_entry_t *e = &d->table[(idx + probe * (probe + 1) / 2) & (NOW_DEDUP_SLOTS - 1)];
+
+        if (!e->used) {
+            // Nothing was ever stored past a never-used slot
+            if (!free_slot) free_slot = e;
+            break;
+        }
+        if (!entry_live(e, now_ms)) {
+            if (!free_slot) free_slot = e;
+            continue;
+        }
+        if (e->msg_id == msg_id && memcmp(e->mac, mac, 6) == 0) {
+            d->stats.duplicates++;
+            return true;
+        }
+        if (!oldest || (int32_t)(e->seen_ms - oldest->seen_ms) < 0) oldest = e;
+    }
+
+    if (!free_slot) {
+        free_slot = oldest;
+        d->stats.evictions++;
+    }
+    free_slot->msg_id = msg_id;
+    free_slot->seen_ms = now_ms;
+    memcpy(free_slot->mac, mac, 6);
+    free_slot->used = 1;
+    d->stats.inserts++;
+    return false;
+}
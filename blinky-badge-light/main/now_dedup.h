@@ -0,0 +1,45 @@
+#ifndef NOW_DEDUP_H
+#define NOW_DEDUP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Time-windowed set of (origin MAC, msg_id) pairs used to drop ESP-NOW duplicates.
+// Open addressing with triangular probing; memory is NOW_DEDUP_SLOTS * sizeof(entry) (16 bytes).
+// Size it for twice (peak distinct messages per second) * window: past about half full the
+// probe bound starts evicting live entries. sim/dedup-stress checks it against a storm.
+
+#ifndef NOW_DEDUP_SLOTS
+#define NOW_DEDUP_SLOTS 256         // must be a power of two
+#endif
+
+#ifndef NOW_DEDUP_WINDOW_MS
+#define NOW_DEDUP_WINDOW_MS 5000    // how long an ID stays "seen"; must outlive relay circulation
+#endif
+
+#define NOW_DEDUP_MAX_PROBE 16      // probe length bound, keeps every lookup O(1)
+
+typedef struct {
+    uint32_t inserts;    // new IDs recorded
+    uint32_t duplicates; // lookups that found a live entry
+    uint32_t evictions;  // live entries pushed out early because the probe window was full
+} now_dedup_stats_t;
+
+typedef struct {
+    uint32_t msg_id;
+    uint32_t seen_ms;
+    uint8_t mac[6];
+    uint8_t used;        // slot has held an entry; expired entries stay used and get recycled
+    uint8_t pad;
+} now_dedup_entry_t;
+
+typedef struct {
+    now_dedup_entry_t table[NOW_DEDUP_SLOTS];
+    now_dedup_stats_t stats;
+} now_dedup_t;
+
+void now_dedup_init(now_dedup_t *d);
+// Returns true if (mac, msg_id) was seen within the window, otherwise records it and returns false
+bool now_dedup_check_and_insert(now_dedup_t *d, const uint8_t mac[6], uint32_t msg_id, uint32_t now_ms);
+
+#endif // NOW_DEDUP_H
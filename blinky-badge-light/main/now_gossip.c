@@ -0,0 +1,349 @@
+#include <stddef.h>
+#include <string.h>
+#include "now_proto.h"
+#include "now_gossip.h"
+
+
+// ---- Compact genome encoding ----
+// Fields only take the values generate_gene() gives them, so 52 bits cover a
+// genome instead of 80. lin is never generated or rendered and packs as 0.
+
+#define PACK_FIELDS 9
+
+static const struct {
+    uint8_t offset;     // field in genome
+    uint8_t min;
+    uint8_t max;
+    uint8_t bits;
+} pack_fields[PACK_FIELDS] = {
+    { offsetof(genome, cd_period), 1, 6, 3 },
+    { offsetof(genome, cd_rate), 0, 255, 8 },
+    { offsetof(genome, cd_dir), 0, 255, 8 },
+    { offsetof(genome, sat), 200, 255, 6 },
+    { offsetof(genome, hue_base), 0, 255, 8 },
+    { offsetof(genome, hue_rate), 1, 4, 2 },
+    { offsetof(genome, hue_dir), 0, 1, 1 },
+    { offsetof(genome, hue_bound), 0, 255, 8 },
+    { offsetof(genome, nonlin), 0, 255, 8 },
+};
+
+
+bool genome_pack(const genome *g, uint8_t out[GOSSIP_PACKED_LEN]) {
+    if (g->lin != 0) return false;
+    uint64_t bits = 0;
+    int shift = 0;
+    for (int i = 0; i < PACK_FIELDS; i++) {
+        uint8_t v = ((const uint8_t *)g)[pack_fields[i].offset];
+        if (v < pack_fields[i].min || v > pack_fields[i].max) return false;
+        bits |= (uint64_t)(v - pack_fields[i].min) << shift;
+        shift += pack_fields[i].bits;
+    }
+    for (int i = 0; i < GOSSIP_PACKED_LEN; i++) out[i] = (uint8_t)(bits >> (8 * i));
+    return true;
+}
+
+
+bool genome_unpack(const uint8_t in[GOSSIP_PACKED_LEN], genome *g) {
+    uint64_t bits = 0;
+    for (int i = 0; i < GOSSIP_PACKED_LEN; i++) bits |= (uint64_t)in[i] << (8 * i);
+    memset(g, 0, sizeof(*g));
+    for (int i = 0; i < PACK_FIELDS; i++) {
+        unsigned v = pack_fields[i].min + (unsigned)(bits & ((1u << pack_fields[i].bits) - 1));
+        if (v > pack_fields[i].max) return false;
+        ((uint8_t *)g)[pack_fields[i].offset] = (uint8_t)v;
+        bits >>= pack_fields[i].bits;
+    }
+    return bits == 0; // spare bits stay clear
+}
+
+
+uint16_t genome_id(const uint8_t packed[GOSSIP_PACKED_LEN]) {
+    uint32_t h = 2166136261u; // FNV-1a
+    for (int i = 0; i < GOSSIP_PACKED_LEN; i++) {
+        h = (h ^ packed[i]) * 16777619u;
+    }
+    uint16_t id = (uint16_t)(h ^ (h >> 16));
+    return id ? id : 1;
+}
+
+
+// ---- Pool ----
+
+// Newer favourites win; the id breaks ties so every badge ranks genomes the same way
+static uint32_t entry_key(uint16_t born_min, uint16_t id) {
+    return (uint32_t)born_min << 16 | id;
+}
+
+
+static int pool_find(const now_gossip_t *gs, uint16_t id) {
+    for (int i = 0; i < GOSSIP_POOL; i++) {
+        if (gs->pool[i].used && gs->pool[i].id == id) return i;
+    }
+    return -1;
+}
+
+
+// Slot a genome with this key would take: a free one, else the oldest collected
+// genome if it is older; -1 if we wouldn't keep it
+static int pool_slot_for(const now_gossip_t *gs, uint32_t key) {
+    int oldest = -1;
+    for (int i = 0; i < GOSSIP_POOL; i++) {
+        const gossip_entry_t *e = &gs->pool[i];
+        if (!e->used) return i;
+        if (e->own) continue;
+        if (oldest < 0 || entry_key(e->born_min, e->id) < entry_key(gs->pool[oldest].born_min, gs->pool[oldest].id)) {
+            oldest = i;
+        }
+    }
+    if (oldest >= 0 && key > entry_key(gs->pool[oldest].born_min, gs->pool[oldest].id)) return oldest;
+    return -1;
+}
+
+
+static bool would_keep(const now_gossip_t *gs, uint16_t id, uint16_t born_min) {
+    return pool_find(gs, id) < 0 && pool_slot_for(gs, entry_key(born_min, id)) >= 0;
+}
+
+
+static int64_t adv_delay_us(uint32_t interval_ms, uint32_t rand) {
+    // Second half of the interval, as in Trickle
+    return ((int64_t)interval_ms / 2 + rand % (interval_ms / 2 + 1)) * 1000;
+}
+
+
+// Something changed around here: advertise again soon
+static void adv_reset(now_gossip_t *gs, int64_t now_us, uint32_t rand) {
+    if (gs->adv_interval_ms == GOSSIP_ADV_MIN_MS) return;
+    gs->adv_interval_ms = GOSSIP_ADV_MIN_MS;
+    int64_t next = now_us + adv_delay_us(GOSSIP_ADV_MIN_MS, rand);
+    if (next < gs->next_adv_us) gs->next_adv_us = next;
+}
+
+
+void now_gossip_init(now_gossip_t *gs, int64_t now_us, uint32_t rand) {
+    memset(gs, 0, sizeof(*gs));
+    gs->enabled = true;
+    memset(gs->own_slot, -1, sizeof(gs->own_slot));
+    gs->adv_interval_ms = GOSSIP_ADV_MIN_MS;
+    gs->next_adv_us = now_us + adv_delay_us(GOSSIP_ADV_MIN_MS, rand);
+}
+
+
+bool now_gossip_set_own(now_gossip_t *gs, int slot, const genome *g, uint16_t born_min, int64_t now_us, uint32_t rand) {
+    if (slot < 0 || slot >= GOSSIP_OWN) return false;
+    uint8_t packed[GOSSIP_PACKED_LEN];
+    bool ok = genome_pack(g, packed);
+    uint16_t id = ok ? genome_id(packed) : 0;
+
+    // The favourite it replaces goes, unless another slot holds the same genome
+    int old = gs->own_slot[slot];
+    gs->own_slot[slot] = -1;
+    if (old >= 0) {
+        bool shared = false;
+        for (int s = 0; s < GOSSIP_OWN; s++) shared |= gs->own_slot[s] == old;
+        if (!shared) gs->pool[old].used = false;
+    }
+    if (!ok) return false;
+
+    int i = pool_find(gs, id);
+    if (i < 0) {
+        // At most GOSSIP_OWN entries are pinned, so there is always a collected one to give up
+        for (i = 0; i < GOSSIP_POOL && gs->pool[i].used; i++) {}
+        if (i == GOSSIP_POOL) i = pool_slot_for(gs, UINT32_MAX);
+        gs->pool[i].used = true;
+        gs->pool[i].id = id;
+        gs->pool[i].born_min = born_min;
+        memcpy(gs->pool[i].packed, packed, GOSSIP_PACKED_LEN);
+    } else if (born_min > gs->pool[i].born_min) {
+        gs->pool[i].born_min = born_min;
+    }
+    gs->pool[i].own = true;
+    gs->own_slot[slot] = (int8_t)i;
+    adv_reset(gs, now_us, rand);
+    return true;
+}
+
+
+static void want_remove(now_gossip_t *gs, uint16_t id) {
+    for (int i = 0; i < gs->want_count; i++) {
+        if (gs->want[i] == id) {
+            gs->want[i] = gs->want[--gs->want_count];
+            return;
+        }
+    }
+}
+
+
+void now_gossip_rx_digest(now_gossip_t *gs, const uint8_t src_addr[6], const gossip_digest_packet_t *pkt, int64_t now_us, uint32_t rand) {
+    if (!gs->enabled) return;
+    int count = pkt->count < GOSSIP_POOL ? pkt->count : GOSSIP_POOL;
+
+    // Pull what we'd keep, from one advertiser at a time
+    bool same = gs->want_count > 0 && memcmp(gs->want_from, src_addr, 6) == 0;
+    if (gs->want_count == 0 || same) {
+        uint8_t before = gs->want_count;
+        for (int i = 0; i < count && gs->want_count < GOSSIP_REQ_IDS; i++) {
+            const gossip_digest_entry_t *e = &pkt->entries[i];
+            if (!would_keep(gs, e->id, e->born_min)) continue;
+            bool listed = false;
+            for (int w = 0; w < gs->want_count; w++) listed |= gs->want[w] == e->id;
+            if (!listed) gs->want[gs->want_count++] = e->id;
+        }
+        if (gs->want_count > before && before == 0) {
+            memcpy(gs->want_from, src_addr, 6);
+            gs->tries = 0;
+            gs->next_req_us = now_us + (int64_t)(rand % GOSSIP_REQ_JITTER_MS) * 1000;
+        }
+    }
+
+    // Push: they lack something of ours they would keep, so let them see our digest soon.
+    // Up to GOSSIP_OWN of their entries are pinned favourites, so with a full pool only a
+    // genome newer than their GOSSIP_OWN + 1 oldest surely beats one they'd give up
+    uint32_t keys[GOSSIP_POOL];
+    for (int i = 0; i < count; i++) {
+        uint32_t k = entry_key(pkt->entries[i].born_min, pkt->entries[i].id);
+        int j = i;
+        for (; j > 0 && keys[j - 1] > k; j--) keys[j] = keys[j - 1];
+        keys[j] = k;
+    }
+    uint32_t their_oldest = count == GOSSIP_POOL ? keys[GOSSIP_OWN] : 0;
+    for (int p = 0; p < GOSSIP_POOL; p++) {
+        const gossip_entry_t *e = &gs->pool[p];
+        if (!e->used) continue;
+        bool listed = false;
+        for (int i = 0; i < count && !listed; i++) listed = pkt->entries[i].id == e->id;
+        if (!listed && entry_key(e->born_min, e->id) > their_oldest) {
+            adv_reset(gs, now_us, rand);
+            break;
+        }
+    }
+}
+
+
+void now_gossip_rx_req(now_gossip_t *gs, const uint8_t own_mac[6], const gossip_req_packet_t *pkt, int64_t now_us) {
+    if (!gs->enabled) return;
+    int count = pkt->count < GOSSIP_REQ_IDS ? pkt->count : GOSSIP_REQ_IDS;
+
+    if (memcmp(pkt->target, own_mac, 6) != 0) {
+        // Someone asked our advertiser first; its answer is broadcast, so wait for that
+        if (gs->want_count == 0 || memcmp(pkt->target, gs->want_from, 6) != 0) return;
+        for (int i = 0; i < count; i++) want_remove(gs, pkt->ids[i]);
+        if (gs->want_count == 0) {
+            gs->stats.reqs_suppressed++;
+        } else if (gs->next_req_us < now_us + (int64_t)GOSSIP_REQ_TIMEOUT_MS * 1000) {
+            gs->next_req_us = now_us + (int64_t)GOSSIP_REQ_TIMEOUT_MS * 1000;
+        }
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        int p = pool_find(gs, pkt->ids[i]);
+        if (p < 0) continue;
+        if (!gs->send_mask) gs->send_us = now_us + (int64_t)GOSSIP_SEND_DELAY_MS * 1000;
+        gs->send_mask |= 1u << p;
+    }
+}
+
+
+int now_gossip_rx_genomes(now_gossip_t *gs, const gossip_genomes_packet_t *pkt, int64_t now_us, uint32_t rand,
+                          genome learned[GOSSIP_BATCH], uint16_t learned_born[GOSSIP_BATCH]) {
+    if (!gs->enabled) return 0;
+    int count = pkt->count < GOSSIP_BATCH ? pkt->count : GOSSIP_BATCH;
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        const gossip_genome_t *in = &pkt->genomes[i];
+        gs->stats.genomes_heard++;
+        genome g;
+        if (!genome_unpack(in->packed, &g)) {
+            gs->stats.genomes_bad++;
+            continue;
+        }
+        uint16_t id = genome_id(in->packed);
+        want_remove(gs, id);
+
+        int p = pool_find(gs, id);
+        if (p >= 0) {
+            // Already on the air from someone else, no need for our copy
+            if (gs->send_mask & (1u << p)) {
+                gs->send_mask &= ~(1u << p);
+                gs->stats.sends_suppressed++;
+            }
+            continue;
+        }
+        p = pool_slot_for(gs, entry_key(in->born_min, id));
+        if (p < 0) continue;
+        gs->send_mask &= ~(1u << p);
+        gs->pool[p] = (gossip_entry_t){ .used = true, .id = id, .born_min = in->born_min };
+        memcpy(gs->pool[p].packed, in->packed, GOSSIP_PACKED_LEN);
+        gs->stats.genomes_learned++;
+        learned[n] = g;
+        learned_born[n] = in->born_min;
+        n++;
+    }
+    if (n > 0) adv_reset(gs, now_us, rand);
+    if (gs->want_count == 0) gs->tries = 0;
+    return n;
+}
+
+
+bool now_gossip_build_digest(now_gossip_t *gs, gossip_digest_packet_t *out, int64_t now_us, uint32_t rand) {
+    if (!gs->enabled || now_us < gs->next_adv_us) return false;
+    memset(out, 0, sizeof(*out));
+    out->type = GOSSIP_DIGEST_MSG;
+    for (int i = 0; i < GOSSIP_POOL; i++) {
+        if (!gs->pool[i].used) continue;
+        out->entries[out->count].id = gs->pool[i].id;
+        out->entries[out->count].born_min = gs->pool[i].born_min;
+        out->count++;
+    }
+    gs->stats.digests_sent++;
+
+    gs->next_adv_us = now_us + adv_delay_us(gs->adv_interval_ms, rand);
+    gs->adv_interval_ms = gs->adv_interval_ms * 2 < GOSSIP_ADV_MAX_MS ? gs->adv_interval_ms * 2 : GOSSIP_ADV_MAX_MS;
+    return true;
+}
+
+
+bool now_gossip_build_req(now_gossip_t *gs, gossip_req_packet_t *out, int64_t now_us) {
+    if (gs->want_count == 0 || now_us < gs->next_req_us) return false;
+    if (gs->tries >= GOSSIP_REQ_TRIES) {
+        // The next digest we hear starts over
+        gs->want_count = 0;
+        gs->tries = 0;
+        return false;
+    }
+    memset(out, 0, sizeof(*out));
+    out->type = GOSSIP_REQ_MSG;
+    memcpy(out->target, gs->want_from, 6);
+    out->count = gs->want_count;
+    memcpy(out->ids, gs->want, gs->want_count * sizeof(uint16_t));
+    gs->stats.reqs_sent++;
+    gs->tries++;
+    gs->next_req_us = now_us + (int64_t)GOSSIP_REQ_TIMEOUT_MS * 1000;
+    return true;
+}
+
+
+bool now_gossip_build_genomes(now_gossip_t *gs, gossip_genomes_packet_t *out, int64_t now_us) {
+    if (!gs->send_mask || now_us < gs->send_us) return false;
+    memset(out, 0, sizeof(*out));
+    out->type = GOSSIP_GENOMES_MSG;
+    for (int p = 0; p < GOSSIP_POOL && out->count < GOSSIP_BATCH; p++) {
+        if (!(gs->send_mask & (1u << p))) continue;
+        gs->send_mask &= ~(1u << p);
+        if (!gs->pool[p].used) continue;
+        memcpy(out->genomes[out->count].packed, gs->pool[p].packed, GOSSIP_PACKED_LEN);
+        out->genomes[out->count].born_min = gs->pool[p].born_min;
+        out->count++;
+    }
+    gs->stats.genomes_sent += out->count;
+    return out->count > 0;
+}
+
+
+int64_t now_gossip_next_due_us(const now_gossip_t *gs) {
+    if (!gs->enabled) return INT64_MAX;
+    int64_t next = gs->next_adv_us;
+    if (gs->want_count && gs->next_req_us < next) next = gs->next_req_us;
+    if (gs->send_mask && gs->send_us < next) next = gs->send_us;
+    return next;
+}
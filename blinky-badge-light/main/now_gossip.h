@@ -0,0 +1,121 @@
+#ifndef NOW_GOSSIP_H
+#define NOW_GOSSIP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "genes.h"
+
+// Genome gossip: badges share their favourite patterns. Each badge holds a small
+// pool of genomes, its own favourites pinned plus the newest ones it collected,
+// and now and then advertises a digest of the pool (genome ids and ages). A badge
+// that sees something in a digest it would keep asks the advertiser for it; the
+// answer is broadcast in batches, so everyone around who wanted the same genomes
+// picks them up too, and a request or answer overheard from someone else cancels
+// our own. Pools only keep the newest genomes, so neighbourhoods settle instead of
+// trading forever.
+//
+// Decisions live here; now_proto.c puts the messages on the air.
+
+#define GOSSIP_POOL 16              // genomes a badge holds, its favourites included
+#define GOSSIP_OWN 5                // favourites, NUM_PATTERNS on the badge
+#define GOSSIP_BATCH 8              // genomes per GOSSIP_GENOMES_MSG
+#define GOSSIP_REQ_IDS 8
+#define GOSSIP_PACKED_LEN 7         // 52 bits, see genome_pack()
+#define GOSSIP_ADV_MIN_MS 2000      // digest interval, Trickle style like the sync beacons
+#define GOSSIP_ADV_MAX_MS 120000
+#define GOSSIP_REQ_JITTER_MS 100    // lets one of the badges that want the same genomes ask first
+#define GOSSIP_REQ_TIMEOUT_MS 500
+#define GOSSIP_REQ_TRIES 3
+#define GOSSIP_SEND_DELAY_MS 20     // gathers requests that arrive together into one batch
+
+// Genome ids are a hash of the packed genome, 0 never occurs
+typedef struct {
+    uint16_t id;
+    uint16_t born_min;              // network time in minutes it became someone's favourite
+} __attribute__((packed)) gossip_digest_entry_t;
+
+typedef struct {
+    uint8_t type;                   // GOSSIP_DIGEST_MSG
+    uint8_t count;
+    gossip_digest_entry_t entries[GOSSIP_POOL];
+} __attribute__((packed)) gossip_digest_packet_t;
+
+typedef struct {
+    uint8_t type;                   // GOSSIP_REQ_MSG
+    uint8_t target[6];
+    uint8_t count;
+    uint16_t ids[GOSSIP_REQ_IDS];
+} __attribute__((packed)) gossip_req_packet_t;
+
+typedef struct {
+    uint8_t packed[GOSSIP_PACKED_LEN];
+    uint16_t born_min;
+} __attribute__((packed)) gossip_genome_t;
+
+typedef struct {
+    uint8_t type;                   // GOSSIP_GENOMES_MSG
+    uint8_t count;
+    gossip_genome_t genomes[GOSSIP_BATCH];
+} __attribute__((packed)) gossip_genomes_packet_t;
+
+typedef struct {
+    uint32_t digests_sent;
+    uint32_t reqs_sent;
+    uint32_t reqs_suppressed;       // someone else asked the same badge first
+    uint32_t genomes_sent;
+    uint32_t sends_suppressed;      // someone else already sent them
+    uint32_t genomes_heard;
+    uint32_t genomes_learned;       // new to our pool
+    uint32_t genomes_bad;           // failed to unpack
+} now_gossip_stats_t;
+
+typedef struct {
+    bool used;
+    bool own;                       // one of our favourites, never evicted
+    uint16_t id;
+    uint16_t born_min;
+    uint8_t packed[GOSSIP_PACKED_LEN];
+} gossip_entry_t;
+
+typedef struct {
+    bool enabled;
+    gossip_entry_t pool[GOSSIP_POOL];
+    int8_t own_slot[GOSSIP_OWN];    // pool index of each favourite, -1 if unset
+
+    int64_t next_adv_us;
+    uint32_t adv_interval_ms;
+
+    // Genomes we want, all from one advertiser at a time
+    uint8_t want_from[6];
+    uint16_t want[GOSSIP_REQ_IDS];
+    uint8_t want_count;
+    uint8_t tries;
+    int64_t next_req_us;
+
+    uint16_t send_mask;             // pool entries someone asked us for
+    int64_t send_us;
+
+    now_gossip_stats_t stats;
+} now_gossip_t;
+
+// Lossless for every genome generate_gene() makes; false for anything else
+bool genome_pack(const genome *g, uint8_t out[GOSSIP_PACKED_LEN]);
+bool genome_unpack(const uint8_t in[GOSSIP_PACKED_LEN], genome *g);
+uint16_t genome_id(const uint8_t packed[GOSSIP_PACKED_LEN]);
+
+void now_gossip_init(now_gossip_t *gs, int64_t now_us, uint32_t rand);
+// Favourite slot (pattern) now holds g; false if it can't be gossiped
+bool now_gossip_set_own(now_gossip_t *gs, int slot, const genome *g, uint16_t born_min, int64_t now_us, uint32_t rand);
+
+void now_gossip_rx_digest(now_gossip_t *gs, const uint8_t src_addr[6], const gossip_digest_packet_t *pkt, int64_t now_us, uint32_t rand);
+void now_gossip_rx_req(now_gossip_t *gs, const uint8_t own_mac[6], const gossip_req_packet_t *pkt, int64_t now_us);
+// Genomes new to our pool are copied to learned; returns how many
+int now_gossip_rx_genomes(now_gossip_t *gs, const gossip_genomes_packet_t *pkt, int64_t now_us, uint32_t rand,
+                          genome learned[GOSSIP_BATCH], uint16_t learned_born[GOSSIP_BATCH]);
+
+bool now_gossip_build_digest(now_gossip_t *gs, gossip_digest_packet_t *out, int64_t now_us, uint32_t rand);
+bool now_gossip_build_req(now_gossip_t *gs, gossip_req_packet_t *out, int64_t now_us);
+bool now_gossip_build_genomes(now_gossip_t *gs, gossip_genomes_packet_t *out, int64_t now_us);
+int64_t now_gossip_next_due_us(const now_gossip_t *gs);
+
+#endif // NOW_GOSSIP_H
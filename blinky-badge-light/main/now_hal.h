@@ -0,0 +1,42 @@
+#ifndef NOW_HAL_H
+#define NOW_HAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "now_proto.h"
+
+// Platform hooks used by now_proto.c. Implemented by now.c and ota_update.c on the
+// badge and by sim/sim.c on Linux.
+
+int64_t now_hal_time_us(void);
+uint32_t now_hal_random(void);
+
+// Broadcasts one frame; completion is reported back through now_proto_send_done()
+bool now_hal_send(now_proto_t *np, const uint8_t *frame, int len);
+
+// A firework we haven't seen before arrived
+void now_hal_firework(now_proto_t *np, const firework_packet_t *pkt);
+
+// Sound features from a nearby badge; t_us is already checked against network time
+void now_hal_audio(now_proto_t *np, const audio_packet_t *pkt);
+
+// A show keyframe, repeats and all; rx_us is local time
+void now_hal_show(now_proto_t *np, const uint8_t src_addr[6], const show_keyframe_t *pkt, int64_t rx_us);
+
+// A favourite genome from another badge that made it into our gossip pool
+void now_hal_genome(now_proto_t *np, const genome *g, uint16_t born_min);
+
+// Firmware distribution, see now_ota.h. Offsets are bytes into the image.
+// Reads the image we run, to serve it
+bool now_hal_ota_read(now_proto_t *np, uint32_t offset, uint8_t *buf, int len);
+// Hands image->sig to be checked against the release key, away from the radio; the
+// result comes back through now_proto_ota_checked(). False if it couldn't be handed on
+bool now_hal_ota_verify(now_proto_t *np, const now_ota_image_t *image);
+// Hands one page of the image being downloaded to the flash writer; pages come in order
+// and data stays untouched until the writer reports back through now_proto_ota_flash_done()
+bool now_hal_ota_write(now_proto_t *np, const now_ota_image_t *image, uint16_t page, const uint8_t *data, int len);
+// All pages are stored: the writer checks the image against image->sha and switches to it,
+// then reports back the same way
+bool now_hal_ota_finish(now_proto_t *np, const now_ota_image_t *image);
+
+#endif // NOW_HAL_H
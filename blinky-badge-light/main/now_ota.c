@@ -0,0 +1,371 @@
+#include <stddef.h>
+#include <string.h>
+#include "now_proto.h"
+#include "now_ota.h"
+
+
+static uint16_t crc16_update(uint16_t crc, const uint8_t *data, int len) {
+    for (int i = 0; i < len; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int b = 0; b < 8; b++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+
+static uint16_t data_crc(const ota_data_packet_t *pkt) {
+    uint16_t crc = crc16_update(0xFFFF, (const uint8_t *)pkt, offsetof(ota_data_packet_t, crc));
+    return crc16_update(crc, pkt->data, OTA_CHUNK_LEN);
+}
+
+
+// FNV-1a over the whole description, signature and all, for the rejected ring
+static uint32_t image_key(const now_ota_image_t *image) {
+    const uint8_t *p = (const uint8_t *)image;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < sizeof(*image); i++) h = (h ^ p[i]) * 16777619u;
+    return h;
+}
+
+
+static bool rejected(const now_ota_t *o, const now_ota_image_t *image) {
+    uint32_t key = image_key(image);
+    for (int i = 0; i < OTA_REJECTED; i++) {
+        if (o->rejected[i] == key) return true;
+    }
+    return false;
+}
+
+
+static void reject(now_ota_t *o, const now_ota_image_t *image) {
+    o->rejected[o->rejected_next] = image_key(image);
+    o->rejected_next = (o->rejected_next + 1) % OTA_REJECTED;
+}
+
+
+uint16_t now_ota_pages(const now_ota_image_t *image) {
+    return (uint16_t)((image->size + OTA_PAGE_LEN - 1) / OTA_PAGE_LEN);
+}
+
+
+// Chunks that exist in this page; only the last page is short
+static uint32_t page_mask(const now_ota_image_t *image, uint16_t page) {
+    uint32_t left = image->size - (uint32_t)page * OTA_PAGE_LEN;
+    if (left >= OTA_PAGE_LEN) return 0xFFFFFFFFu;
+    uint32_t chunks = (left + OTA_CHUNK_LEN - 1) / OTA_CHUNK_LEN;
+    return (1u << chunks) - 1;
+}
+
+
+static int64_t adv_delay_us(uint32_t interval_ms, uint32_t rand) {
+    // Second half of the interval, as in Trickle
+    return ((int64_t)interval_ms / 2 + rand % (interval_ms / 2 + 1)) * 1000;
+}
+
+
+// Someone around runs an older image: let them know soon
+static void adv_reset(now_ota_t *o, int64_t now_us, uint32_t rand) {
+    if (o->adv_interval_ms == OTA_ADV_MIN_MS) return;
+    o->adv_interval_ms = OTA_ADV_MIN_MS;
+    int64_t next = now_us + adv_delay_us(OTA_ADV_MIN_MS, rand);
+    if (next < o->next_adv_us) o->next_adv_us = next;
+}
+
+
+void now_ota_init(now_ota_t *o, const now_ota_image_t *own, bool can_serve, int64_t now_us, uint32_t rand) {
+    memset(o, 0, sizeof(*o));
+    o->own = *own;
+    o->can_serve = can_serve && own->size > 0;
+    o->adv_interval_ms = OTA_ADV_MIN_MS;
+    o->next_adv_us = now_us + adv_delay_us(OTA_ADV_MIN_MS, rand);
+    o->air_tokens_us = (int64_t)OTA_AIRTIME_BURST_US * 100 / OTA_AIRTIME_PCT;
+    o->air_refill_us = now_us;
+}
+
+
+void now_ota_resume(now_ota_t *o, const now_ota_image_t *image, uint16_t pages_done) {
+    o->resume = *image;
+    o->resume_pages = pages_done;
+}
+
+
+static void start_download(now_ota_t *o, const uint8_t src_addr[6], int rssi, const now_ota_image_t *image, int64_t now_us, uint32_t rand) {
+    bool resumable = memcmp(&o->resume, image, sizeof(*image)) == 0 && o->resume_pages < now_ota_pages(image);
+    o->downloading = true;
+    o->target = *image;
+    memcpy(o->source, src_addr, 6);
+    o->source_rssi = (int8_t)rssi;
+    o->page = resumable ? o->resume_pages : 0;
+    o->have = 0;
+    o->tries = 0;
+    o->next_req_us = now_us + (int64_t)(rand % OTA_REQ_JITTER_MS) * 1000;
+}
+
+
+// Newer, not given up on, and something we'd switch to
+static bool wanted(const now_ota_t *o, const now_ota_image_t *image) {
+    if (image->version <= o->own.version || image->size == 0 || rejected(o, image)) return false;
+    return !o->downloading || image->version > o->target.version;
+}
+
+
+bool now_ota_adv_unchecked(now_ota_t *o, const ota_adv_packet_t *pkt, int64_t now_us) {
+    const now_ota_image_t *image = &pkt->image;
+    if (o->writing || o->verifying || !wanted(o, image) || memcmp(image, &o->checked, sizeof(*image)) == 0) return false;
+    // Made-up versions come cheap, checking them doesn't
+    if (now_us < o->next_check_us) {
+        o->stats.sig_unchecked++;
+        return false;
+    }
+    o->next_check_us = now_us + (int64_t)OTA_CHECK_GAP_MS * 1000;
+    o->verifying = true;
+    o->verify = *image;
+    return true;
+}
+
+
+void now_ota_adv_checked(now_ota_t *o, bool ok, bool dropped) {
+    if (!o->verifying) return;
+    o->verifying = false;
+    if (dropped) return;
+    if (ok) {
+        o->checked = o->verify;
+        return;
+    }
+    o->stats.sig_bad++;
+    reject(o, &o->verify);
+}
+
+
+void now_ota_rx_adv(now_ota_t *o, const uint8_t src_addr[6], int rssi, const ota_adv_packet_t *pkt, int64_t now_us, uint32_t rand) {
+    const now_ota_image_t *image = &pkt->image;
+    if (image->version < o->own.version) {
+        adv_reset(o, now_us, rand);
+        return;
+    }
+    // buf stays put while it's being written
+    if (o->writing) return;
+
+    if (wanted(o, image)) {
+        if (memcmp(image, &o->checked, sizeof(*image)) == 0) start_download(o, src_addr, rssi, image, now_us, rand);
+        return;
+    }
+    if (!o->downloading) return;
+    // Same image from someone else; switch once our source stopped answering, or from a faint one to a
+    // much closer one. Staying put otherwise keeps requesters on few sources, so fewer of them talk at once
+    if (memcmp(image, &o->target, sizeof(*image)) != 0) return;
+    bool same = memcmp(src_addr, o->source, 6) == 0;
+    bool closer = !same && o->source_rssi < OTA_SOURCE_WEAK_RSSI && rssi >= o->source_rssi + OTA_SOURCE_BETTER_DB;
+    if (same) o->source_rssi = (int8_t)rssi;
+    if (o->tries < OTA_SOURCE_TRIES && !closer) return;
+    // Gave up on our source, or it was just busy and is still around: pick up again from whoever advertised
+    if (!same) o->stats.source_changes++;
+    memcpy(o->source, src_addr, 6);
+    o->source_rssi = (int8_t)rssi;
+    o->tries = 0;
+    o->next_req_us = now_us + (int64_t)(rand % OTA_REQ_JITTER_MS) * 1000;
+}
+
+
+void now_ota_rx_req(now_ota_t *o, const uint8_t own_mac[6], const ota_req_packet_t *pkt, int64_t now_us) {
+    if (memcmp(pkt->source, own_mac, 6) != 0) return;
+    if (!o->can_serve || pkt->version != o->own.version || pkt->page >= now_ota_pages(&o->own)) return;
+    uint32_t missing = pkt->missing & page_mask(&o->own, pkt->page);
+    if (!missing) return;
+
+    if (!o->serving || o->serve_page == pkt->page) {
+        o->serve_mask |= missing;
+        if (!o->serving) {
+            o->serving = true;
+            o->serve_page = pkt->page;
+            if (o->serve_next_us < now_us) o->serve_next_us = now_us;
+        }
+        return;
+    }
+    // Lowest page first pulls the stragglers along, so more requesters share each page sent.
+    // Whoever gets bumped asks again after OTA_REQ_TIMEOUT_MS
+    if (o->queued && o->queued_page < pkt->page) return;
+    if (o->queued && o->queued_page > pkt->page) o->queued_mask = 0;
+    o->queued = true;
+    o->queued_page = pkt->page;
+    o->queued_mask |= missing;
+}
+
+
+// Time credit for the airtime cap: a chunk on air costs its airtime stretched by 100 / OTA_AIRTIME_PCT
+static int64_t air_cost_us(void) {
+    return (int64_t)now_proto_frame_airtime_us(sizeof(ota_data_packet_t)) * 100 / OTA_AIRTIME_PCT;
+}
+
+
+static void air_refill(now_ota_t *o, int64_t now_us) {
+    int64_t max = (int64_t)OTA_AIRTIME_BURST_US * 100 / OTA_AIRTIME_PCT;
+    if (now_us > o->air_refill_us) {
+        o->air_tokens_us += now_us - o->air_refill_us;
+        o->air_refill_us = now_us;
+    }
+    if (o->air_tokens_us > max) o->air_tokens_us = max;
+}
+
+
+bool now_ota_rx_data(now_ota_t *o, const uint8_t src_addr[6], const ota_data_packet_t *pkt, int64_t now_us) {
+    o->stats.chunks_heard++;
+    // Every chunk on air around us counts against the cap, whoever's it is
+    air_refill(o, now_us);
+    o->air_tokens_us -= air_cost_us();
+    if (data_crc(pkt) != pkt->crc) {
+        o->stats.chunks_bad++;
+        return false;
+    }
+    // Our source busy with someone else's page is still there, keep asking it. Chunks of our
+    // image from anyone mean a busy channel too; under the airtime cap our source may just be waiting
+    if (o->downloading && (memcmp(src_addr, o->source, 6) == 0 || pkt->version == o->target.version)) o->tries = 0;
+    // Anyone's chunks will do, not just our source's
+    if (!o->downloading || o->writing || pkt->version != o->target.version || pkt->page != o->page || pkt->chunk >= OTA_CHUNKS_PER_PAGE) {
+        return false;
+    }
+    uint32_t bit = 1u << pkt->chunk;
+    uint32_t need = page_mask(&o->target, o->page);
+    if (!(need & bit)) return false;
+
+    // Only new data counts as progress; repeats of what we have don't keep a dead source alive
+    if (o->have & bit) return false;
+    o->tries = 0;
+    o->next_req_us = now_us + (int64_t)OTA_IDLE_MS * 1000;
+
+    memcpy(&o->buf[pkt->chunk * OTA_CHUNK_LEN], pkt->data, OTA_CHUNK_LEN);
+    o->have |= bit;
+    o->stats.chunks_used++;
+    o->writing = o->have == need;
+    return o->writing;
+}
+
+
+bool now_ota_page_written(now_ota_t *o, bool ok, int64_t now_us) {
+    o->writing = false;
+    if (!ok) {
+        // Doesn't fit or flash trouble; retrying the same image won't help
+        o->downloading = false;
+        reject(o, &o->target);
+        return false;
+    }
+    o->stats.pages_written++;
+    o->page++;
+    o->have = 0;
+    o->tries = 0;
+    o->next_req_us = now_us;
+    o->writing = o->page == now_ota_pages(&o->target);
+    return o->writing;
+}
+
+
+void now_ota_finished(now_ota_t *o, bool ok, int64_t now_us) {
+    o->downloading = false;
+    o->writing = false;
+    if (!ok) {
+        o->stats.verify_failed++;
+        reject(o, &o->target);
+        return;
+    }
+    // On the badge we reboot into it; until then (and in the simulator) we serve it
+    o->own = o->target;
+    o->can_serve = true;
+    o->serving = false;
+    o->serve_mask = 0;
+    o->queued = false;
+    o->queued_mask = 0;
+    o->stats.images_done++;
+    o->adv_interval_ms = OTA_ADV_MIN_MS;
+    o->next_adv_us = now_us;
+}
+
+
+void now_ota_yield(now_ota_t *o, int64_t now_us) {
+    o->quiet_until_us = now_us + (int64_t)OTA_YIELD_MS * 1000;
+}
+
+
+static int64_t after_quiet(const now_ota_t *o, int64_t t) {
+    return t < o->quiet_until_us ? o->quiet_until_us : t;
+}
+
+
+bool now_ota_build_adv(now_ota_t *o, ota_adv_packet_t *out, int64_t now_us, uint32_t rand) {
+    if (!o->can_serve || now_us < o->next_adv_us) return false;
+    out->type = OTA_ADV_MSG;
+    out->image = o->own;
+    o->stats.adv_sent++;
+
+    o->next_adv_us = now_us + adv_delay_us(o->adv_interval_ms, rand);
+    o->adv_interval_ms = o->adv_interval_ms * 2 < OTA_ADV_MAX_MS ? o->adv_interval_ms * 2 : OTA_ADV_MAX_MS;
+    return true;
+}
+
+
+bool now_ota_build_req(now_ota_t *o, ota_req_packet_t *out, int64_t now_us) {
+    if (!o->downloading || o->writing || o->tries >= OTA_SOURCE_TRIES || now_us < after_quiet(o, o->next_req_us)) return false;
+
+    out->type = OTA_REQ_MSG;
+    memcpy(out->source, o->source, 6);
+    out->version = o->target.version;
+    out->page = o->page;
+    out->missing = page_mask(&o->target, o->page) & ~o->have;
+    o->stats.req_sent++;
+    if (o->have) o->stats.nacks_sent++;
+
+    o->next_req_us = now_us + (int64_t)OTA_REQ_TIMEOUT_MS * 1000;
+    if (++o->tries == OTA_SOURCE_TRIES) {
+        // Source gone; advertising our old version wakes up anyone else who has the new one
+        o->adv_interval_ms = OTA_ADV_MIN_MS;
+        o->next_adv_us = now_us;
+    }
+    return true;
+}
+
+
+bool now_ota_next_chunk(now_ota_t *o, int64_t now_us, uint16_t *page, uint8_t *chunk) {
+    if (!o->serving || now_us < after_quiet(o, o->serve_next_us)) return false;
+    air_refill(o, now_us);
+    if (o->air_tokens_us < air_cost_us()) {
+        o->serve_next_us = now_us + air_cost_us() - o->air_tokens_us;
+        o->stats.chunks_capped++;
+        return false;
+    }
+    o->air_tokens_us -= air_cost_us();
+
+    int c = 0;
+    while (!(o->serve_mask & (1u << c))) c++;
+    *page = o->serve_page;
+    *chunk = (uint8_t)c;
+    o->serve_mask &= ~(1u << c);
+    if (!o->serve_mask) {
+        o->serving = o->queued;
+        o->serve_page = o->queued_page;
+        o->serve_mask = o->queued_mask;
+        o->queued = false;
+        o->queued_mask = 0;
+    }
+    o->serve_next_us = now_us + OTA_CHUNK_GAP_US;
+    o->stats.chunks_sent++;
+    return true;
+}
+
+
+void now_ota_seal(const now_ota_t *o, ota_data_packet_t *out, uint16_t page, uint8_t chunk) {
+    out->type = OTA_DATA_MSG;
+    out->version = o->own.version;
+    out->page = page;
+    out->chunk = chunk;
+    out->crc = data_crc(out);
+}
+
+
+int64_t now_ota_next_due_us(const now_ota_t *o) {
+    int64_t next = INT64_MAX;
+    if (o->can_serve) next = o->next_adv_us;
+    if (o->downloading && !o->writing && o->tries < OTA_SOURCE_TRIES && after_quiet(o, o->next_req_us) < next) next = after_quiet(o, o->next_req_us);
+    if (o->serving && after_quiet(o, o->serve_next_us) < next) next = after_quiet(o, o->serve_next_us);
+    return next;
+}
@@ -0,0 +1,187 @@
+#ifndef NOW_OTA_H
+#define NOW_OTA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Firmware distribution badge to badge, Deluge style. Every badge advertises the
+// image it runs; a badge that hears a newer version asks the advertiser for it
+// one flash page at a time. The source broadcasts the chunks that were asked for,
+// so everyone nearby that needs the same page picks them up too, and receivers
+// NACK just the chunks they still miss. Finished pages go to flash in order, and
+// progress is kept per page so a transfer resumes after a lost source or a reboot.
+// Once the whole image is in and verified the badge boots into it and starts
+// serving it to the next hop.
+//
+// Anyone can send an advert, so adverts carry an ECDSA P-256 signature over the
+// image description made with the release key (sim/ota-sign), and a badge only
+// starts on an image whose signature checks out against the key built into it.
+// Page writes and the final check happen in a flash writer task, so the radio
+// keeps going meanwhile, and the chunks everyone around sends are held to a share
+// of the channel.
+//
+// Decisions live here; flash access goes through now_hal.h.
+
+#ifndef BADGE_FW_VERSION
+#define BADGE_FW_VERSION 1          // bump for every release, badges only take newer images
+#endif
+
+#define OTA_CHUNK_LEN 128
+#define OTA_PAGE_LEN 4096           // one flash sector, written whole
+#define OTA_CHUNKS_PER_PAGE (OTA_PAGE_LEN / OTA_CHUNK_LEN) // one bit each in a 32 bit NACK mask
+#define OTA_ADV_MIN_MS 1000         // advertising interval, Trickle style like the sync beacons
+#define OTA_ADV_MAX_MS 60000
+#ifndef OTA_CHUNK_GAP_US
+#define OTA_CHUNK_GAP_US 1500       // between our chunks, leaves the channel to fireworks and sync
+#endif
+#define OTA_IDLE_MS 80              // NACK what's missing once the data paused this long
+#define OTA_REQ_TIMEOUT_MS 300      // ask again when nothing came back
+#define OTA_REQ_JITTER_MS 50        // spreads out the first request from badges that heard the same advert
+#define OTA_SOURCE_TRIES 6          // unanswered requests before we wait for another source
+#define OTA_YIELD_MS 200            // keep quiet this long once a firework comes by, it goes first
+#define OTA_SOURCE_WEAK_RSSI -75    // a source this faint costs NACK rounds, so
+#define OTA_SOURCE_BETTER_DB 10     // move to one this much louder when it advertises
+#define OTA_SIG_LEN 64              // ECDSA P-256, r then s, big endian
+#define OTA_CHECK_GAP_MS 1000       // signature checks cost the radio task; at most one this often
+#define OTA_REJECTED 8              // images we gave up on, remembered so they don't start again
+#ifndef OTA_AIRTIME_PCT
+#define OTA_AIRTIME_PCT 30          // chunks heard and sent around us, as a share of the channel
+#endif
+#define OTA_AIRTIME_BURST_US 40000  // airtime that may go out back to back
+
+typedef struct {
+    uint16_t version;
+    uint32_t size;
+    uint8_t sha[32];                // SHA-256 over all size bytes
+    uint8_t sig[OTA_SIG_LEN];       // release key's signature over the fields above
+} __attribute__((packed)) now_ota_image_t;
+
+#define OTA_SIGNED_LEN offsetof(now_ota_image_t, sig)
+
+// Stored right after the image in its partition: its advert, signature and all.
+// sim/ota-sign appends one to a release build; a badge writes one once a download checks out
+#define OTA_TRAILER_MAGIC 0x41544F42u   // "BOTA"
+typedef struct {
+    uint32_t magic;
+    now_ota_image_t image;
+} __attribute__((packed)) now_ota_trailer_t;
+
+// "I run this image and can send it"
+typedef struct {
+    uint8_t type;                   // OTA_ADV_MSG
+    now_ota_image_t image;
+} __attribute__((packed)) ota_adv_packet_t;
+
+// Asks source for the chunks set in missing; the first request for a page asks for all of them
+typedef struct {
+    uint8_t type;                   // OTA_REQ_MSG
+    uint8_t source[6];
+    uint16_t version;
+    uint16_t page;
+    uint32_t missing;
+} __attribute__((packed)) ota_req_packet_t;
+
+typedef struct {
+    uint8_t type;                   // OTA_DATA_MSG
+    uint16_t version;
+    uint16_t page;
+    uint8_t chunk;
+    uint16_t crc;                   // CRC-16/CCITT over the rest of the packet
+    uint8_t data[OTA_CHUNK_LEN];    // zero padded past the end of the image
+} __attribute__((packed)) ota_data_packet_t;
+
+typedef struct {
+    uint32_t adv_sent;
+    uint32_t req_sent;
+    uint32_t nacks_sent;            // requests for part of a page we already got some of
+    uint32_t chunks_sent;
+    uint32_t chunks_heard;
+    uint32_t chunks_used;           // new chunks for the page we were filling
+    uint32_t chunks_bad;            // failed the CRC
+    uint32_t pages_written;
+    uint32_t images_done;
+    uint32_t verify_failed;
+    uint32_t source_changes;
+    uint32_t sig_bad;               // adverts whose signature didn't check out
+    uint32_t sig_unchecked;         // adverts for new images that came too soon after a check
+    uint32_t chunks_capped;         // times our chunks waited for the airtime cap
+} now_ota_stats_t;
+
+typedef struct {
+    now_ota_image_t own;            // what we run, and serve to others
+    bool can_serve;
+    int64_t next_adv_us;
+    uint32_t adv_interval_ms;
+
+    // Serving one page at a time, to everyone who asked for it, with the lowest other page asked for lined up
+    bool serving;
+    uint16_t serve_page;
+    uint32_t serve_mask;
+    int64_t serve_next_us;
+    bool queued;
+    uint16_t queued_page;
+    uint32_t queued_mask;
+
+    // Downloading a newer image
+    bool downloading;
+    now_ota_image_t target;
+    uint8_t source[6];
+    int8_t source_rssi;
+    uint16_t page;                  // page being filled; everything before it is in flash
+    uint32_t have;                  // chunks of page we have
+    int64_t next_req_us;
+    uint8_t tries;                  // requests since the last data
+    bool writing;                   // buf is with the flash writer, or the whole image is being checked
+    uint8_t buf[OTA_PAGE_LEN];
+
+    now_ota_image_t checked;        // last advert whose signature checked out
+    int64_t next_check_us;
+    bool verifying;                 // verify is with the flash writer's task
+    now_ota_image_t verify;
+    uint32_t rejected[OTA_REJECTED]; // fingerprints of images we gave up on, a ring
+    uint8_t rejected_next;
+
+    int64_t air_tokens_us;          // time credit for the airtime cap, less chunks on air around us
+    int64_t air_refill_us;
+
+    int64_t quiet_until_us;         // yielding the channel to fireworks
+    now_ota_image_t resume;         // partly stored image from before a reboot
+    uint16_t resume_pages;
+
+    now_ota_stats_t stats;
+} now_ota_t;
+
+void now_ota_init(now_ota_t *o, const now_ota_image_t *own, bool can_serve, int64_t now_us, uint32_t rand);
+// Pages of image already in flash, picked up when it is advertised again
+void now_ota_resume(now_ota_t *o, const now_ota_image_t *image, uint16_t pages_done);
+
+uint16_t now_ota_pages(const now_ota_image_t *image);
+
+// True for an advert we would start downloading from but whose signature hasn't been checked;
+// the caller has it checked and reports back with now_ota_adv_checked(), the download starts
+// on an advert after that. False for the rest, while a check is out, and for new images beyond
+// one per OTA_CHECK_GAP_MS, which wait for their next advert
+bool now_ota_adv_unchecked(now_ota_t *o, const ota_adv_packet_t *pkt, int64_t now_us);
+// How the check of o->verify went; dropped when it couldn't be made, the next advert tries again
+void now_ota_adv_checked(now_ota_t *o, bool ok, bool dropped);
+void now_ota_rx_adv(now_ota_t *o, const uint8_t src_addr[6], int rssi, const ota_adv_packet_t *pkt, int64_t now_us, uint32_t rand);
+void now_ota_rx_req(now_ota_t *o, const uint8_t own_mac[6], const ota_req_packet_t *pkt, int64_t now_us);
+// True when the page in o->buf is complete and should be written out as page o->page; buf
+// then belongs to the flash writer until now_ota_page_written()
+bool now_ota_rx_data(now_ota_t *o, const uint8_t src_addr[6], const ota_data_packet_t *pkt, int64_t now_us);
+// After the page write; true when that was the last page and the image should be verified,
+// which again counts as writing until now_ota_finished()
+bool now_ota_page_written(now_ota_t *o, bool ok, int64_t now_us);
+void now_ota_finished(now_ota_t *o, bool ok, int64_t now_us);
+// A firework is on its way through; hold our requests and chunks for OTA_YIELD_MS
+void now_ota_yield(now_ota_t *o, int64_t now_us);
+
+bool now_ota_build_adv(now_ota_t *o, ota_adv_packet_t *out, int64_t now_us, uint32_t rand);
+bool now_ota_build_req(now_ota_t *o, ota_req_packet_t *out, int64_t now_us);
+// Next chunk to serve; the caller reads it from flash and calls now_ota_seal()
+bool now_ota_next_chunk(now_ota_t *o, int64_t now_us, uint16_t *page, uint8_t *chunk);
+void now_ota_seal(const now_ota_t *o, ota_data_packet_t *out, uint16_t page, uint8_t chunk);
+int64_t now_ota_next_due_us(const now_ota_t *o);
+
+#endif // NOW_OTA_H
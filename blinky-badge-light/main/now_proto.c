@@ -0,0 +1,634 @@
+#include <string.h>
+#include <math.h>
+#include "now_proto.h"
+#include "now_hal.h"
+
+// Tunables are overridable at build time so the simulator can compare protocol variants
+#ifndef FIREWORK_TTL
+#define FIREWORK_TTL 6           // suppressed relays cover less ground per hop than plain flooding, so allow one more
+#endif
+
+// Relays wait a back-off and are dropped once the copies heard from neighbours
+// leave too little of our range uncovered (area-based suppression, by RSSI)
+#ifndef RELAY_BACKOFF_MIN_MS
+#define RELAY_BACKOFF_MIN_MS 5
+#endif
+#ifndef RELAY_BACKOFF_MAX_MS
+#define RELAY_BACKOFF_MAX_MS 80
+#endif
+#ifndef RELAY_MIN_GAIN_PCT
+#define RELAY_MIN_GAIN_PCT 35       // share of our range still uncovered that's worth a relay, 0 = plain flooding
+#endif
+// Sparse crowds can't spare relays: below this many neighbours everyone relays, and
+// the full RELAY_MIN_GAIN_PCT only applies from RELAY_DENSE_NEIGHBOURS on
+#ifndef RELAY_SPARSE_NEIGHBOURS
+#define RELAY_SPARSE_NEIGHBOURS 8
+#endif
+#ifndef RELAY_DENSE_NEIGHBOURS
+#define RELAY_DENSE_NEIGHBOURS 24
+#endif
+#define RELAY_DENSITY_WINDOW_MS (2 * SYNC_BEACON_PERIOD_MS) // every neighbour beacons in it
+// Badges that barely heard the sender are further out and relay first, so each
+// hop covers as much ground as plain flooding did. RSSI in dBm; RELAY_RSSI_NEAR is
+// about where a sender leaves too little to relay in a dense crowd.
+#define RELAY_RSSI_EDGE -90
+#define RELAY_RSSI_NEAR -75
+#ifndef RELAY_JITTER_PCT
+#define RELAY_JITTER_PCT 10         // share of the back-off window that stays random
+#endif
+
+// Airtime estimate for 802.11b broadcast at 1 Mbps with long preamble
+#define NOW_PHY_PREAMBLE_US 192
+#define NOW_PHY_RATE_KBPS 1000
+#define NOW_FRAME_OVERHEAD_BYTES 43 // MAC header, vendor action/IE headers and FCS
+
+
+int now_proto_msg_len(uint8_t type) {
+    switch (type) {
+        case FIREWORK_MSG: return sizeof(firework_packet_t);
+        case TIME_SYNC_MSG: return sizeof(time_sync_packet_t);
+        case AUDIO_MSG: return sizeof(audio_packet_t);
+        case SHOW_MSG: return sizeof(show_keyframe_t);
+        case OTA_ADV_MSG: return sizeof(ota_adv_packet_t);
+        case OTA_REQ_MSG: return sizeof(ota_req_packet_t);
+        case OTA_DATA_MSG: return sizeof(ota_data_packet_t);
+        case GOSSIP_DIGEST_MSG: return sizeof(gossip_digest_packet_t);
+        case GOSSIP_REQ_MSG: return sizeof(gossip_req_packet_t);
+        case GOSSIP_GENOMES_MSG: return sizeof(gossip_genomes_packet_t);
+        default:           return 0;
+    }
+}
+
+
+uint32_t now_proto_frame_airtime_us(int payload_len) {
+    return NOW_PHY_PREAMBLE_US + ((payload_len + NOW_FRAME_OVERHEAD_BYTES) * 8 * 1000) / NOW_PHY_RATE_KBPS;
+}
+
+
+void now_proto_init(now_proto_t *np, const uint8_t mac[6]) {
+    void *user = np->user;
+    memset(np, 0, sizeof(*np));
+    np->user = user;
+    memcpy(np->own_mac, mac, 6);
+    np->start_us = now_hal_time_us();
+    now_dedup_init(&np->dedup);
+    now_sync_init(&np->sync, mac, now_hal_time_us(), now_hal_random());
+    np->audio_tokens_ms = AUDIO_BURST * 1000;
+    np->audio_refill_us = now_hal_time_us();
+
+    // Make notifications work immediately after startup
+    int64_t now = now_hal_time_us() / 1000; // ms
+    for (int i = 0; i < MAX_SEND_PER_WINDOW; ++i) {
+        np->last_sent_times[i] = now - WINDOW_MS - 1;
+    }
+}
+
+
+static bool can_send_firework(const now_proto_t *np, int64_t now) {
+    int send_count = 0;
+    for (int i = 0; i < MAX_SEND_PER_WINDOW; i++) {
+        if (now - np->last_sent_times[i] < WINDOW_MS) {
+            send_count++;
+        }
+    }
+    return send_count < MAX_SEND_PER_WINDOW;
+}
+
+
+bool now_proto_launch_firework(now_proto_t *np, firework_packet_t *out) {
+    int64_t now = now_hal_time_us() / 1000; // ms
+    if (!can_send_firework(np, now)) return false;
+
+    out->type = FIREWORK_MSG;
+    out->msg_id = now_hal_random();
+    out->ttl = FIREWORK_TTL;
+    memcpy(out->origin, np->own_mac, 6);
+
+    // Record the sent firework for rate limiting
+    np->last_sent_times[np->last_sent_idx] = now;
+    np->last_sent_idx = (np->last_sent_idx + 1) % MAX_SEND_PER_WINDOW;
+    now_ota_yield(&np->ota, now * 1000);
+    return true;
+}
+
+
+// Records the firework and reports whether it was already seen within the dedup window
+static bool firework_seen(now_proto_t *np, const firework_packet_t *pkt) {
+    return now_dedup_check_and_insert(&np->dedup, pkt->origin, pkt->msg_id, (uint32_t)(now_hal_time_us() / 1000));
+}
+
+
+static now_pending_t *pending_add(now_proto_t *np, const now_tx_item_t *item, int64_t due_us) {
+    for (int i = 0; i < NOW_PENDING_SLOTS; i++) {
+        now_pending_t *p = &np->pending[i];
+        if (!p->used) {
+            p->used = true;
+            p->sent_once = false;
+            p->is_relay = false;
+            p->gain_pct = 0;
+            p->due_us = due_us;
+            p->item = *item;
+            return p;
+        }
+    }
+    np->stats.tx_dropped++;
+    return NULL;
+}
+
+
+static now_pending_t *pending_find_relay(now_proto_t *np, const firework_packet_t *pkt) {
+    for (int i = 0; i < NOW_PENDING_SLOTS; i++) {
+        now_pending_t *p = &np->pending[i];
+        if (!p->used || !p->is_relay || p->item.data[0] != FIREWORK_MSG) continue;
+        const firework_packet_t *queued = (const firework_packet_t *)p->item.data;
+        if (queued->msg_id == pkt->msg_id && memcmp(queued->origin, pkt->origin, 6) == 0) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+
+// Back-off grows with signal strength, plus some jitter to break ties
+static int relay_backoff_ms(int rssi) {
+    int span = RELAY_BACKOFF_MAX_MS - RELAY_BACKOFF_MIN_MS;
+    if (rssi < RELAY_RSSI_EDGE) rssi = RELAY_RSSI_EDGE;
+    if (rssi > RELAY_RSSI_NEAR) rssi = RELAY_RSSI_NEAR;
+
+    int det_span = span * (100 - RELAY_JITTER_PCT) / 100;
+    int det = det_span * (rssi - RELAY_RSSI_EDGE) / (RELAY_RSSI_NEAR - RELAY_RSSI_EDGE);
+    int jitter = now_hal_random() % (span - det_span + 1);
+    return RELAY_BACKOFF_MIN_MS + det + jitter;
+}
+
+
+// Share of our range a sender at this RSSI didn't cover: one minus the overlap of
+// two equal discs, by distance over the range at RELAY_RSSI_EDGE (28 dB per decade)
+static const struct {
+    int8_t rssi;
+    uint8_t gain_pct;
+} relay_gain_table[] = {
+    { -90, 61 }, { -85, 41 }, { -80, 28 }, { -75, 19 }, { -70, 12 }, { -65, 8 }, { -60, 5 }, { -40, 0 },
+};
+#define RELAY_GAIN_POINTS (int)(sizeof(relay_gain_table) / sizeof(relay_gain_table[0]))
+
+
+static int relay_gain_pct(int rssi) {
+    if (rssi <= relay_gain_table[0].rssi) return relay_gain_table[0].gain_pct;
+    for (int i = 1; i < RELAY_GAIN_POINTS; i++) {
+        if (rssi <= relay_gain_table[i].rssi) {
+            int span = relay_gain_table[i].rssi - relay_gain_table[i - 1].rssi;
+            int drop = relay_gain_table[i - 1].gain_pct - relay_gain_table[i].gain_pct;
+            return relay_gain_table[i - 1].gain_pct - drop * (rssi - relay_gain_table[i - 1].rssi) / span;
+        }
+    }
+    return 0;
+}
+
+
+// Every sender heard sets a bit for its MAC; two windows of those bits give the
+// neighbour count by linear counting, good to a few up to about a hundred
+static void neighbour_heard(now_proto_t *np, const uint8_t mac[6], int64_t rx_us) {
+    int64_t window_us = (int64_t)RELAY_DENSITY_WINDOW_MS * 1000;
+    if (rx_us - np->neighbour_window_us >= window_us) {
+        np->neighbour_bits[1] = rx_us - np->neighbour_window_us < 2 * window_us ? np->neighbour_bits[0] : 0;
+        np->neighbour_bits[0] = 0;
+        np->neighbour_window_us = rx_us;
+    }
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < 6; i++) h = (h ^ mac[i]) * 16777619u;
+    np->neighbour_bits[0] |= 1ULL << (h >> 26);
+}
+
+
+static int neighbour_count(const now_proto_t *np) {
+    int zeros = 64 - __builtin_popcountll(np->neighbour_bits[0] | np->neighbour_bits[1]);
+    if (zeros == 0) return 255;
+    int n = (int)(64.0f * logf(64.0f / zeros) + 0.5f);
+    return n > 255 ? 255 : n;
+}
+
+
+// Sparse crowds relay everything, dense ones only what adds enough coverage
+static int relay_min_gain_pct(const now_proto_t *np) {
+    int n = neighbour_count(np);
+    if (n <= RELAY_SPARSE_NEIGHBOURS) return 0;
+    if (n >= RELAY_DENSE_NEIGHBOURS) return RELAY_MIN_GAIN_PCT;
+    return RELAY_MIN_GAIN_PCT * (n - RELAY_SPARSE_NEIGHBOURS) / (RELAY_DENSE_NEIGHBOURS - RELAY_SPARSE_NEIGHBOURS);
+}
+
+
+static void handle_firework(now_proto_t *np, const firework_packet_t *pkt, int rssi) {
+    if (firework_seen(np, pkt)) {
+        // A neighbour at our hop depth relayed it too and covered part of what we would;
+        // the nearer it is, the less is left. Copies with a higher TTL are upstream
+        // retries and don't count.
+        now_pending_t *p = pending_find_relay(np, pkt);
+        if (p && pkt->ttl <= ((const firework_packet_t *)p->item.data)->ttl) {
+            p->gain_pct = (uint8_t)(p->gain_pct * relay_gain_pct(rssi) / 100);
+            if (p->gain_pct < relay_min_gain_pct(np)) {
+                p->used = false;
+                np->stats.relays_suppressed++;
+            }
+        }
+        return;
+    }
+    np->stats.fireworks_seen++;
+    now_ota_yield(&np->ota, now_hal_time_us());
+
+    now_hal_firework(np, pkt);
+
+    // Relay the firework packet to other badges if TTL > 0, for extended reach, unless
+    // we're so close to the sender that it already covered nearly all we would.
+    // The back-off spreads relays out and gives neighbours a chance to suppress us.
+    int gain_pct = relay_gain_pct(rssi);
+    if (pkt->ttl > 0 && gain_pct < relay_min_gain_pct(np)) {
+        np->stats.relays_suppressed++;
+    } else if (pkt->ttl > 0) {
+        now_tx_item_t relay = {
+            .enqueue_us = now_hal_time_us(),
+            .repeats = 1,
+            .len = sizeof(firework_packet_t),
+        };
+        firework_packet_t *out = (firework_packet_t *)relay.data;
+        *out = *pkt;
+        out->ttl--;
+
+        int backoff_ms = relay_backoff_ms(rssi);
+        now_pending_t *p = pending_add(np, &relay, relay.enqueue_us + (int64_t)backoff_ms * 1000);
+        if (p) {
+            p->is_relay = true;
+            p->gain_pct = (uint8_t)gain_pct;
+        }
+    }
+}
+
+
+// Remember who publishes around us: the same one again, else a free or the stalest slot
+static void audio_publisher_heard(now_proto_t *np, const uint8_t src_addr[6], uint8_t db, int64_t rx_us) {
+    now_audio_publisher_t *slot = &np->audio_publishers[0];
+    for (int i = 0; i < AUDIO_PUBLISHERS; i++) {
+        now_audio_publisher_t *p = &np->audio_publishers[i];
+        if (p->heard_us && memcmp(p->mac, src_addr, 6) == 0) {
+            slot = p;
+            break;
+        }
+        if (p->heard_us < slot->heard_us) slot = p;
+    }
+    memcpy(slot->mac, src_addr, 6);
+    slot->db = db;
+    slot->heard_us = rx_us;
+}
+
+
+static bool audio_beaten(const now_proto_t *np, uint8_t db, int64_t now) {
+    for (int i = 0; i < AUDIO_PUBLISHERS; i++) {
+        const now_audio_publisher_t *p = &np->audio_publishers[i];
+        if (!p->heard_us || now - p->heard_us >= (int64_t)AUDIO_YIELD_MS * 1000) continue;
+        if (p->db >= db + AUDIO_YIELD_DB) return true;
+        if (p->db + AUDIO_YIELD_DB > db && memcmp(p->mac, np->own_mac, 6) < 0) return true;
+    }
+    return false;
+}
+
+
+static void handle_audio(now_proto_t *np, const uint8_t src_addr[6], const audio_packet_t *pkt, int64_t rx_us) {
+    np->stats.audio_heard++;
+    audio_publisher_heard(np, src_addr, pkt->db, rx_us);
+
+    // Latency from the publisher's audio block to us hearing it, both in network time
+    uint32_t latency = (uint32_t)now_proto_network_time_us(np, rx_us) - pkt->t_us;
+    if (latency > 1000000) return; // stale, or we aren't synced to the publisher yet
+    now_stats_t *s = &np->stats;
+    if (latency > s->audio_rx_latency_max_us) s->audio_rx_latency_max_us = latency;
+    s->audio_rx_latency_avg_us = s->audio_rx_latency_avg_us ? (s->audio_rx_latency_avg_us * 7 + latency) / 8 : latency;
+
+    now_hal_audio(np, pkt);
+}
+
+
+// Change filter, yield and airtime cap for our own audio events. Stale events are
+// worthless, so anything over the cap is dropped rather than queued.
+static bool audio_may_send(now_proto_t *np, const audio_packet_t *pkt, int64_t now) {
+    int64_t tokens = np->audio_tokens_ms + (now - np->audio_refill_us) * AUDIO_MAX_PER_SEC / 1000;
+    np->audio_tokens_ms = tokens > AUDIO_BURST * 1000 ? AUDIO_BURST * 1000 : (int32_t)tokens;
+    np->audio_refill_us = now;
+
+    // The level is scaled to the recent range, so in a quiet room it follows the noise
+    int moved = pkt->level > np->audio_sent_level ? pkt->level - np->audio_sent_level : np->audio_sent_level - pkt->level;
+    bool fresh = now - np->audio_sent_us < (int64_t)AUDIO_KEEPALIVE_MS * 1000;
+    if (pkt->db < AUDIO_QUIET_DB || (!pkt->beat && moved < AUDIO_LEVEL_STEP && fresh)) {
+        np->stats.audio_unchanged++;
+        return false;
+    }
+    if (audio_beaten(np, pkt->db, now)) {
+        np->stats.audio_yielded++;
+        return false;
+    }
+    if (np->audio_tokens_ms < 1000) {
+        np->stats.audio_capped++;
+        return false;
+    }
+    np->audio_tokens_ms -= 1000;
+    np->audio_sent_level = pkt->level;
+    np->audio_sent_us = now;
+    return true;
+}
+
+
+// Adverts for an image we'd fetch have their signature checked first, off the radio task
+static void handle_ota_adv(now_proto_t *np, const uint8_t src_addr[6], int rssi, const ota_adv_packet_t *pkt, int64_t rx_us) {
+    if (now_ota_adv_unchecked(&np->ota, pkt, rx_us) && !now_hal_ota_verify(np, &pkt->image)) {
+        now_ota_adv_checked(&np->ota, false, true);
+    }
+    now_ota_rx_adv(&np->ota, src_addr, rssi, pkt, rx_us, now_hal_random());
+}
+
+
+// A chunk for the page we're filling; full pages go to the flash writer
+static void handle_ota_data(now_proto_t *np, const uint8_t src_addr[6], const ota_data_packet_t *pkt, int64_t rx_us) {
+    now_ota_t *o = &np->ota;
+    if (!now_ota_rx_data(o, src_addr, pkt, rx_us)) return;
+
+    uint32_t offset = (uint32_t)o->page * OTA_PAGE_LEN;
+    uint32_t len = o->target.size - offset < OTA_PAGE_LEN ? o->target.size - offset : OTA_PAGE_LEN;
+    if (!now_hal_ota_write(np, &o->target, o->page, o->buf, (int)len)) now_ota_page_written(o, false, rx_us);
+}
+
+
+void now_proto_ota_flash_done(now_proto_t *np, bool ok) {
+    now_ota_t *o = &np->ota;
+    int64_t now = now_hal_time_us();
+    if (!o->writing) return;
+    // Past the last page, what came back was the check of the whole image
+    if (o->page == now_ota_pages(&o->target)) {
+        now_ota_finished(o, ok, now);
+    } else if (now_ota_page_written(o, ok, now) && !now_hal_ota_finish(np, &o->target)) {
+        now_ota_finished(o, false, now);
+    }
+}
+
+
+void now_proto_ota_checked(now_proto_t *np, bool ok) {
+    now_ota_adv_checked(&np->ota, ok, false);
+}
+
+
+// Genomes batched by whoever was asked for them; we keep what beats our pool
+static void handle_gossip_genomes(now_proto_t *np, const gossip_genomes_packet_t *pkt, int64_t rx_us) {
+    genome learned[GOSSIP_BATCH];
+    uint16_t born[GOSSIP_BATCH];
+    int n = now_gossip_rx_genomes(&np->gossip, pkt, rx_us, now_hal_random(), learned, born);
+    for (int i = 0; i < n; i++) now_hal_genome(np, &learned[i], born[i]);
+}
+
+
+void now_proto_rx_msg(now_proto_t *np, const uint8_t src_addr[6], int rssi, int64_t rx_us, const uint8_t *msg, int len) {
+    if (len < 1 || len != now_proto_msg_len(msg[0])) return;
+    neighbour_heard(np, src_addr, rx_us);
+
+    switch (msg[0]) {
+        case FIREWORK_MSG: handle_firework(np, (const firework_packet_t *)msg, rssi); break;
+        case TIME_SYNC_MSG: now_sync_rx_beacon(&np->sync, src_addr, (const time_sync_packet_t *)msg, rx_us, now_hal_random()); break;
+        case AUDIO_MSG: handle_audio(np, src_addr, (const audio_packet_t *)msg, rx_us); break;
+        case SHOW_MSG:
+            np->stats.show_heard++;
+            now_hal_show(np, src_addr, (const show_keyframe_t *)msg, rx_us);
+            break;
+        case OTA_ADV_MSG: handle_ota_adv(np, src_addr, rssi, (const ota_adv_packet_t *)msg, rx_us); break;
+        case OTA_REQ_MSG: now_ota_rx_req(&np->ota, np->own_mac, (const ota_req_packet_t *)msg, rx_us); break;
+        case OTA_DATA_MSG: handle_ota_data(np, src_addr, (const ota_data_packet_t *)msg, rx_us); break;
+        case GOSSIP_DIGEST_MSG:
+            now_gossip_rx_digest(&np->gossip, src_addr, (const gossip_digest_packet_t *)msg, rx_us, now_hal_random());
+            break;
+        case GOSSIP_REQ_MSG: now_gossip_rx_req(&np->gossip, np->own_mac, (const gossip_req_packet_t *)msg, rx_us); break;
+        case GOSSIP_GENOMES_MSG: handle_gossip_genomes(np, (const gossip_genomes_packet_t *)msg, rx_us); break;
+        default: break;
+    }
+}
+
+
+void now_proto_submit(now_proto_t *np, const now_tx_item_t *item) {
+    // Our own fireworks must never trigger us again when relayed back
+    if (item->data[0] == FIREWORK_MSG) {
+        firework_seen(np, (const firework_packet_t *)item->data);
+        np->stats.fireworks_seen++;
+    }
+    int64_t now = now_hal_time_us();
+    if (item->data[0] == AUDIO_MSG && !audio_may_send(np, (const audio_packet_t *)item->data, now)) return;
+    pending_add(np, item, now);
+}
+
+
+void now_proto_send_done(now_proto_t *np, bool ok, int64_t done_us) {
+    np->tx_in_flight = false;
+    if (!ok) {
+        np->stats.frames_failed++;
+        np->tx_beacon = false;
+        return;
+    }
+    if (np->tx_beacon) {
+        now_sync_beacon_sent(&np->sync, np->tx_beacon_seq, done_us);
+        np->tx_beacon = false;
+    }
+    if (np->tx_oldest_enqueue_us == 0) return;
+
+    uint32_t latency = (uint32_t)(done_us - np->tx_oldest_enqueue_us);
+    now_stats_t *s = &np->stats;
+    s->send_latency_last_us = latency;
+    if (latency > s->send_latency_max_us) s->send_latency_max_us = latency;
+    if (s->send_latency_avg_us == 0) {
+        s->send_latency_avg_us = latency;
+    } else {
+        s->send_latency_avg_us = (s->send_latency_avg_us * 7 + latency) / 8;
+    }
+}
+
+
+// Time sync beacons ride the normal schedule and share frames with anything else due
+static void schedule_beacon(now_proto_t *np, int64_t now) {
+    now_tx_item_t beacon = {
+        .enqueue_us = now,
+        .repeats = 1,
+        .len = sizeof(time_sync_packet_t),
+    };
+    now_sync_build_beacon(&np->sync, (time_sync_packet_t *)beacon.data, now, now_hal_random());
+    pending_add(np, &beacon, now);
+}
+
+
+// OTA adverts and requests, also sharing frames with anything else due
+static void schedule_ota(now_proto_t *np, int64_t now) {
+    now_tx_item_t item = {
+        .enqueue_us = now,
+        .repeats = 1,
+    };
+    if (now_ota_build_adv(&np->ota, (ota_adv_packet_t *)item.data, now, now_hal_random())) {
+        item.len = sizeof(ota_adv_packet_t);
+        pending_add(np, &item, now);
+    }
+    if (now_ota_build_req(&np->ota, (ota_req_packet_t *)item.data, now)) {
+        item.len = sizeof(ota_req_packet_t);
+        pending_add(np, &item, now);
+    }
+}
+
+
+// Digest, requests and genome batches, sharing frames like the OTA messages
+static void schedule_gossip(now_proto_t *np, int64_t now) {
+    now_tx_item_t item = {
+        .enqueue_us = now,
+        .repeats = 1,
+    };
+    if (now_gossip_build_digest(&np->gossip, (gossip_digest_packet_t *)item.data, now, now_hal_random())) {
+        item.len = sizeof(gossip_digest_packet_t);
+        pending_add(np, &item, now);
+    }
+    if (now_gossip_build_req(&np->gossip, (gossip_req_packet_t *)item.data, now)) {
+        item.len = sizeof(gossip_req_packet_t);
+        pending_add(np, &item, now);
+    }
+    if (now_gossip_build_genomes(&np->gossip, (gossip_genomes_packet_t *)item.data, now)) {
+        item.len = sizeof(gossip_genomes_packet_t);
+        pending_add(np, &item, now);
+    }
+}
+
+
+// Appends the next OTA chunk we serve, read straight from flash
+static int add_ota_chunk(now_proto_t *np, uint8_t *out, int space, int64_t now) {
+    uint16_t page;
+    uint8_t chunk;
+    if (space < (int)sizeof(ota_data_packet_t) || !now_ota_next_chunk(&np->ota, now, &page, &chunk)) return 0;
+
+    ota_data_packet_t *pkt = (ota_data_packet_t *)out;
+    uint32_t offset = (uint32_t)page * OTA_PAGE_LEN + (uint32_t)chunk * OTA_CHUNK_LEN;
+    uint32_t len = np->ota.own.size - offset < OTA_CHUNK_LEN ? np->ota.own.size - offset : OTA_CHUNK_LEN;
+    memset(pkt->data, 0, sizeof(pkt->data));
+    if (!now_hal_ota_read(np, offset, pkt->data, (int)len)) return 0; // the requester NACKs it
+    now_ota_seal(&np->ota, pkt, page, chunk);
+    return sizeof(ota_data_packet_t);
+}
+
+
+// Pack every due message into a single frame and put it on the air
+void now_proto_poll(now_proto_t *np) {
+    int64_t now = now_hal_time_us();
+    if (now >= np->sync.next_beacon_us) schedule_beacon(np, now);
+    if (now >= now_ota_next_due_us(&np->ota)) schedule_ota(np, now);
+    if (now >= now_gossip_next_due_us(&np->gossip)) schedule_gossip(np, now);
+    if (np->tx_in_flight) return;
+
+    uint8_t frame[NOW_MAX_FRAME_LEN];
+    int frame_len = 0;
+    int msgs = 0;
+    int64_t oldest = 0;
+    int beacon_len = 0;
+    int audio_len = 0;
+    int show_len = 0;
+    int ota_len = 0;
+    int gossip_len = 0;
+
+    for (int i = 0; i < NOW_PENDING_SLOTS; i++) {
+        now_pending_t *p = &np->pending[i];
+        if (!p->used || p->due_us > now) continue;
+        if (frame_len + p->item.len > (int)sizeof(frame)) break;
+
+        memcpy(&frame[frame_len], p->item.data, p->item.len);
+        frame_len += p->item.len;
+        msgs++;
+        if (p->is_relay) np->stats.relays_sent++;
+        if (p->item.data[0] == TIME_SYNC_MSG) {
+            np->tx_beacon_seq = ((const time_sync_packet_t *)p->item.data)->seq;
+            beacon_len = p->item.len;
+        }
+        if (p->item.data[0] == AUDIO_MSG) {
+            np->stats.audio_sent++;
+            audio_len += p->item.len;
+        }
+        if (p->item.data[0] == SHOW_MSG) {
+            np->stats.show_sent++;
+            show_len += p->item.len;
+        }
+        if (p->item.data[0] == OTA_ADV_MSG || p->item.data[0] == OTA_REQ_MSG) {
+            ota_len += p->item.len;
+        }
+        if (p->item.data[0] >= GOSSIP_DIGEST_MSG && p->item.data[0] <= GOSSIP_GENOMES_MSG) {
+            gossip_len += p->item.len;
+        }
+
+        if (!p->sent_once) {
+            p->sent_once = true;
+            if (oldest == 0 || p->item.enqueue_us < oldest) oldest = p->item.enqueue_us;
+        }
+        if (--p->item.repeats > 0) {
+            p->due_us = now + (int64_t)p->item.interval_ms * 1000;
+        } else {
+            p->used = false;
+        }
+    }
+    int chunk_len = add_ota_chunk(np, &frame[frame_len], (int)sizeof(frame) - frame_len, now);
+    if (chunk_len) {
+        frame_len += chunk_len;
+        ota_len += chunk_len;
+        msgs++;
+    }
+    if (msgs == 0) return;
+
+    np->stats.msgs_batched += msgs - 1;
+    np->tx_oldest_enqueue_us = oldest;
+    np->tx_started_us = now;
+    np->tx_in_flight = true;
+    np->tx_beacon = beacon_len > 0;
+
+    if (!now_hal_send(np, frame, frame_len)) {
+        now_proto_send_done(np, false, now);
+        return;
+    }
+    uint32_t airtime = now_proto_frame_airtime_us(frame_len);
+    np->stats.frames_sent++;
+    np->stats.tx_airtime_us += airtime;
+    // A beacon, audio event, keyframe, OTA or gossip message that shared a frame only costs its own bytes
+    if (beacon_len) {
+        np->stats.sync_airtime_us += msgs == 1 ? airtime : (uint32_t)(beacon_len * 8 * 1000 / NOW_PHY_RATE_KBPS);
+    }
+    if (audio_len) {
+        np->stats.audio_airtime_us += msgs == 1 ? airtime : (uint32_t)(audio_len * 8 * 1000 / NOW_PHY_RATE_KBPS);
+    }
+    if (show_len) {
+        np->stats.show_airtime_us += msgs == 1 ? airtime : (uint32_t)(show_len * 8 * 1000 / NOW_PHY_RATE_KBPS);
+    }
+    if (ota_len) {
+        np->stats.ota_airtime_us += msgs == 1 ? airtime : (uint32_t)(ota_len * 8 * 1000 / NOW_PHY_RATE_KBPS);
+    }
+    if (gossip_len) {
+        np->stats.gossip_airtime_us += msgs == 1 ? airtime : (uint32_t)(gossip_len * 8 * 1000 / NOW_PHY_RATE_KBPS);
+    }
+}
+
+
+int64_t now_proto_next_due_us(const now_proto_t *np) {
+    int64_t next_due = np->sync.next_beacon_us;
+    int64_t ota_due = now_ota_next_due_us(&np->ota);
+    if (ota_due < next_due) next_due = ota_due;
+    int64_t gossip_due = now_gossip_next_due_us(&np->gossip);
+    if (gossip_due < next_due) next_due = gossip_due;
+    for (int i = 0; i < NOW_PENDING_SLOTS; i++) {
+        if (np->pending[i].used && np->pending[i].due_us < next_due) next_due = np->pending[i].due_us;
+    }
+    return next_due;
+}
+
+
+void now_proto_get_stats(const now_proto_t *np, now_stats_t *out) {
+    *out = np->stats;
+    out->sync = np->sync.stats;
+    out->ota = np->ota.stats;
+    out->gossip = np->gossip.stats;
+    out->neighbours = (uint8_t)neighbour_count(np);
+    out->airtime_per_firework_us = out->fireworks_seen ?
+        (uint32_t)((out->tx_airtime_us - out->sync_airtime_us - out->audio_airtime_us - out->show_airtime_us -
+                    out->ota_airtime_us - out->gossip_airtime_us) / out->fireworks_seen) : 0;
+    int64_t uptime_ms = (now_hal_time_us() - np->start_us) / 1000;
+    out->gossip_airtime_ms_per_hour = uptime_ms > 0 ? (uint32_t)(out->gossip_airtime_us * 3600 / uptime_ms) : 0;
+}
@@ -0,0 +1,199 @@
+#ifndef NOW_PROTO_H
+#define NOW_PROTO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "now_dedup.h"
+#include "now_sync.h"
+#include "show.h"
+#include "now_ota.h"
+#include "now_gossip.h"
+
+// ESP-NOW protocol core: rate limiting, dedup, relay scheduling, time sync, audio
+// sharing, show keyframes, firmware distribution, genome gossip and frame packing.
+// Has no ESP-IDF dependencies; the platform is reached through now_hal.h so the
+// same code runs in the radio task on the badge and in the Linux simulator (sim/).
+
+// Message types, first byte of every message
+#define FIREWORK_MSG 0x42
+#define TIME_SYNC_MSG 0x43     // time_sync_packet_t, see now_sync.h
+#define AUDIO_MSG 0x44
+#define SHOW_MSG 0x45          // show_keyframe_t, see show.h
+#define OTA_ADV_MSG 0x46       // ota_*_packet_t, see now_ota.h
+#define OTA_REQ_MSG 0x47
+#define OTA_DATA_MSG 0x48
+#define GOSSIP_DIGEST_MSG 0x49 // gossip_*_packet_t, see now_gossip.h
+#define GOSSIP_REQ_MSG 0x4A
+#define GOSSIP_GENOMES_MSG 0x4B
+
+// Sound features from a badge near the music, for badges that can't hear it well.
+// Single hop, never relayed.
+typedef struct {
+    uint8_t type;
+    uint8_t seq;
+    uint8_t db;          // raw sound level in dB SPL, the loudest badge around publishes
+    uint8_t level;       // level 0-255 as the publisher renders it
+    uint8_t beat;        // beat strength, 0 if this block had no beat
+    uint32_t t_us;       // network time at the end of the audio block, low 32 bits
+} __attribute__((packed)) audio_packet_t;
+
+typedef struct {
+    uint8_t type;        // Message type (e.g., FIREWORK_MSG_TYPE)
+    uint32_t msg_id;     // Random nonce for deduplication
+    uint8_t ttl;         // Hop limit
+    uint8_t origin[6];   // MAC of the badge that launched it; msg_id is only unique per origin
+} __attribute__((packed)) firework_packet_t;
+
+#define NOW_MAX_FRAME_LEN 250       // ESP_NOW_MAX_DATA_LEN
+#define NOW_MAX_MSG_LEN 136         // largest single message, an OTA chunk
+#define NOW_PENDING_SLOTS 16
+
+#define MAX_SEND_PER_WINDOW 4
+#define WINDOW_MS (40 * 1000)  // 40 seconds
+
+// Our own fireworks go out several times to ensure delivery
+#define FIREWORK_RETRIES 3
+#define FIREWORK_RETRY_DELAY_MS 20
+
+// Audio: a crowd around one speaker hears about the same thing, so one badge per
+// neighbourhood publishes. A badge stays quiet while it hears a publisher that is
+// clearly louder, or about as loud with a lower MAC, so a crowd of similar badges
+// settles on one instead of all publishing or taking turns. The publisher sends beats,
+// level changes and a keep-alive, nothing in silence, under a token bucket. An audio
+// frame is ~600 us on air, so the bucket is at most ~0.7% of the channel.
+#define AUDIO_MAX_PER_SEC 12
+#define AUDIO_BURST 3
+#define AUDIO_YIELD_MS 500     // stay quiet this long after hearing a publisher that beats us
+#define AUDIO_YIELD_DB 3       // this much louder beats us outright; within it the lower MAC does
+#define AUDIO_PUBLISHERS 4     // recent publishers we compare ourselves with
+#define AUDIO_QUIET_DB 60      // dB SPL; below this there's no music to pass on
+#define AUDIO_LEVEL_STEP 8     // level-only updates wait for the level to move this much (of 255)
+#define AUDIO_KEEPALIVE_MS 250 // or for this long, under REMOTE_HOLD_MS so listeners don't fade out
+
+// Radio counters, owned by whoever runs the protocol (the radio task on the badge,
+// which hands copies to other tasks through now_get_stats())
+typedef struct {
+    uint32_t tx_queued;            // Messages accepted into the TX queue
+    uint32_t tx_dropped;           // Messages dropped because the TX queue or schedule was full
+    uint32_t rx_dropped;           // Received messages dropped because the RX queue was full
+    uint32_t frames_sent;          // Frames handed to the radio
+    uint32_t frames_failed;        // Frames that failed to send or never completed
+    uint32_t msgs_batched;         // Messages that shared a frame with an earlier one
+    uint8_t tx_queue_depth;        // Messages currently waiting in the TX queue
+    uint8_t tx_queue_peak;         // Highest TX queue depth seen
+    uint32_t send_latency_last_us; // Enqueue to send-complete for the last frame
+    uint32_t send_latency_avg_us;  // Smoothed enqueue to send-complete latency
+    uint32_t send_latency_max_us;  // Worst enqueue to send-complete latency
+    uint32_t fireworks_seen;       // Distinct fireworks sent or received
+    uint32_t relays_sent;          // Firework relays that went on air
+    uint32_t relays_suppressed;    // Firework relays skipped or cancelled because others covered our range
+    uint8_t neighbours;            // Badges heard lately, estimated; sets how hard relays are suppressed
+    uint64_t tx_airtime_us;        // Estimated total time our frames occupied the channel
+    uint64_t sync_airtime_us;      // Part of tx_airtime_us spent on time sync beacons
+    uint64_t audio_airtime_us;     // Part of tx_airtime_us spent on audio events
+    uint32_t audio_sent;           // Audio events we put on the air
+    uint32_t audio_capped;         // Audio events dropped by the airtime cap
+    uint32_t audio_yielded;        // Audio events dropped because a louder badge publishes
+    uint32_t audio_unchanged;      // Audio events dropped because they said nothing new
+    uint32_t audio_heard;          // Audio events received
+    uint32_t audio_rx_latency_avg_us; // Audio block to reception, smoothed
+    uint32_t audio_rx_latency_max_us;
+    uint64_t show_airtime_us;      // Part of tx_airtime_us spent on show keyframes
+    uint32_t show_sent;            // Show keyframes we put on the air, repeats included
+    uint32_t show_heard;           // Show keyframes received, repeats included
+    uint64_t ota_airtime_us;       // Part of tx_airtime_us spent on firmware distribution
+    uint64_t gossip_airtime_us;    // Part of tx_airtime_us spent on genome gossip
+    uint32_t gossip_airtime_ms_per_hour; // gossip_airtime_us over our uptime
+    uint32_t airtime_per_firework_us; // Airtime outside sync, audio, show, OTA and gossip / fireworks_seen
+    now_sync_stats_t sync;
+    now_ota_stats_t ota;
+    now_gossip_stats_t gossip;
+} now_stats_t;
+
+typedef struct {
+    int64_t enqueue_us;
+    uint16_t interval_ms;   // gap between repeats
+    uint8_t repeats;        // how many times to put it on air
+    uint8_t len;
+    uint8_t data[NOW_MAX_MSG_LEN];
+} now_tx_item_t;
+
+// Messages scheduled for the air, filled by now_proto_submit() and by relays
+typedef struct {
+    bool used;
+    bool sent_once;
+    bool is_relay;
+    uint8_t gain_pct;       // share of our range no copy heard so far covered (relays only)
+    int64_t due_us;
+    now_tx_item_t item;
+} now_pending_t;
+
+typedef struct {
+    uint8_t mac[6];
+    uint8_t db;
+    int64_t heard_us;               // 0 = free
+} now_audio_publisher_t;
+
+// Everything one badge's protocol instance owns
+typedef struct {
+    uint8_t own_mac[6];
+    void *user;                     // owner context for the HAL (the simulator's badge)
+    int64_t start_us;               // for per-hour rates
+    now_dedup_t dedup;
+    now_pending_t pending[NOW_PENDING_SLOTS];
+    now_sync_t sync;
+    now_ota_t ota;                  // call now_ota_init() after now_proto_init() to take part
+    now_gossip_t gossip;            // same with now_gossip_init()
+
+    int64_t last_sent_times[MAX_SEND_PER_WINDOW]; // ms, our own fireworks for rate limiting
+    uint8_t last_sent_idx;
+
+    bool tx_in_flight;
+    int64_t tx_started_us;
+    int64_t tx_oldest_enqueue_us;   // 0 if the frame only carried repeats
+    bool tx_beacon;                 // frame in flight carries time sync beacon tx_beacon_seq
+    uint8_t tx_beacon_seq;
+
+    uint64_t neighbour_bits[2];     // hashed MACs heard in this and the last density window
+    int64_t neighbour_window_us;
+
+    int32_t audio_tokens_ms;        // token bucket, 1000 per message
+    int64_t audio_refill_us;
+    now_audio_publisher_t audio_publishers[AUDIO_PUBLISHERS];
+    uint8_t audio_sent_level;       // level of our last audio event
+    int64_t audio_sent_us;
+
+    now_stats_t stats;
+} now_proto_t;
+
+void now_proto_init(now_proto_t *np, const uint8_t mac[6]);
+
+// Size on the air of each message type, 0 for types we don't understand
+int now_proto_msg_len(uint8_t type);
+uint32_t now_proto_frame_airtime_us(int payload_len);
+
+// Builds a new firework from us, or returns false if we're over the rate limit
+bool now_proto_launch_firework(now_proto_t *np, firework_packet_t *out);
+
+void now_proto_submit(now_proto_t *np, const now_tx_item_t *item);
+// rx_us is when the frame arrived, taken as close to the radio as the platform allows
+void now_proto_rx_msg(now_proto_t *np, const uint8_t src_addr[6], int rssi, int64_t rx_us, const uint8_t *msg, int len);
+void now_proto_send_done(now_proto_t *np, bool ok, int64_t done_us);
+// The flash writer is done with the page or image check now_hal_ota_write()/finish() handed it
+void now_proto_ota_flash_done(now_proto_t *np, bool ok);
+// The advert signature check now_hal_ota_verify() handed on is done
+void now_proto_ota_checked(now_proto_t *np, bool ok);
+
+// Puts the next frame on the air if anything is due and nothing is in flight
+void now_proto_poll(now_proto_t *np);
+// When the next scheduled message, time sync beacon, OTA or gossip message is due
+int64_t now_proto_next_due_us(const now_proto_t *np);
+
+// Network time for a local timestamp, see now_sync.h
+static inline int64_t now_proto_network_time_us(const now_proto_t *np, int64_t local_us) {
+    return now_sync_network_time_us(&np->sync.clock, local_us);
+}
+
+void now_proto_get_stats(const now_proto_t *np, now_stats_t *out);
+
+#endif // NOW_PROTO_H
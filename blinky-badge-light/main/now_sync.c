@@ -0,0 +1,249 @@
+#include <string.h>
+#include "now_proto.h"
+#include "now_sync.h"
+
+#define SYNC_MAX_SKEW 100e-6        // two crystals good to 40 ppm each; anything beyond is a bad fit
+
+
+void now_sync_init(now_sync_t *s, const uint8_t mac[6], int64_t now_us, uint32_t rand) {
+    memset(s, 0, sizeof(*s));
+    memcpy(s->own_mac, mac, 6);
+    memcpy(s->root, mac, 6); // everyone starts as their own root until they hear a lower MAC
+    s->root_heard_us = now_us;
+    s->stats.synced = true;
+    s->beacon_interval_ms = SYNC_BEACON_MIN_MS;
+    s->next_beacon_us = now_us + (int64_t)(rand % SYNC_BEACON_MIN_MS) * 1000;
+}
+
+
+static int64_t beacon_delay_us(uint16_t interval_ms, uint32_t rand) {
+    int span_ms = interval_ms * SYNC_BEACON_JITTER_PCT / 100;
+    int jitter_ms = (int)(rand % (2 * span_ms + 1)) - span_ms;
+    return (int64_t)(interval_ms + jitter_ms) * 1000;
+}
+
+
+// Something changed that neighbours should hear about soon
+static void beacon_reset(now_sync_t *s, int64_t now_us, uint32_t rand) {
+    if (s->beacon_interval_ms == SYNC_BEACON_MIN_MS) return;
+    s->beacon_interval_ms = SYNC_BEACON_MIN_MS;
+    int64_t next = now_us + beacon_delay_us(SYNC_BEACON_MIN_MS, rand);
+    if (next < s->next_beacon_us) s->next_beacon_us = next;
+}
+
+
+static bool is_root(const now_sync_t *s) {
+    return memcmp(s->root, s->own_mac, 6) == 0;
+}
+
+
+static void reset_samples(now_sync_t *s) {
+    s->sample_count = 0;
+    s->sample_idx = 0;
+    s->stats.resets++;
+    s->stats.error_last_us = 0;
+    s->stats.error_avg_us = 0;
+    s->stats.synced = is_root(s);
+}
+
+
+// Least squares fit of offset against local time, relative to the newest sample
+// so the sums stay small enough for doubles to be exact
+static void fit_clock(now_sync_t *s) {
+    int n = s->sample_count;
+    const now_sync_sample_t *last = &s->samples[(s->sample_idx + SYNC_SAMPLES - 1) % SYNC_SAMPLES];
+
+    double mean_x = 0, mean_o = 0;
+    for (int i = 0; i < n; i++) {
+        mean_x += (double)(s->samples[i].local_us - last->local_us);
+        mean_o += (double)(s->samples[i].offset_us - last->offset_us);
+    }
+    mean_x /= n;
+    mean_o /= n;
+
+    if (n >= 2) {
+        double sxx = 0, sxo = 0;
+        for (int i = 0; i < n; i++) {
+            double dx = (double)(s->samples[i].local_us - last->local_us) - mean_x;
+            double d_o = (double)(s->samples[i].offset_us - last->offset_us) - mean_o;
+            sxx += dx * dx;
+            sxo += dx * d_o;
+        }
+        if (sxx > 0) {
+            double skew = sxo / sxx;
+            if (skew > SYNC_MAX_SKEW) skew = SYNC_MAX_SKEW;
+            if (skew < -SYNC_MAX_SKEW) skew = -SYNC_MAX_SKEW;
+            s->clock.skew = skew;
+        }
+    }
+    s->clock.local_ref = last->local_us + (int64_t)mean_x;
+    s->clock.offset_us = last->offset_us + (int64_t)mean_o;
+}
+
+
+static void add_sample(now_sync_t *s, int64_t local_us, int64_t network_us, uint32_t rand) {
+    if (s->sample_count > 0) {
+        int64_t err = network_us - now_sync_network_time_us(&s->clock, local_us);
+        uint32_t abs_err = err < 0 ? (uint32_t)-err : (uint32_t)err;
+        // Only a fit that is passed on counts; one sample can't know the skew yet
+        if (s->sample_count >= SYNC_MIN_SAMPLES) {
+            s->stats.error_last_us = abs_err;
+            s->stats.error_avg_us = s->sample_count > SYNC_MIN_SAMPLES ? (s->stats.error_avg_us * 7 + abs_err) / 8 : abs_err;
+        }
+        if (abs_err > SYNC_RESET_US) reset_samples(s);
+    }
+    s->samples[s->sample_idx] = (now_sync_sample_t){ .local_us = local_us, .offset_us = network_us - local_us };
+    s->sample_idx = (s->sample_idx + 1) % SYNC_SAMPLES;
+    if (s->sample_count < SYNC_SAMPLES) s->sample_count++;
+    s->stats.samples++;
+    fit_clock(s);
+    if (s->sample_count == SYNC_MIN_SAMPLES) {
+        s->stats.synced = true;
+        beacon_reset(s, local_us, rand); // we just became useful downstream
+    }
+}
+
+
+static now_sync_neighbour_t *neighbour_find(now_sync_t *s, const uint8_t mac[6]) {
+    for (int i = 0; i < SYNC_NEIGHBOURS; i++) {
+        if (s->neighbours[i].used && memcmp(s->neighbours[i].mac, mac, 6) == 0) return &s->neighbours[i];
+    }
+    return NULL;
+}
+
+
+// Neighbours we pair beacons from. Once full we stick with the ones we
+// have (closest to the root first) so entries live long enough to be paired.
+static now_sync_neighbour_t *neighbour_get(now_sync_t *s, const uint8_t mac[6], uint8_t hops, int64_t now_us) {
+    now_sync_neighbour_t *victim = neighbour_find(s, mac);
+    if (victim) return victim;
+
+    bool victim_stale = false;
+    for (int i = 0; i < SYNC_NEIGHBOURS; i++) {
+        now_sync_neighbour_t *n = &s->neighbours[i];
+
+        bool stale = !n->used || now_us - n->rx_us > (int64_t)SYNC_NEIGHBOUR_TIMEOUT_MS * 1000;
+        if (stale) {
+            if (!victim_stale) victim = n;
+            victim_stale = true;
+        } else if (!victim_stale && n->hops > hops && (!victim || n->hops > victim->hops)) {
+            victim = n;
+        }
+    }
+    if (!victim) return NULL;
+    memset(victim, 0, sizeof(*victim));
+    memcpy(victim->mac, mac, 6);
+    return victim;
+}
+
+
+void now_sync_rx_beacon(now_sync_t *s, const uint8_t src_addr[6], const time_sync_packet_t *pkt, int64_t rx_us, uint32_t rand) {
+    s->stats.beacons_heard++;
+
+    int cmp = memcmp(pkt->root, s->root, 6);
+    if (cmp > 0) {
+        beacon_reset(s, rx_us, rand); // they follow a worse root, tell them about ours
+        return;
+    }
+    if (cmp < 0) {
+        // Lower root wins; the old regression is against the wrong clock
+        memcpy(s->root, pkt->root, 6);
+        s->hops = pkt->hops < SYNC_MAX_HOPS ? pkt->hops + 1 : SYNC_MAX_HOPS;
+        s->stats.hops = s->hops;
+        s->root_seq = pkt->root_seq - 1; // so it counts as news below
+        s->clock.skew = 0;
+        memset(s->neighbours, 0, sizeof(s->neighbours));
+        s->has_parent = false;
+        reset_samples(s);
+        beacon_reset(s, rx_us, rand);
+    }
+    if ((pkt->flags & SYNC_FLAG_SETTLING) && pkt->hops == s->hops + 1) {
+        beacon_reset(s, rx_us, rand); // a badge one hop down is still filling its fit from us or our peers
+    }
+    if (is_root(s)) return;
+
+    // Only the root moves root_seq on, so a newer one is news that came down some chain
+    // from it; badges cut off from the root can only repeat what they last heard and
+    // can't keep each other going
+    int8_t news = (int8_t)(pkt->root_seq - s->root_seq);
+    if (news > 0) {
+        s->root_seq = pkt->root_seq;
+        s->root_heard_us = rx_us;
+    }
+
+    now_sync_neighbour_t *n = neighbour_get(s, src_addr, pkt->hops, rx_us);
+    if (!n) return;
+    bool paired = (pkt->flags & SYNC_FLAG_PREV_VALID) && n->used && n->seq == pkt->prev_seq;
+    n->streak = paired ? (n->streak < 255 ? n->streak + 1 : 255) : 0;
+    if (!n->used || (int8_t)(pkt->root_seq - n->root_seq) > 0) n->news_us = rx_us;
+    n->used = true;
+    n->hops = pkt->hops;
+    n->seq = pkt->seq;
+    n->root_seq = pkt->root_seq;
+    int64_t prev_rx_us = n->rx_us;
+    n->rx_us = rx_us;
+
+    // A parent that stops passing on news has lost the root as much as one gone quiet
+    bool is_parent = s->has_parent && memcmp(s->parent, src_addr, 6) == 0;
+    if (is_parent) s->parent_heard_us = n->news_us;
+    if (!paired || pkt->hops >= SYNC_MAX_HOPS) return;
+
+    // Samples come from one parent at a time so the fit stays consistent. Move to a
+    // closer one once it has proven a solid link, or once ours is lost, to anyone
+    // usable that brings news we hadn't heard yet: a badge downstream of us can't,
+    // so a lost root leaves no loop behind to count hop counts up. Hop counts follow
+    // the parent so a badge at the edge of the root's range doesn't keep waiting on it.
+    bool parent_lost = !s->has_parent || rx_us - s->parent_heard_us > (int64_t)SYNC_NEIGHBOUR_TIMEOUT_MS * 1000;
+    bool closer = pkt->hops + 1 < s->hops && n->streak >= SYNC_PARENT_STREAK && news >= 0;
+    if (!is_parent && ((parent_lost && (news > 0 || !s->has_parent)) || closer)) {
+        memcpy(s->parent, src_addr, 6);
+        s->has_parent = true;
+        s->stats.parent_changes++;
+        is_parent = true;
+    }
+    if (!is_parent) return;
+
+    s->hops = pkt->hops + 1;
+    s->stats.hops = s->hops;
+    s->parent_heard_us = n->news_us;
+    add_sample(s, prev_rx_us, pkt->prev_tx_us, rand);
+}
+
+
+void now_sync_build_beacon(now_sync_t *s, time_sync_packet_t *out, int64_t now_us, uint32_t rand) {
+    if (!is_root(s) && now_us - s->root_heard_us > (int64_t)SYNC_ROOT_TIMEOUT_MS * 1000) {
+        // Keep the current estimate as our clock so the time carries on without a jump
+        memcpy(s->root, s->own_mac, 6);
+        s->hops = 0;
+        s->stats.hops = 0;
+        s->has_parent = false;
+        reset_samples(s);
+        s->root_seq = 0;
+        s->beacon_interval_ms = SYNC_BEACON_MIN_MS;
+    }
+
+    out->type = TIME_SYNC_MSG;
+    out->seq = ++s->seq;
+    out->prev_seq = s->prev_seq;
+    out->flags = s->prev_valid ? SYNC_FLAG_PREV_VALID : 0;
+    if (!is_root(s) && s->sample_count < SYNC_SAMPLES / 2) out->flags |= SYNC_FLAG_SETTLING;
+    if (is_root(s)) s->root_seq++;
+    out->hops = s->hops;
+    out->root_seq = s->root_seq;
+    memcpy(out->root, s->root, 6);
+    out->prev_tx_us = s->prev_tx_us;
+
+    s->next_beacon_us = now_us + beacon_delay_us(s->beacon_interval_ms, rand);
+    if (s->beacon_interval_ms < SYNC_BEACON_PERIOD_MS) {
+        s->beacon_interval_ms = s->beacon_interval_ms * 2 < SYNC_BEACON_PERIOD_MS ? s->beacon_interval_ms * 2 : SYNC_BEACON_PERIOD_MS;
+    }
+}
+
+
+void now_sync_beacon_sent(now_sync_t *s, uint8_t seq, int64_t done_us) {
+    // Until we've fit the root's clock our time is worthless to others; they only use our beacons for hop counts
+    s->prev_valid = is_root(s) || s->sample_count >= SYNC_MIN_SAMPLES;
+    s->prev_seq = seq;
+    s->prev_tx_us = now_sync_network_time_us(&s->clock, done_us);
+    s->stats.beacons_sent++;
+}
@@ -0,0 +1,122 @@
+#ifndef NOW_SYNC_H
+#define NOW_SYNC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Mesh-wide network time, FTSP style. The badge with the lowest MAC is the root
+// and its clock is the network time; everyone else fits offset and skew to it by
+// linear regression over the last few beacons from badges closer to the root, and
+// beacons their own estimate so the time spreads hop by hop.
+//
+// Beacons are two-step: the send time of a frame is only known once it left the
+// radio, so each beacon carries the network time its predecessor went out at and
+// receivers pair that with the local time they heard the predecessor.
+
+// Beacon interval starts short whenever something changes (new root, newly synced,
+// a neighbour following a worse root or still settling) and doubles up to the
+// period, like Trickle.
+// Steady state is one beacon per period; a beacon is ~690 us on air, so ~0.014% duty.
+#ifndef SYNC_BEACON_PERIOD_MS
+#define SYNC_BEACON_PERIOD_MS 5000
+#endif
+#define SYNC_BEACON_MIN_MS 1000
+#define SYNC_BEACON_JITTER_PCT 20   // +/- spread so neighbours don't beacon in lockstep
+#define SYNC_ROOT_TIMEOUT_MS (6 * SYNC_BEACON_PERIOD_MS) // root lost, take over
+#define SYNC_SAMPLES 8              // regression window
+#define SYNC_MIN_SAMPLES 2          // samples before we pass our time on
+#define SYNC_NEIGHBOURS 8           // senders whose last beacon we remember, closest to the root first
+#define SYNC_NEIGHBOUR_TIMEOUT_MS (3 * SYNC_BEACON_PERIOD_MS)
+#define SYNC_PARENT_STREAK 3        // paired beacons in a row before we switch to a closer parent
+#define SYNC_MAX_HOPS 16
+#define SYNC_RESET_US 50000         // residual this large means the reference jumped, start over
+
+typedef struct {
+    uint8_t type;        // TIME_SYNC_MSG
+    uint8_t seq;         // our beacon counter
+    uint8_t prev_seq;    // beacon that left us at prev_tx_us
+    uint8_t flags;       // SYNC_FLAG_*
+    uint8_t hops;        // distance from the root, 0 = root
+    uint8_t root_seq;    // newest root beacon the sender has heard of; the root counts it up
+    uint8_t root[6];     // badge whose clock the network follows
+    int64_t prev_tx_us;  // network time beacon prev_seq finished sending
+} __attribute__((packed)) time_sync_packet_t;
+
+#define SYNC_FLAG_PREV_VALID 0x01
+#define SYNC_FLAG_SETTLING 0x02     // sender's fit isn't full yet, upstream beacons fast to help
+
+// Maps local time to network time; small enough to copy between tasks
+typedef struct {
+    int64_t local_ref;
+    int64_t offset_us;   // network - local at local_ref
+    double skew;         // d(network - local) / d(local)
+} now_sync_clock_t;
+
+typedef struct {
+    int64_t local_us;
+    int64_t offset_us;
+} now_sync_sample_t;
+
+typedef struct {
+    uint8_t mac[6];
+    uint8_t seq;
+    uint8_t hops;
+    uint8_t streak;      // beacons in a row we could pair
+    uint8_t root_seq;
+    bool used;
+    int64_t rx_us;       // local time we heard beacon seq
+    int64_t news_us;     // local time its root_seq last moved on
+} now_sync_neighbour_t;
+
+typedef struct {
+    uint32_t beacons_sent;
+    uint32_t beacons_heard;
+    uint32_t samples;        // beacons that produced an offset sample
+    uint32_t resets;         // regression restarts (root change or time jump)
+    uint32_t parent_changes;
+    uint32_t error_last_us;  // |predicted - reported| network time on the last sample
+    uint32_t error_avg_us;   // smoothed error_last_us; both 0 while unsynced
+    uint8_t hops;            // 0 while we are the root
+    bool synced;             // root, or enough samples since the last reset to pass our time on
+} now_sync_stats_t;
+
+typedef struct {
+    uint8_t own_mac[6];
+    uint8_t root[6];
+    uint8_t hops;
+    uint8_t root_seq;        // newest root beacon we've heard of
+    int64_t root_heard_us;   // local time root_seq last moved on
+    uint8_t parent[6];       // badge our samples come from
+    bool has_parent;
+    int64_t parent_heard_us; // local time the parent last passed on news of the root
+
+    now_sync_clock_t clock;
+    now_sync_sample_t samples[SYNC_SAMPLES];
+    uint8_t sample_count;
+    uint8_t sample_idx;
+
+    now_sync_neighbour_t neighbours[SYNC_NEIGHBOURS];
+
+    uint8_t seq;
+    bool prev_valid;
+    uint8_t prev_seq;
+    int64_t prev_tx_us;      // network time, see time_sync_packet_t
+
+    int64_t next_beacon_us;
+    uint16_t beacon_interval_ms;
+    now_sync_stats_t stats;
+} now_sync_t;
+
+void now_sync_init(now_sync_t *s, const uint8_t mac[6], int64_t now_us, uint32_t rand);
+
+static inline int64_t now_sync_network_time_us(const now_sync_clock_t *c, int64_t local_us) {
+    return local_us + c->offset_us + (int64_t)(c->skew * (double)(local_us - c->local_ref));
+}
+
+// Fills the next beacon; call when now >= next_beacon_us
+void now_sync_build_beacon(now_sync_t *s, time_sync_packet_t *out, int64_t now_us, uint32_t rand);
+// The frame carrying beacon seq left the radio at local time done_us
+void now_sync_beacon_sent(now_sync_t *s, uint8_t seq, int64_t done_us);
+void now_sync_rx_beacon(now_sync_t *s, const uint8_t src_addr[6], const time_sync_packet_t *pkt, int64_t rx_us, uint32_t rand);
+
+#endif // NOW_SYNC_H
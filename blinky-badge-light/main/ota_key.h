@@ -0,0 +1,12 @@
+#ifndef OTA_KEY_H
+#define OTA_KEY_H
+
+#include <stdint.h>
+
+// Public half of the release key, uncompressed P-256 point. Badges only fetch images
+// whose advert is signed with the private half (see now_ota.h). Replace the whole file
+// with the output of `sim/ota-sign -g release.pem`, and keep release.pem off the repo.
+// All zeros is no key: every advert fails its check and badges never update.
+static const uint8_t ota_release_key[65] = { 0 };
+
+#endif // OTA_KEY_H
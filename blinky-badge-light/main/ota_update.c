@@ -0,0 +1,295 @@
+#include <string.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_image_format.h"
+#include "esp_random.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "mbedtls/sha256.h"
+#include "mbedtls/ecdsa.h"
+#include "nvs.h"
+
+#include "ota_update.h"
+#include "ota_key.h"
+#include "now.h"
+#include "now_hal.h"
+
+static const char *TAG = "OTA";
+
+#define OTA_RESTART_DELAY_MS 500    // lets the radio task finish the frame in flight
+#define OTA_WRITER_PRIORITY 2       // under the radio and lighting, flash can wait for them
+
+// Pages of a download already in the update partition, so it survives a power cycle
+typedef struct {
+    now_ota_image_t image;
+    uint16_t pages_done;
+} ota_progress_t;
+
+// A page for the flash writer, the whole image to check, or an advert's signature;
+// data is the protocol's page buffer, which it leaves alone until we report back
+typedef struct {
+    now_ota_image_t image;
+    uint16_t page;
+    const uint8_t *data;
+    int len;
+    bool finish;
+    bool verify;
+} ota_job_t;
+
+static const esp_partition_t *running_part = NULL;
+static const esp_partition_t *update_part = NULL;
+static esp_timer_handle_t restart_timer = NULL;
+static uint32_t spare_len;          // bytes of the image in update_part, 0 when there's none
+static volatile bool downloading = false;
+static QueueHandle_t job_queue = NULL;
+// Set by the writer for the radio task, like tx_done in now.c; a signature check can be
+// out next to a page, so it reports on its own
+static volatile bool job_done = false;
+static volatile bool job_ok = false;
+static volatile bool check_done = false;
+static volatile bool check_ok = false;
+
+
+static bool partition_sha256(const esp_partition_t *part, uint32_t size, uint8_t sha[32]) {
+    static uint8_t block[1024];
+    mbedtls_sha256_context ctx;
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts(&ctx, 0);
+    bool ok = true;
+    for (uint32_t off = 0; off < size && ok; off += sizeof(block)) {
+        uint32_t len = size - off < sizeof(block) ? size - off : sizeof(block);
+        ok = esp_partition_read(part, off, block, len) == ESP_OK;
+        if (ok) mbedtls_sha256_update(&ctx, block, len);
+    }
+    mbedtls_sha256_finish(&ctx, sha);
+    mbedtls_sha256_free(&ctx);
+    return ok;
+}
+
+
+// image->sig against the release key in ota_key.h
+static bool signature_ok(const now_ota_image_t *image) {
+    uint8_t hash[32];
+    mbedtls_sha256((const uint8_t *)image, OTA_SIGNED_LEN, hash, 0);
+
+    mbedtls_ecp_group grp;
+    mbedtls_ecp_point key;
+    mbedtls_mpi r, s;
+    mbedtls_ecp_group_init(&grp);
+    mbedtls_ecp_point_init(&key);
+    mbedtls_mpi_init(&r);
+    mbedtls_mpi_init(&s);
+    int err = mbedtls_ecp_group_load(&grp, MBEDTLS_ECP_DP_SECP256R1);
+    if (!err) err = mbedtls_ecp_point_read_binary(&grp, &key, ota_release_key, sizeof(ota_release_key));
+    if (!err) err = mbedtls_mpi_read_binary(&r, image->sig, OTA_SIG_LEN / 2);
+    if (!err) err = mbedtls_mpi_read_binary(&s, image->sig + OTA_SIG_LEN / 2, OTA_SIG_LEN / 2);
+    if (!err) err = mbedtls_ecdsa_verify(&grp, hash, sizeof(hash), &key, &r, &s);
+    mbedtls_mpi_free(&s);
+    mbedtls_mpi_free(&r);
+    mbedtls_ecp_point_free(&key);
+    mbedtls_ecp_group_free(&grp);
+    return err == 0;
+}
+
+
+static void save_progress(const ota_progress_t *progress) {
+    nvs_handle_t nvs_handle;
+    if (nvs_open("ota", NVS_READWRITE, &nvs_handle) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to open NVS, OTA progress not saved");
+        return;
+    }
+    if (progress) {
+        nvs_set_blob(nvs_handle, "progress", progress, sizeof(*progress));
+    } else {
+        nvs_erase_key(nvs_handle, "progress");
+    }
+    nvs_commit(nvs_handle);
+    nvs_close(nvs_handle);
+}
+
+
+static void restart_cb(void *arg) {
+    esp_restart();
+}
+
+
+static bool write_page(const ota_job_t *job) {
+    const now_ota_image_t *image = &job->image;
+    uint32_t offset = (uint32_t)job->page * OTA_PAGE_LEN;
+    if (!update_part || image->size + sizeof(now_ota_trailer_t) > update_part->size) {
+        ESP_LOGW(TAG, "Firmware version %d doesn't fit the update partition", image->version);
+        return false;
+    }
+    esp_err_t err = esp_partition_erase_range(update_part, offset, OTA_PAGE_LEN);
+    if (err == ESP_OK) err = esp_partition_write(update_part, offset, job->data, job->len);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to write OTA page %d: %s", job->page, esp_err_to_name(err));
+        return false;
+    }
+    ota_progress_t progress = { .image = *image, .pages_done = job->page + 1 };
+    save_progress(&progress);
+    if (job->page % 32 == 0) {
+        ESP_LOGI(TAG, "Firmware version %d: page %d of %d", image->version, job->page + 1, now_ota_pages(image));
+    }
+    return true;
+}
+
+
+static bool finish_image(const now_ota_image_t *image) {
+    save_progress(NULL);
+
+    uint8_t sha[32];
+    if (!partition_sha256(update_part, image->size, sha) || memcmp(sha, image->sha, sizeof(sha)) != 0) {
+        ESP_LOGE(TAG, "Firmware version %d failed the SHA-256 check", image->version);
+        return false;
+    }
+    // The signed advert goes behind the image, so we can serve it once we run it.
+    // The last page only erased up to its end
+    now_ota_trailer_t trailer = { .magic = OTA_TRAILER_MAGIC, .image = *image };
+    uint32_t erased = (uint32_t)now_ota_pages(image) * OTA_PAGE_LEN;
+    esp_err_t err = ESP_OK;
+    if (image->size + sizeof(trailer) > erased) err = esp_partition_erase_range(update_part, erased, OTA_PAGE_LEN);
+    if (err == ESP_OK) err = esp_partition_write(update_part, image->size, &trailer, sizeof(trailer));
+    // Also checks the image's own header, checksum and hash
+    if (err == ESP_OK) err = esp_ota_set_boot_partition(update_part);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Firmware version %d rejected: %s", image->version, esp_err_to_name(err));
+        return false;
+    }
+    ESP_LOGI(TAG, "Firmware version %d verified, restarting into it", image->version);
+    esp_timer_start_once(restart_timer, OTA_RESTART_DELAY_MS * 1000);
+    return true;
+}
+
+
+// Slow work for the radio task: a sector erase and the NVS commit take tens of
+// milliseconds each, a P-256 signature check about as long, the image check longer,
+// and the radio shouldn't stop for any of them
+static void writer_task(void *param) {
+    ota_job_t job;
+    while (1) {
+        xQueueReceive(job_queue, &job, portMAX_DELAY);
+        if (job.verify) {
+            check_ok = signature_ok(&job.image);
+            check_done = true;
+        } else {
+            job_ok = job.finish ? finish_image(&job.image) : write_page(&job);
+            job_done = true;
+        }
+        now_wake();
+    }
+}
+
+
+// Describe the image we run so others can fetch it, and pick up a download cut short by a reboot
+void ota_update_init(now_proto_t *np) {
+    running_part = esp_ota_get_running_partition();
+    update_part = esp_ota_get_next_update_partition(NULL);
+
+    // We only hand on an image with the signed advert behind it, and only if that describes us
+    now_ota_image_t own = { .version = BADGE_FW_VERSION };
+    esp_partition_pos_t pos = { .offset = running_part->address, .size = running_part->size };
+    esp_image_metadata_t meta;
+    now_ota_trailer_t trailer;
+    bool have_meta = esp_image_get_metadata(&pos, &meta) == ESP_OK;
+    bool can_serve = update_part != NULL && have_meta &&
+                     esp_partition_read(running_part, meta.image_len, &trailer, sizeof(trailer)) == ESP_OK &&
+                     trailer.magic == OTA_TRAILER_MAGIC &&
+                     trailer.image.version == own.version && trailer.image.size == meta.image_len &&
+                     partition_sha256(running_part, meta.image_len, own.sha) &&
+                     memcmp(trailer.image.sha, own.sha, sizeof(own.sha)) == 0 &&
+                     signature_ok(&trailer.image);
+    if (can_serve) own = trailer.image;
+    else if (update_part) ESP_LOGW(TAG, "No signed advert behind this image, not serving it");
+    now_ota_init(&np->ota, &own, can_serve, esp_timer_get_time(), esp_random());
+    ESP_LOGI(TAG, "Running firmware version %d, %" PRIu32 " bytes from %s", own.version, own.size, running_part->label);
+
+    // After an update the other partition holds the image we came from, which the
+    // bootloader rolls back to; scratch use has to stay clear of it and its advert
+    if (update_part) {
+        pos = (esp_partition_pos_t){ .offset = update_part->address, .size = update_part->size };
+        if (esp_image_get_metadata(&pos, &meta) == ESP_OK) spare_len = meta.image_len + sizeof(trailer);
+    }
+
+    nvs_handle_t nvs_handle;
+    ota_progress_t progress;
+    size_t size = sizeof(progress);
+    if (nvs_open("ota", NVS_READONLY, &nvs_handle) == ESP_OK) {
+        if (nvs_get_blob(nvs_handle, "progress", &progress, &size) == ESP_OK && progress.image.version > own.version) {
+            ESP_LOGI(TAG, "Resuming download of version %d at page %d", progress.image.version, progress.pages_done);
+            now_ota_resume(&np->ota, &progress.image, progress.pages_done);
+            downloading = true;
+        }
+        nvs_close(nvs_handle);
+    }
+
+    const esp_timer_create_args_t timer_args = { .callback = restart_cb, .name = "ota_restart" };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &restart_timer));
+    job_queue = xQueueCreate(2, sizeof(ota_job_t));     // a page or the image, and a signature
+    xTaskCreatePinnedToCore(writer_task, "OTA Writer", 4096, NULL, OTA_WRITER_PRIORITY, NULL, 0);
+}
+
+
+bool ota_update_take_result(bool *check, bool *ok) {
+    *check = check_done;
+    if (check_done) {
+        *ok = check_ok;
+        check_done = false;
+        return true;
+    }
+    if (!job_done) return false;
+    *ok = job_ok;
+    job_done = false;
+    return true;
+}
+
+
+// Once the new image has booted far enough to get here, keep it
+void ota_update_mark_valid(void) {
+    esp_ota_img_states_t state;
+    if (esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) == ESP_OK && state == ESP_OTA_IMG_PENDING_VERIFY) {
+        ESP_LOGI(TAG, "New firmware started, cancelling rollback");
+        esp_ota_mark_app_valid_cancel_rollback();
+    }
+}
+
+
+const esp_partition_t *ota_update_scratch(uint32_t len, uint32_t *offset) {
+    if (!update_part || downloading || len > update_part->size) return NULL;
+    // Whole sectors, so erasing the scratch leaves the rest alone
+    uint32_t start = (update_part->size - len) / update_part->erase_size * update_part->erase_size;
+    if (start < spare_len) return NULL;
+    *offset = start;
+    return update_part;
+}
+
+
+// ---- now_hal.h ----
+
+bool now_hal_ota_read(now_proto_t *np, uint32_t offset, uint8_t *buf, int len) {
+    return esp_partition_read(running_part, offset, buf, len) == ESP_OK;
+}
+
+
+bool now_hal_ota_verify(now_proto_t *np, const now_ota_image_t *image) {
+    ota_job_t job = { .image = *image, .verify = true };
+    return job_queue && xQueueSend(job_queue, &job, 0) == pdPASS;
+}
+
+
+bool now_hal_ota_write(now_proto_t *np, const now_ota_image_t *image, uint16_t page, const uint8_t *data, int len) {
+    ota_job_t job = { .image = *image, .page = page, .data = data, .len = len };
+    downloading = true;
+    return job_queue && xQueueSend(job_queue, &job, 0) == pdPASS;
+}
+
+
+bool now_hal_ota_finish(now_proto_t *np, const now_ota_image_t *image) {
+    ota_job_t job = { .image = *image, .finish = true };
+    return job_queue && xQueueSend(job_queue, &job, 0) == pdPASS;
+}
@@ -0,0 +1,22 @@
+#ifndef OTA_UPDATE_H
+#define OTA_UPDATE_H
+
+#include "esp_partition.h"
+#include "now_proto.h"
+
+// Flash side of firmware distribution over ESP-NOW (protocol in now_ota.c).
+// Images go to the other OTA partition, written by a task of its own, and we boot into
+// them once verified.
+
+void ota_update_init(now_proto_t *np);
+// For the radio task: true once the writer finished what now_hal_ota_write(),
+// now_hal_ota_finish() or, with *check set, now_hal_ota_verify() handed it, with how it
+// went in *ok; call until false
+bool ota_update_take_result(bool *check, bool *ok);
+void ota_update_mark_valid(void);
+// Scratch room of len bytes at the end of the update partition, past the image already
+// in it (the one a rollback would boot); sets *offset. NULL if there is no such room,
+// or a download has used the partition since boot
+const esp_partition_t *ota_update_scratch(uint32_t len, uint32_t *offset);
+
+#endif // OTA_UPDATE_H
@@ -4,8 +4,7 @@
 #include <driver/gpio.h>
 
 // LED pins
-#define LED_PIN GPIO_NUM_2 // GPIO pin for LED data
-#define LED_COUNT 24 // Number of LEDs
+#define LED_PIN GPIO_NUM_2 // GPIO pin for LED data, LED_COUNT is in led_layout.h with the heart's layout
 
 // Battery monitoring pins
 #define ADC_CHANNEL ADC_CHANNEL_8   // GPIO9 on ADC1
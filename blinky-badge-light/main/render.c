@@ -0,0 +1,275 @@
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "render.h"
+#include "led_control.h"
+#include "led_utils.h"
+#include "led_geometry.h"
+#include "battery_policy.h"
+#include "battery_level_pattern.h"
+#include "firework_notification_pattern.h"
+#include "vu_meter.h"
+#include "storage.h"
+#include "trace.h"
+
+static int current_pattern = 0; // Active pattern ID
+uint8_t brightness = MAX_BRIGHTNESS;
+uint8_t effective_brightness = MAX_BRIGHTNESS;
+static const uint8_t brightness_levels[] = { //gamma corrected brightness levels for better perceived change between levels
+    20,    
+    35,   
+    69,   
+    121, 
+    200  
+};
+
+
+static int brightness_index = 0; // Index for the current brightness level
+volatile bool flash_active = false;
+int64_t flash_end_time = 0;
+
+static uint8_t frame_flags;             // RENDER_* of the frame being rendered
+static int64_t frame_us, frame_net_us;  // latched at its start
+static int frame_leds = LED_COUNT;      // see render_set_frame_leds()
+static bool frame_full;                 // the frame being rendered has all frame_leds, not just the heart's
+
+// Set the active pattern
+void set_pattern(int pattern_id) {
+    trace_event(TRACE_SET_PATTERN, (uint16_t)pattern_id);
+    current_pattern = pattern_id % NUM_PATTERNS;
+}
+
+// Set LED brightness
+void set_brightness(int index) {
+    trace_event(TRACE_SET_BRIGHTNESS, (uint16_t)index);
+    brightness_index = index % (sizeof(brightness_levels) / sizeof(brightness_levels[0]));
+    brightness = brightness_levels[brightness_index];
+}
+
+
+int render_brightness_index(void) {
+    return brightness_index;
+}
+
+
+int64_t render_frame_time_us(void) {
+    return frame_us;
+}
+
+
+int64_t render_frame_network_time_us(void) {
+    return frame_net_us;
+}
+
+
+void render_set_frame_leds(int leds) {
+    frame_leds = leds > LED_COUNT ? leds : LED_COUNT;
+}
+
+
+float render_sound_level(void) {
+    return render_hal_sound_level((uint32_t)frame_net_us);
+}
+
+
+// Where the hue animation has got to at step loop, in LEDs; the same for the whole frame
+static float hue_offset(const genome *g, int loop) {
+    int dir = (g->hue_dir == 0) ? 1 : -1;
+    float frac_offset = fmodf(((float)(dir * loop * g->hue_rate) / 256.0f) * LED_COUNT, LED_COUNT);
+    if (frac_offset < 0) frac_offset += LED_COUNT;
+    return frac_offset;
+}
+
+
+// Where LED i is along the pattern, 1 at LED_COUNT - 1; on the heart spaced as the LEDs
+// are on the board, extension LEDs past it a step each
+static float pattern_pos(int i) {
+#if LED_GEOMETRY_FROM_BOARD
+    if (i < LED_COUNT) return led_geometry[i].arc * (float)LED_COUNT / 256.0f / (float)(LED_COUNT - 1);
+#endif
+    return (float)i / (float)(LED_COUNT - 1);
+}
+
+
+static uint8_t pattern_hue(const genome *g, int led_index, int loop, float frac_offset) {
+    uint8_t hue;
+    if ((g->hue_base == 0) && (g->hue_bound == 255)) {
+        // Full rainbow
+        int dir = (g->hue_dir == 0) ? 1 : -1;
+        uint32_t base_hue = (255 * led_index) / LED_COUNT;
+        int32_t animated_hue = base_hue + dir * (loop * g->hue_rate);
+        hue = (uint8_t)(((animated_hue % 256) + 256) % 256);
+    } else {
+        // Limited hue range, triangle wave
+        float shifted = (led_index + frac_offset);
+        int idx0 = ((int)shifted) % LED_COUNT;
+        int idx1 = (idx0 + 1) % LED_COUNT;
+        float frac = shifted - (int)shifted;
+        uint8_t base_hue = (uint8_t)((1.0f - frac) * led_hue_ramp[idx0] + frac * led_hue_ramp[idx1]);
+        hue = map_16(base_hue, 0, 255, g->hue_base, g->hue_bound);
+    }
+    return hue;
+}
+
+
+uint8_t calculate_pattern_hue(const genome *g, int led_index, int loop) {
+    return pattern_hue(g, led_index, loop, hue_offset(g, loop));
+}
+
+
+void render_pattern(int index, uint8_t *framebuffer, int loop) {
+    render_genome(index, &patterns[index], MAX_BRIGHTNESS, framebuffer, loop);
+}
+
+
+void render_genome(int index, const genome *g, uint8_t max_level, uint8_t *framebuffer, int loop) {
+    if (index >= NUM_PATTERNS - 2) frame_flags |= RENDER_SOUND;
+    // Limit brightness if battery is low but not critical
+    if (limit_brightness) {
+        effective_brightness = brightness_levels[0];
+    } else {
+        effective_brightness = (brightness < max_level) ? brightness : max_level;
+    }
+
+    // notification from esp-now pattern
+    if (show_firework_notification) {
+        int elapsed = (frame_us / 1000) - firework_notification_start_time;
+        if (elapsed >= FIREWORK_NOTIFICATION_TOTAL_MS) {
+            show_firework_notification = false;
+        } else {
+            render_firework_notification_pattern(framebuffer, elapsed, g, loop);
+            return;
+        }
+    }
+
+    // Show battery meter patern if enabled and timer didn't run out, otherwise, turn it off
+    if (show_battery_meter) {
+        int elapsed = (frame_us / 1000) - battery_meter_start_time;
+        if (elapsed >= BATTERY_TOTAL_MS) {
+            show_battery_meter = false;
+        }
+        else {
+            render_battery_level_pattern(framebuffer, elapsed);
+            return;
+        }
+    }
+
+    // VU meter pattern shortcut
+    if (index == NUM_PATTERNS - 1) {
+        render_vu_meter_pattern(framebuffer, g, loop);
+        return;
+    }
+
+    // Main pattern loop
+    int tau = map_16(g->cd_rate, 0, 255, 700, 8000); // ms
+    int64_t curtime = frame_net_us / 1000; // ms, shared across badges so equal genomes stay in phase
+    float twopi = 2.0f * (float)M_PI;
+    float anim = twopi * ((float)(curtime % tau) / tau);
+    float sound_level = (index == NUM_PATTERNS - 2) ? render_sound_level() : 0.0f;
+    float frac_offset = hue_offset(g, loop);
+
+    // Past the heart the hue and the sinusoid just keep going
+    for (int i = 0; i < frame_leds; i++) {
+        // ---- HUE calculation ----
+        uint8_t hue = pattern_hue(g, i, loop, frac_offset);
+
+        // ---- VALUE (brightness sinusoid) ----
+        float t = pattern_pos(i);
+        float phase = twopi * g->cd_period * t;
+        float spacetime = (g->cd_dir > 128) ? (phase + anim) : (phase - anim);
+        float base_val = 127.0f * (1.0f + cosf(spacetime)); // 0..254
+        uint8_t val = (uint8_t)base_val;
+
+        // ---- NONLINEARITY/GAMMA ----
+        if (g->nonlin > 127)
+            val = (uint8_t)(((uint16_t)val * (uint16_t)val) >> 8);
+
+        // ---- APPLY EFFECTIVE BRIGHTNESS ----
+        // Sound-reactive pattern brightness + effective_brightness for basic sound reactive pattern
+        if (index == NUM_PATTERNS - 2) {
+            // Scale brightness by the sound level (ours blended with nearby badges) and effective_brightness
+            val = (uint8_t)(sound_level * effective_brightness * (val / 255.0f));
+        } else {
+            val = (uint8_t)((val * effective_brightness) / 255);
+        }
+        
+        // ---- HSV to RGB ----
+        uint8_t r, gr, b;
+        hsv_to_rgb(hue, g->sat, val, &r, &gr, &b);
+
+        // ---- Write to framebuffer ----
+        set_pixel(framebuffer, i, r, gr, b);
+    }
+    frame_full = true;
+}
+
+
+void flash_feedback_pattern() {
+    flash_active = true;
+    flash_end_time = render_hal_time_us() / 1000 + 125; // 125ms from now
+}
+
+
+void safety_pattern(uint8_t *framebuffer) {
+    uint8_t dim_red = brightness_levels[0] * 0.2f;
+    uint8_t full_red = brightness_levels[0];
+
+    int64_t ms = frame_us / 1000;
+    int slowdown_factor = 150; // Adjust for speed
+    int shifted = (ms / slowdown_factor);
+
+    for (int i = 0; i < LED_COUNT; i++) {
+        int pattern_index = (i + shifted) % 4;
+        switch (pattern_index) {
+            case 0: // Off
+                set_pixel(framebuffer, i, 0, 0, 0);
+                break;
+            case 1: // Dim
+            case 3: // Dim
+                set_pixel(framebuffer, i, dim_red, 0, 0);
+                break;
+            case 2: // Bright
+                set_pixel(framebuffer, i, full_red, 0, 0);
+                break;
+        }
+    }
+}
+
+// Repeats the heart along the extensions
+static void fill_frame(uint8_t *framebuffer) {
+    for (int i = LED_COUNT; i < frame_leds; i++) memcpy(&framebuffer[i * 3], &framebuffer[(i % LED_COUNT) * 3], 3);
+}
+
+
+uint8_t render_frame(uint8_t *framebuffer, int loop) {
+    frame_us = render_hal_time_us();
+    frame_net_us = render_hal_network_time_us();
+    frame_full = false;
+
+    if (flash_active) {
+        // Don't make flash too bright, 50 is the max
+        uint8_t flash_brightness = (effective_brightness < 50) ? effective_brightness : 50;
+        for (int i = 0; i < LED_COUNT; i++) {
+            set_pixel(framebuffer, i, flash_brightness, flash_brightness, flash_brightness);
+        }
+        fill_frame(framebuffer);
+        // Check if flash duration has passed
+        if (frame_us / 1000 >= flash_end_time) {
+            flash_active = false;
+        }
+        return RENDER_FLASH;
+    }
+
+    frame_flags = 0;
+    if (force_safety_pattern) {
+        safety_pattern(framebuffer);
+        frame_flags |= RENDER_SAFETY;
+    } else if (render_hal_show(framebuffer, loop)) {
+        frame_flags |= RENDER_SHOW;
+    } else {
+        render_pattern(settings.pattern_id, framebuffer, loop);
+    }
+    if (!frame_full) fill_frame(framebuffer);
+    return frame_flags;
+}
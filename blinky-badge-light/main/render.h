@@ -0,0 +1,43 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Composing a frame: the touch flash, the safety pattern, show mode, and otherwise the
+// selected pattern with its overlays. Time and sound are latched once at the start of
+// the frame and everything in it reads them from here.
+// No ESP-IDF dependencies: the badge implements the hooks below in led_control.c,
+// sim/replay implements them to run captured frames on the host.
+
+// ---- Hooks ----
+
+int64_t render_hal_time_us(void);                   // esp_timer time
+int64_t render_hal_network_time_us(void);           // mesh time, see now_network_time_us()
+float render_hal_sound_level(uint32_t now_us);      // get_render_sound_level()
+bool render_hal_show(uint8_t *framebuffer, int loop); // show_mode_render()
+
+// ---- Frames ----
+
+// What went into a frame
+#define RENDER_SOUND 0x01           // a sound-reactive pattern
+#define RENDER_FLASH 0x02           // the touch feedback flash
+#define RENDER_SAFETY 0x04          // the low battery safety pattern
+#define RENDER_SHOW 0x08            // a show mode frame
+
+// Renders the frame at animation step loop, returns its RENDER_* flags
+uint8_t render_frame(uint8_t *framebuffer, int loop);
+// LEDs in a frame, LED_COUNT unless extension strips carry the pattern on past the
+// heart (led_outputs.h); framebuffers hold this many. Patterns are rendered along all
+// of them, everything else is drawn on the heart and repeated along the rest
+void render_set_frame_leds(int leds);
+// Times the frame being rendered was latched at
+int64_t render_frame_time_us(void);
+int64_t render_frame_network_time_us(void);
+// Sound level at the frame's network time
+float render_sound_level(void);
+
+extern int64_t flash_end_time;      // ms, esp_timer time
+int render_brightness_index(void);
+
+#endif // RENDER_H
@@ -0,0 +1,178 @@
+#include <string.h>
+#include "now_proto.h"
+#include "show.h"
+
+
+static void key_from_packet(show_key_t *k, const show_keyframe_t *pkt) {
+    k->state.pattern = pkt->pattern;
+    k->state.level = pkt->level;
+    k->state.g = pkt->g;
+    k->at_ms = pkt->at_ms;
+    k->fade_ms = pkt->fade_ms;
+    k->seq = pkt->seq;
+    k->overlay = pkt->overlay;
+}
+
+
+// Network time is 32 bit ms here, so compare by difference to survive the wrap
+static int32_t ms_diff(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b);
+}
+
+
+void show_follower_init(show_follower_t *f) {
+    memset(f, 0, sizeof(*f));
+}
+
+
+static bool have_seq(const show_follower_t *f, uint8_t seq) {
+    if (f->cur.seq == seq) return true;
+    for (int i = 0; i < f->count; i++) {
+        if (f->queue[i].seq == seq) return true;
+    }
+    return false;
+}
+
+
+void show_follower_rx(show_follower_t *f, const uint8_t src_addr[6], const show_keyframe_t *pkt, uint32_t now_ms) {
+    bool from_leader = f->active && memcmp(f->leader, src_addr, 6) == 0;
+    if (!from_leader) {
+        // One leader at a time; another one only takes over once ours went quiet
+        if (f->active && ms_diff(now_ms, f->heard_ms) <= SHOW_TIMEOUT_MS) {
+            f->stats.dropped++;
+            return;
+        }
+        memcpy(f->leader, src_addr, 6);
+        f->active = true;
+        f->count = 0;
+        key_from_packet(&f->cur, pkt);
+        f->cur.overlay = SHOW_OVERLAY_NONE; // joining mid-show, don't replay what we missed
+        f->heard_ms = now_ms;
+        f->stats.leader_changes++;
+        f->stats.keyframes++;
+        return;
+    }
+    f->heard_ms = now_ms;
+
+    if (have_seq(f, pkt->seq)) {
+        f->stats.duplicates++;
+        return;
+    }
+    if (ms_diff(pkt->at_ms, f->cur.at_ms) <= 0 || f->count == SHOW_QUEUE) {
+        f->stats.dropped++;
+        return;
+    }
+    if (ms_diff(pkt->at_ms, now_ms) < 0) f->stats.late++; // still worth showing, eval jumps to it
+
+    int i = f->count;
+    while (i > 0 && ms_diff(f->queue[i - 1].at_ms, pkt->at_ms) > 0) {
+        f->queue[i] = f->queue[i - 1];
+        i--;
+    }
+    key_from_packet(&f->queue[i], pkt);
+    f->count++;
+    f->stats.keyframes++;
+}
+
+
+static uint8_t lerp8(uint8_t a, uint8_t b, int t) {
+    return (uint8_t)(a + ((int)b - (int)a) * t / 256);
+}
+
+
+// t is 0..256. Fields that only make sense as whole steps switch halfway; the
+// animation period (cd_rate) is one of them because the phase is taken modulo
+// it, so sliding it would scramble the animation on every frame.
+static void blend(show_state_t *out, const show_state_t *a, const show_state_t *b, int t) {
+    const show_state_t *near = t < 128 ? a : b;
+    out->pattern = near->pattern;
+    out->level = lerp8(a->level, b->level, t);
+
+    out->g.cd_period = lerp8(a->g.cd_period, b->g.cd_period, t);
+    out->g.cd_rate = near->g.cd_rate;
+    out->g.cd_dir = near->g.cd_dir;
+    out->g.sat = lerp8(a->g.sat, b->g.sat, t);
+    out->g.hue_base = lerp8(a->g.hue_base, b->g.hue_base, t);
+    out->g.hue_rate = near->g.hue_rate;
+    out->g.hue_dir = near->g.hue_dir;
+    out->g.hue_bound = lerp8(a->g.hue_bound, b->g.hue_bound, t);
+    out->g.lin = lerp8(a->g.lin, b->g.lin, t);
+    out->g.nonlin = lerp8(a->g.nonlin, b->g.nonlin, t);
+}
+
+
+bool show_follower_eval(show_follower_t *f, uint32_t now_ms, show_state_t *out, uint8_t *overlay) {
+    *overlay = SHOW_OVERLAY_NONE;
+    if (!f->active) return false;
+    if (ms_diff(now_ms, f->heard_ms) > SHOW_TIMEOUT_MS) {
+        f->active = false;
+        f->count = 0;
+        return false;
+    }
+
+    while (f->count > 0 && ms_diff(now_ms, f->queue[0].at_ms) >= 0) {
+        f->cur = f->queue[0];
+        if (f->cur.overlay != SHOW_OVERLAY_NONE) *overlay = f->cur.overlay;
+        f->count--;
+        memmove(&f->queue[0], &f->queue[1], f->count * sizeof(show_key_t));
+    }
+
+    *out = f->cur.state;
+    if (f->count > 0) {
+        // A missed keyframe just means we fade in from an older one
+        const show_key_t *next = &f->queue[0];
+        int32_t span = next->fade_ms;
+        int32_t gap = ms_diff(next->at_ms, f->cur.at_ms);
+        if (span > gap) span = gap;
+        int32_t left = ms_diff(next->at_ms, now_ms);
+        if (left < span) blend(out, &f->cur.state, &next->state, (span - left) * 256 / span);
+    }
+    return true;
+}
+
+
+void show_leader_init(show_leader_t *l, uint16_t interval_ms) {
+    memset(l, 0, sizeof(*l));
+    l->interval_ms = interval_ms;
+}
+
+
+void show_leader_overlay(show_leader_t *l, uint8_t overlay) {
+    l->overlay = overlay;
+}
+
+
+// Fields blend() switches rather than fades
+static bool step_changed(const show_state_t *a, const show_state_t *b) {
+    return a->pattern != b->pattern || a->g.cd_rate != b->g.cd_rate || a->g.cd_dir != b->g.cd_dir ||
+           a->g.hue_rate != b->g.hue_rate || a->g.hue_dir != b->g.hue_dir;
+}
+
+
+bool show_leader_poll(show_leader_t *l, const show_state_t *state, uint32_t now_ms, show_keyframe_t *out) {
+    uint32_t since = now_ms - l->last_ms;
+    bool changed = memcmp(state, &l->last, sizeof(*state)) != 0;
+    // A step goes out on the frame it happens: spread over the interval it would
+    // switch halfway through, up to half an interval off, the whole strip at once
+    bool step = l->started && step_changed(state, &l->last);
+    if (l->started && l->overlay == SHOW_OVERLAY_NONE && !step) {
+        if (since < (changed ? l->interval_ms : SHOW_KEEPALIVE_MS)) return false;
+    }
+
+    out->type = SHOW_MSG;
+    out->seq = ++l->seq;
+    out->pattern = state->pattern;
+    out->level = state->level;
+    out->overlay = l->overlay;
+    // Spread the change over the time since the last sample, so a leader that
+    // changes continuously comes out as a smooth ramp on every follower
+    out->fade_ms = (l->started && changed && !step) ? (since < SHOW_LEAD_MS ? since : SHOW_LEAD_MS) : 0;
+    out->at_ms = now_ms + SHOW_LEAD_MS;
+    out->g = state->g;
+
+    l->last = *state;
+    l->last_ms = now_ms;
+    l->started = true;
+    l->overlay = SHOW_OVERLAY_NONE;
+    return true;
+}
@@ -0,0 +1,96 @@
+#ifndef SHOW_H
+#define SHOW_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "genes.h"
+
+// Show mode: one leader badge drives everyone around it. Instead of pixels the
+// leader sends small keyframes (pattern, genome, brightness, overlay) stamped with
+// the network time they take effect, a little ahead so repeats and late frames
+// still arrive in time. Followers queue them and render through the normal
+// pattern engine, fading from one keyframe to the next.
+//
+// Keyframes carry absolute state, never deltas, so a lost one only costs the
+// fade leading into it; the periodic keyframe brings a follower that joined late
+// or missed several back within SHOW_KEEPALIVE_MS.
+// No ESP-IDF dependencies, runs on the badge and in the simulator (sim/).
+
+#define SHOW_LEAD_MS 250            // keyframes take effect this long after the leader sampled them
+#define SHOW_KEYFRAME_MS 100        // at most one keyframe per this while the leader's state changes
+#define SHOW_KEEPALIVE_MS 1000      // keyframe even when nothing changed
+#define SHOW_TIMEOUT_MS 3000        // followers drop the show after this without a keyframe
+#define SHOW_REPEATS 2              // each keyframe goes on air this many times
+#define SHOW_OVERLAY_REPEATS 4      // a lost overlay isn't covered by the next keyframe
+#define SHOW_REPEAT_MS 40
+#define SHOW_QUEUE 16               // future keyframes a follower holds, SHOW_LEAD_MS / shortest interval
+
+// Overlays start when their keyframe takes effect and are never repeated by later keyframes
+#define SHOW_OVERLAY_NONE 0
+#define SHOW_OVERLAY_FLASH 1
+#define SHOW_OVERLAY_FIREWORK 2
+
+typedef struct {
+    uint8_t type;        // SHOW_MSG
+    uint8_t seq;
+    uint8_t pattern;
+    uint8_t level;       // leader's brightness, caps the follower's own setting
+    uint8_t overlay;     // SHOW_OVERLAY_*
+    uint16_t fade_ms;    // fade in from the previous keyframe over this long before at_ms
+    uint32_t at_ms;      // network time this keyframe is fully shown, low 32 bits
+    genome g;
+} __attribute__((packed)) show_keyframe_t;
+
+// What a badge renders
+typedef struct {
+    uint8_t pattern;
+    uint8_t level;
+    genome g;
+} show_state_t;
+
+typedef struct {
+    show_state_t state;
+    uint32_t at_ms;
+    uint16_t fade_ms;
+    uint8_t seq;
+    uint8_t overlay;
+} show_key_t;
+
+typedef struct {
+    uint32_t keyframes;      // distinct keyframes accepted
+    uint32_t duplicates;     // repeats of keyframes we already had
+    uint32_t late;           // arrived after their time, shown with a jump
+    uint32_t dropped;        // queue full or older than what we show
+    uint32_t leader_changes;
+} show_stats_t;
+
+typedef struct {
+    bool active;
+    uint8_t leader[6];
+    uint32_t heard_ms;       // network time of the last keyframe from the leader
+    show_key_t cur;          // newest keyframe whose time has come
+    show_key_t queue[SHOW_QUEUE]; // still to come, by at_ms
+    uint8_t count;
+    show_stats_t stats;
+} show_follower_t;
+
+typedef struct {
+    uint8_t seq;
+    bool started;
+    show_state_t last;       // state in the last keyframe
+    uint32_t last_ms;        // network time the last keyframe was sampled
+    uint16_t interval_ms;    // shortest gap between keyframes
+    uint8_t overlay;         // goes out with the next keyframe
+} show_leader_t;
+
+void show_follower_init(show_follower_t *f);
+void show_follower_rx(show_follower_t *f, const uint8_t src_addr[6], const show_keyframe_t *pkt, uint32_t now_ms);
+// State to render at network time now_ms and any overlay starting now; false while no show is running
+bool show_follower_eval(show_follower_t *f, uint32_t now_ms, show_state_t *out, uint8_t *overlay);
+
+void show_leader_init(show_leader_t *l, uint16_t interval_ms);
+void show_leader_overlay(show_leader_t *l, uint8_t overlay);
+// Fills a keyframe when one is due for the leader's current state
+bool show_leader_poll(show_leader_t *l, const show_state_t *state, uint32_t now_ms, show_keyframe_t *out);
+
+#endif // SHOW_H
@@ -0,0 +1,94 @@
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "show_mode.h"
+#include "led_control.h"
+#include "storage.h"
+#include "now.h"
+#include "firework_notification_pattern.h"
+#include "capture.h"
+
+static const char *TAG = "SHOW";
+
+// The leader renders its own keyframes through the follower too, so it changes at the same moment as everyone else
+static const uint8_t self_addr[6] = {0};
+
+// Follower is fed by the radio task and read by the lighting task
+static show_follower_t follower;
+static show_leader_t leader;
+static volatile bool leading = false;
+static portMUX_TYPE show_lock = portMUX_INITIALIZER_UNLOCKED;
+
+
+void show_mode_rx(const uint8_t src_addr[6], const show_keyframe_t *pkt, uint32_t now_ms) {
+    portENTER_CRITICAL(&show_lock);
+    if (!leading) show_follower_rx(&follower, src_addr, pkt, now_ms);
+    portEXIT_CRITICAL(&show_lock);
+}
+
+
+bool show_mode_render(uint8_t *framebuffer, int loop) {
+    uint32_t now_ms = (uint32_t)(now_network_time_us() / 1000);
+    show_state_t own = {
+        .pattern = settings.pattern_id,
+        .level = brightness,
+        .g = patterns[settings.pattern_id],
+    };
+    show_keyframe_t pkt;
+    show_state_t state;
+    uint8_t overlay;
+
+    portENTER_CRITICAL(&show_lock);
+    bool send = leading && show_leader_poll(&leader, &own, now_ms, &pkt);
+    if (send) show_follower_rx(&follower, self_addr, &pkt, now_ms);
+    bool active = show_follower_eval(&follower, now_ms, &state, &overlay);
+    portEXIT_CRITICAL(&show_lock);
+
+    if (send) now_send_show(&pkt);
+    if (!active) return false;
+
+    switch (overlay) {
+        case SHOW_OVERLAY_FLASH:
+            flash_feedback_pattern();
+            capture_flash(esp_timer_get_time());
+            break;
+        case SHOW_OVERLAY_FIREWORK: {
+            int64_t now = esp_timer_get_time();
+            firework_notification_start(now / 1000);
+            capture_firework(now);
+            break;
+        }
+    }
+    render_genome(state.pattern % NUM_PATTERNS, &state.g, state.level, framebuffer, loop);
+    return true;
+}
+
+
+void show_mode_toggle_leader(void) {
+    portENTER_CRITICAL(&show_lock);
+    leading = !leading;
+    show_follower_init(&follower);
+    show_leader_init(&leader, SHOW_KEYFRAME_MS);
+    portEXIT_CRITICAL(&show_lock);
+    ESP_LOGI(TAG, "%s leading a show", leading ? "Started" : "Stopped");
+}
+
+
+bool show_mode_is_leader(void) {
+    return leading;
+}
+
+
+void show_mode_overlay(uint8_t overlay) {
+    portENTER_CRITICAL(&show_lock);
+    show_leader_overlay(&leader, overlay);
+    portEXIT_CRITICAL(&show_lock);
+}
+
+
+void show_mode_get_stats(show_stats_t *out) {
+    portENTER_CRITICAL(&show_lock);
+    *out = follower.stats;
+    portEXIT_CRITICAL(&show_lock);
+}
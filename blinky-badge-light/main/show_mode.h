@@ -0,0 +1,23 @@
+#ifndef SHOW_MODE_H
+#define SHOW_MODE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "show.h"
+
+// Badge side of show mode (show.c has the protocol). Hold the ? spot to start or
+// stop leading; every badge in radio range then renders the leader's pattern.
+
+// Called from the radio task for every keyframe heard; now_ms is network time
+void show_mode_rx(const uint8_t src_addr[6], const show_keyframe_t *pkt, uint32_t now_ms);
+// Renders the show into the framebuffer; false when no show is running
+bool show_mode_render(uint8_t *framebuffer, int loop);
+
+void show_mode_toggle_leader(void);
+bool show_mode_is_leader(void);
+// Overlay shown on every badge in the show at the same moment
+void show_mode_overlay(uint8_t overlay);
+
+void show_mode_get_stats(show_stats_t *out);
+
+#endif // SHOW_MODE_H
@@ -0,0 +1,166 @@
+#include <math.h>
+#include <string.h>
+#include "sound.h"
+
+
+float sound_block_db(const int32_t *samples, int count) {
+    double sum_squares = 0.0;
+    for (int i = 0; i < count; i+=2) {
+        float normalized_to_1 = ((float)(samples[i] << 1)) / ((float)(1 << 31));
+        sum_squares += normalized_to_1 * normalized_to_1;
+    }
+    float rms = sqrtf(sum_squares / count / 2); // Divide by 2 because we are using mono input
+    float dbfs = 20.0f * log10f(rms + 1e-8f);
+    return dbfs + 120.0f;
+}
+
+
+void sound_init(sound_analysis_t *a) {
+    memset(a, 0, sizeof(*a));
+    a->avg_low_db = 30.0f;
+    a->avg_high_db = 150.0f;
+}
+
+
+static void db_get_low_high(sound_analysis_t *a) {
+    int i, j;
+    int sample_count = 5;
+    float lowest[sample_count];
+    float highest[sample_count];
+    for (i = 0; i < sample_count; i++) {
+        lowest[i] = 150.0f; // Initialize with a high value
+    }
+    for (i = 0; i < sample_count; i++) {
+        highest[i] = 30.0f; // Initialize with a low value
+    }
+
+    for (i = 0; i < SOUND_HISTORY_LEN; i++) {
+        float val = a->history[i];
+        // Find lowest
+        for (j = 0; j < sample_count; j++) {
+            if (val < lowest[j]) {
+                float tmp = lowest[j];
+                lowest[j] = val;
+                val = tmp;
+            }
+        }
+        // Find highest
+        val = a->history[i];
+        for (j = 0; j < sample_count; j++) {
+            if (val > highest[j]) {
+                float tmp = highest[j];
+                highest[j] = val;
+                val = tmp;
+            }
+        }
+    }
+    // Compute averages
+    float sum_low = 0, sum_high = 0;
+    for (i = 0; i < sample_count; i++) {
+        sum_low += lowest[i];
+        sum_high += highest[i];
+    }
+    a->avg_low_db = sum_low / sample_count;
+    a->avg_high_db = sum_high / sample_count;
+}
+
+
+void sound_prime(sound_analysis_t *a, const float *db, int count) {
+    for (int i = 0; i < SOUND_HISTORY_LEN; i++) a->history[i] = db[i % count];
+    a->history_idx = 0;
+    a->beat_avg_db = 0.0f;
+    db_get_low_high(a);
+}
+
+
+// Smoothed brightness level of the last block within the recent range
+static void calculate_sound_brightness(sound_analysis_t *a)
+{
+    // clamp dB range
+    if (a->avg_high_db == a->avg_low_db) {
+        // Avoid divide by zero
+        a->brightness_level = 0.2f;
+        return;
+    }
+
+    if (a->db > a->avg_high_db) a->db = a->avg_high_db;
+    if (a->db < a->avg_low_db) a->db = a->avg_low_db;
+
+    // Normalize to [0, 1]
+    float level = (a->db - a->avg_low_db) / (a->avg_high_db - a->avg_low_db);
+    if (level < 0.01f) level = 0.01f;
+
+    // rolling average
+    a->level_avgs[a->level_idx++ % 2] = level;
+    a->brightness_level = (a->level_avgs[0] + a->level_avgs[1]) / 2.0f;
+
+    // make it more uniform
+    a->smooth_level = powf(a->brightness_level, 1.4f);
+
+    // Clamp to [0.05, 0.8] for brightness so it won't be completely dark or too bright
+    float min_bright = 0.05f;
+    float max_bright = 0.8f;
+    a->brightness_level = min_bright + (max_bright - min_bright) * a->brightness_level;
+}
+
+
+// Returns beat strength 0-255 for this block, 0 if it isn't a beat
+static uint8_t detect_beat(sound_analysis_t *a, float db, int64_t now_ms) {
+    if (a->beat_avg_db == 0.0f) a->beat_avg_db = db;
+    float excess = db - a->beat_avg_db;
+    a->beat_avg_db += BEAT_AVG_ALPHA * (db - a->beat_avg_db);
+
+    if (excess < BEAT_THRESHOLD_DB || now_ms - a->last_beat_ms < BEAT_MIN_GAP_MS) return 0;
+    a->last_beat_ms = now_ms;
+    float strength = excess / BEAT_FULL_DB;
+    return (uint8_t)(fminf(strength, 1.0f) * 255.0f);
+}
+
+
+uint8_t sound_block(sound_analysis_t *a, float db, int64_t block_us, sound_features_t *local) {
+    a->history[a->history_idx] = db;
+    a->history_idx = (a->history_idx + 1) % SOUND_HISTORY_LEN;
+    db_get_low_high(a); // Update low and high averages
+    a->db = db;
+    calculate_sound_brightness(a); // Update dB brightness level
+
+    uint8_t beat = detect_beat(a, db, block_us / 1000);
+    local->level = a->smooth_level;
+    local->t_us = (uint32_t)block_us;
+    if (beat) {
+        local->beat = beat;
+        local->beat_t_us = (uint32_t)block_us;
+    }
+    return beat;
+}
+
+
+void sound_remote(sound_features_t *remote, uint8_t level, uint8_t beat, uint32_t t_us) {
+    remote->level = level / 255.0f;
+    remote->t_us = t_us;
+    if (beat) {
+        remote->beat = beat;
+        remote->beat_t_us = t_us;
+    }
+}
+
+
+static float beat_pulse(const sound_features_t *f, uint32_t now_us) {
+    uint32_t age_ms = (now_us - f->beat_t_us) / 1000;
+    if (f->beat == 0 || age_ms >= BEAT_PULSE_MS) return 0.0f;
+    return (f->beat / 255.0f) * (1.0f - (float)age_ms / BEAT_PULSE_MS);
+}
+
+
+// Beats are placed by network time so every badge's pulse decays in step
+float sound_mix(const sound_features_t *local, const sound_features_t *remote, uint32_t now_us) {
+    float level = local->level;
+    uint32_t remote_age_ms = (now_us - remote->t_us) / 1000;
+    if (remote->t_us != 0 && remote_age_ms < REMOTE_HOLD_MS) {
+        float remote_level = remote->level * (1.0f - (float)remote_age_ms / REMOTE_HOLD_MS);
+        level = fmaxf(level, remote_level);
+    }
+    // Only a nearby badge's beats pulse; alone, the level is what it always was
+    level += BEAT_PULSE_GAIN * beat_pulse(remote, now_us);
+    return fminf(level, 1.0f);
+}
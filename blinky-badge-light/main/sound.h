@@ -0,0 +1,77 @@
+#ifndef SOUND_H
+#define SOUND_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Sound analysis behind the sound-reactive patterns: dB of a block of I2S samples, the
+// level range of the last two seconds, a brightness level within it, beat detection,
+// and the blend of our own features with the loudest nearby badge's.
+// No ESP-IDF dependencies; microphone.c feeds it blocks and locks around it, and
+// sim/replay runs captured dB values through the same code.
+
+#define SOUND_HISTORY_LEN 100       // blocks, about two seconds
+
+// Beat detection: a block this much louder than the recent average, at most every BEAT_MIN_GAP_MS
+#ifndef BEAT_THRESHOLD_DB
+#define BEAT_THRESHOLD_DB 6.0f
+#endif
+#ifndef BEAT_FULL_DB
+#define BEAT_FULL_DB 18.0f          // excess that counts as a full strength beat
+#endif
+#ifndef BEAT_MIN_GAP_MS
+#define BEAT_MIN_GAP_MS 200
+#endif
+#ifndef BEAT_AVG_ALPHA
+#define BEAT_AVG_ALPHA 0.05f        // ~1 s average at 50 blocks per second
+#endif
+#ifndef BEAT_PULSE_MS
+#define BEAT_PULSE_MS 150           // how long a beat brightens the sound patterns
+#endif
+#ifndef BEAT_PULSE_GAIN
+#define BEAT_PULSE_GAIN 0.3f
+#endif
+#ifndef REMOTE_HOLD_MS
+#define REMOTE_HOLD_MS 300          // a remote level fades out over this long
+#endif
+
+// Latest sound features, local or from the loudest nearby badge
+typedef struct {
+    float level;
+    uint8_t beat;            // strength of the last beat
+    uint32_t beat_t_us;      // network time of the last beat, low 32 bits
+    uint32_t t_us;           // network time of the last update, low 32 bits
+} sound_features_t;
+
+// Everything the analysis carries from block to block. Plain data, so a capture
+// keyframe can copy it whole
+typedef struct {
+    float history[SOUND_HISTORY_LEN]; // dB of the last blocks
+    int32_t history_idx;
+    float avg_low_db;               // quietest and loudest of the history
+    float avg_high_db;
+    float level_avgs[2];            // the last two levels, averaged
+    int32_t level_idx;
+    float db;                       // last block, clamped to the range
+    float brightness_level;         // 0.05-0.8
+    float smooth_level;             // 0-1, for the patterns
+    float beat_avg_db;
+    int64_t last_beat_ms;
+} sound_analysis_t;
+
+// dB SPL of a block of 32-bit I2S samples, left slot only
+float sound_block_db(const int32_t *samples, int count);
+
+void sound_init(sound_analysis_t *a);
+// Fills the history from a few blocks read right after power-up
+void sound_prime(sound_analysis_t *a, const float *db, int count);
+// One block at network time block_us: updates the analysis and the local features,
+// returns the strength of a beat on this block, 0 if none
+uint8_t sound_block(sound_analysis_t *a, float db, int64_t block_us, sound_features_t *local);
+// An audio event from a nearby badge
+void sound_remote(sound_features_t *remote, uint8_t level, uint8_t beat, uint32_t t_us);
+// Level for the patterns at network time now_us [0.0, 1.0]: the louder of ours and a
+// fading copy of the remote one, plus a pulse on the remote's latest beat
+float sound_mix(const sound_features_t *local, const sound_features_t *remote, uint32_t now_us);
+
+#endif // SOUND_H
@@ -0,0 +1,111 @@
+#include <inttypes.h>
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+#include "standby.h"
+#include "led_control.h"
+#include "energy.h"
+#include "touch_input.h"
+#include "now.h"
+#include "pins.h"
+
+static const char *TAG = "STANDBY";
+
+#define STANDBY_MIN_MHZ 40          // CPU clock while awake in standby
+#define STANDBY_MAX_MHZ 240
+
+static volatile bool active = false;
+static int64_t entered_us;
+static standby_stats_t stats;
+static volatile int64_t sleep_us;   // written by the sleep callback
+static volatile uint32_t wakeups;
+static portMUX_TYPE standby_lock = portMUX_INITIALIZER_UNLOCKED;
+
+
+// Runs with the scheduler stopped on the way out of every light sleep
+static IRAM_ATTR esp_err_t on_sleep_exit(int64_t sleep_time_us, void *arg) {
+    if (active) {
+        sleep_us += sleep_time_us;
+        wakeups++;
+    }
+    return ESP_OK;
+}
+
+
+static void set_light_sleep(bool on) {
+    esp_pm_config_t pm = {
+        .max_freq_mhz = STANDBY_MAX_MHZ,
+        .min_freq_mhz = on ? STANDBY_MIN_MHZ : STANDBY_MAX_MHZ,
+        .light_sleep_enable = on,
+    };
+    ESP_ERROR_CHECK(esp_pm_configure(&pm));
+}
+
+
+void standby_init(void) {
+    esp_pm_sleep_cbs_register_config_t cbs = { .exit_cb = on_sleep_exit };
+    ESP_ERROR_CHECK(esp_pm_light_sleep_register_cbs(&cbs));
+    set_light_sleep(false);
+}
+
+
+void standby_enter(void) {
+    if (active) return;
+    ESP_LOGI(TAG, "Standby");
+    portENTER_CRITICAL(&standby_lock);
+    entered_us = esp_timer_get_time();
+    active = true;
+    stats.entries++;
+    portEXIT_CRITICAL(&standby_lock);
+
+    lighting_standby(true);         // blanks the LEDs, lets go of the mic
+    touch_set_sleep_scan(true);
+    now_set_standby(true);
+    ESP_ERROR_CHECK(esp_sleep_enable_wifi_wakeup());
+    set_light_sleep(true);
+}
+
+
+void standby_exit(int64_t input_us) {
+    if (!active) return;
+    set_light_sleep(false);
+    // Pattern first, the rest can follow the LEDs
+    lighting_show_input(input_us);
+    lighting_standby(false);
+    touch_set_sleep_scan(false);
+    now_set_standby(false);
+    esp_sleep_disable_wifi_wakeup();
+
+    portENTER_CRITICAL(&standby_lock);
+    active = false;
+    stats.time_us += esp_timer_get_time() - entered_us;
+    portEXIT_CRITICAL(&standby_lock);
+
+    standby_stats_t st;
+    standby_get_stats(&st);
+    ESP_LOGI(TAG, "Awake after %" PRIu64 " ms of standby, %.0f %% of it asleep, about %" PRIu32 " uA",
+             st.time_us / 1000, st.time_us ? 100.0 * st.sleep_us / st.time_us : 0.0, st.current_ua);
+}
+
+
+bool standby_active(void) {
+    return active;
+}
+
+
+void standby_get_stats(standby_stats_t *out) {
+    portENTER_CRITICAL(&standby_lock);
+    *out = stats;
+    out->active = active;
+    if (active) out->time_us += esp_timer_get_time() - entered_us;
+    out->sleep_us = sleep_us;
+    out->wakeups = wakeups;
+    portEXIT_CRITICAL(&standby_lock);
+
+    lighting_get_resume_latency(&out->resume_us_last, &out->resume_us_max);
+    out->current_ua = energy_standby_ua();
+}
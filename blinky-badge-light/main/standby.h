@@ -0,0 +1,30 @@
+#ifndef STANDBY_H
+#define STANDBY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Lights off but awake: double tap the off pad to blank the LEDs and stop lighting
+// and audio work, touch any pad to get the pattern back. In between the CPU light
+// sleeps, woken by the touch sensor and by the radio's wake windows, so the badge
+// keeps up with fireworks, sync and gossip without drawing much.
+
+typedef struct {
+    bool active;
+    uint32_t entries;
+    uint64_t time_us;           // in standby, all visits
+    uint64_t sleep_us;          // of that, in light sleep
+    uint32_t wakeups;           // light sleeps ended
+    uint32_t resume_us_last;    // wake touch to the pattern back on the LEDs
+    uint32_t resume_us_max;
+    uint32_t current_ua;        // average in standby, from the calibrated energy model; 0 before its first sample
+} standby_stats_t;
+
+void standby_init(void);
+void standby_enter(void);
+// input_us is the touch that woke us; the first frame after it is timed against it
+void standby_exit(int64_t input_us);
+bool standby_active(void);
+void standby_get_stats(standby_stats_t *out);
+
+#endif // STANDBY_H
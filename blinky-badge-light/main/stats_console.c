@@ -0,0 +1,299 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "esp_console.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "stats_console.h"
+#include "led_control.h"
+#include "led_outputs.h"
+#include "microphone.h"
+#include "battery_monitor.h"
+#include "touch_input.h"
+#include "now.h"
+#include "standby.h"
+#include "trace.h"
+#include "telemetry.h"
+#include "capture.h"
+#include "testing_routine.h"
+#include "energy.h"
+
+static const char *TAG = "CONSOLE";
+
+#define MAX_TASKS 32
+
+// Run time counters at the last `tasks`, so CPU shares are over the time since then (since
+// boot the first time). They count microseconds in 64 bits; 32 would wrap every 71 minutes
+typedef struct {
+    TaskHandle_t handle;
+    configRUN_TIME_COUNTER_TYPE run_time;
+} task_sample_t;
+static task_sample_t last_tasks[MAX_TASKS];
+static int last_task_count;
+static configRUN_TIME_COUNTER_TYPE last_total;
+
+
+static configRUN_TIME_COUNTER_TYPE last_run_time(TaskHandle_t handle) {
+    for (int i = 0; i < last_task_count; i++) {
+        if (last_tasks[i].handle == handle) return last_tasks[i].run_time;
+    }
+    return 0;
+}
+
+
+static int cmd_tasks(int argc, char **argv) {
+    TaskStatus_t *st = malloc(MAX_TASKS * sizeof(TaskStatus_t));
+    if (!st) return 1;
+    configRUN_TIME_COUNTER_TYPE total;
+    int n = uxTaskGetSystemState(st, MAX_TASKS, &total);
+    // Both cores count time, so a task busy all the time on one is 50 % of it
+    configRUN_TIME_COUNTER_TYPE elapsed = (total - last_total) * portNUM_PROCESSORS;
+
+    printf("%-16s core prio  cpu %%  stack free\n", "task");
+    for (int i = 0; i < n; i++) {
+        configRUN_TIME_COUNTER_TYPE used = st[i].ulRunTimeCounter - last_run_time(st[i].xHandle);
+        int core = st[i].xCoreID == tskNO_AFFINITY ? -1 : (int)st[i].xCoreID;
+        printf("%-16s %4d %4u %6.1f %7" PRIu32 " B\n", st[i].pcTaskName, core, (unsigned)st[i].uxCurrentPriority,
+               elapsed ? 100.0 * used / elapsed : 0.0, (uint32_t)st[i].usStackHighWaterMark);
+    }
+    last_task_count = n;
+    for (int i = 0; i < n; i++) {
+        last_tasks[i] = (task_sample_t){ st[i].xHandle, st[i].ulRunTimeCounter };
+    }
+    last_total = total;
+    free(st);
+    return 0;
+}
+
+
+static int cmd_heap(int argc, char **argv) {
+    printf("heap      free %7u  min free %7u  largest block %7u\n",
+           (unsigned)heap_caps_get_free_size(MALLOC_CAP_8BIT), (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT),
+           (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+    printf("internal  free %7u  min free %7u  largest block %7u\n",
+           (unsigned)heap_caps_get_free_size(MALLOC_CAP_INTERNAL), (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL),
+           (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL));
+    return 0;
+}
+
+
+static int cmd_frames(int argc, char **argv) {
+    lighting_frame_stats_t f;
+    lighting_get_frame_stats(&f);
+    printf("frames %" PRIu32 ", %u fps\n", f.frames, f.fps);
+    printf("render  %5" PRIu32 " us avg %6" PRIu32 " us max\n", f.render_us_avg, f.render_us_max);
+    printf("refresh %5" PRIu32 " us avg %6" PRIu32 " us max\n", f.refresh_us_avg, f.refresh_us_max);
+    led_output_stats_t outs[LED_OUTPUTS_MAX];
+    int n = lighting_get_output_stats(outs);
+    for (int i = 0; i < n; i++) {
+        printf("  gpio %2d %4u LEDs %-6s sent after %5" PRIu32 " us last %5" PRIu32 " us avg %6" PRIu32 " us max\n",
+               outs[i].gpio, outs[i].count, i == 0 ? "heart" : outs[i].mode == LED_OUT_EXTEND ? "extend" : "mirror",
+               outs[i].wire_us_last, outs[i].wire_us_avg, outs[i].wire_us_max);
+    }
+
+    photon_latency_t l;
+    lighting_get_latency(&l);
+    if (l.count) {
+        printf("touch to LEDs: %" PRIu32 " inputs, %.1f ms avg, %.1f ms max\n", l.count,
+               l.sum_us / 1000.0 / l.count, l.max_us / 1000.0);
+    }
+    return 0;
+}
+
+
+static int cmd_audio(int argc, char **argv) {
+    mic_power_stats_t m;
+    mic_get_power_stats(&m);
+    printf("mic %s, %" PRIu32 " power-ups, last ready in %" PRIu32 " ms\n", m.on ? "on" : "off", m.power_ups, m.warmup_us / 1000);
+    printf("on %" PRIu64 " s, off %" PRIu64 " s\n", m.on_us / 1000000, m.off_us / 1000000);
+    if (m.blocks) {
+        printf("block %" PRIu64 " us avg %" PRIu32 " us max over %" PRIu32 " blocks\n", m.cpu_sum_us / m.blocks, m.cpu_max_us, m.blocks);
+    }
+    printf("saved %" PRIu32 " ms CPU, %" PRIu32 " uAh\n", m.saved_cpu_ms, m.saved_uah);
+
+    sound_remote_stats_t r;
+    sound_get_remote_stats(&r);
+    printf("remote events %" PRIu32 ", %" PRIu32 " us avg %" PRIu32 " us max, %" PRIu32 " over budget\n",
+           r.events, r.latency_avg_us, r.latency_max_us, r.over_budget);
+    return 0;
+}
+
+
+static int cmd_battery(int argc, char **argv) {
+    battery_timing_t t;
+    battery_get_timing(&t);
+    printf("battery %u mV%s%s\n", current_battery_voltage, limit_brightness ? ", dimmed" : "",
+           force_safety_pattern ? ", safety pattern" : "");
+    printf("%" PRIu32 " readings, ADC %" PRIu32 " us last %" PRIu32 " us max, whole reading %" PRIu32 " ms\n",
+           t.readings, t.adc_us_last, t.adc_us_max, t.reading_us_last / 1000);
+    return 0;
+}
+
+
+static int cmd_touch(int argc, char **argv) {
+    const gesture_latency_t *g = touch_gesture_latency();
+    for (int t = 0; t < GESTURE_TYPES; t++) {
+        if (!g[t].count) continue;
+        printf("%-12s %5" PRIu32 "  %.1f ms avg %.1f ms max\n", gesture_name(t), g[t].count,
+               g[t].latency_sum_us / 1000.0 / g[t].count, g[t].latency_max_us / 1000.0);
+    }
+    touch_track_stats_t tr;
+    touch_get_tracker_stats(&tr);
+    printf("presses %" PRIu32 " accepted, %" PRIu32 " false, %" PRIu32 " missed\n", tr.accepted, tr.false_activations, tr.missed_activations);
+
+    static const char *const modes[TOUCH_SCAN_MODES] = { "fast", "idle", "sleep" };
+    touch_scan_stats_t sc;
+    touch_get_scan_stats(&sc);
+    printf("scan %" PRIu32 " us, now %s\n", sc.scan_us, modes[sc.mode]);
+    // The sensor's draw scales with the share of time it measures; latency is input to action,
+    // and a touch waits up to a period to be scanned on top
+    for (int m = 0; m < TOUCH_SCAN_MODES; m++) {
+        float duty = sc.period_us[m] ? (float)sc.scan_us / sc.period_us[m] : 0;
+        const gesture_latency_t *l = &sc.latency[m];
+        printf("  %-5s every %6" PRIu32 " us, sensing %5.1f %% ~%3.0f uA, %" PRIu64 " s, %" PRIu32 " touches",
+               modes[m], sc.period_us[m], 100 * duty, duty * TOUCH_SCAN_UA, sc.time_us[m] / 1000000, sc.touches[m]);
+        if (l->count) {
+            printf(", latency %.1f ms avg %.1f ms max + up to %.1f ms scan", l->latency_sum_us / 1000.0 / l->count,
+                   l->latency_max_us / 1000.0, sc.period_us[m] / 1000.0);
+        }
+        printf("\n");
+    }
+    return 0;
+}
+
+
+static int cmd_radio(int argc, char **argv) {
+    now_stats_t s;
+    now_get_stats(&s);
+    printf("frames %" PRIu32 " sent, %" PRIu32 " failed; queue %u, peak %u\n", s.frames_sent, s.frames_failed,
+           s.tx_queue_depth, s.tx_queue_peak);
+    printf("send latency %" PRIu32 " us avg %" PRIu32 " us max\n", s.send_latency_avg_us, s.send_latency_max_us);
+    printf("fireworks %" PRIu32 ", relays %" PRIu32 " sent %" PRIu32 " suppressed, %u neighbours\n", s.fireworks_seen,
+           s.relays_sent, s.relays_suppressed, s.neighbours);
+    printf("airtime %" PRIu64 " ms: sync %" PRIu64 ", audio %" PRIu64 ", show %" PRIu64 ", ota %" PRIu64 ", gossip %" PRIu64 "\n",
+           s.tx_airtime_us / 1000, s.sync_airtime_us / 1000, s.audio_airtime_us / 1000, s.show_airtime_us / 1000,
+           s.ota_airtime_us / 1000, s.gossip_airtime_us / 1000);
+    if (!s.sync.synced) printf("time sync: unsynced, %" PRIu32 " resets\n", s.sync.resets);
+    else if (s.sync.hops == 0) printf("time sync: root\n");
+    else printf("time sync: %u hops, error %" PRIu32 " us avg %" PRIu32 " us last\n", s.sync.hops, s.sync.error_avg_us, s.sync.error_last_us);
+
+    standby_stats_t sb;
+    standby_get_stats(&sb);
+    if (sb.entries) {
+        printf("standby %s, %" PRIu32 " times, %" PRIu64 " s, %.0f %% asleep, about %" PRIu32 " uA; resume %.1f ms last %.1f ms max\n",
+               sb.active ? "now" : "off", sb.entries, sb.time_us / 1000000, sb.time_us ? 100.0 * sb.sleep_us / sb.time_us : 0.0,
+               sb.current_ua, sb.resume_us_last / 1000.0, sb.resume_us_max / 1000.0);
+    }
+    return 0;
+}
+
+
+static int cmd_energy(int argc, char **argv) {
+    energy_model_t m;
+    energy_get(&m);
+    float total = 0, total_ua = 0;
+    for (int i = 0; i < ENERGY_SUBSYSTEMS; i++) {
+        total += energy_model_mah(&m, i);
+        total_ua += m.ua_last[i];
+    }
+    printf("%" PRIu64 " s, battery scale %.2f from %" PRIu32 " windows%s\n", m.time_us / 1000000, m.scale, m.windows,
+           m.window_open ? "" : ", waiting for steady readings");
+    printf("%-6s %9s %6s %8s\n", "", "mAh", "share", "mA now");
+    for (int i = 0; i < ENERGY_SUBSYSTEMS; i++) {
+        float mah = energy_model_mah(&m, i);
+        printf("%-6s %9.2f %5.1f%% %8.2f\n", energy_subsystem_name(i), mah, total > 0 ? 100.0 * mah / total : 0.0,
+               m.ua_last[i] * m.scale / 1000.0);
+    }
+    printf("%-6s %9.2f %6s %8.2f\n", "total", total, "", total_ua * m.scale / 1000.0);
+    return 0;
+}
+
+
+static int cmd_trace(int argc, char **argv) {
+    trace_dump();
+    return 0;
+}
+
+
+static int cmd_telemetry(int argc, char **argv) {
+    telemetry_stats_t t;
+    telemetry_get_stats(&t);
+    if (t.enabled) {
+        printf("boot %u, sector %" PRIu32 " of %" PRIu32 " %" PRIu32 " B used, %" PRIu32 " B in RAM, %" PRIu32 " records\n", t.boot,
+               t.seq, t.sectors, t.used, t.pending, t.records);
+        printf("%" PRIu32 " erases, %" PRIu32 " us max, %" PRIu32 " frames lost to them; write %" PRIu32 " us max\n", t.erases,
+               t.erase_us_max, t.erase_frames_lost, t.write_us_max);
+    }
+    telemetry_dump();
+    return 0;
+}
+
+
+static int cmd_capture(int argc, char **argv) {
+    if (argc > 1 && !strcmp(argv[1], "save")) {
+        printf(capture_save() ? "saved\n" : "not saved\n");
+    } else if (argc > 1 && !strcmp(argv[1], "saved")) {
+        capture_dump_saved();
+    } else {
+        capture_dump();
+    }
+    return 0;
+}
+
+
+static int cmd_selftest(int argc, char **argv) {
+    // The report comes as a `selftest {...}` line when it's done
+    printf(testing_routine_start() ? "self-test started\n" : "self-test already running\n");
+    return 0;
+}
+
+
+static int cmd_stats(int argc, char **argv) {
+    static const esp_console_cmd_func_t all[] = { cmd_tasks, cmd_heap, cmd_frames, cmd_audio, cmd_battery, cmd_touch, cmd_radio,
+                                                  cmd_energy };
+    printf("uptime %" PRId64 " s\n", esp_timer_get_time() / 1000000);
+    for (int i = 0; i < sizeof(all) / sizeof(all[0]); i++) {
+        printf("\n");
+        all[i](argc, argv);
+    }
+    return 0;
+}
+
+
+void stats_console_init(void) {
+    static const esp_console_cmd_t cmds[] = {
+        { .command = "tasks", .help = "CPU share since the last call and free stack of every task", .func = cmd_tasks },
+        { .command = "heap", .help = "Free, lowest free and largest free block", .func = cmd_heap },
+        { .command = "frames", .help = "Lighting fps, render and refresh time, touch to LED latency", .func = cmd_frames },
+        { .command = "audio", .help = "Microphone on time, block processing time, nearby sound events", .func = cmd_audio },
+        { .command = "battery", .help = "Battery voltage and how long reading it takes", .func = cmd_battery },
+        { .command = "touch", .help = "Gesture latency, noise rejections, scan modes", .func = cmd_touch },
+        { .command = "radio", .help = "ESP-NOW traffic and airtime, standby", .func = cmd_radio },
+        { .command = "energy", .help = "Charge drawn per subsystem in mAh, scaled to the battery's own discharge", .func = cmd_energy },
+        { .command = "stats", .help = "All of the above", .func = cmd_stats },
+        { .command = "trace", .help = "Dump the event trace; decode a saved log with sim/trace-decode", .func = cmd_trace },
+        { .command = "telemetry", .help = "Dump the flash history log; decode a saved log with sim/telemetry-parse", .func = cmd_telemetry },
+        { .command = "capture", .help = "Dump the input capture, `capture save` keeps it across a reboot, `capture saved` dumps that; replay a saved log with sim/replay",
+          .func = cmd_capture },
+        { .command = "selftest", .help = "Factory self-test, ends with a `selftest {...}` JSON report line", .func = cmd_selftest },
+    };
+
+    esp_console_repl_t *repl = NULL;
+    esp_console_repl_config_t repl_cfg = ESP_CONSOLE_REPL_CONFIG_DEFAULT();
+    repl_cfg.prompt = "badge>";
+    repl_cfg.task_priority = 1;     // below everything that shows on the LEDs
+    esp_console_dev_uart_config_t uart_cfg = ESP_CONSOLE_DEV_UART_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(esp_console_new_repl_uart(&uart_cfg, &repl_cfg, &repl));
+
+    ESP_ERROR_CHECK(esp_console_register_help_command());
+    for (int i = 0; i < sizeof(cmds) / sizeof(cmds[0]); i++) {
+        ESP_ERROR_CHECK(esp_console_cmd_register(&cmds[i]));
+    }
+    ESP_ERROR_CHECK(esp_console_start_repl(repl));
+    ESP_LOGI(TAG, "Stats console on UART, type help");
+}
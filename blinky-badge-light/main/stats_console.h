@@ -0,0 +1,9 @@
+#ifndef STATS_CONSOLE_H
+#define STATS_CONSOLE_H
+
+// Serial console with runtime statistics: per task CPU and stack, heap, frame and
+// audio timing, battery reads, touch, radio. Type `help` for the commands. Nothing
+// here runs until a command comes in, so it stays enabled in release builds.
+void stats_console_init(void);
+
+#endif // STATS_CONSOLE_H
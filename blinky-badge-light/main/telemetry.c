@@ -0,0 +1,314 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "telemetry.h"
+#include "telemetry_format.h"
+#include "battery_monitor.h"
+#include "led_control.h"
+#include "microphone.h"
+#include "show_mode.h"
+#include "standby.h"
+#include "storage.h"
+#include "now_ota.h"
+
+static const char *TAG = "TELEMETRY";
+
+#define TLOG_SUBTYPE 0x40           // data partition "telemetry" in partitions.csv
+#define TLOG_FLUSH_MIN 10           // records reach flash at least this often
+#define TLOG_PENDING_MAX TLOG_PAGE_SIZE
+
+// Flash writes and erases stop the cache on both cores, so everything running from
+// flash waits for them. A page write is well under a millisecond and fits between
+// frames. A sector erase takes tens of milliseconds, but with SPI_FLASH_AUTO_SUSPEND
+// (sdkconfig) the chip suspends it whenever the cache misses and resumes it after,
+// so frames keep their timing and only the erase itself gets slower. The next sector
+// is still erased ahead in standby where it can. erase() counts the frames that
+// didn't come while it ran, which stays at 0 unless suspend isn't working.
+
+static const esp_partition_t *part;
+static const uint8_t *map;          // reads go through the cache and stop nobody
+static esp_partition_mmap_handle_t map_handle;
+static SemaphoreHandle_t lock;
+static int sectors;
+static int cur = -1;                // sector being filled
+static uint32_t cur_seq;
+static uint32_t written;            // bytes of it on flash
+static int erased_next = -1;        // the sector after cur, if already erased
+
+static uint8_t pending[TLOG_PENDING_MAX];
+static int pending_len;
+static int pending_min;             // minutes since pending was last written out
+static uint16_t boot;
+static bool have_key;               // this sector has a key record, samples can follow
+static tlog_sample_t last;
+static telemetry_stats_t stats;
+
+
+static const uint8_t *sector_data(int s) {
+    return map + (size_t)s * TLOG_SECTOR_SIZE;
+}
+
+
+static bool sector_valid(int s, uint32_t *seq) {
+    tlog_sector_header_t h;
+    memcpy(&h, sector_data(s), sizeof(h));
+    if (h.magic != TLOG_MAGIC) return false;
+    *seq = h.seq;
+    return true;
+}
+
+
+static bool sector_blank(int s, uint32_t from) {
+    const uint8_t *d = sector_data(s);
+    for (uint32_t i = from; i < TLOG_SECTOR_SIZE; i++) {
+        if (d[i] != 0xff) return false;
+    }
+    return true;
+}
+
+
+static void erase(int s) {
+    lighting_frame_stats_t f0, f1;
+    lighting_get_frame_stats(&f0);
+    int64_t t0 = esp_timer_get_time();
+    esp_err_t err = esp_partition_erase_range(part, (size_t)s * TLOG_SECTOR_SIZE, TLOG_SECTOR_SIZE);
+    uint32_t us = (uint32_t)(esp_timer_get_time() - t0);
+    lighting_get_frame_stats(&f1);
+    if (err != ESP_OK) ESP_LOGW(TAG, "Erasing sector %d failed: %s", s, esp_err_to_name(err));
+    stats.erases++;
+    if (us > stats.erase_us_max) stats.erase_us_max = us;
+    // A frame every 20 ms while the lights are on; one short is one the erase held up
+    uint32_t due = us / 20000;
+    uint32_t shown = f1.frames - f0.frames;
+    if (!standby_active() && due > shown + 1) stats.erase_frames_lost += due - shown - 1;
+}
+
+
+static void flush_locked(void) {
+    if (!pending_len) return;
+    int64_t t0 = esp_timer_get_time();
+    esp_err_t err = esp_partition_write(part, (size_t)cur * TLOG_SECTOR_SIZE + written, pending, pending_len);
+    uint32_t us = (uint32_t)(esp_timer_get_time() - t0);
+    if (err != ESP_OK) ESP_LOGW(TAG, "Writing %d bytes failed: %s", pending_len, esp_err_to_name(err));
+    if (us > stats.write_us_max) stats.write_us_max = us;
+    written += pending_len;
+    pending_len = 0;
+    pending_min = 0;
+}
+
+
+// Moves on to the next sector, overwriting the oldest history
+static void next_sector(void) {
+    flush_locked();
+    int s = (cur + 1) % sectors;
+    if (erased_next != s) erase(s);
+    tlog_sector_header_t h = { .magic = TLOG_MAGIC, .seq = cur_seq + 1 };
+    esp_partition_write(part, (size_t)s * TLOG_SECTOR_SIZE, &h, sizeof(h));
+    cur = s;
+    cur_seq = h.seq;
+    written = sizeof(h);
+    erased_next = -1;
+    have_key = false;
+}
+
+
+static void append(const uint8_t *rec, int len) {
+    if (pending_len + len > TLOG_PENDING_MAX) flush_locked();
+    memcpy(&pending[pending_len], rec, len);
+    pending_len += len;
+    stats.records++;
+}
+
+
+static bool fits(int len) {
+    return written + pending_len + len <= TLOG_SECTOR_SIZE;
+}
+
+
+static void log_sample(const tlog_sample_t *s) {
+    uint8_t rec[TLOG_RECORD_MAX];
+    int len = have_key ? tlog_encode_sample(rec, &last, s) : 0;
+    if (!have_key || !fits(len)) {
+        len = tlog_encode_key(rec, s);
+        if (!fits(len)) next_sector();
+        have_key = true;
+    }
+    append(rec, len);
+    last = *s;
+}
+
+
+// Finds the sector being filled and where its records end. A record cut short by a
+// power loss leaves bytes that don't decode, and nothing may be appended after those
+static void find_end(void) {
+    uint32_t seq;
+    for (int s = 0; s < sectors; s++) {
+        if (sector_valid(s, &seq) && (cur < 0 || seq > cur_seq)) {
+            cur = s;
+            cur_seq = seq;
+        }
+    }
+    if (cur < 0) {
+        ESP_LOGI(TAG, "Log is empty, starting it");
+        cur = sectors - 1;
+        cur_seq = 0;
+        next_sector();
+        return;
+    }
+
+    const uint8_t *d = sector_data(cur);
+    tlog_sample_t state = { 0 };
+    tlog_record_t r;
+    int off = sizeof(tlog_sector_header_t), end = off;
+    while (tlog_decode(d, TLOG_SECTOR_SIZE, &off, &state, &r)) {
+        end = off;
+        boot = r.tag == TLOG_BOOT ? r.boot.boot : r.sample.boot;
+    }
+    written = end;
+    if (!sector_blank(cur, end)) {
+        ESP_LOGW(TAG, "Sector %d has a damaged record at %d, going on in the next one", cur, end);
+        next_sector();
+    }
+    int n = (cur + 1) % sectors;
+    if (sector_blank(n, 0)) erased_next = n;
+}
+
+
+void telemetry_init(void) {
+    part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, TLOG_SUBTYPE, "telemetry");
+    if (!part) {
+        // Badges that only ever got new firmware over the air still have the old table
+        ESP_LOGW(TAG, "No telemetry partition, flash over USB to get the new partition table");
+        return;
+    }
+    if (esp_partition_mmap(part, 0, part->size, ESP_PARTITION_MMAP_DATA, (const void **)&map, &map_handle) != ESP_OK) {
+        ESP_LOGW(TAG, "Can't map the telemetry partition");
+        part = NULL;
+        return;
+    }
+    lock = xSemaphoreCreateMutex();
+    sectors = part->size / TLOG_SECTOR_SIZE;
+    find_end();
+
+    boot++;
+    tlog_boot_t b = { .boot = boot, .reset_reason = (uint8_t)esp_reset_reason(), .fw_version = BADGE_FW_VERSION };
+    uint8_t rec[TLOG_RECORD_MAX];
+    int len = tlog_encode_boot(rec, &b);
+    if (!fits(len)) next_sector();
+    append(rec, len);
+    // Out at once, so a badge stuck in a reset loop still leaves a trail
+    flush_locked();
+    stats.enabled = true;
+    ESP_LOGI(TAG, "Boot %u, logging to sector %d of %d at %" PRIu32, boot, cur, sectors, written);
+}
+
+
+void telemetry_task(void *param) {
+    if (!part) vTaskDelete(NULL);
+
+    tlog_sample_t s = { .boot = boot };
+    uint8_t flags = 0;
+    uint32_t db_sum = 0, db_count = 0;
+    uint8_t db_max = 0;
+    lighting_frame_stats_t f;
+    lighting_get_frame_stats(&f);
+    uint32_t frames = f.frames;
+    TickType_t wake = xTaskGetTickCount();
+
+    for (int tick = 1;; tick++) {
+        vTaskDelayUntil(&wake, pdMS_TO_TICKS(1000));
+
+        mic_power_stats_t m;
+        mic_get_power_stats(&m);
+        if (limit_brightness) flags |= TLOG_F_LIMIT_BRIGHTNESS;
+        if (force_safety_pattern) flags |= TLOG_F_SAFETY_PATTERN;
+        if (standby_active()) flags |= TLOG_F_STANDBY;
+        if (show_mode_is_leader()) flags |= TLOG_F_SHOW_LEADER;
+        if (m.on) {
+            float db = current_dB_level;
+            uint8_t db_u8 = db <= 0.0f ? 0 : db >= 255.0f ? 255 : (uint8_t)(db + 0.5f);
+            flags |= TLOG_F_MIC_ON;
+            db_sum += db_u8;
+            db_count++;
+            if (db_u8 > db_max) db_max = db_u8;
+        }
+        if (tick % TLOG_SAMPLE_S) continue;
+
+        lighting_get_frame_stats(&f);
+        s.minute++;
+        s.voltage_mv = current_battery_voltage;
+        s.flags = flags;
+        s.fps = (uint8_t)((f.frames - frames + TLOG_SAMPLE_S / 2) / TLOG_SAMPLE_S);
+        s.loud_avg_db = db_count ? (uint8_t)(db_sum / db_count) : 0;
+        s.loud_max_db = db_max;
+        s.settings = (uint8_t)((settings.brightness & 0x0f) << 4 | (settings.pattern_id & 0x0f));
+        frames = f.frames;
+        flags = 0;
+        db_sum = db_count = 0;
+        db_max = 0;
+
+        xSemaphoreTake(lock, portMAX_DELAY);
+        log_sample(&s);
+        if (++pending_min >= TLOG_FLUSH_MIN) flush_locked();
+        // Erase ahead while dark, once the sector is half full so history isn't dropped early
+        int n = (cur + 1) % sectors;
+        if (erased_next != n && standby_active() && written > TLOG_SECTOR_SIZE / 2) {
+            erase(n);
+            erased_next = n;
+        }
+        xSemaphoreGive(lock);
+    }
+}
+
+
+void telemetry_flush(void) {
+    if (!part) return;
+    if (xSemaphoreTake(lock, pdMS_TO_TICKS(100)) != pdTRUE) return;
+    flush_locked();
+    xSemaphoreGive(lock);
+}
+
+
+void telemetry_dump(void) {
+    if (!part) {
+        printf("no telemetry partition\n");
+        return;
+    }
+    telemetry_flush();
+    printf("telemetry begin 1 %d %d\n", sectors, TLOG_SECTOR_SIZE);
+    uint32_t seq;
+    for (int s = 0; s < sectors; s++) {
+        if (!sector_valid(s, &seq)) continue;
+        const uint8_t *d = sector_data(s);
+        for (uint32_t off = 0; off < TLOG_SECTOR_SIZE && !sector_blank(s, off); off += 32) {
+            printf("tl %d %03" PRIx32 " ", s, off);
+            for (int i = 0; i < 32; i++) printf("%02x", d[off + i]);
+            printf("\n");
+        }
+    }
+    printf("telemetry end\n");
+}
+
+
+void telemetry_get_stats(telemetry_stats_t *out) {
+    if (!part) {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+    xSemaphoreTake(lock, portMAX_DELAY);
+    stats.boot = boot;
+    stats.sectors = sectors;
+    stats.seq = cur_seq;
+    stats.used = written;
+    stats.pending = pending_len;
+    *out = stats;
+    xSemaphoreGive(lock);
+}
@@ -0,0 +1,35 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Long-term history in its own flash partition (layout in telemetry_format.h): the
+// reset reason of every boot, and once a minute battery voltage, time dimmed or on the
+// safety pattern, frame rate and loudness. Type `telemetry` in the serial monitor and
+// feed the saved log to sim/telemetry-parse.
+
+typedef struct {
+    bool enabled;           // partition found
+    uint16_t boot;          // this boot's number
+    uint32_t sectors;
+    uint32_t seq;           // sector being filled
+    uint32_t used;          // bytes of it on flash
+    uint32_t pending;       // encoded, not on flash yet
+    uint32_t records;       // since boot
+    uint32_t erases;
+    uint32_t write_us_max;
+    uint32_t erase_us_max;
+    uint32_t erase_frames_lost;     // lights on, frames that didn't come while erasing
+} telemetry_stats_t;
+
+// Before the tasks start: finds the end of the log and records the boot
+void telemetry_init(void);
+void telemetry_task(void *param);
+// Writes out what is still in RAM, e.g. before cutting power
+void telemetry_flush(void);
+// Hex dump of the log to stdout
+void telemetry_dump(void);
+void telemetry_get_stats(telemetry_stats_t *out);
+
+#endif // TELEMETRY_H
@@ -0,0 +1,119 @@
+#include <string.h>
+#include "telemetry_format.h"
+
+
+static int put_varint(uint8_t *out, uint32_t v) {
+    int n = 0;
+    while (v >= 0x80) {
+        out[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (uint8_t)v;
+    return n;
+}
+
+
+static bool get_varint(const uint8_t *buf, int len, int *off, uint32_t *v) {
+    *v = 0;
+    for (int shift = 0; shift < 35 && *off < len; shift += 7) {
+        uint8_t b = buf[(*off)++];
+        *v |= (uint32_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+
+int tlog_encode_boot(uint8_t *out, const tlog_boot_t *b) {
+    int n = 0;
+    out[n++] = TLOG_BOOT;
+    n += put_varint(&out[n], b->boot);
+    out[n++] = b->reset_reason;
+    memcpy(&out[n], &b->fw_version, 4);
+    return n + 4;
+}
+
+
+int tlog_encode_key(uint8_t *out, const tlog_sample_t *s) {
+    int n = 0;
+    out[n++] = TLOG_KEY;
+    n += put_varint(&out[n], s->boot);
+    n += put_varint(&out[n], s->minute);
+    memcpy(&out[n], &s->voltage_mv, 2);
+    n += 2;
+    out[n++] = s->flags;
+    out[n++] = s->fps;
+    out[n++] = s->loud_avg_db;
+    out[n++] = s->loud_max_db;
+    out[n++] = s->settings;
+    return n;
+}
+
+
+int tlog_encode_sample(uint8_t *out, const tlog_sample_t *prev, const tlog_sample_t *s) {
+    int n = 1;
+    uint8_t changed = 0;
+    if (s->voltage_mv != prev->voltage_mv) {
+        int32_t d = (int32_t)s->voltage_mv - prev->voltage_mv;
+        changed |= TLOG_CH_VOLTAGE;
+        n += put_varint(&out[n], (uint32_t)((d << 1) ^ (d >> 31)));
+    }
+    if (s->flags != prev->flags) { changed |= TLOG_CH_FLAGS; out[n++] = s->flags; }
+    if (s->fps != prev->fps) { changed |= TLOG_CH_FPS; out[n++] = s->fps; }
+    if (s->loud_avg_db != prev->loud_avg_db) { changed |= TLOG_CH_LOUD_AVG; out[n++] = s->loud_avg_db; }
+    if (s->loud_max_db != prev->loud_max_db) { changed |= TLOG_CH_LOUD_MAX; out[n++] = s->loud_max_db; }
+    if (s->settings != prev->settings) { changed |= TLOG_CH_SETTINGS; out[n++] = s->settings; }
+    out[0] = TLOG_SAMPLE | changed;
+    return n;
+}
+
+
+bool tlog_decode(const uint8_t *buf, int len, int *off, tlog_sample_t *state, tlog_record_t *out) {
+    if (*off >= len) return false;
+    uint8_t tag = buf[(*off)++];
+    uint32_t v;
+    out->tag = tag;
+
+    if (tag == TLOG_BOOT) {
+        if (!get_varint(buf, len, off, &v) || *off + 5 > len) return false;
+        out->boot.boot = (uint16_t)v;
+        out->boot.reset_reason = buf[(*off)++];
+        memcpy(&out->boot.fw_version, &buf[*off], 4);
+        *off += 4;
+        state->boot = 0;            // samples of the new boot start from its key record
+        return true;
+    }
+    if (tag == TLOG_KEY) {
+        tlog_sample_t s;
+        if (!get_varint(buf, len, off, &v)) return false;
+        s.boot = (uint16_t)v;
+        if (!get_varint(buf, len, off, &v) || *off + 7 > len) return false;
+        s.minute = v;
+        memcpy(&s.voltage_mv, &buf[*off], 2);
+        *off += 2;
+        s.flags = buf[(*off)++];
+        s.fps = buf[(*off)++];
+        s.loud_avg_db = buf[(*off)++];
+        s.loud_max_db = buf[(*off)++];
+        s.settings = buf[(*off)++];
+        *state = out->sample = s;
+        return true;
+    }
+    // A sample without a key record before it in the sector has nothing to build on
+    if ((tag & 0xc0) != TLOG_SAMPLE || state->boot == 0) return false;
+
+    tlog_sample_t s = *state;
+    s.minute++;
+    if (tag & TLOG_CH_VOLTAGE) {
+        if (!get_varint(buf, len, off, &v)) return false;
+        s.voltage_mv = (uint16_t)(s.voltage_mv + (int32_t)((v >> 1) ^ -(v & 1)));
+    }
+    uint8_t *fields[] = { &s.flags, &s.fps, &s.loud_avg_db, &s.loud_max_db, &s.settings };
+    for (int i = 0; i < 5; i++) {
+        if (!(tag & (TLOG_CH_FLAGS << i))) continue;
+        if (*off >= len) return false;
+        *fields[i] = buf[(*off)++];
+    }
+    *state = out->sample = s;
+    return true;
+}
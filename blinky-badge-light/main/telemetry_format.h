@@ -0,0 +1,81 @@
+#ifndef TELEMETRY_FORMAT_H
+#define TELEMETRY_FORMAT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// On-flash telemetry log format. The log partition is a ring of 4 KB sectors, each
+// starting with a header carrying a sequence number; the sector with the highest one
+// is being filled. Records are byte-packed and variable length: a sample stores only
+// the fields that changed since the one before, and the voltage as a difference.
+// A key record with the full state starts every boot and every sector, so any sector
+// decodes on its own once older ones have been erased. Erased flash (0xff) ends the
+// records of a sector.
+// No ESP-IDF dependencies, sim/telemetry-parse decodes dumps with the same code.
+
+#define TLOG_SECTOR_SIZE 4096
+#define TLOG_PAGE_SIZE 256          // flash program unit; records are written out a page at a time
+#define TLOG_MAGIC 0x474f4c54       // "TLOG"
+#define TLOG_SAMPLE_S 60            // one sample a minute
+#define TLOG_RECORD_MAX 16          // longest encoded record
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;                   // counts up across the whole ring
+} tlog_sector_header_t;
+
+// Record tags
+#define TLOG_BOOT 0x01              // boot number, reset reason, firmware version
+#define TLOG_KEY 0x02               // full state
+#define TLOG_SAMPLE 0x80            // low bits: TLOG_CH_* mask of the fields that follow
+#define TLOG_END 0xff
+
+#define TLOG_CH_VOLTAGE 0x01        // zigzag varint difference in mV
+#define TLOG_CH_FLAGS 0x02
+#define TLOG_CH_FPS 0x04
+#define TLOG_CH_LOUD_AVG 0x08
+#define TLOG_CH_LOUD_MAX 0x10
+#define TLOG_CH_SETTINGS 0x20       // brightness << 4 | pattern
+
+// Sample flags: state during the minute before the sample
+#define TLOG_F_LIMIT_BRIGHTNESS 0x01
+#define TLOG_F_SAFETY_PATTERN 0x02
+#define TLOG_F_STANDBY 0x04
+#define TLOG_F_MIC_ON 0x08
+#define TLOG_F_SHOW_LEADER 0x10     // leading a show
+
+typedef struct {
+    uint16_t boot;
+    uint32_t minute;                // since boot
+    uint16_t voltage_mv;
+    uint8_t flags;                  // TLOG_F_*, anything set during the minute
+    uint8_t fps;                    // lighting frames per second, minute average
+    uint8_t loud_avg_db;            // sound level, minute average and peak
+    uint8_t loud_max_db;
+    uint8_t settings;               // brightness index << 4 | pattern
+} tlog_sample_t;
+
+typedef struct {
+    uint16_t boot;
+    uint8_t reset_reason;           // esp_reset_reason_t
+    uint32_t fw_version;
+} tlog_boot_t;
+
+typedef struct {
+    uint8_t tag;                    // TLOG_BOOT, TLOG_KEY or TLOG_SAMPLE
+    tlog_boot_t boot;               // TLOG_BOOT
+    tlog_sample_t sample;           // TLOG_KEY and TLOG_SAMPLE: state after the record
+} tlog_record_t;
+
+// Encoders write at most TLOG_RECORD_MAX bytes and return how many
+int tlog_encode_boot(uint8_t *out, const tlog_boot_t *b);
+int tlog_encode_key(uint8_t *out, const tlog_sample_t *s);
+// Changes from prev to s; the minute is implicitly prev->minute + 1
+int tlog_encode_sample(uint8_t *out, const tlog_sample_t *prev, const tlog_sample_t *s);
+
+// Decodes the record at buf[*off], advancing *off. state carries the sample state from
+// record to record, start it zeroed for every sector. False at the end of the records
+// or on a record that doesn't decode
+bool tlog_decode(const uint8_t *buf, int len, int *off, tlog_sample_t *state, tlog_record_t *out);
+
+#endif // TELEMETRY_FORMAT_H
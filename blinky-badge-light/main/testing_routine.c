@@ -1,16 +1,35 @@
 #include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
 #include <inttypes.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_timer.h"
 #include "led_utils.h"
 #include "led_control.h"
+#include "led_outputs.h"
 #include "pins.h"
 #include "microphone.h"
+#include "battery_monitor.h"
+#include "touch_input.h"
+#include "touch_action.h"
+#include "now_ota.h"
 #include "nvs_flash.h"
 #include "nvs.h"
 #include "esp_system.h"
+#include "testing_routine.h"
+
+// Factory self-test, started by holding pads 0, 1 and 2 or with `selftest` on the
+// console. The LED sequence runs on this task while the other checks run on tasks of
+// their own, and every check reports what it measured, all in one line at the end:
+//   selftest {"v":2,"pass":true,"ms":3710,"led":{...},"mic":{...},...}
+// for a bring-up script to parse. The LEDs then show a segment per check in the order
+// of the report, green for pass and red for fail.
 
 volatile bool show_testing_routine = false;
 
@@ -20,6 +39,57 @@ uint8_t white_brightness = 40; // Brightness for white
 uint8_t color_brightness = 100; // Brightness for colors
 float threshold_db_level = 60.0f; // Threshold volume for microphone test
 
+#define SELFTEST_VERSION 2         // 2: touch benchmarks checked against a window per pad
+#define LED_STEP_MS 400             // white, red, green, blue
+#define LED_REFRESH_MS 20           // refreshed this often during a step, each one timed
+#define RMT_WIRE_US (led_outputs_longest() * 24 * 5 / 4) // 1.25 us a bit, the outputs are sent together
+#define RMT_MAX_US (RMT_WIRE_US * 2 + 300) // reset gap and driver overhead included
+#define MIC_SETTLE_MS 150           // the mic task powers the mic up and primes it meanwhile
+#define MIC_TEST_MS 2000
+#define MIC_FLOOR_MIN_DB 20.0f      // a dead mic reads zeros, about -40 dB
+#define BATTERY_TEST_MIN_MV OFF_THRESH
+#define BATTERY_TEST_MAX_MV (MAX_BATTERY_VOLTAGE + 200)
+#define TOUCH_TEST_MS 1500          // the pads that started the test may still be held at first
+#define TOUCH_TEST_SAMPLE_MS 50
+#define TOUCH_TEST_DEV_PCT 10       // an untouched pad reads this close to its benchmark
+// Where each pad's benchmark has to be, {min, max} in raw counts. The benchmark follows
+// the pad's own untouched reading, so only an absolute window tells a pad with its
+// electrode from an open or shorted one. The default is a first wide window, not
+// bring-up data: narrow it per pad from the benchmarks in the reports of known-good
+// badges, e.g. -DTOUCH_TEST_WINDOWS="{ 21000, 34000 }, { 20500, 33000 }, ..."
+#ifndef TOUCH_TEST_WINDOWS
+#define TOUCH_TEST_WINDOW_DEFAULT { 8000, 200000 }
+#define TOUCH_TEST_WINDOWS TOUCH_TEST_WINDOW_DEFAULT, TOUCH_TEST_WINDOW_DEFAULT, TOUCH_TEST_WINDOW_DEFAULT, \
+    TOUCH_TEST_WINDOW_DEFAULT, TOUCH_TEST_WINDOW_DEFAULT, TOUCH_TEST_WINDOW_DEFAULT
+#endif
+#define CHECK_TIMEOUT_MS 5000
+#define RESULT_HOLD_MS 1500
+
+typedef struct {
+    bool done;
+    bool pass;
+    uint32_t ms;                    // how long the check took
+} check_t;
+
+enum { CHECK_LED, CHECK_MIC, CHECK_NVS, CHECK_BATTERY, CHECK_TOUCH, CHECKS };
+
+static check_t checks[CHECKS];
+static SemaphoreHandle_t checks_done;
+static struct {
+    uint32_t min_us, max_us, sum_us;
+    int count;
+} refresh;
+static struct {
+    float floor_db, peak_db;
+    int blocks;
+} mic;
+static esp_err_t nvs_err;
+static uint16_t battery_mv;
+static const uint32_t touch_window[NUM_TOUCH_PADS][2] = { TOUCH_TEST_WINDOWS };
+static struct {
+    uint32_t benchmark[NUM_TOUCH_PADS];
+    uint8_t dev_pct[NUM_TOUCH_PADS]; // least deviation from the benchmark seen
+} touch;
 
 uint8_t framebuffer[LED_COUNT * 3];
 
@@ -45,197 +115,206 @@ const char *reset_reason_str(esp_reset_reason_t reason) {
     }
 }
 
-void blink_test_warning() {
-    for (int blink = 0; blink < 5; blink++) {
-        // All on
-        for (int i = 0; i < LED_COUNT; i++) {
-            set_pixel(framebuffer, i, white_brightness, white_brightness, white_brightness);
-        }
-        update_leds(framebuffer);
-        vTaskDelay(pdMS_TO_TICKS(200));
 
-        // All off
-        for (int i = 0; i < LED_COUNT; i++) {
-            set_pixel(framebuffer, i, 0, 0, 0);
-        }
-        update_leds(framebuffer);
-        vTaskDelay(pdMS_TO_TICKS(200));
-    }
+static void finish(int check, bool pass, int64_t start) {
+    checks[check].ms = (uint32_t)((esp_timer_get_time() - start) / 1000);
+    checks[check].pass = pass;
+    checks[check].done = true;
 }
 
 
-void led_rgb_test() {
-    // RED
-    for (int i = 0; i < LED_COUNT; i++) {
-        set_pixel(framebuffer, i, color_brightness, 0, 0);
-    }
-    update_leds(framebuffer);
-    vTaskDelay(pdMS_TO_TICKS(2000));
-
-    // GREEN
-    for (int i = 0; i < LED_COUNT; i++) {
-        set_pixel(framebuffer, i, 0, color_brightness, 0);
-    }
-    update_leds(framebuffer);
-    vTaskDelay(pdMS_TO_TICKS(2000));
+// Checks on tasks of their own report here when done
+static void finish_task(int check, bool pass, int64_t start) {
+    finish(check, pass, start);
+    xSemaphoreGive(checks_done);
+    vTaskDelete(NULL);
+}
 
-    // BLUE
-    for (int i = 0; i < LED_COUNT; i++) {
-        set_pixel(framebuffer, i, 0, 0, color_brightness);
-    }
-    update_leds(framebuffer);
-    vTaskDelay(pdMS_TO_TICKS(2000));
 
-    // Turn off all LEDs at end
-    for (int i = 0; i < LED_COUNT; i++) {
-        set_pixel(framebuffer, i, 0, 0, 0);
-    }
-    update_leds(framebuffer);
+static void fill(uint8_t r, uint8_t g, uint8_t b) {
+    for (int i = 0; i < LED_COUNT; i++) set_pixel(framebuffer, i, r, g, b);
 }
 
 
-void test_microphone() {
-    // Test lasts for 2 seconds, checking every 100 ms
-    const int test_duration_ms = 2000;
-    const int interval_ms = 100;
-    const int loops = test_duration_ms / interval_ms;
-    bool sound_detected = false;
+// White, red, green and blue for the eye or a camera, timing every refresh meanwhile
+static void led_check(void) {
+    static const uint8_t steps[][3] = { { 1, 1, 1 }, { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+    int64_t start = esp_timer_get_time();
+    refresh.min_us = UINT32_MAX;
+    for (int s = 0; s < sizeof(steps) / sizeof(steps[0]); s++) {
+        uint8_t level = s ? color_brightness : white_brightness;
+        fill(steps[s][0] * level, steps[s][1] * level, steps[s][2] * level);
+        for (int t = 0; t < LED_STEP_MS; t += LED_REFRESH_MS) {
+            int64_t before = esp_timer_get_time();
+            update_leds(framebuffer, LED_COUNT);
+            uint32_t us = (uint32_t)(esp_timer_get_time() - before);
+            if (us < refresh.min_us) refresh.min_us = us;
+            if (us > refresh.max_us) refresh.max_us = us;
+            refresh.sum_us += us;
+            refresh.count++;
+            vTaskDelay(pdMS_TO_TICKS(LED_REFRESH_MS));
+        }
+    }
+    fill(0, 0, 0);
+    update_leds(framebuffer, LED_COUNT);
+    // Faster than the bits take on the wire means they didn't all go out
+    finish(CHECK_LED, refresh.min_us >= RMT_WIRE_US && refresh.max_us <= RMT_MAX_US, start);
+}
 
-    ESP_LOGI(TAG, "Starting microphone test... Make a loud sound near the badge!");
-    vTaskDelay(pdMS_TO_TICKS(1000)); // Wait for 1 seconds before starting the test
 
-    for (int i = 0; i < loops; i++) {
+// Quietest and loudest block over a couple of seconds; someone or the test fixture
+// makes a loud sound meanwhile
+static void mic_check(void *param) {
+    int64_t start = esp_timer_get_time();
+    mic_want(MIC_USER_TEST, true);
+    vTaskDelay(pdMS_TO_TICKS(MIC_SETTLE_MS));
+    mic.floor_db = INFINITY;
+    mic.peak_db = -INFINITY;
+    int64_t end = esp_timer_get_time() + MIC_TEST_MS * 1000LL;
+    while (esp_timer_get_time() < end) {
         float db = get_sound_level();
-        ESP_LOGI(TAG, "Mic Test: Sound Level = %.2f dB", db);
-
-        // Visual feedback: if dB is over threshold, flash green; else, red.
-        uint8_t r = 0, g = 0, b = 0;
-        if (db > threshold_db_level) {
-            g = color_brightness; // Green for detected sound
-            sound_detected = true;
-        } else {
-            r = color_brightness; // Red for quiet
-        }
-        for (int j = 0; j < LED_COUNT; j++) {
-            set_pixel(framebuffer, j, r, g, b);
-        }
-        update_leds(framebuffer);
-
-        vTaskDelay(pdMS_TO_TICKS(interval_ms));
+        if (db < mic.floor_db) mic.floor_db = db;
+        if (db > mic.peak_db) mic.peak_db = db;
+        mic.blocks++;
     }
-    
-    // Turn off all LEDs briefly before final result
-    for (int i = 0; i < LED_COUNT; i++) {
-        set_pixel(framebuffer, i, 0, 0, 0);
-    }
-    update_leds(framebuffer);
-    vTaskDelay(pdMS_TO_TICKS(500)); 
-
-    // Final result: solid green (pass) or solid red (fail)
-    uint8_t r = 0, g = 0, b = 0;
-    if (sound_detected) {
-        g = color_brightness;
-        ESP_LOGI(TAG, "Mic Test: PASSED!");
-    } else {
-        r = color_brightness;
-        ESP_LOGI(TAG, "Mic Test: FAILED. No sound detected.");
-    }
-    for (int j = 0; j < LED_COUNT; j++) {
-        set_pixel(framebuffer, j, r, g, b);
-    }
-    update_leds(framebuffer);
-    vTaskDelay(pdMS_TO_TICKS(3000)); // Hold result for a few sec for the result
+    mic_want(MIC_USER_TEST, false);
+    finish_task(CHECK_MIC, mic.blocks && mic.floor_db >= MIC_FLOOR_MIN_DB && mic.peak_db > threshold_db_level, start);
 }
 
 
-void storage_self_test() {
+static esp_err_t nvs_round_trip(void) {
     nvs_handle_t nvs_handle;
     esp_err_t err = nvs_open("storage", NVS_READWRITE, &nvs_handle);
-    bool pass = true;
-
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "NVS storage test: Failed to open NVS");
-        pass = false;
-        goto test_end;
-    }
-
-    uint32_t test_value = 0x5A5A1234;
+    if (err != ESP_OK) return err;
+    uint32_t test_value = 0x5A5A1234 ^ (uint32_t)esp_timer_get_time(), check_value = 0;
     err = nvs_set_u32(nvs_handle, "selftest", test_value);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "NVS storage test: Failed to write test value");
-        pass = false;
-        goto close_and_end;
+    if (err == ESP_OK) err = nvs_commit(nvs_handle);
+    if (err == ESP_OK) err = nvs_get_u32(nvs_handle, "selftest", &check_value);
+    if (err == ESP_OK && check_value != test_value) {
+        ESP_LOGE(TAG, "NVS readback mismatch (wrote 0x%08" PRIx32 ", read 0x%08" PRIx32 ")", test_value, check_value);
+        err = ESP_ERR_INVALID_CRC;
     }
+    nvs_close(nvs_handle);
+    return err;
+}
 
-    err = nvs_commit(nvs_handle);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "NVS storage test: Commit failed");
-        pass = false;
-        goto close_and_end;
-    }
 
-    uint32_t check_value = 0;
-    err = nvs_get_u32(nvs_handle, "selftest", &check_value);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "NVS storage test: Failed to read back value");
-        pass = false;
-        goto close_and_end;
-    }
+// NVS and the battery ADC are quick, one task does both
+static void storage_battery_check(void *param) {
+    int64_t start = esp_timer_get_time();
+    nvs_err = nvs_round_trip();
+    finish(CHECK_NVS, nvs_err == ESP_OK, start);
 
-    if (check_value != test_value) {
-        ESP_LOGE(TAG, "NVS storage test: Readback value mismatch (wrote 0x%08" PRIx32 ", read 0x%08" PRIx32 ")", test_value, check_value);        pass = false;
-        goto close_and_end;
-    }
-
-    ESP_LOGI(TAG, "NVS storage self-test PASSED!");
+    start = esp_timer_get_time();
+    battery_mv = get_battery_voltage();
+    finish_task(CHECK_BATTERY, battery_mv >= BATTERY_TEST_MIN_MV && battery_mv <= BATTERY_TEST_MAX_MV, start);
+}
 
-close_and_end:
-    nvs_close(nvs_handle);
 
-test_end:
-    // Flash result: green = pass, red = fail
-    uint8_t r = 0, g = 0, b = 0;
-    if (pass) {
-        g = color_brightness;
-    } else {
-        r = color_brightness;
-    }
-    for (int i = 0; i < LED_COUNT; i++) {
-        set_pixel(framebuffer, i, r, g, b);
+// Every pad's benchmark must be inside its window (TOUCH_TEST_WINDOWS), and the pad
+// must read near it at some point, so it isn't stuck touched. The benchmark alone says
+// nothing, it settles on whatever an open pad reads too
+static void touch_check(void *param) {
+    int64_t start = esp_timer_get_time();
+    uint32_t smooth[NUM_TOUCH_PADS];
+    for (int i = 0; i < NUM_TOUCH_PADS; i++) touch.dev_pct[i] = 255;
+    for (int t = 0; t < TOUCH_TEST_MS; t += TOUCH_TEST_SAMPLE_MS) {
+        touch_get_pad_readings(touch.benchmark, smooth);
+        for (int i = 0; i < NUM_TOUCH_PADS; i++) {
+            if (!touch.benchmark[i]) continue;
+            uint32_t dev = (uint32_t)llabs((int64_t)smooth[i] - touch.benchmark[i]) * 100 / touch.benchmark[i];
+            if (dev < touch.dev_pct[i]) touch.dev_pct[i] = (uint8_t)dev;
+        }
+        vTaskDelay(pdMS_TO_TICKS(TOUCH_TEST_SAMPLE_MS));
     }
-    update_leds(framebuffer);
-    vTaskDelay(pdMS_TO_TICKS(3000)); // 3 second
-
-    // Turn off LEDs after
-    for (int i = 0; i < LED_COUNT; i++) {
-        set_pixel(framebuffer, i, 0, 0, 0);
+    bool pass = true;
+    for (int i = 0; i < NUM_TOUCH_PADS; i++) {
+        pass &= touch.benchmark[i] >= touch_window[i][0] && touch.benchmark[i] <= touch_window[i][1];
+        pass &= touch.dev_pct[i] <= TOUCH_TEST_DEV_PCT;
     }
-    update_leds(framebuffer);
+    finish_task(CHECK_TOUCH, pass, start);
 }
 
 
+// The report line, built whole so no other task's log lands in the middle of it
+static void report(bool pass, uint32_t ms) {
+    static char line[896];
+    uint8_t mac[6] = { 0 };
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    int n = snprintf(line, sizeof(line),
+                     "selftest {\"v\":%d,\"mac\":\"%02x:%02x:%02x:%02x:%02x:%02x\",\"fw\":%d,\"reset\":\"%s\",\"pass\":%s,\"ms\":%" PRIu32
+                     ",\"heap\":%" PRIu32,
+                     SELFTEST_VERSION, mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], BADGE_FW_VERSION,
+                     reset_reason_str(esp_reset_reason()), pass ? "true" : "false", ms, esp_get_free_heap_size());
+#define CHECK_FIELDS "{\"pass\":%s,\"done\":%s,\"ms\":%" PRIu32
+#define CHECK_ARGS(c) checks[c].pass ? "true" : "false", checks[c].done ? "true" : "false", checks[c].ms
+    n += snprintf(&line[n], sizeof(line) - n, ",\"led\":" CHECK_FIELDS ",\"refresh_us\":[%" PRIu32 ",%" PRIu32 ",%" PRIu32 "]}",
+                  CHECK_ARGS(CHECK_LED), refresh.min_us, refresh.count ? refresh.sum_us / refresh.count : 0, refresh.max_us);
+    n += snprintf(&line[n], sizeof(line) - n, ",\"mic\":" CHECK_FIELDS ",\"floor_db\":%.1f,\"peak_db\":%.1f,\"blocks\":%d}",
+                  CHECK_ARGS(CHECK_MIC), mic.blocks ? mic.floor_db : 0.0f, mic.blocks ? mic.peak_db : 0.0f, mic.blocks);
+    n += snprintf(&line[n], sizeof(line) - n, ",\"nvs\":" CHECK_FIELDS ",\"err\":\"%s\"}", CHECK_ARGS(CHECK_NVS),
+                  esp_err_to_name(nvs_err));
+    n += snprintf(&line[n], sizeof(line) - n, ",\"battery\":" CHECK_FIELDS ",\"mv\":%u}", CHECK_ARGS(CHECK_BATTERY), battery_mv);
+    n += snprintf(&line[n], sizeof(line) - n, ",\"touch\":" CHECK_FIELDS ",\"benchmark\":[", CHECK_ARGS(CHECK_TOUCH));
+    for (int i = 0; i < NUM_TOUCH_PADS; i++) n += snprintf(&line[n], sizeof(line) - n, "%s%" PRIu32, i ? "," : "", touch.benchmark[i]);
+    n += snprintf(&line[n], sizeof(line) - n, "],\"window\":[");
+    for (int i = 0; i < NUM_TOUCH_PADS; i++) {
+        n += snprintf(&line[n], sizeof(line) - n, "%s[%" PRIu32 ",%" PRIu32 "]", i ? "," : "", touch_window[i][0], touch_window[i][1]);
+    }
+    n += snprintf(&line[n], sizeof(line) - n, "],\"dev_pct\":[");
+    for (int i = 0; i < NUM_TOUCH_PADS; i++) n += snprintf(&line[n], sizeof(line) - n, "%s%u", i ? "," : "", touch.dev_pct[i]);
+    snprintf(&line[n], sizeof(line) - n, "]}}\n");
+#undef CHECK_FIELDS
+#undef CHECK_ARGS
+    printf("%s", line);
+}
 
 
-void testing_routine() {
-    ESP_LOGI(TAG, "Starting testing routine...");
+static void testing_routine(void *param) {
+    ESP_LOGI(TAG, "Starting self-test...");
+    int64_t start = esp_timer_get_time();
+    memset(checks, 0, sizeof(checks));
+    memset(&refresh, 0, sizeof(refresh));
+    memset(&mic, 0, sizeof(mic));
+    memset(&touch, 0, sizeof(touch));
+    nvs_err = ESP_FAIL;
+    battery_mv = 0;
+    if (!checks_done) checks_done = xSemaphoreCreateCounting(3, 0);
+    while (xSemaphoreTake(checks_done, 0) == pdTRUE) {} // from checks that timed out last time
+
+    // Independent of the LEDs and of each other
+    int tasks = 0;
+    tasks += xTaskCreatePinnedToCore(mic_check, "TestMic", 3072, NULL, 5, NULL, tskNO_AFFINITY) == pdPASS;
+    tasks += xTaskCreatePinnedToCore(storage_battery_check, "TestStorage", 3072, NULL, 5, NULL, tskNO_AFFINITY) == pdPASS;
+    tasks += xTaskCreatePinnedToCore(touch_check, "TestTouch", 3072, NULL, 5, NULL, tskNO_AFFINITY) == pdPASS;
+    led_check();
+    for (int i = 0; i < tasks; i++) {
+        int64_t left_ms = CHECK_TIMEOUT_MS - (esp_timer_get_time() - start) / 1000;
+        if (xSemaphoreTake(checks_done, pdMS_TO_TICKS(left_ms > 0 ? left_ms : 0)) != pdTRUE) break;
+    }
 
-    // Test LED strip
-    ESP_LOGI(TAG, "Testing LED strip...");
-    blink_test_warning();
-    led_rgb_test();
-    ESP_LOGI(TAG, "LED strip test completed.");
-    
-    ESP_LOGI(TAG, "Testing microphone...");
-    blink_test_warning();
-    test_microphone();
-    ESP_LOGI(TAG, "Microphone test completed.");
+    bool pass = true;
+    for (int c = 0; c < CHECKS; c++) pass &= checks[c].done && checks[c].pass;
+    uint32_t ms = (uint32_t)((esp_timer_get_time() - start) / 1000);
+    report(pass, ms);
+    ESP_LOGI(TAG, "Self-test %s in %" PRIu32 " ms", pass ? "PASSED" : "FAILED", ms);
 
-    ESP_LOGI(TAG, "Testing NVS storage...");
-    blink_test_warning();
-    storage_self_test();
-    ESP_LOGI(TAG, "NVS storage test completed.");
+    for (int i = 0; i < LED_COUNT; i++) {
+        const check_t *c = &checks[i * CHECKS / LED_COUNT];
+        bool ok = c->done && c->pass;
+        set_pixel(framebuffer, i, ok ? 0 : color_brightness, ok ? color_brightness : 0, 0);
+    }
+    update_leds(framebuffer, LED_COUNT);
+    vTaskDelay(pdMS_TO_TICKS(RESULT_HOLD_MS));
 
-    ESP_LOGI(TAG, "Testing routine completed.");
     show_testing_routine = false;
     vTaskDelete(NULL);
-}
\ No newline at end of file
+}
+
+
+bool testing_routine_start(void) {
+    if (show_testing_routine) return false;
+    show_testing_routine = true;
+    xTaskCreatePinnedToCore(testing_routine, "TestingRoutine", 4096, NULL, 5, NULL, 1);
+    return true;
+}
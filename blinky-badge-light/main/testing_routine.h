@@ -3,7 +3,8 @@
 
 
 const char *reset_reason_str(esp_reset_reason_t reason);
-void testing_routine();
+// Starts the factory self-test on its own task; false if it is running already
+bool testing_routine_start(void);
 extern volatile bool show_testing_routine;
 
 #endif // TESTING_ROUTINE_H
\ No newline at end of file
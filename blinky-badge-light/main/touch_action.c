@@ -0,0 +1,15 @@
+#include "touch_action.h"
+
+
+int touch_action(const gesture_out_t *out, bool testing, bool standby) {
+    if (out->type == GESTURE_CHORD) return testing ? TOUCH_NONE : TOUCH_TEST;
+    // The testing routine reads the pads itself
+    if (testing) return TOUCH_NONE;
+    // In standby a touch anywhere only wakes the badge
+    if (standby) return out->type == GESTURE_PRESS ? TOUCH_WAKE : TOUCH_NONE;
+    if (out->type == GESTURE_DOUBLE_TAP && out->pad == OFF_PAD_IDX) return TOUCH_STANDBY;
+
+    if (out->type == GESTURE_PRESS && out->pad != OFF_PAD_IDX) return out->pad;
+    if (out->type == GESTURE_LONG_PRESS) return out->pad == SPOT_PAD_IDX ? SHOW_ACTION : out->pad;
+    return TOUCH_NONE;
+}
@@ -0,0 +1,23 @@
+#ifndef TOUCH_ACTION_H
+#define TOUCH_ACTION_H
+
+#include <stdbool.h>
+#include "gesture.h"
+
+// What a recognized gesture does. No ESP-IDF dependencies, sim/replay decides captured
+// gestures with the same code.
+
+#define NUM_TOUCH_PADS 6
+#define OFF_PAD_IDX 3
+#define SPOT_PAD_IDX 5
+#define SHOW_ACTION NUM_TOUCH_PADS // when the ? spot is held
+
+// Besides the pad actions 0 to SHOW_ACTION for handle_touch_action()
+#define TOUCH_NONE -1
+#define TOUCH_TEST (SHOW_ACTION + 1)    // pads 0, 1 and 2 held: testing routine
+#define TOUCH_STANDBY (SHOW_ACTION + 2) // double tap on the off pad
+#define TOUCH_WAKE (SHOW_ACTION + 3)    // any touch in standby
+
+int touch_action(const gesture_out_t *out, bool testing, bool standby);
+
+#endif // TOUCH_ACTION_H
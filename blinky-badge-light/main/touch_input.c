@@ -1,9 +1,9 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/queue.h"
-#include "freertos/timers.h"
+#include <inttypes.h>
 #include "esp_log.h"
 #include "esp_timer.h"
+#include "esp_random.h"
 #include "driver/touch_sens.h"
 
 #include "touch_input.h"
@@ -13,12 +13,16 @@
 #include "battery_level_pattern.h"
 #include "battery_monitor.h"
 #include "now.h"
-#include "firework_notification_pattern.h"
 #include "testing_routine.h"
+#include "show_mode.h"
+#include "gesture.h"
+#include "touch_action.h"
+#include "touch_tracker.h"
+#include "standby.h"
+#include "trace.h"
+#include "capture.h"
 
-#define NUM_TOUCH_PADS 6
 static const char *TAG = "TOUCH_INPUT";
-#define OFF_PAD_IDX 3
 
 static bool is_pressed[NUM_TOUCH_PADS] = {false};
 static touch_sensor_handle_t touch_handle = NULL;
@@ -33,15 +37,31 @@ static const int pad_ids[NUM_TOUCH_PADS] = {
     8  // ? spot notification touchpad
 };
 
-static TimerHandle_t off_hold_timer = NULL;
-static const int OFF_HOLD_TIME_MS = 500; // 500 ms
+#define OFF_HOLD_TIME_MS 500
+#define STANDBY_DOUBLE_MS 400
+#define COMBO_HOLD_TIME_MS 2000 // pads 0, 1 and 2 together start the testing routine
+#define SHOW_HOLD_TIME_MS 2000
 
-static TimerHandle_t combo_hold_timer = NULL;
-static const int COMBO_HOLD_TIME_MS = 2000; // 2000 ms
+static const gesture_pad_config_t pad_gestures[GESTURE_PADS] = {
+    [OFF_PAD_IDX] = { .long_ms = OFF_HOLD_TIME_MS, .double_ms = STANDBY_DOUBLE_MS }, // double tap for standby
+    [SPOT_PAD_IDX] = { .long_ms = SHOW_HOLD_TIME_MS }, // a tap still fires right away, holding on toggles show mode
+};
+static const gesture_chord_t combo_chord = { .mask = 0x07, .hold_ms = COMBO_HOLD_TIME_MS };
 
-static const float TOUCH_THRESH = 0.02f;
+static const float TOUCH_THRESH = TOUCH_MIN_RATIO;
 static float thresh2bm_ratio[NUM_TOUCH_PADS] = {TOUCH_THRESH,TOUCH_THRESH,TOUCH_THRESH,TOUCH_THRESH,TOUCH_THRESH,TOUCH_THRESH};
 
+#define TOUCH_RETUNE_MS 10000   // how often hardware thresholds may be reprogrammed
+#define TOUCH_FAST_WINDOW_MS 5000 // fast scanning this long after the last touch
+
+// Pause between two scans of all pads, and how often the tracker samples them. Fast
+// is back to back; idle trades up to 20 ms of touch latency for a sensor that is
+// mostly off; sleep (standby) scans slower still, within the 50 ms we allow a wake
+// touch, and wakes the CPU from light sleep on a touch
+static const float scan_interval_us[TOUCH_SCAN_MODES] = { 50.0f, 20000.0f, 30000.0f };
+static const int sample_period_ms[TOUCH_SCAN_MODES] = { 50, 250, 0 };
+static const char *const scan_mode_names[TOUCH_SCAN_MODES] = { "fast", "idle", "sleep" };
+
 #define TOUCH_SAMPLE_CFG_DEFAULT() ((touch_sensor_sample_config_t[]){TOUCH_SENSOR_V2_DEFAULT_SAMPLE_CONFIG(500, TOUCH_VOLT_LIM_L_0V5, TOUCH_VOLT_LIM_H_2V2)})
 #define TOUCH_CHAN_CFG_DEFAULT() ((touch_channel_config_t){ \
     .active_thresh = {2000}, \
@@ -53,28 +73,65 @@ touch_sensor_sample_config_t sample_cfg[TOUCH_SAMPLE_CFG_NUM] = TOUCH_SAMPLE_CFG
 touch_channel_config_t chan_cfg = TOUCH_CHAN_CFG_DEFAULT();
 
 
-// Action queue for pad press events
-static QueueHandle_t touch_action_queue = NULL;
+// Press and release events from the ISR, recognized in touch_task
+static gesture_ring_t touch_ring;
+static gesture_t gestures;
+static TaskHandle_t touch_task_handle = NULL;
+static touch_tracker_t tracker;
+static touch_sensor_config_t sens_cfg = TOUCH_SENSOR_DEFAULT_BASIC_CONFIG(TOUCH_SAMPLE_CFG_NUM, sample_cfg);
+static touch_scan_mode_t scan_mode = TOUCH_SCAN_FAST;
+static int64_t scan_mode_since_us;
+static touch_scan_stats_t scan_stats;
+static volatile bool sleep_scan_wanted = false;
+static touch_scan_mode_t gesture_mode;   // scan mode the gesture under way started in
+static uint32_t boot_benchmark[NUM_TOUCH_PADS];
+static uint32_t boot_thresh[NUM_TOUCH_PADS];
 
-void handle_touch_action(int pad) {
+// input_us is when the touch happened; every action that shows on the LEDs hands it
+// to lighting_show_input() as soon as the state changed, before any slow NVS write
+void handle_touch_action(int pad, int64_t input_us) {
     switch (pad) {
         case 0: settings.pattern_id = (settings.pattern_id + 1) % NUM_PATTERNS;
                 set_pattern(settings.pattern_id);
+                lighting_show_input(input_us);
                 save_settings(&settings);
                 break;
         case 1: settings.brightness = (settings.brightness + 1) % NUM_BRIGHTNESS_LEVELS;
                 set_brightness(settings.brightness);
+                lighting_show_input(input_us);
                 save_settings(&settings);
                 break;
-        case 2: generate_gene(&patterns[settings.pattern_id]);
+        case 2: // half the time take a favourite from a badge nearby instead of a random one
+                if ((esp_random() & 1) || !now_take_shared_genome(&patterns[settings.pattern_id])) {
+                    generate_gene(&patterns[settings.pattern_id]);
+                }
+                capture_genome(settings.pattern_id, &patterns[settings.pattern_id]);
+                // when leading a show, flash along with everyone following
+                if (show_mode_is_leader()) {
+                    show_mode_overlay(SHOW_OVERLAY_FLASH);
+                } else {
+                    flash_feedback_pattern();
+                }
+                lighting_show_input(input_us);
                 save_genomes_to_storage();
-                flash_feedback_pattern();
+                now_share_genome(settings.pattern_id, &patterns[settings.pattern_id], true);
                 break;
         case 3: turn_off(); break;
         case 4: show_battery_meter = true;
                 battery_meter_start_time = esp_timer_get_time() / 1000;
+                lighting_show_input(input_us);
+                break;
+        case 5: if (show_mode_is_leader()) {
+                    show_mode_overlay(SHOW_OVERLAY_FIREWORK);
+                } else {
+                    now_send_firework();
+                }
+                break;
+        case SHOW_ACTION:
+                show_mode_toggle_leader();
+                flash_feedback_pattern();
+                lighting_show_input(input_us);
                 break;
-        case 5: now_send_firework(); break;
     }
 }
 
@@ -86,79 +143,40 @@ static int find_pad_idx(int chan_id) {
 }
 
 
-static void off_hold_timer_callback(TimerHandle_t xTimer) {
-    // Trigger the OFF action
-    int pad_idx = OFF_PAD_IDX;
-    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
-    xQueueSendFromISR(touch_action_queue, &pad_idx, &xHigherPriorityTaskWoken);
-}
-
+static bool push_touch_event(int chan_id, bool down) {
+    int pad_idx = find_pad_idx(chan_id);
+    if (pad_idx < 0) return false;
+    is_pressed[pad_idx] = down;
+    trace_event(TRACE_TOUCH_ISR, (uint16_t)(pad_idx | down << 8));
+    gesture_event_t ev = { .t_us = esp_timer_get_time(), .pad = (uint8_t)pad_idx, .down = down };
+    gesture_ring_push(&touch_ring, &ev);
 
-static void combo_hold_timer_callback(TimerHandle_t xTimer) {
-    show_testing_routine = true;
-    xTaskCreatePinnedToCore((TaskFunction_t)testing_routine, "TestingRoutine", 4096, NULL, 5, NULL, 1);
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    if (touch_task_handle) {
+        vTaskNotifyGiveFromISR(touch_task_handle, &xHigherPriorityTaskWoken);
+    }
+    return xHigherPriorityTaskWoken == pdTRUE;
 }
 
 static bool touch_on_active_callback(touch_sensor_handle_t sens_handle, const touch_active_event_data_t *event, void *user_ctx)
 {
-    int pad_idx = find_pad_idx(event->chan_id);
-    if (pad_idx >= 0) {
-        is_pressed[pad_idx] = true;
-        if (pad_idx == OFF_PAD_IDX) {
-            if (off_hold_timer == NULL) {
-                off_hold_timer = xTimerCreate("OffHold", pdMS_TO_TICKS(OFF_HOLD_TIME_MS), pdFALSE, NULL, off_hold_timer_callback);
-            }
-            xTimerStart(off_hold_timer, 0); // Start or restart the timer for 1 second
-            return false; // Don't queue yet
-        }
-
-        // if all three pads are pressed, start the combo hold timer for the testing routine
-        if (is_pressed[0] && is_pressed[1] && is_pressed[2]) {
-            if (combo_hold_timer == NULL) {
-                combo_hold_timer = xTimerCreate("ComboHold", pdMS_TO_TICKS(COMBO_HOLD_TIME_MS), pdFALSE, NULL, combo_hold_timer_callback);
-            }
-            xTimerStart(combo_hold_timer, 0); // Start or restart the timer
-        } else {
-            if (combo_hold_timer != NULL) {
-                xTimerStop(combo_hold_timer, 0);
-            }
-        }
-        
-        BaseType_t xHigherPriorityTaskWoken = pdFALSE;
-        xQueueSendFromISR(touch_action_queue, &pad_idx, &xHigherPriorityTaskWoken);
-        return xHigherPriorityTaskWoken == pdTRUE;
-    }
-    return false;
+    return push_touch_event(event->chan_id, true);
 }
 
 static bool touch_on_inactive_callback(touch_sensor_handle_t sens_handle, const touch_inactive_event_data_t *event, void *user_ctx)
 {
-    int pad_idx = find_pad_idx(event->chan_id);
-    if (pad_idx >= 0) {
-        is_pressed[pad_idx] = false;
-        if (pad_idx == OFF_PAD_IDX) {
-            if (off_hold_timer != NULL) {
-                xTimerStop(off_hold_timer, 0);
-            }
-        }
-
-        // If any of pads 0, 1, or 2 is released and the testing routine is not showing, stop the combo hold timer
-        if ((pad_idx == 0 || pad_idx == 1 || pad_idx == 2) && !show_testing_routine){
-            if (combo_hold_timer != NULL) {
-                xTimerStop(combo_hold_timer, 0);
-            }
-        }
-
-    }
-    return false;
+    return push_touch_event(event->chan_id, false);
 }
 
 static void do_initial_scanning(touch_sensor_handle_t sens_handle)
 {
     ESP_ERROR_CHECK(touch_sensor_enable(sens_handle));
+    int64_t start = esp_timer_get_time();
     for (int i = 0; i < 3; i++) {
         ESP_ERROR_CHECK(touch_sensor_trigger_oneshot_scanning(sens_handle, 2000));
     }
+    // One scan of all pads with the sample config in use, which is what the sensor costs per scan
+    scan_stats.scan_us = (uint32_t)((esp_timer_get_time() - start) / 3);
     ESP_ERROR_CHECK(touch_sensor_disable(sens_handle));
     for (int i = 0; i < NUM_TOUCH_PADS; i++) {
         uint32_t benchmark[TOUCH_SAMPLE_CFG_NUM] = {0};
@@ -167,15 +185,16 @@ static void do_initial_scanning(touch_sensor_handle_t sens_handle)
             chan_cfg.active_thresh[j] = (uint32_t)(benchmark[j] * thresh2bm_ratio[i]);
         }
         ESP_ERROR_CHECK(touch_sensor_reconfig_channel(chan_handles[i], &chan_cfg));
+        boot_benchmark[i] = benchmark[0];
+        boot_thresh[i] = chan_cfg.active_thresh[0];
     }
 }
 
 void init_touch(void)
 {
-    // Create action queue
-    touch_action_queue = xQueueCreate(4, sizeof(int));
+    gesture_init(&gestures, pad_gestures, &combo_chord, 1);
     // 1. Sensor config
-    touch_sensor_config_t sens_cfg = TOUCH_SENSOR_DEFAULT_BASIC_CONFIG(TOUCH_SAMPLE_CFG_NUM, sample_cfg);
+    sens_cfg.meas_interval_us = scan_interval_us[TOUCH_SCAN_FAST];
     ESP_ERROR_CHECK(touch_sensor_new_controller(&sens_cfg, &touch_handle));
     // 2. Create and enable each channel
     for (int i = 0; i < NUM_TOUCH_PADS; i++) {
@@ -186,16 +205,28 @@ void init_touch(void)
     ESP_ERROR_CHECK(touch_sensor_config_filter(touch_handle, &filter_cfg));
     // 4. Initial scan to calibrate thresholds
     do_initial_scanning(touch_handle);
+    touch_tracker_init(&tracker, NUM_TOUCH_PADS, boot_benchmark, boot_thresh);
     // 5. Register callbacks
     touch_event_callbacks_t callbacks = {
         .on_active = touch_on_active_callback,
         .on_inactive = touch_on_inactive_callback,
     };
     ESP_ERROR_CHECK(touch_sensor_register_callbacks(touch_handle, &callbacks, NULL));
+    // 6. A touch wakes the CPU from light sleep
+    touch_sleep_config_t sleep_cfg = TOUCH_SENSOR_DEFAULT_LSLP_CONFIG();
+    ESP_ERROR_CHECK(touch_sensor_config_sleep_wakeup(touch_handle, &sleep_cfg));
     // 7. Enable sensor and start scanning
     ESP_ERROR_CHECK(touch_sensor_enable(touch_handle));
     ESP_ERROR_CHECK(touch_sensor_start_continuous_scanning(touch_handle));
+    scan_mode_since_us = esp_timer_get_time();
     ESP_LOGI(TAG, "Touch pads initialized");
+
+    // Sensor on-time per mode; its current scales with this, and a touch waits up to a period to be seen
+    for (int m = 0; m < TOUCH_SCAN_MODES; m++) {
+        uint32_t period_us = scan_stats.scan_us + (uint32_t)scan_interval_us[m];
+        ESP_LOGI(TAG, "Touch scan %s: every %" PRIu32 " us, sensing %.1f %% of the time", scan_mode_names[m],
+                 period_us, 100.0f * scan_stats.scan_us / period_us);
+    }
 }
 
 bool get_is_touched(int pad_num)
@@ -205,21 +236,228 @@ bool get_is_touched(int pad_num)
     return is_pressed[pad_num];
 }
 
+const gesture_latency_t *touch_gesture_latency(void)
+{
+    return gestures.latency;
+}
+
+void touch_get_tracker_stats(touch_track_stats_t *out)
+{
+    *out = tracker.stats;
+}
+
+void touch_set_sleep_scan(bool sleep)
+{
+    sleep_scan_wanted = sleep;
+    if (touch_task_handle) {
+        xTaskNotifyGive(touch_task_handle);
+    }
+}
+
+void touch_get_scan_stats(touch_scan_stats_t *out)
+{
+    *out = scan_stats;
+    out->mode = scan_mode;
+    out->time_us[scan_mode] += esp_timer_get_time() - scan_mode_since_us;
+    for (int m = 0; m < TOUCH_SCAN_MODES; m++) {
+        out->period_us[m] = scan_stats.scan_us + (uint32_t)scan_interval_us[m];
+    }
+}
+
+static uint32_t read_smooth(int pad_idx)
+{
+    uint32_t data[TOUCH_SAMPLE_CFG_NUM] = {0};
+    touch_channel_read_data(chan_handles[pad_idx], TOUCH_CHAN_DATA_TYPE_SMOOTH, data);
+    return data[0];
+}
+
+void touch_get_pad_readings(uint32_t *benchmark, uint32_t *smooth)
+{
+    for (int i = 0; i < NUM_TOUCH_PADS; i++) {
+        uint32_t data[TOUCH_SAMPLE_CFG_NUM] = {0};
+        touch_channel_read_data(chan_handles[i], TOUCH_CHAN_DATA_TYPE_BENCHMARK, data);
+        benchmark[i] = data[0];
+        smooth[i] = read_smooth(i);
+    }
+}
+
+static void feed_gesture(const gesture_event_t *ev);
+
+// Baselines and noise follow the pads; touches the hardware missed become events of their own
+static void sample_pads(void)
+{
+    uint32_t smooth[NUM_TOUCH_PADS];
+    for (int i = 0; i < NUM_TOUCH_PADS; i++) smooth[i] = read_smooth(i);
+    uint32_t pressed, released;
+    touch_tracker_sample(&tracker, smooth, led_frame_power(), &pressed, &released);
+    for (int i = 0; i < NUM_TOUCH_PADS; i++) {
+        if (!((pressed | released) & (1u << i))) continue;
+        bool down = pressed & (1u << i);
+        is_pressed[i] = down;
+        gesture_event_t ev = { .t_us = esp_timer_get_time(), .pad = (uint8_t)i, .down = down };
+        ESP_LOGD(TAG, "Pad %d %s, missed by the touch sensor", i, down ? "touched" : "let go");
+        feed_gesture(&ev);
+    }
+}
+
+// Reprogramming the sensor needs it stopped; takes a couple of scans
+static void sensor_pause(void)
+{
+    ESP_ERROR_CHECK(touch_sensor_stop_continuous_scanning(touch_handle));
+    ESP_ERROR_CHECK(touch_sensor_disable(touch_handle));
+}
+
+static void sensor_resume(void)
+{
+    ESP_ERROR_CHECK(touch_sensor_enable(touch_handle));
+    ESP_ERROR_CHECK(touch_sensor_start_continuous_scanning(touch_handle));
+}
+
+static void set_scan_mode(touch_scan_mode_t mode)
+{
+    if (mode == scan_mode) return;
+    int64_t now = esp_timer_get_time();
+    scan_stats.time_us[scan_mode] += now - scan_mode_since_us;
+    scan_mode_since_us = now;
+    scan_mode = mode;
+    scan_stats.switches++;
+
+    sensor_pause();
+    sens_cfg.meas_interval_us = scan_interval_us[mode];
+    ESP_ERROR_CHECK(touch_sensor_reconfig_controller(touch_handle, &sens_cfg));
+    sensor_resume();
+    ESP_LOGD(TAG, "Touch scanning %s", scan_mode_names[mode]);
+}
+
+// Thresholds from boot drift away from what the pads look like now; reprogramming
+// needs the sensor stopped, so only while nobody is touching anything
+static void retune_thresholds(void)
+{
+    if (gestures.down_mask) return;
+    uint32_t want[NUM_TOUCH_PADS];
+    bool any = false;
+    for (int i = 0; i < NUM_TOUCH_PADS; i++) {
+        want[i] = touch_tracker_retune(&tracker, i);
+        any |= want[i] != 0;
+    }
+    if (!any) return;
+
+    sensor_pause();
+    for (int i = 0; i < NUM_TOUCH_PADS; i++) {
+        if (!want[i]) continue;
+        for (int j = 0; j < TOUCH_SAMPLE_CFG_NUM; j++) {
+            chan_cfg.active_thresh[j] = want[i];
+        }
+        if (touch_sensor_reconfig_channel(chan_handles[i], &chan_cfg) == ESP_OK) {
+            ESP_LOGI(TAG, "Pad %d threshold %" PRIu32 " -> %" PRIu32, i, tracker.pads[i].hw_threshold, want[i]);
+            touch_tracker_set_hw(&tracker, i, want[i]);
+        }
+    }
+    sensor_resume();
+}
+
+static void act_on_gesture(const gesture_out_t *out)
+{
+    trace_event(TRACE_GESTURE, (uint16_t)(out->pad | out->type << 8));
+    capture_touch(out->type, out->pad, out->due_us);
+    int action = touch_action(out, show_testing_routine, standby_active());
+    switch (action) {
+        case TOUCH_NONE:
+            return;
+        case TOUCH_TEST:
+            testing_routine_start();
+            break;
+        case TOUCH_WAKE:
+            standby_exit(out->due_us);
+            break;
+        case TOUCH_STANDBY:
+            standby_enter();
+            break;
+        default:
+            handle_touch_action(action, out->due_us);
+            gesture_record_latency(&gestures, out, esp_timer_get_time());
+            break;
+    }
+    // Per scan mode too, so what slow scanning costs in latency shows next to what it saves
+    int64_t done_us = esp_timer_get_time();
+    gesture_latency_t *l = &scan_stats.latency[gesture_mode];
+    uint32_t us = done_us > out->due_us ? (uint32_t)(done_us - out->due_us) : 0;
+    l->count++;
+    l->latency_sum_us += us;
+    if (us > l->latency_max_us) l->latency_max_us = us;
+    ESP_LOGD(TAG, "%s on pad %d, acted on after %" PRIu32 " us", gesture_name(out->type), out->pad, us);
+}
+
+static void feed_gesture(const gesture_event_t *ev)
+{
+    gesture_out_t out[GESTURE_OUT_MAX];
+    int n = gesture_feed(&gestures, ev, out);
+    for (int i = 0; i < n; i++) act_on_gesture(&out[i]);
+}
+
 void touch_task(void *param)
 {
-    int pad_idx;
+    touch_task_handle = xTaskGetCurrentTaskHandle();
+    gesture_out_t out[GESTURE_OUT_MAX];
+    gesture_event_t ev;
+    uint32_t dropped = 0;
+    touch_track_stats_t seen = {0};
+    int64_t next_sample_us = 0, next_retune_us = esp_timer_get_time() + TOUCH_RETUNE_MS * 1000LL;
+    int64_t fast_until_us = esp_timer_get_time() + TOUCH_FAST_WINDOW_MS * 1000LL;
     while (1) {
-        if (show_testing_routine) {
-            vTaskDelay(20 / portTICK_PERIOD_MS);
-            continue;
+        // Sleep until the ISR has something, a hold runs out, the pads are due a sample
+        // or it's time to slow the scanning down
+        int64_t due = gesture_next_due_us(&gestures);
+        if (sample_period_ms[scan_mode] && next_sample_us < due) due = next_sample_us;
+        if (scan_mode == TOUCH_SCAN_FAST && fast_until_us < due) due = fast_until_us;
+        TickType_t wait = portMAX_DELAY;
+        if (due != INT64_MAX) {
+            int64_t left_us = due - esp_timer_get_time();
+            wait = left_us > 0 ? pdMS_TO_TICKS((left_us + 999) / 1000) + 1 : 0;
+        }
+        ulTaskNotifyTake(pdTRUE, wait);
+
+        // A press only counts if the pad reads clear of the noise the LEDs make right now
+        bool touched = false;
+        while (gesture_ring_pop(&touch_ring, &ev)) {
+            touched = true;
+            bool pass = ev.down ? touch_tracker_press(&tracker, ev.pad, read_smooth(ev.pad), led_frame_power())
+                                : touch_tracker_release(&tracker, ev.pad);
+            if (pass && ev.down && !gestures.down_mask) gesture_mode = scan_mode;
+            if (pass) feed_gesture(&ev);
+            if (pass && ev.down) scan_stats.touches[scan_mode]++;
+        }
+        int64_t now = esp_timer_get_time();
+        if (touched) fast_until_us = now + TOUCH_FAST_WINDOW_MS * 1000LL;
+        if (sleep_scan_wanted) {
+            set_scan_mode(TOUCH_SCAN_SLEEP);
+        } else if (touched || gestures.down_mask || scan_mode == TOUCH_SCAN_SLEEP) {
+            if (scan_mode == TOUCH_SCAN_SLEEP) fast_until_us = now + TOUCH_FAST_WINDOW_MS * 1000LL;
+            set_scan_mode(TOUCH_SCAN_FAST);
+        } else if (now >= fast_until_us) {
+            set_scan_mode(TOUCH_SCAN_IDLE);
         }
 
-        // Wait for a pad event from the ISR callback
-        if (xQueueReceive(touch_action_queue, &pad_idx, portMAX_DELAY) == pdPASS) {
-            // Firework notification is so bright it can cause issues with voltage and affect touch readings
-            if (!show_firework_notification) {
-                handle_touch_action(pad_idx);
-            }
+        if (sample_period_ms[scan_mode] && now >= next_sample_us) {
+            sample_pads();
+            next_sample_us = now + sample_period_ms[scan_mode] * 1000LL;
+        }
+        if (scan_mode != TOUCH_SCAN_SLEEP && now >= next_retune_us) {
+            retune_thresholds();
+            next_retune_us = now + TOUCH_RETUNE_MS * 1000LL;
+        }
+        int n = gesture_poll(&gestures, esp_timer_get_time(), out);
+        for (int i = 0; i < n; i++) act_on_gesture(&out[i]);
+
+        if (tracker.stats.false_activations != seen.false_activations || tracker.stats.missed_activations != seen.missed_activations) {
+            ESP_LOGD(TAG, "Touch: %" PRIu32 " accepted, %" PRIu32 " false, %" PRIu32 " missed", tracker.stats.accepted,
+                     tracker.stats.false_activations, tracker.stats.missed_activations);
+            seen = tracker.stats;
+        }
+
+        if (touch_ring.dropped != dropped) {
+            ESP_LOGW(TAG, "%" PRIu32 " touch events lost, ring full", touch_ring.dropped - dropped);
+            dropped = touch_ring.dropped;
         }
     }
-}
\ No newline at end of file
+}
@@ -2,9 +2,35 @@
 #define TOUCH_INPUT_H
 
 #include <stdint.h>
+#include "gesture.h"
+#include "touch_tracker.h"
 
 void init_touch();
 bool get_is_touched(int pad_num);
 void touch_task(void *param);
+// Input-to-action time per GESTURE_* type
+const gesture_latency_t *touch_gesture_latency(void);
+// Presses rejected as LED noise and touches the sensor missed
+void touch_get_tracker_stats(touch_track_stats_t *out);
+// Each pad's benchmark and smoothed reading now, NUM_TOUCH_PADS of each (self-test)
+void touch_get_pad_readings(uint32_t *benchmark, uint32_t *smooth);
+
+// Fast scanning for a while after every touch, idle scanning after that; sleep scanning
+// (slowest, wakes the CPU from light sleep on a touch) while asked for
+typedef enum { TOUCH_SCAN_FAST, TOUCH_SCAN_IDLE, TOUCH_SCAN_SLEEP, TOUCH_SCAN_MODES } touch_scan_mode_t;
+
+typedef struct {
+    touch_scan_mode_t mode;
+    uint32_t scan_us;                       // one scan of all pads, measured at boot
+    uint32_t period_us[TOUCH_SCAN_MODES];   // scan to scan; the sensor is on scan_us of it
+    uint64_t time_us[TOUCH_SCAN_MODES];
+    uint32_t touches[TOUCH_SCAN_MODES];     // presses that started in each mode
+    gesture_latency_t latency[TOUCH_SCAN_MODES]; // input to action of gestures begun in each mode; the
+                                            // sensor adds up to a period before the input is seen
+    uint32_t switches;
+} touch_scan_stats_t;
+
+void touch_set_sleep_scan(bool sleep);
+void touch_get_scan_stats(touch_scan_stats_t *out);
 
 #endif // TOUCH_INPUT_H
\ No newline at end of file
@@ -0,0 +1,116 @@
+#include <string.h>
+#include "touch_tracker.h"
+
+
+static int power_bin(uint8_t led_power) {
+    return led_power * TOUCH_POWER_BINS / 256;
+}
+
+
+void touch_tracker_init(touch_tracker_t *t, int count, const uint32_t baseline[], const uint32_t hw_threshold[]) {
+    memset(t, 0, sizeof(*t));
+    t->count = count < TOUCH_TRACK_PADS ? count : TOUCH_TRACK_PADS;
+    for (int i = 0; i < t->count; i++) {
+        touch_track_pad_t *p = &t->pads[i];
+        p->baseline = p->last = (float)baseline[i];
+        p->hw_threshold = hw_threshold[i];
+        // Until we have heard them, brighter bins are assumed noisier, so a bright
+        // frame right after boot doesn't turn into touches
+        for (int b = 0; b < TOUCH_POWER_BINS; b++) {
+            p->noise[b] = p->baseline * TOUCH_MIN_RATIO / TOUCH_NOISE_K * (1 + b);
+        }
+    }
+}
+
+
+float touch_tracker_threshold(const touch_tracker_t *t, int pad, uint8_t led_power) {
+    const touch_track_pad_t *p = &t->pads[pad];
+    float from_noise = TOUCH_NOISE_K * p->noise[power_bin(led_power)];
+    float floor = TOUCH_MIN_RATIO * p->baseline;
+    return from_noise > floor ? from_noise : floor;
+}
+
+
+void touch_tracker_sample(touch_tracker_t *t, const uint32_t smooth[], uint8_t led_power, uint32_t *pressed, uint32_t *released) {
+    *pressed = *released = 0;
+    int bin = power_bin(led_power);
+    for (int i = 0; i < t->count; i++) {
+        touch_track_pad_t *p = &t->pads[i];
+        float x = (float)smooth[i];
+        float delta = x - p->baseline;
+        float thresh = touch_tracker_threshold(t, i, led_power);
+        p->last = x;
+
+        if (p->hw_down) continue;
+        if (p->sw_down) {
+            // Half the threshold to let go, so a touch near the edge doesn't chatter
+            if (delta < thresh / 2) {
+                p->sw_down = false;
+                p->over = 0;
+                *released |= 1u << i;
+            }
+            continue;
+        }
+        if (delta > thresh) {
+            if (++p->over >= TOUCH_CONFIRM_SAMPLES) {
+                p->sw_down = true;
+                t->stats.missed_activations++;
+                *pressed |= 1u << i;
+            }
+            continue;
+        }
+        p->over = 0;
+        // Idle: follow slow drift (temperature, humidity, a hand near the badge) but
+        // not the rising edge of a touch
+        if (delta < thresh / 2) {
+            float dev = delta < 0 ? -delta : delta;
+            p->baseline += delta / TOUCH_BASELINE_RATE;
+            p->noise[bin] += (dev - p->noise[bin]) / TOUCH_NOISE_RATE;
+        }
+    }
+}
+
+
+bool touch_tracker_press(touch_tracker_t *t, int pad, uint32_t smooth, uint8_t led_power) {
+    if (pad < 0 || pad >= t->count) return true;
+    touch_track_pad_t *p = &t->pads[pad];
+    p->last = (float)smooth;
+    if (p->sw_down) {
+        // We already reported this one; the hardware caught up
+        p->sw_down = false;
+        p->hw_down = true;
+        return false;
+    }
+    if ((float)smooth - p->baseline <= touch_tracker_threshold(t, pad, led_power)) {
+        t->stats.false_activations++;
+        return false;
+    }
+    p->hw_down = true;
+    p->over = 0;
+    t->stats.accepted++;
+    return true;
+}
+
+
+bool touch_tracker_release(touch_tracker_t *t, int pad) {
+    if (pad < 0 || pad >= t->count) return true;
+    touch_track_pad_t *p = &t->pads[pad];
+    bool was_down = p->hw_down;
+    p->hw_down = false;
+    return was_down;
+}
+
+
+uint32_t touch_tracker_retune(const touch_tracker_t *t, int pad) {
+    const touch_track_pad_t *p = &t->pads[pad];
+    uint32_t want = (uint32_t)touch_tracker_threshold(t, pad, 0);
+    if (want == 0) want = 1;
+    float off = ((float)want - (float)p->hw_threshold) / (float)(p->hw_threshold ? p->hw_threshold : 1);
+    if (off < TOUCH_RETUNE_CHANGE && off > -TOUCH_RETUNE_CHANGE) return 0;
+    return want;
+}
+
+
+void touch_tracker_set_hw(touch_tracker_t *t, int pad, uint32_t hw_threshold) {
+    t->pads[pad].hw_threshold = hw_threshold;
+}
@@ -0,0 +1,65 @@
+#ifndef TOUCH_TRACKER_H
+#define TOUCH_TRACKER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Touch pad baselines and noise, kept up to date while the badge runs. The touch
+// task feeds it periodic smooth readings of every pad together with how hard the
+// LEDs are being driven in the current frame; LED current couples into the pads,
+// so noise is learned separately for each LED power bin. A press the hardware
+// reports is only let through when the reading clears the noise at the current
+// LED power, and a reading that stays well above it without the hardware noticing
+// counts as a touch of its own. Readings go up when a pad is touched.
+// No ESP-IDF dependencies.
+
+#define TOUCH_TRACK_PADS 8
+#define TOUCH_POWER_BINS 4          // LED power 0-255 split evenly
+#define TOUCH_MIN_RATIO 0.02f       // threshold never below this share of the baseline
+#define TOUCH_NOISE_K 5.0f          // threshold at least this many times the noise
+#define TOUCH_CONFIRM_SAMPLES 3     // samples over threshold before we call a touch the hardware missed
+#define TOUCH_BASELINE_RATE 64      // baseline follows idle readings by 1/this per sample
+#define TOUCH_NOISE_RATE 32
+#define TOUCH_RETUNE_CHANGE 0.2f    // hardware threshold is reprogrammed once it's this far off
+
+typedef struct {
+    uint32_t accepted;              // hardware presses that cleared the noise
+    uint32_t false_activations;     // hardware presses that didn't
+    uint32_t missed_activations;    // touches only we saw
+} touch_track_stats_t;
+
+typedef struct {
+    float baseline;
+    float noise[TOUCH_POWER_BINS];  // mean absolute deviation of idle readings
+    float last;
+    uint8_t over;                   // consecutive samples over threshold
+    bool hw_down;                   // the hardware reported it, and we let it through
+    bool sw_down;                   // we reported it without the hardware
+    uint32_t hw_threshold;          // what the hardware is programmed with
+} touch_track_pad_t;
+
+typedef struct {
+    touch_track_pad_t pads[TOUCH_TRACK_PADS];
+    int count;
+    touch_track_stats_t stats;
+} touch_tracker_t;
+
+// Start from the baselines measured at boot, with thresholds as programmed
+void touch_tracker_init(touch_tracker_t *t, int count, const uint32_t baseline[], const uint32_t hw_threshold[]);
+
+// Periodic reading of every pad. Sets *pressed / *released to bit masks of pads where
+// a touch the hardware missed starts or ends
+void touch_tracker_sample(touch_tracker_t *t, const uint32_t smooth[], uint8_t led_power, uint32_t *pressed, uint32_t *released);
+// Hardware press, with a reading taken as it is handled; false if it was noise
+bool touch_tracker_press(touch_tracker_t *t, int pad, uint32_t smooth, uint8_t led_power);
+// Hardware release; false if the press wasn't let through, so there is nothing to release
+bool touch_tracker_release(touch_tracker_t *t, int pad);
+
+// Reading above the baseline that counts as a touch at this LED power
+float touch_tracker_threshold(const touch_tracker_t *t, int pad, uint8_t led_power);
+// Hardware threshold for a pad from what we learned with the LEDs dim, 0 while it's still
+// close enough to what is programmed. touch_tracker_set_hw() once it's been applied
+uint32_t touch_tracker_retune(const touch_tracker_t *t, int pad);
+void touch_tracker_set_hw(touch_tracker_t *t, int pad, uint32_t hw_threshold);
+
+#endif // TOUCH_TRACKER_H
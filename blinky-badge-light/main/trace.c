@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "esp_attr.h"
+#include "esp_cpu.h"
+#include "esp_ipc.h"
+#include "esp_timer.h"
+#include "esp_private/esp_clk.h"
+#include "freertos/FreeRTOS.h"
+
+#include "trace.h"
+
+#if TRACE_ENABLED
+
+// Each core writes only its own ring. An ISR can cut in between a task's index grab and
+// its write, so the index is taken atomically and records may land slightly out of order;
+// the decoder sorts them
+typedef struct {
+    uint32_t head;
+    trace_record_t rec[TRACE_RING_LEN];
+} trace_ring_t;
+
+static trace_ring_t rings[portNUM_PROCESSORS];
+
+// Cycle counter and esp_timer read together on one core, to place its records in time
+typedef struct {
+    uint32_t cycles;
+    int64_t us;
+} trace_anchor_t;
+
+
+IRAM_ATTR void trace_event(uint16_t id, uint16_t arg) {
+    uint32_t cycles = esp_cpu_get_cycle_count();
+    trace_ring_t *r = &rings[esp_cpu_get_core_id()];
+    uint32_t i = __atomic_fetch_add(&r->head, 1, __ATOMIC_RELAXED);
+    trace_record_t *rec = &r->rec[i % TRACE_RING_LEN];
+    rec->cycles = cycles;
+    rec->id = id;
+    rec->arg = arg;
+}
+
+
+static void take_anchor(void *arg) {
+    trace_anchor_t *a = arg;
+    a->cycles = esp_cpu_get_cycle_count();
+    a->us = esp_timer_get_time();
+}
+
+
+void trace_dump(void) {
+    trace_record_t *copy = malloc(sizeof(rings[0].rec));
+    if (!copy) return;
+
+    // Timestamps are in cycles at the full clock; in standby the clock drops and spans stretch
+    printf("trace begin 1 %d %d\n", esp_clk_cpu_freq() / 1000000, portNUM_PROCESSORS);
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        trace_ring_t *r = &rings[core];
+        uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        memcpy(copy, r->rec, sizeof(r->rec));
+        trace_anchor_t anchor;
+        if (esp_ipc_call_blocking(core, take_anchor, &anchor) != ESP_OK) continue;
+
+        uint32_t count = head < TRACE_RING_LEN ? head : TRACE_RING_LEN;
+        printf("trace core %d %08" PRIx32 " %" PRId64 " %" PRIu32 "\n", core, anchor.cycles, anchor.us, count);
+        for (uint32_t i = head - count; i != head; i++) {
+            const trace_record_t *rec = &copy[i % TRACE_RING_LEN];
+            printf("tr %d %08" PRIx32 " %u %u\n", core, rec->cycles, rec->id, rec->arg);
+        }
+    }
+    printf("trace end\n");
+    free(copy);
+}
+
+#else
+
+void trace_dump(void) {
+    printf("tracing is off, build with TRACE_ENABLED=1\n");
+}
+
+#endif
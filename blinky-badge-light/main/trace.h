@@ -0,0 +1,57 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// Binary event trace for the hot paths. trace_event() writes one 8 byte record,
+// CPU cycle count plus event and argument, into a RAM ring per core: no locks, no
+// formatting, safe in ISRs. The `trace` console command dumps both rings as text
+// lines, and sim/trace-decode turns a captured monitor log into Chrome trace JSON
+// (chrome://tracing or ui.perfetto.dev).
+// The record format and event list have no ESP-IDF dependencies; the host decoder
+// includes this header too.
+
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 1
+#endif
+#define TRACE_RING_LEN 512          // records per core, power of two
+
+// X(id, name, kind): kind B starts a span, E ends the span of the event before it,
+// I is an instant
+#define TRACE_EVENTS(X) \
+    X(TRACE_FRAME_START,    "frame",        'B') \
+    X(TRACE_FRAME_END,      "frame",        'E') \
+    X(TRACE_RMT_START,      "rmt",          'B') \
+    X(TRACE_RMT_DONE,       "rmt",          'E') \
+    X(TRACE_I2S_BLOCK,      "i2s block",    'I') \
+    X(TRACE_AUDIO_START,    "audio",        'B') \
+    X(TRACE_AUDIO_END,      "audio",        'E') \
+    X(TRACE_TOUCH_ISR,      "touch isr",    'I') \
+    X(TRACE_GESTURE,        "gesture",      'I') \
+    X(TRACE_RADIO_RX,       "radio rx",     'I') \
+    X(TRACE_RADIO_TX,       "radio tx",     'B') \
+    X(TRACE_RADIO_TX_DONE,  "radio tx",     'E') \
+    X(TRACE_SET_PATTERN,    "set pattern",  'I') \
+    X(TRACE_SET_BRIGHTNESS, "set brightness", 'I') \
+    X(TRACE_MARK,           "mark",         'I')
+
+#define TRACE_ID(id, name, kind) id,
+enum { TRACE_EVENTS(TRACE_ID) TRACE_EVENT_COUNT };
+#undef TRACE_ID
+
+typedef struct {
+    uint32_t cycles;                // CPU cycle counter of the core that wrote it, wraps
+    uint16_t id;
+    uint16_t arg;                   // event specific: pad, length, frame number...
+} trace_record_t;
+
+#if TRACE_ENABLED
+void trace_event(uint16_t id, uint16_t arg);
+#else
+static inline void trace_event(uint16_t id, uint16_t arg) {}
+#endif
+
+// Prints both rings to stdout between `trace begin` and `trace end` lines
+void trace_dump(void);
+
+#endif // TRACE_H
@@ -1,38 +1,50 @@
 #include <math.h>
 #include "genes.h"
 #include "led_utils.h"
-#include "microphone.h"
-#include "pins.h"
 #include "led_control.h"
-#include "esp_log.h"
+#include "render.h"
+#include "vu_meter.h"
 
 static float vu_display_level = 0.0f;
+#ifndef VU_ATTACK_RATE
 #define VU_ATTACK_RATE 0.25f  // How fast it can rise
+#endif
+#ifndef VU_DECAY_RATE
 #define VU_DECAY_RATE 0.02f   // How slow it falls
+#endif
+
+float vu_meter_level(void) {
+    return vu_display_level;
+}
+
+void vu_meter_set_level(float level) {
+    vu_display_level = level;
+}
 
 static inline uint8_t scale_channel(uint8_t c, float scale) {
     return (uint8_t)(c * scale);
 }
 
 void render_vu_meter_pattern(uint8_t *framebuffer, const genome *g, int loop) {
-    if (smooth_dB_brightness_level > vu_display_level) {
-        vu_display_level += VU_ATTACK_RATE * (smooth_dB_brightness_level - vu_display_level);
+    float sound_level = render_sound_level();
+    if (sound_level > vu_display_level) {
+        vu_display_level += VU_ATTACK_RATE * (sound_level - vu_display_level);
     } else {
         vu_display_level -= VU_DECAY_RATE;
-        if (vu_display_level < smooth_dB_brightness_level)
-            vu_display_level = smooth_dB_brightness_level;
+        if (vu_display_level < sound_level)
+            vu_display_level = sound_level;
         if (vu_display_level < 0.0f) vu_display_level = 0.0f;
     }
 
-    int levels = sizeof(heart_fill_order) / sizeof(heart_fill_order[0]);
+    int levels = LED_FILL_LEVELS;
     int num_lit_levels = (int)ceilf(vu_display_level * levels);
     num_lit_levels = (int)fmaxf(0, fminf(num_lit_levels, levels));
 
     float global_brightness = effective_brightness / 255.0f;
 
     for (int lvl = 0; lvl < levels; lvl++) {
-        int led_idx0 = heart_fill_order[lvl][0];
-        int led_idx1 = heart_fill_order[lvl][1];
+        int led_idx0 = led_fill_order[lvl][0];
+        int led_idx1 = led_fill_order[lvl][1];
         uint8_t r0 = 0, g0 = 0, b0 = 0;
 
         if (lvl < num_lit_levels) {
@@ -40,7 +52,7 @@ void render_vu_meter_pattern(uint8_t *framebuffer, const genome *g, int loop) {
             hsv_to_rgb(hue0, g->sat, 255, &r0, &g0, &b0);
 
             float per_level = (levels > 1) ? (0.7f + 0.3f * ((float)lvl / (levels - 1))) : 1.0f;
-            float pos_brightness = fminf(fmaxf(per_level * smooth_dB_brightness_level, 0.2f), 1.0f);
+            float pos_brightness = fminf(fmaxf(per_level * sound_level, 0.2f), 1.0f);
             float scale = pos_brightness * global_brightness;
 
             r0 = scale_channel(r0, scale);
@@ -5,5 +5,8 @@
 #include "genes.h"
 
 void render_vu_meter_pattern(uint8_t *framebuffer, const genome *g, int loop);
+// The meter's displayed level, which rises and falls towards the sound level frame by frame
+float vu_meter_level(void);
+void vu_meter_set_level(float level);
 
 #endif // VU_METER_H
\ No newline at end of file
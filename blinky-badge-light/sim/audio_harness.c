@@ -0,0 +1,468 @@
+// Streams WAV recordings through the badge's sound pipeline to judge how it reacts to
+// music: the dB of each microphone block (sound_block_db), the level range, brightness
+// and beats (main/sound.c) and the frames of the sound-reactive pattern or the VU meter
+// (main/render.c, main/vu_meter.c), all the badge's own code.
+//
+//   ./audio-harness set1.wav set2.wav ...     summary per file and over all of them
+//   ./audio-harness -c set1.wav > frames.csv  every frame: dB, level, VU level, every LED
+//
+//   -p N    pattern to render, 3 the sound-reactive one (default), 4 the VU meter
+//   -g DB   dB SPL a full-scale sample stands for (default 120, as the badge's mic)
+//   -b N    brightness level 0-4 (default 4)
+//
+// Timing follows the badge: the I2S DMA fills 240-frame buffers at 44.1 kHz and drops
+// the oldest when nobody reads them, the microphone task reads 512 frames and sleeps 20
+// ms, the lighting task renders, refreshes the strip and waits 20 ms, both at 100 Hz
+// tick resolution. Onsets are found in the audio itself, independent of the badge's beat
+// detection, and the latency is until a refresh ends with the LEDs visibly brighter.
+// Flicker counts frame-to-frame steps that reverse right away. CPU time is the host's,
+// per block; the badge's own is in the `mic` stats console command.
+// Tunables can be overridden at build time: make audio-harness SOUND_FLAGS="-DVU_DECAY_RATE=0.04f"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "render.h"
+#include "led_control.h"
+#include "led_utils.h"
+#include "sound.h"
+#include "vu_meter.h"
+#include "storage.h"
+
+#define SAMPLE_RATE 44100
+
+// As the badge has them
+#define DMA_DESC_NUM 6              // I2S_CHANNEL_DEFAULT_CONFIG
+#define DMA_FRAME_NUM 240
+#define DMA_SLOTS (DMA_DESC_NUM + 2)
+#define MIC_BLOCK_FRAMES 512        // SAMPLE_BUFF_SIZE in main/microphone.c, 32-bit frames
+#define MIC_DELAY_TICKS 2           // vTaskDelay(pdMS_TO_TICKS(20)) after every block
+#define MIC_SETTLE_BLOCKS 5
+#define MIC_PRIME_BLOCKS 5
+#define FRAME_WAIT_TICKS 2          // ulTaskNotifyTake() between frames in lighting_task()
+#define LOOP_PERIOD_MS 20
+#define TICK_US 10000               // CONFIG_FREERTOS_HZ 100
+#define REFRESH_US (LED_COUNT * 30 + 280) // 24 bits an LED at 800 kHz and the reset gap
+
+// Onsets in the audio: a 256-sample window this much louder than the last ~200 ms
+#define ONSET_WINDOW 256
+#define ONSET_DB 9.0f
+#define ONSET_ALPHA 0.03f
+#define ONSET_FLOOR_DB 60.0f        // quieter windows don't count
+#define ONSET_GAP_MS 150
+// Light that rose by this share of the file's brightest frame answers an onset
+#define RESPONSE_RISE 0.1f
+#define RESPONSE_WINDOW_MS 400
+// Frame steps of at least this share that reverse on the next frame count as flicker
+#define FLICKER_STEP 0.05f
+
+badge_settings_t settings;
+genome patterns[NUM_PATTERNS];
+
+// Spatially flat: two whole periods over the strip, so the frame's mean follows the level
+static const genome harness_genome = {
+    .cd_period = 2, .cd_rate = 128, .sat = 255, .hue_rate = 2, .hue_bound = 255,
+};
+
+typedef struct {
+    FILE *f;
+    int channels, bits, format;     // format 1 integer PCM, 3 float
+    long left;                      // frames not read yet
+    float gain;
+} wav_t;
+
+typedef struct {
+    int64_t light_us;               // when the refresh ended
+    float mean;                     // average channel, 0-255
+} frame_t;
+
+typedef struct {
+    double seconds;
+    long blocks, frames, dropped_desc;
+    int onsets, answered;
+    float *latencies_ms;
+    int latency_count;
+    double step_sum;
+    long reversals;
+    float peak;
+    double cpu_sum_us;
+    double cpu_max_us;
+} result_t;
+
+static sound_analysis_t analysis;
+static sound_features_t local, remote;
+static int64_t clock_us;
+
+
+// ---- Hooks ----
+
+int64_t render_hal_time_us(void) {
+    return clock_us;
+}
+
+
+int64_t render_hal_network_time_us(void) {
+    return clock_us;
+}
+
+
+float render_hal_sound_level(uint32_t now_us) {
+    return sound_mix(&local, &remote, now_us);
+}
+
+
+bool render_hal_show(uint8_t *framebuffer, int loop) {
+    return false;
+}
+
+
+// ---- WAV ----
+
+static uint32_t le32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+
+static bool wav_open(wav_t *w, const char *path, float gain) {
+    uint8_t h[12], c[8], fmt[40];
+    memset(w, 0, sizeof(*w));
+    w->gain = gain;
+    if (!(w->f = fopen(path, "rb"))) {
+        perror(path);
+        return false;
+    }
+    if (fread(h, 1, 12, w->f) != 12 || memcmp(h, "RIFF", 4) || memcmp(h + 8, "WAVE", 4)) goto bad;
+    while (fread(c, 1, 8, w->f) == 8) {
+        uint32_t len = le32(c + 4);
+        if (!memcmp(c, "fmt ", 4)) {
+            if (len < 16 || fread(fmt, 1, len < sizeof(fmt) ? len : sizeof(fmt), w->f) != (len < sizeof(fmt) ? len : sizeof(fmt))) goto bad;
+            if (len > sizeof(fmt)) fseek(w->f, len - sizeof(fmt), SEEK_CUR);
+            w->format = fmt[0] | fmt[1] << 8;
+            if (w->format == 0xfffe && len >= 26) w->format = fmt[24] | fmt[25] << 8; // WAVE_FORMAT_EXTENSIBLE
+            w->channels = fmt[2] | fmt[3] << 8;
+            w->bits = fmt[14] | fmt[15] << 8;
+            if (le32(fmt + 4) != SAMPLE_RATE) {
+                fprintf(stderr, "%s: %u Hz, the badge samples at %d; resample it first, e.g. sox in.wav -r %d out.wav\n", path,
+                        le32(fmt + 4), SAMPLE_RATE, SAMPLE_RATE);
+                fclose(w->f);
+                return false;
+            }
+        } else if (!memcmp(c, "data", 4)) {
+            if (!w->channels) goto bad;
+            bool ok = (w->format == 1 && (w->bits == 16 || w->bits == 24 || w->bits == 32)) || (w->format == 3 && w->bits == 32);
+            if (!ok) {
+                fprintf(stderr, "%s: only 16, 24 and 32-bit PCM and 32-bit float are read\n", path);
+                fclose(w->f);
+                return false;
+            }
+            w->left = len / (w->channels * w->bits / 8);
+            return true;
+        } else {
+            fseek(w->f, len + (len & 1), SEEK_CUR);
+        }
+    }
+bad:
+    fprintf(stderr, "%s: not a WAV file\n", path);
+    fclose(w->f);
+    return false;
+}
+
+
+// Next n frames as mono samples in [-1, 1), false at the end
+static bool wav_read(wav_t *w, float *out, int n) {
+    if (w->left < n) return false;
+    int bytes = w->bits / 8, frame = bytes * w->channels;
+    uint8_t buf[DMA_FRAME_NUM * 8 * 4];
+    for (int done = 0; done < n;) {
+        int chunk = n - done < (int)(sizeof(buf) / frame) ? n - done : (int)(sizeof(buf) / frame);
+        if (fread(buf, frame, chunk, w->f) != (size_t)chunk) return false;
+        for (int i = 0; i < chunk; i++) {
+            float sum = 0.0f;
+            for (int ch = 0; ch < w->channels; ch++) {
+                const uint8_t *p = &buf[i * frame + ch * bytes];
+                if (w->format == 3) {
+                    float v;
+                    memcpy(&v, p, 4);
+                    sum += v;
+                } else if (bytes == 2) {
+                    sum += (int16_t)(p[0] | p[1] << 8) / 32768.0f;
+                } else if (bytes == 3) {
+                    sum += (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24) / 2147483648.0f;
+                } else {
+                    sum += (int32_t)le32(p) / 2147483648.0f;
+                }
+            }
+            out[done + i] = sum / w->channels * w->gain;
+        }
+        done += chunk;
+    }
+    w->left -= n;
+    return true;
+}
+
+
+// ---- Pipeline ----
+
+static int64_t desc_done_us(long k) {
+    return (int64_t)(k + 1) * DMA_FRAME_NUM * 1000000 / SAMPLE_RATE;
+}
+
+
+// First wake-up after n ticks, as vTaskDelay() and friends count them
+static int64_t after_ticks(int64_t t, int n) {
+    return (t / TICK_US + n) * TICK_US;
+}
+
+
+static int by_value(const void *a, const void *b) {
+    float x = *(const float *)a, y = *(const float *)b;
+    return x < y ? -1 : x > y;
+}
+
+
+static void csv_frame(int64_t t, float db, const uint8_t *fb) {
+    float level = sound_mix(&local, &remote, (uint32_t)t);
+    printf("%.1f,%.2f,%.3f,%.3f", t / 1000.0, db, level, vu_meter_level());
+    for (int i = 0; i < LED_COUNT; i++) {
+        int m = fb[i * 3] > fb[i * 3 + 1] ? fb[i * 3] : fb[i * 3 + 1];
+        printf(",%d", m > fb[i * 3 + 2] ? m : fb[i * 3 + 2]);
+    }
+    printf("\n");
+}
+
+
+static bool run(const char *path, float gain, bool csv, result_t *res) {
+    wav_t w;
+    if (!wav_open(&w, path, gain)) return false;
+    memset(res, 0, sizeof(*res));
+    sound_init(&analysis);
+    memset(&local, 0, sizeof(local));
+    vu_meter_set_level(0.0f);
+    flash_active = false;
+
+    // DMA buffers done and not read yet, oldest first, and the one being read from
+    static float desc[DMA_SLOTS][DMA_FRAME_NUM];
+    long next_desc = 0;
+    int queued = 0, first = 0, cur_off = DMA_FRAME_NUM, cur = 0;
+    bool have_cur = false;
+
+    int mic_blocks = 0;
+    float primed[MIC_PRIME_BLOCKS], last_db = 0.0f;
+    int32_t block[MIC_BLOCK_FRAMES];
+    int64_t mic_at = 0, frame_at = 0;
+    uint8_t framebuffer[LED_COUNT * 3];
+
+    float onset_avg = 0.0f, window[ONSET_WINDOW];
+    int window_fill = 0;
+    int64_t last_onset_us = -ONSET_GAP_MS * 1000LL;
+    int64_t *onsets = NULL;
+    frame_t *frames = NULL;
+    long frames_max = 0, onsets_max = 0;
+
+    for (;;) {
+        int64_t t_desc = desc_done_us(next_desc);
+        if (t_desc <= mic_at && t_desc <= frame_at) {
+            // A DMA buffer fills up; the driver drops the oldest when all are waiting
+            if (queued == DMA_DESC_NUM) {
+                first = (first + 1) % DMA_SLOTS;
+                queued--;
+                res->dropped_desc++;
+            }
+            float *d = desc[(first + queued) % DMA_SLOTS];
+            if (!wav_read(&w, d, DMA_FRAME_NUM)) break;
+            queued++;
+            next_desc++;
+
+            for (int i = 0; i < DMA_FRAME_NUM; i++) {
+                window[window_fill++] = d[i];
+                if (window_fill < ONSET_WINDOW) continue;
+                window_fill = 0;
+                double e = 0.0;
+                for (int j = 0; j < ONSET_WINDOW; j++) e += window[j] * window[j];
+                float db = 10.0f * log10f(e / ONSET_WINDOW + 1e-16f) + 120.0f;
+                int64_t end_us = (next_desc - 1) * DMA_FRAME_NUM * 1000000LL / SAMPLE_RATE +
+                                 (int64_t)(i + 1) * 1000000 / SAMPLE_RATE;
+                if (onset_avg && db - onset_avg >= ONSET_DB && db >= ONSET_FLOOR_DB &&
+                    end_us - last_onset_us >= ONSET_GAP_MS * 1000LL) {
+                    last_onset_us = end_us;
+                    if (res->onsets == onsets_max) {
+                        onsets_max = onsets_max ? onsets_max * 2 : 1024;
+                        onsets = realloc(onsets, onsets_max * sizeof(*onsets));
+                    }
+                    onsets[res->onsets++] = end_us;
+                }
+                onset_avg = onset_avg ? onset_avg + ONSET_ALPHA * (db - onset_avg) : db;
+            }
+            continue;
+        }
+
+        if (mic_at <= frame_at) {
+            int have = (have_cur ? DMA_FRAME_NUM - cur_off : 0) + queued * DMA_FRAME_NUM;
+            if (have < MIC_BLOCK_FRAMES) {
+                // i2s_channel_read() blocks until the next buffer is done
+                mic_at = t_desc;
+                continue;
+            }
+            for (int n = 0; n < MIC_BLOCK_FRAMES;) {
+                if (!have_cur || cur_off == DMA_FRAME_NUM) {
+                    cur = first;
+                    first = (first + 1) % DMA_SLOTS;
+                    queued--;
+                    cur_off = 0;
+                    have_cur = true;
+                }
+                // What the mic puts in the 32-bit slot, as sound_block_db() reads it
+                float s = desc[cur][cur_off++];
+                s = s > 0.999f ? 0.999f : s < -0.999f ? -0.999f : s;
+                block[n++] = (int32_t)(s * 1073741824.0f);
+            }
+
+            struct timespec a, b;
+            clock_gettime(CLOCK_MONOTONIC, &a);
+            float db = sound_block_db(block, MIC_BLOCK_FRAMES);
+            mic_blocks++;
+            if (mic_blocks > MIC_SETTLE_BLOCKS + MIC_PRIME_BLOCKS) {
+                sound_block(&analysis, db, mic_at, &local);
+                last_db = db;
+                res->blocks++;
+                mic_at = after_ticks(mic_at, MIC_DELAY_TICKS);
+            } else if (mic_blocks > MIC_SETTLE_BLOCKS) {
+                // Power-up: settling and priming blocks are read back to back
+                primed[mic_blocks - MIC_SETTLE_BLOCKS - 1] = db;
+                if (mic_blocks == MIC_SETTLE_BLOCKS + MIC_PRIME_BLOCKS) sound_prime(&analysis, primed, MIC_PRIME_BLOCKS);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &b);
+            double us = (b.tv_sec - a.tv_sec) * 1e6 + (b.tv_nsec - a.tv_nsec) / 1e3;
+            res->cpu_sum_us += us;
+            if (us > res->cpu_max_us) res->cpu_max_us = us;
+            continue;
+        }
+
+        clock_us = frame_at;
+        render_frame(framebuffer, (int)(frame_at / 1000 / LOOP_PERIOD_MS % 256));
+        uint32_t sum = 0;
+        for (int i = 0; i < LED_COUNT * 3; i++) sum += framebuffer[i];
+        if (res->frames == frames_max) {
+            frames_max = frames_max ? frames_max * 2 : 4096;
+            frames = realloc(frames, frames_max * sizeof(*frames));
+        }
+        frame_t *fr = &frames[res->frames++];
+        fr->light_us = frame_at + REFRESH_US;
+        fr->mean = (float)sum / (LED_COUNT * 3);
+        if (fr->mean > res->peak) res->peak = fr->mean;
+        if (csv) csv_frame(frame_at, last_db, framebuffer);
+        frame_at = after_ticks(fr->light_us, FRAME_WAIT_TICKS);
+    }
+    fclose(w.f);
+    res->seconds = (double)next_desc * DMA_FRAME_NUM / SAMPLE_RATE;
+
+    // Onset to the first refresh visibly brighter than the one before the onset
+    float rise = RESPONSE_RISE * res->peak;
+    res->latencies_ms = malloc((res->onsets + 1) * sizeof(float));
+    long f = 0;
+    for (int o = 0; o < res->onsets; o++) {
+        while (f < res->frames && frames[f].light_us <= onsets[o]) f++;
+        if (f == 0 || f == res->frames) continue;
+        float base = frames[f - 1].mean;
+        for (long g = f; g < res->frames && frames[g].light_us - onsets[o] <= RESPONSE_WINDOW_MS * 1000LL; g++) {
+            if (frames[g].mean >= base + rise) {
+                res->latencies_ms[res->latency_count++] = (frames[g].light_us - onsets[o]) / 1000.0f;
+                break;
+            }
+        }
+    }
+    res->answered = res->latency_count;
+
+    float step_min = FLICKER_STEP * res->peak, prev = 0.0f;
+    for (long i = 1; i < res->frames; i++) {
+        float d = frames[i].mean - frames[i - 1].mean;
+        res->step_sum += fabsf(d) / (res->peak ? res->peak : 1.0f);
+        if (fabsf(d) >= step_min && fabsf(prev) >= step_min && (d > 0) != (prev > 0)) res->reversals++;
+        prev = d;
+    }
+    free(frames);
+    free(onsets);
+    return true;
+}
+
+
+static void print_result(const char *name, const result_t *r) {
+    printf("%s: %.1f s, %ld blocks (%.1f per second), %ld frames (%.1f fps), %ld DMA buffers dropped\n", name, r->seconds,
+           r->blocks, r->blocks / r->seconds, r->frames, r->frames / r->seconds, r->dropped_desc);
+    printf("  onsets: %d, %d lit up within %d ms", r->onsets, r->answered, RESPONSE_WINDOW_MS);
+    if (r->latency_count) {
+        int n = r->latency_count;
+        printf(": median %.0f ms, 90%% %.0f ms, worst %.0f ms", r->latencies_ms[n / 2], r->latencies_ms[n * 9 / 10],
+               r->latencies_ms[n - 1]);
+    }
+    printf("\n");
+    printf("  flicker: %.4f mean step of the brightest frame, %.2f reversals per second\n",
+           r->frames > 1 ? r->step_sum / (r->frames - 1) : 0.0, r->reversals / r->seconds);
+    printf("  cpu: %.2f us per block average, %.1f us worst (host)\n",
+           r->cpu_sum_us / (r->blocks + MIC_SETTLE_BLOCKS + MIC_PRIME_BLOCKS), r->cpu_max_us);
+}
+
+
+int main(int argc, char **argv) {
+    bool csv = false;
+    int pattern = NUM_PATTERNS - 2, level = NUM_BRIGHTNESS_LEVELS - 1, arg = 1;
+    float full_scale_db = 120.0f;
+    for (; arg < argc && argv[arg][0] == '-' && argv[arg][1]; arg++) {
+        if (!strcmp(argv[arg], "-c")) csv = true;
+        else if (!strcmp(argv[arg], "-p") && arg + 1 < argc) pattern = atoi(argv[++arg]);
+        else if (!strcmp(argv[arg], "-g") && arg + 1 < argc) full_scale_db = atof(argv[++arg]);
+        else if (!strcmp(argv[arg], "-b") && arg + 1 < argc) level = atoi(argv[++arg]);
+        else break;
+    }
+    if (arg == argc || (csv && argc - arg != 1) || pattern < 0 || pattern >= NUM_PATTERNS) {
+        fprintf(stderr, "usage: %s [-c] [-p PATTERN] [-g DB] [-b LEVEL] WAV...\n"
+                        "  -c CSV of every frame, one file only\n", argv[0]);
+        return 1;
+    }
+
+    led_layout_init();
+    for (int i = 0; i < NUM_PATTERNS; i++) patterns[i] = harness_genome;
+    settings.pattern_id = pattern;
+    settings.brightness = level;
+    set_pattern(pattern);
+    set_brightness(level);
+    float gain = powf(10.0f, (full_scale_db - 120.0f) / 20.0f);
+
+    if (csv) {
+        printf("t_ms,db,level,vu");
+        for (int i = 0; i < LED_COUNT; i++) printf(",led%d", i);
+        printf("\n");
+    }
+    result_t all = { 0 }, r;
+    int files = 0;
+    for (; arg < argc; arg++) {
+        if (!run(argv[arg], gain, csv, &r)) return 1;
+        qsort(r.latencies_ms, r.latency_count, sizeof(float), by_value);
+        if (!csv) print_result(argv[arg], &r);
+        files++;
+        all.seconds += r.seconds;
+        all.blocks += r.blocks;
+        all.frames += r.frames;
+        all.dropped_desc += r.dropped_desc;
+        all.onsets += r.onsets;
+        all.answered += r.answered;
+        all.latencies_ms = realloc(all.latencies_ms, (all.latency_count + r.latency_count + 1) * sizeof(float));
+        memcpy(&all.latencies_ms[all.latency_count], r.latencies_ms, r.latency_count * sizeof(float));
+        all.latency_count += r.latency_count;
+        all.step_sum += r.step_sum;
+        all.reversals += r.reversals;
+        all.cpu_sum_us += r.cpu_sum_us;
+        if (r.cpu_max_us > all.cpu_max_us) all.cpu_max_us = r.cpu_max_us;
+        free(r.latencies_ms);
+    }
+    if (files > 1) {
+        qsort(all.latencies_ms, all.latency_count, sizeof(float), by_value);
+        print_result("all", &all);
+    }
+    free(all.latencies_ms);
+    return 0;
+}
@@ -0,0 +1,303 @@
+// Drives the dedup set (main/now_dedup.c) at relay-storm rates and checks every
+// answer against an exact record of what it was told, so a wrong answer shows up
+// the moment it happens instead of as a firework that didn't fire.
+//
+//   ./dedup-stress               every phase, default rates
+//   ./dedup-stress -r 8000       messages per second heard, copies included
+//   ./dedup-stress -t 120 -s 7   seconds per phase, random seed
+//
+// Two kinds of wrong answer:
+//   false drop  a message reported as seen that wasn't, within the window; the firework
+//               is lost on this badge and never relayed. Never allowed.
+//   miss        a copy seen within the window reported as new; fires and relays twice.
+//               Only allowed once the table is over capacity, and never more often
+//               than it evicted a live entry.
+// Phases:
+//   storm       thousands of copies a second of a few dozen new fireworks, under capacity
+//   expiry      copies right at the edge of the window, 1 ms either side
+//   reuse       the same msg_id from many origins
+//   chains      IDs that all hash to one slot: full probe chains, expired entries in
+//               the middle of a chain recycled while live ones sit behind them
+//   wrap        the storm again with the millisecond clock wrapping around
+//   overload    more new fireworks than the table holds; misses allowed, false drops not
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "now_dedup.h"
+
+#define REF_SLOTS (1 << 22)        // exact record, never full in any phase
+#define ORIGINS 512
+#define CHAIN_IDS (NOW_DEDUP_MAX_PROBE * 3)
+
+typedef struct {
+    uint8_t mac[6];
+    uint32_t msg_id;
+} msg_t;
+
+typedef struct {
+    uint32_t t_ms;
+    uint32_t seq;       // keeps same-time copies in the order they were made
+    msg_t m;
+} copy_t;
+
+typedef struct {
+    msg_t m;
+    uint32_t seen_ms;
+    bool used;
+} ref_entry_t;
+
+typedef struct {
+    uint64_t checks, duplicates, false_drops, misses;
+} result_t;
+
+static int rate = 5000;            // copies heard per second
+static int seconds = 60;
+static uint64_t seed = 1;
+static uint64_t rng_state;
+
+static uint8_t origins[ORIGINS][6];
+static ref_entry_t *ref;
+static copy_t *copies;
+static size_t copy_count, copy_cap;
+static int failures;
+
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+static uint32_t rng_below(uint32_t n) {
+    return (uint32_t)((rng_next() >> 32) % n);
+}
+
+
+// ---- Exact record ----
+
+static ref_entry_t *ref_find(const msg_t *m) {
+    uint64_t h = m->msg_id * 0x9E3779B97F4A7C15ULL;
+    for (int i = 0; i < 6; i++) h = (h ^ m->mac[i]) * 0x100000001B3ULL;
+    size_t i = (h >> 20) & (REF_SLOTS - 1);
+    while (ref[i].used && (ref[i].m.msg_id != m->msg_id || memcmp(ref[i].m.mac, m->mac, 6))) i = (i + 1) & (REF_SLOTS - 1);
+    return &ref[i];
+}
+
+
+// One copy heard: ask the set and compare with the record
+static void check(now_dedup_t *d, const msg_t *m, uint32_t now_ms, result_t *r) {
+    ref_entry_t *e = ref_find(m);
+    bool seen = e->used && (uint32_t)(now_ms - e->seen_ms) < NOW_DEDUP_WINDOW_MS;
+    bool got = now_dedup_check_and_insert(d, m->mac, m->msg_id, now_ms);
+    r->checks++;
+    if (got && !seen) r->false_drops++;
+    if (!got && seen) r->misses++;
+    if (got) {
+        r->duplicates++;
+    } else {
+        // Recorded anew, same as the set did
+        e->used = true;
+        e->m = *m;
+        e->seen_ms = now_ms;
+    }
+}
+
+
+// ---- Workloads ----
+
+static void add_copy(uint32_t t_ms, const msg_t *m) {
+    if (copy_count == copy_cap) {
+        copy_cap = copy_cap ? copy_cap * 2 : 1 << 16;
+        copies = realloc(copies, copy_cap * sizeof(copy_t));
+        if (!copies) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    copies[copy_count] = (copy_t){ .t_ms = t_ms, .seq = (uint32_t)copy_count, .m = *m };
+    copy_count++;
+}
+
+static int cmp_copy(const void *a, const void *b) {
+    const copy_t *x = a, *y = b;
+    if (x->t_ms != y->t_ms) return x->t_ms < y->t_ms ? -1 : 1;
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static msg_t random_msg(void) {
+    msg_t m;
+    memcpy(m.mac, origins[rng_below(ORIGINS)], 6);
+    m.msg_id = (uint32_t)(rng_next() >> 32);
+    return m;
+}
+
+// New fireworks at new_per_s, each heard as relay copies spread the way a storm
+// spreads them: most within a few hundred ms, a tail out past the window.
+// Times are relative to the phase start.
+static void make_storm(int new_per_s, int copies_per_s) {
+    int fireworks = new_per_s * seconds;
+    int per_firework = copies_per_s / (new_per_s > 0 ? new_per_s : 1);
+    if (per_firework < 1) per_firework = 1;
+    for (int f = 0; f < fireworks; f++) {
+        msg_t m = random_msg();
+        uint32_t t0 = rng_below(seconds * 1000);
+        add_copy(t0, &m);
+        for (int c = 1; c < per_firework; c++) {
+            uint32_t delay = rng_below(8) ? rng_below(400) : rng_below(NOW_DEDUP_WINDOW_MS * 3 / 2);
+            add_copy(t0 + delay, &m);
+        }
+    }
+}
+
+// Copies 1 ms inside, at, and 1 ms past the end of the window, against a light storm
+static void make_expiry(void) {
+    make_storm(5, 500);
+    for (int f = 0; f < seconds * 5; f++) {
+        msg_t m = random_msg();
+        uint32_t t0 = rng_below(seconds * 1000);
+        add_copy(t0, &m);
+        add_copy(t0 + NOW_DEDUP_WINDOW_MS - 1, &m);
+        add_copy(t0 + NOW_DEDUP_WINDOW_MS, &m);
+        add_copy(t0 + NOW_DEDUP_WINDOW_MS + 1, &m);
+    }
+}
+
+// One msg_id from many origins at once; each origin's copy is its own firework
+static void make_reuse(void) {
+    for (int f = 0; f < seconds * 2; f++) {
+        uint32_t id = (uint32_t)(rng_next() >> 32);
+        uint32_t t0 = rng_below(seconds * 1000);
+        for (int o = 0; o < 8; o++) {
+            msg_t m = { .msg_id = id };
+            memcpy(m.mac, origins[rng_below(ORIGINS)], 6);
+            for (int c = 0; c < 10; c++) add_copy(t0 + rng_below(300), &m);
+        }
+    }
+}
+
+// Message IDs whose home slot is the same, found by where an empty set stores them
+static int colliding_ids(const uint8_t mac[6], uint32_t *ids, int want) {
+    static now_dedup_t probe;
+    int home = -1, found = 0;
+    for (uint32_t id = 1; found < want && id < 50000000; id++) {
+        now_dedup_init(&probe);
+        now_dedup_check_and_insert(&probe, mac, id, 0);
+        int slot = 0;
+        while (probe.table[slot].msg_id != id || !probe.table[slot].used) slot++;
+        if (home < 0) home = slot;
+        if (slot == home) ids[found++] = id;
+    }
+    return found;
+}
+
+// Fills a chain to the probe bound in two age groups, lets the older one expire,
+// inserts into the gaps and checks the younger group behind them is still found
+static void make_chains(void) {
+    uint32_t ids[CHAIN_IDS];
+    const uint8_t *mac = origins[0];
+    int n = colliding_ids(mac, ids, CHAIN_IDS);
+    if (n < CHAIN_IDS) {
+        fprintf(stderr, "only found %d colliding IDs\n", n);
+        exit(1);
+    }
+    int half = NOW_DEDUP_MAX_PROBE / 2;
+    for (uint32_t t = 0; t + 3 * NOW_DEDUP_WINDOW_MS < (uint32_t)seconds * 1000; t += 3 * NOW_DEDUP_WINDOW_MS) {
+        uint32_t young = t + NOW_DEDUP_WINDOW_MS / 2;
+        uint32_t later = t + NOW_DEDUP_WINDOW_MS + NOW_DEDUP_WINDOW_MS / 4; // old group expired, young one live
+        int base = (int)(rng_below(CHAIN_IDS - NOW_DEDUP_MAX_PROBE - half));
+        for (int i = 0; i < NOW_DEDUP_MAX_PROBE; i++) {
+            msg_t m = { .msg_id = ids[base + i] };
+            memcpy(m.mac, mac, 6);
+            add_copy(i < half ? t : young, &m);
+            add_copy((i < half ? t : young) + 50, &m);
+            if (i >= half) add_copy(later + 10, &m); // the young ones sit behind the recycled slots
+        }
+        for (int i = 0; i < half; i++) {
+            msg_t m = { .msg_id = ids[base + NOW_DEDUP_MAX_PROBE + i] };
+            memcpy(m.mac, mac, 6);
+            add_copy(later, &m);                  // land in the expired slots
+            add_copy(later + 20, &m);
+        }
+    }
+}
+
+
+// ---- Running ----
+
+static void run(const char *name, void (*make)(void), int new_per_s, uint32_t start_ms, bool may_miss) {
+    copy_count = 0;
+    memset(ref, 0, REF_SLOTS * sizeof(ref_entry_t));
+    if (make) make();
+    else make_storm(new_per_s, rate);
+    qsort(copies, copy_count, sizeof(copy_t), cmp_copy);
+
+    static now_dedup_t d;
+    now_dedup_init(&d);
+    result_t r = {0};
+    for (size_t i = 0; i < copy_count; i++) check(&d, &copies[i].m, start_ms + copies[i].t_ms, &r);
+
+    uint32_t span_ms = copy_count ? copies[copy_count - 1].t_ms + 1 : 1;
+    bool ok = r.false_drops == 0 && r.misses <= d.stats.evictions && (may_miss || r.misses == 0);
+    printf("%-9s %8.0f msg/s %7" PRIu64 " checks %7" PRIu64 " dups %6" PRIu32 " evictions %5" PRIu64 " misses %3" PRIu64 " false drops  %s\n",
+           name, r.checks * 1000.0 / span_ms, r.checks, r.duplicates, d.stats.evictions, r.misses, r.false_drops,
+           ok ? "ok" : "FAIL");
+    if (!ok) failures++;
+}
+
+static void run_expiry(void) { make_expiry(); }
+static void run_reuse(void) { make_reuse(); }
+static void run_chains(void) { make_chains(); }
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -r N     copies heard per second in the storm phases (default %d)\n"
+        "  -t S     seconds per phase (default %d)\n"
+        "  -s SEED  random seed (default %" PRIu64 ")\n",
+        prog, rate, seconds, seed);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "r:t:s:h")) != -1) {
+        switch (opt) {
+            case 'r': rate = atoi(optarg); break;
+            case 't': seconds = atoi(optarg); break;
+            case 's': seed = strtoull(optarg, NULL, 0); break;
+            default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (rate < 1 || seconds < 4 * NOW_DEDUP_WINDOW_MS / 1000) {
+        usage(argv[0]);
+        return 1;
+    }
+    rng_state = seed * 0x9E3779B97F4A7C15ULL + 1;
+    for (int o = 0; o < ORIGINS; o++) {
+        uint64_t x = rng_next();
+        memcpy(origins[o], &x, 6);
+        origins[o][0] = 0x02; // locally administered, like the simulator's badges
+    }
+    ref = calloc(REF_SLOTS, sizeof(ref_entry_t));
+    if (!ref) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    // A quarter of the table's capacity in new fireworks, then four times it
+    int capacity_per_s = NOW_DEDUP_SLOTS * 1000 / NOW_DEDUP_WINDOW_MS;
+    printf("%d slots, %d ms window: %d new IDs/s fill it\n", NOW_DEDUP_SLOTS, NOW_DEDUP_WINDOW_MS, capacity_per_s);
+    run("storm", NULL, capacity_per_s / 4, 0, false);
+    run("expiry", run_expiry, 0, 0, false);
+    run("reuse", run_reuse, 0, 0, false);
+    run("chains", run_chains, 0, 0, false);
+    run("wrap", NULL, capacity_per_s / 4, UINT32_MAX - (uint32_t)seconds * 500, false);
+    run("overload", NULL, capacity_per_s * 4, 0, true);
+    printf("%s\n", failures ? "FAILED" : "all ok");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,119 @@
+// Checks the heart's LED table (main/led_geometry.c) against the board layout: works
+// out every LED's position, angle, distance, place along the outline and height from
+// the pick-and-place file and compares them with what the firmware has.
+//
+//   ./geometry-check                       the board's own positions.csv
+//   ./geometry-check other/positions.csv
+//
+// Exits 1 if any LED is off by more than rounding.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "led_geometry.h"
+
+#define POSITIONS "../../hardware/KiCad/blinky_badge_light/production/positions.csv"
+#define XY_SLACK 1                  // units, the table is rounded
+#define ANGLE_SLACK 2               // angle, radius and arc steps
+
+typedef struct {
+    int found;
+    double x, y;                    // mm, y up as on the board
+} pos_t;
+
+
+static int read_positions(const char *path, pos_t *pos) {
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        // D1 to D24 are the heart, LED i is D(i + 1); other parts and LEDs don't matter
+        char *d = strstr(line, "D");
+        int n;
+        double x, y;
+        if (!d || d - line > 3 || sscanf(d, "D%d,%lf,%lf", &n, &x, &y) != 3 || n < 1 || n > LED_COUNT) continue;
+        pos[n - 1] = (pos_t){ 1, x, y };
+    }
+    fclose(f);
+    for (int i = 0; i < LED_COUNT; i++) {
+        if (!pos[i].found) {
+            fprintf(stderr, "%s: no D%d\n", path, i + 1);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+static int off(int have, int want, int slack, int wraps) {
+    int d = abs(have - want);
+    if (wraps && d > 128) d = 256 - d;
+    return d > slack;
+}
+
+
+int main(int argc, char **argv) {
+#if LED_COUNT != 24 || LED_SHAPE != LED_SHAPE_RING
+    fprintf(stderr, "only the heart's table comes from the board, build with the default layout\n");
+    return 1;
+#endif
+    const char *path = argc > 1 ? argv[1] : POSITIONS;
+    pos_t pos[LED_COUNT] = { 0 };
+    if (!read_positions(path, pos)) {
+        fprintf(stderr, "usage: %s [positions.csv]\n", argv[0]);
+        return 1;
+    }
+    led_layout_init();
+
+    double cx = 0, cy = 0;
+    for (int i = 0; i < LED_COUNT; i++) {
+        cx += pos[i].x / LED_COUNT;
+        cy += pos[i].y / LED_COUNT;
+    }
+    double unit_mm = LED_GEOMETRY_UM / 1000.0;
+    double x[LED_COUNT], y[LED_COUNT], dist[LED_COUNT], along[LED_COUNT + 1];
+    double dmax = 0;
+    int furthest = 0;
+    along[0] = 0;
+    for (int i = 0; i < LED_COUNT; i++) {
+        x[i] = (pos[i].x - cx) / unit_mm;
+        y[i] = (pos[i].y - cy) / unit_mm;
+        dist[i] = hypot(x[i], y[i]);
+        if (dist[i] > dmax) {
+            dmax = dist[i];
+            furthest = i;
+        }
+        int next = (i + 1) % LED_COUNT;
+        along[i + 1] = along[i] + hypot(pos[next].x - pos[i].x, pos[next].y - pos[i].y);
+    }
+    printf("centre (%.1f, %.1f) mm, furthest LED %d at (%.0f, %.0f): %.0f units, %.1f mm\n", cx, cy, furthest, x[furthest],
+           y[furthest], dmax, dmax * unit_mm);
+
+    int bad = 0;
+    for (int i = 0; i < LED_COUNT; i++) {
+        const led_point_t *p = &led_geometry[i];
+        int want_x = (int)lround(x[i]), want_y = (int)lround(y[i]);
+        int want_angle = (int)lround(atan2(x[i], y[i]) * 128 / M_PI) & 255;
+        int want_radius = (int)lround(255 * dist[i] / dmax);
+        int want_arc = (int)lround(256 * along[i] / along[LED_COUNT]) & 255;
+        // Rank bottom up among the distinct heights
+        int want_height = 0;
+        for (int j = 0; j < LED_COUNT; j++) {
+            int below = 1;
+            for (int k = 0; k < j; k++) {
+                if (lround(y[k]) == lround(y[j])) below = 0;
+            }
+            if (below && lround(y[j]) < want_y) want_height++;
+        }
+        if (off(p->x, want_x, XY_SLACK, 0) || off(p->y, want_y, XY_SLACK, 0) || off(p->angle, want_angle, ANGLE_SLACK, 1) ||
+            off(p->radius, want_radius, ANGLE_SLACK, 0) || off(p->arc, want_arc, ANGLE_SLACK, 1) || p->height != want_height) {
+            printf("LED %2d: has (%d, %d) angle %d radius %d arc %d height %d, board (%d, %d) %d %d %d %d\n", i, p->x, p->y, p->angle,
+                   p->radius, p->arc, p->height, want_x, want_y, want_angle, want_radius, want_arc, want_height);
+            bad++;
+        }
+    }
+    printf(bad ? "%d LEDs differ from the board\n" : "all %d LEDs match the board\n", bad ? bad : LED_COUNT);
+    return bad ? 1 : 0;
+}
@@ -0,0 +1,189 @@
+// Replays a scripted touch trace through the gesture recognizer (main/gesture.c)
+// and prints the gestures it reports, when, and how long after the input.
+// With -p the pads are scanned once a period, like the touch sensor in one of its
+// scan modes (the badge's `touch` command lists them), so every event is seen at the
+// end of the first scan after it and latency counts from the input itself.
+//
+// Trace lines, times in ms:
+//   long PAD MS            PAD reports a long press once held MS
+//   double PAD MS          PAD reports double taps up to MS apart (taps wait that long)
+//   chord PAD,PAD,... MS   those pads held together for MS
+//   T PAD down|up          touch event
+//   expect T GESTURE PAD   GESTURE (tap, double, long, chord) due at T; with any expect
+//                          line in the trace, every gesture but presses has to be expected
+// Everything after # is a comment.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "gesture.h"
+
+#define MAX_EVENTS 4096
+#define MAX_EXPECT 256
+#define DRAIN_US 10000000       // keep polling this long after the last event
+
+typedef struct {
+    int64_t t_us;
+    uint8_t type;
+    uint8_t pad;
+    bool seen;
+} expect_t;
+
+static gesture_pad_config_t pads[GESTURE_PADS];
+static gesture_chord_t chords[GESTURE_CHORDS];
+static int chord_count;
+static gesture_event_t events[MAX_EVENTS];
+static int event_count;
+static expect_t expects[MAX_EXPECT];
+static int expect_count;
+static int failures;
+static int64_t wake_us = 0;      // touch task scheduling delay
+static int64_t scan_us = 0;      // scan period, 0 = events seen as they happen
+static int64_t scan_wait_sum_us, scan_wait_max_us;
+static bool quiet = false;
+
+static int parse_type(const char *s) {
+    if (!strcmp(s, "tap")) return GESTURE_TAP;
+    if (!strcmp(s, "double")) return GESTURE_DOUBLE_TAP;
+    if (!strcmp(s, "long")) return GESTURE_LONG_PRESS;
+    if (!strcmp(s, "chord")) return GESTURE_CHORD;
+    if (!strcmp(s, "press")) return GESTURE_PRESS;
+    return -1;
+}
+
+static bool load(const char *path) {
+    FILE *f = strcmp(path, "-") ? fopen(path, "r") : stdin;
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    char line[256];
+    int lineno = 0;
+    bool ok = true;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        char a[32], b[64], c[32], d[32];
+        int n = sscanf(line, "%31s %63s %31s %31s", a, b, c, d);
+        if (n <= 0) continue;
+
+        if (n == 3 && (!strcmp(a, "long") || !strcmp(a, "double")) && atoi(b) >= 0 && atoi(b) < GESTURE_PADS) {
+            if (a[0] == 'l') pads[atoi(b)].long_ms = (uint16_t)atoi(c);
+            else pads[atoi(b)].double_ms = (uint16_t)atoi(c);
+        } else if (n == 3 && !strcmp(a, "chord") && chord_count < GESTURE_CHORDS) {
+            gesture_chord_t *ch = &chords[chord_count++];
+            for (char *p = strtok(b, ","); p; p = strtok(NULL, ",")) ch->mask |= 1 << (atoi(p) % GESTURE_PADS);
+            ch->hold_ms = (uint16_t)atoi(c);
+        } else if (n == 4 && !strcmp(a, "expect") && expect_count < MAX_EXPECT && parse_type(c) >= 0) {
+            expects[expect_count++] = (expect_t){ .t_us = (int64_t)(atof(b) * 1000), .type = (uint8_t)parse_type(c), .pad = (uint8_t)atoi(d) };
+        } else if (n == 3 && (!strcmp(c, "down") || !strcmp(c, "up")) && event_count < MAX_EVENTS) {
+            events[event_count++] = (gesture_event_t){ .t_us = (int64_t)(atof(a) * 1000), .pad = (uint8_t)atoi(b), .down = c[0] == 'd' };
+        } else {
+            fprintf(stderr, "%s:%d: can't read this line\n", path, lineno);
+            ok = false;
+        }
+    }
+    if (f != stdin) fclose(f);
+    return ok;
+}
+
+static void report(gesture_t *g, const gesture_out_t *out, int n, int64_t now_us) {
+    for (int i = 0; i < n; i++) {
+        gesture_record_latency(g, &out[i], now_us);
+        if (!quiet) {
+            printf("%10.1f ms  %-10s %s %d, %.1f ms after the input\n", out[i].due_us / 1000.0, gesture_name(out[i].type),
+                   out[i].type == GESTURE_CHORD ? "chord" : "pad", out[i].pad, (now_us - out[i].due_us) / 1000.0);
+        }
+        if (expect_count == 0 || out[i].type == GESTURE_PRESS) continue;
+        bool matched = false;
+        for (int e = 0; e < expect_count && !matched; e++) {
+            expect_t *x = &expects[e];
+            int64_t off = out[i].due_us - x->t_us;
+            if (!x->seen && x->type == out[i].type && x->pad == out[i].pad && off > -1000 && off < 1000 + scan_us) {
+                x->seen = matched = true;
+            }
+        }
+        if (!matched) {
+            printf("FAIL: %s on %d at %.1f ms wasn't expected\n", gesture_name(out[i].type), out[i].pad, out[i].due_us / 1000.0);
+            failures++;
+        }
+    }
+}
+
+// Polls whatever falls due up to until_us, each seen wake_us late as on a busy badge
+static void poll_until(gesture_t *g, int64_t until_us) {
+    gesture_out_t out[GESTURE_OUT_MAX];
+    int64_t due;
+    while ((due = gesture_next_due_us(g)) <= until_us) {
+        int64_t now = due + wake_us;
+        report(g, out, gesture_poll(g, now, out), now);
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "usage: %s [options] TRACE (- for stdin)\n"
+        "  -w US    touch task wakes up this late after every event or hold (default 0)\n"
+        "  -p US    pads are scanned every US, events are seen at the end of the next scan\n"
+        "  -q       only print the summary and failures\n",
+        prog);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "w:p:qh")) != -1) {
+        switch (opt) {
+            case 'w': wake_us = atoll(optarg); break;
+            case 'p': scan_us = atoll(optarg); break;
+            case 'q': quiet = true; break;
+            default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc - 1 || wake_us < 0 || scan_us < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!load(argv[optind])) return 1;
+
+    gesture_t g;
+    gesture_init(&g, pads, chords, chord_count);
+    gesture_out_t out[GESTURE_OUT_MAX];
+    int64_t last = 0;
+    for (int i = 0; i < event_count; i++) {
+        if (scan_us) {
+            int64_t seen = (events[i].t_us + scan_us - 1) / scan_us * scan_us;
+            int64_t wait = seen - events[i].t_us;
+            scan_wait_sum_us += wait;
+            if (wait > scan_wait_max_us) scan_wait_max_us = wait;
+            events[i].t_us = seen;
+        }
+        poll_until(&g, events[i].t_us);
+        int64_t now = events[i].t_us + wake_us;
+        report(&g, out, gesture_feed(&g, &events[i], out), now);
+        last = events[i].t_us;
+    }
+    poll_until(&g, last + DRAIN_US);
+
+    for (int e = 0; e < expect_count; e++) {
+        if (expects[e].seen) continue;
+        printf("FAIL: expected %s on %d at %.1f ms\n", gesture_name(expects[e].type), expects[e].pad, expects[e].t_us / 1000.0);
+        failures++;
+    }
+    printf("gesture      count  latency mean / max\n");
+    for (int t = 0; t < GESTURE_TYPES; t++) {
+        const gesture_latency_t *l = &g.latency[t];
+        if (!l->count) continue;
+        printf("%-12s %5" PRIu32 "  %.1f / %.1f ms\n", gesture_name(t), l->count,
+               l->latency_sum_us / 1000.0 / l->count, l->latency_max_us / 1000.0);
+    }
+    if (scan_us && event_count) {
+        printf("%-12s %5d  %.1f / %.1f ms before the gesture recognizer sees them\n", "scan wait", event_count,
+               scan_wait_sum_us / 1000.0 / event_count, scan_wait_max_us / 1000.0);
+    }
+    if (expect_count) printf("%d gestures expected, %d failures\n", expect_count, failures);
+    return failures ? 1 : 0;
+}
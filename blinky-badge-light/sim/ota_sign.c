@@ -0,0 +1,131 @@
+// Signs a release build for badge-to-badge updates (main/now_ota.h). Badges only fetch
+// an image whose advert carries a signature made with the release key, and they serve
+// the image they run with the advert stored behind it.
+//
+//   ./ota-sign -g release.pem > ../main/ota_key.h
+//        new release key; the public half goes into the firmware, keep release.pem safe
+//   ./ota-sign release.pem 2 ../build/blinky-badge-light.bin signed.bin
+//        appends the signed advert for version 2 (BADGE_FW_VERSION of that build);
+//        flash signed.bin to the first badge instead of the plain build
+//
+// Needs OpenSSL's libcrypto.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/evp.h>
+#include <openssl/ec.h>
+#include <openssl/pem.h>
+#include <openssl/core_names.h>
+
+#include "now_ota.h"
+
+static int usage(const char *prog) {
+    fprintf(stderr, "usage: %s -g KEY.pem > ota_key.h\n       %s KEY.pem VERSION IN.bin OUT.bin\n", prog, prog);
+    return 1;
+}
+
+
+static int generate(const char *path) {
+    FILE *f = fopen(path, "wx");
+    if (!f) {
+        fprintf(stderr, "%s: exists or can't be created\n", path);
+        return 1;
+    }
+    EVP_PKEY *key = EVP_EC_gen("P-256");
+    uint8_t pub[65];
+    size_t pub_len = 0;
+    if (!key || !PEM_write_PrivateKey(f, key, NULL, NULL, 0, NULL, NULL) ||
+        !EVP_PKEY_get_octet_string_param(key, OSSL_PKEY_PARAM_ENCODED_PUBLIC_KEY, pub, sizeof(pub), &pub_len) ||
+        pub_len != sizeof(pub)) {
+        fprintf(stderr, "key generation failed\n");
+        fclose(f);
+        return 1;
+    }
+    fclose(f);
+
+    printf("#ifndef OTA_KEY_H\n#define OTA_KEY_H\n\n#include <stdint.h>\n\n");
+    printf("// Public half of the release key, uncompressed P-256 point, from sim/ota-sign -g\n");
+    printf("static const uint8_t ota_release_key[65] = {");
+    for (int i = 0; i < (int)sizeof(pub); i++) printf("%s0x%02x,", i % 12 ? " " : "\n    ", pub[i]);
+    printf("\n};\n\n#endif // OTA_KEY_H\n");
+    EVP_PKEY_free(key);
+    return 0;
+}
+
+
+static uint8_t *read_file(const char *path, long *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(*len > 0 ? *len : 1);
+    if (data && fread(data, 1, *len, f) != (size_t)*len) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    return data;
+}
+
+
+// ECDSA over SHA-256 of what's signed, r and s as 32 bytes each like the badge reads them
+static int sign(EVP_PKEY *key, now_ota_image_t *image) {
+    uint8_t der[80];
+    size_t der_len = sizeof(der);
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    int ok = ctx && EVP_DigestSignInit(ctx, NULL, EVP_sha256(), NULL, key) == 1 &&
+             EVP_DigestSign(ctx, der, &der_len, (const uint8_t *)image, OTA_SIGNED_LEN) == 1;
+    EVP_MD_CTX_free(ctx);
+    if (!ok) return 0;
+
+    const uint8_t *p = der;
+    ECDSA_SIG *sig = d2i_ECDSA_SIG(NULL, &p, (long)der_len);
+    if (!sig) return 0;
+    ok = BN_bn2binpad(ECDSA_SIG_get0_r(sig), image->sig, OTA_SIG_LEN / 2) == OTA_SIG_LEN / 2 &&
+         BN_bn2binpad(ECDSA_SIG_get0_s(sig), image->sig + OTA_SIG_LEN / 2, OTA_SIG_LEN / 2) == OTA_SIG_LEN / 2;
+    ECDSA_SIG_free(sig);
+    return ok;
+}
+
+
+int main(int argc, char **argv) {
+    if (argc == 3 && !strcmp(argv[1], "-g")) return generate(argv[2]);
+    if (argc != 5) return usage(argv[0]);
+
+    FILE *f = fopen(argv[1], "r");
+    EVP_PKEY *key = f ? PEM_read_PrivateKey(f, NULL, NULL, NULL) : NULL;
+    if (f) fclose(f);
+    if (!key) {
+        fprintf(stderr, "%s: not a private key\n", argv[1]);
+        return 1;
+    }
+    int version = atoi(argv[2]);
+    long len;
+    uint8_t *bin = read_file(argv[3], &len);
+    if (version < 1 || version > 65535 || !bin || len <= 0) {
+        fprintf(stderr, "need a version from 1 to 65535 and a readable image\n");
+        return 1;
+    }
+
+    now_ota_trailer_t trailer = { .magic = OTA_TRAILER_MAGIC };
+    trailer.image.version = (uint16_t)version;
+    trailer.image.size = (uint32_t)len;
+    unsigned int sha_len = 0;
+    if (!EVP_Digest(bin, len, trailer.image.sha, &sha_len, EVP_sha256(), NULL) || !sign(key, &trailer.image)) {
+        fprintf(stderr, "signing failed\n");
+        return 1;
+    }
+
+    FILE *out = fopen(argv[4], "wb");
+    if (!out || fwrite(bin, 1, len, out) != (size_t)len || fwrite(&trailer, 1, sizeof(trailer), out) != sizeof(trailer)) {
+        fprintf(stderr, "%s: write failed\n", argv[4]);
+        return 1;
+    }
+    fclose(out);
+    printf("version %d, %ld bytes, signed advert appended to %s\n", version, len, argv[4]);
+    EVP_PKEY_free(key);
+    free(bin);
+    return 0;
+}
@@ -0,0 +1,149 @@
+// Times the badge's render code (main/render.c and the overlays) for a strip of
+// LED_COUNT LEDs, fixed at build time like on the badge. `make render-bench` builds one
+// per size, render-bench-24, -144, -300 and -1024; `make bench` runs them all.
+//
+//   ./render-bench-144             every pattern and overlay, 3000 frames each
+//   ./render-bench-144 -n 500      frames per case
+//   ./render-bench-144 -k 9.5      badge estimate: host times this many times slower
+//
+// A frame has 20 ms at 50 fps, and the strip's refresh takes its wire time out of
+// that (24 bits an LED at 800 kHz, then the reset gap), so rendering gets the rest.
+// Times are the host's; for -k, divide the render average `frames` shows on a 24 LED
+// badge by what this tool reports for the same pattern at 24.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "render.h"
+#include "led_control.h"
+#include "led_utils.h"
+#include "battery_policy.h"
+#include "battery_level_pattern.h"
+#include "firework_notification_pattern.h"
+#include "storage.h"
+
+#define FRAME_BUDGET_US 20000       // 50 fps
+#define WIRE_US (LED_COUNT * 30 + 280)
+#define LOOP_PERIOD_MS 20
+
+badge_settings_t settings;
+genome patterns[NUM_PATTERNS];
+
+// One of each kind of hue: the full rainbow and a limited range, which goes by the ramp
+static const genome bench_genomes[] = {
+    { .cd_period = 3, .cd_rate = 90, .cd_dir = 200, .sat = 255, .hue_base = 0, .hue_rate = 3, .hue_bound = 255, .nonlin = 200 },
+    { .cd_period = 5, .cd_rate = 180, .cd_dir = 20, .sat = 220, .hue_base = 40, .hue_rate = 7, .hue_dir = 1, .hue_bound = 170 },
+};
+
+enum { CASE_PATTERN, CASE_FLASH, CASE_SAFETY, CASE_BATTERY, CASE_FIREWORK };
+
+static int64_t clock_us;
+
+
+// ---- Hooks ----
+
+int64_t render_hal_time_us(void) {
+    return clock_us;
+}
+
+
+int64_t render_hal_network_time_us(void) {
+    return clock_us;
+}
+
+
+float render_hal_sound_level(uint32_t now_us) {
+    return 0.5f + 0.5f * sinf(now_us / 150000.0f);
+}
+
+
+bool render_hal_show(uint8_t *framebuffer, int loop) {
+    return false;
+}
+
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+// Keeps the overlay of the case on for every frame
+static void set_case(int c) {
+    int ms = (int)(clock_us / 1000);
+    flash_active = c == CASE_FLASH;
+    flash_end_time = c == CASE_FLASH ? ms + 1000 : 0;
+    force_safety_pattern = c == CASE_SAFETY;
+    show_battery_meter = c == CASE_BATTERY;
+    battery_meter_start_time = ms;
+    show_firework_notification = c == CASE_FIREWORK;
+    firework_notification_start_time = ms;
+}
+
+
+static void bench(const char *name, int c, int pattern, int frames, float k, uint32_t *checksum) {
+    static uint8_t framebuffer[LED_COUNT * 3];
+    settings.pattern_id = pattern;
+    set_pattern(pattern);
+    double sum = 0, worst = 0;
+    for (int f = 0; f < frames; f++) {
+        clock_us += LOOP_PERIOD_MS * 1000;
+        set_case(c);
+        double t0 = now_s();
+        render_frame(framebuffer, f);
+        double us = (now_s() - t0) * 1e6;
+        sum += us;
+        if (us > worst) worst = us;
+        // Keeps the compiler from dropping the frames
+        for (int i = 0; i < LED_COUNT * 3; i += 7) *checksum = *checksum * 31 + framebuffer[i];
+    }
+    double avg = sum / frames;
+    int left = FRAME_BUDGET_US - WIRE_US;
+    printf("%-10s %9.2f %9.2f %8.1f %7.2f", name, avg, worst, avg * 1000 / LED_COUNT, left > 0 ? 100 * avg / left : 0);
+    if (k > 0) printf(" %9.0f %s", avg * k, left > 0 && avg * k <= left ? "fits" : "over");
+    printf("\n");
+}
+
+
+int main(int argc, char **argv) {
+    int frames = 3000;
+    float k = 0;
+    for (int arg = 1; arg < argc; arg++) {
+        if (!strcmp(argv[arg], "-n") && arg + 1 < argc) frames = atoi(argv[++arg]);
+        else if (!strcmp(argv[arg], "-k") && arg + 1 < argc) k = atof(argv[++arg]);
+        else {
+            fprintf(stderr, "usage: %s [-n FRAMES] [-k HOST_TO_BADGE]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (frames < 1) frames = 1;
+
+    led_layout_init();
+    current_battery_voltage = 3900;
+    set_brightness(NUM_BRIGHTNESS_LEVELS - 1);
+    uint32_t checksum = 0;
+
+    int left = FRAME_BUDGET_US - WIRE_US;
+    printf("%d LEDs: frame %d us at 50 fps, wire %d us, %d us left to render%s\n", LED_COUNT, FRAME_BUDGET_US, WIRE_US,
+           left > 0 ? left : 0, left > 0 ? "" : " (the refresh alone is over the budget, split the strip across outputs in led_outputs.h)");
+    printf("%-10s %9s %9s %8s %7s%s\n", "case", "avg us", "max us", "ns/LED", "% used", k > 0 ? "  badge us" : "");
+    for (int g = 0; g < (int)(sizeof(bench_genomes) / sizeof(bench_genomes[0])); g++) {
+        for (int i = 0; i < NUM_PATTERNS; i++) patterns[i] = bench_genomes[g];
+        for (int p = 0; p < NUM_PATTERNS; p++) {
+            char name[16];
+            snprintf(name, sizeof(name), "%s %d", g ? "range" : "rainbow", p);
+            bench(name, CASE_PATTERN, p, frames, k, &checksum);
+        }
+    }
+    bench("flash", CASE_FLASH, 0, frames, k, &checksum);
+    bench("safety", CASE_SAFETY, 0, frames, k, &checksum);
+    bench("battery", CASE_BATTERY, 0, frames, k, &checksum);
+    bench("firework", CASE_FIREWORK, 0, frames, k, &checksum);
+    printf("checksum %08x\n", checksum);
+    return 0;
+}
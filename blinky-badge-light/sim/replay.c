@@ -0,0 +1,415 @@
+// Replays an input capture from the badge (main/capture.c) through the badge's own render
+// code and checks every frame against the checksum the badge recorded. Feed it a saved
+// monitor log with a `capture` or `capture saved` dump; other log lines around the dump
+// are skipped, and with several dumps in the log the last one wins.
+//
+//   ./replay monitor.log           summary
+//   ./replay -v monitor.log        and every input and every frame that came out different
+//
+// Replay starts at the first key record left in the ring and loads the badge's state
+// from it; every later key is compared with the replayed state and then loaded again, so
+// one divergence doesn't spoil the rest. Frames within a few counts of the badge's are
+// put down to float rounding (the badge's FPU against the host's libm). Show mode frames
+// depend on the show leader's packets, which aren't captured, and are skipped.
+// Exits 2 if any frame came out different.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "capture_format.h"
+#include "render.h"
+#include "led_utils.h"
+#include "battery_policy.h"
+#include "battery_level_pattern.h"
+#include "firework_notification_pattern.h"
+#include "touch_action.h"
+#include "vu_meter.h"
+#include "storage.h"
+
+#define MAX_CAPTURE (1 << 20)
+#define ROUNDING_SUM 4              // frames whose channel sums differ by at most this are close enough
+
+badge_settings_t settings;
+genome patterns[NUM_PATTERNS];
+
+static uint8_t data[MAX_CAPTURE];
+static int data_len;
+
+// Sound updates, in the order the badge numbered them
+typedef struct {
+    uint32_t seq;
+    uint8_t tag;
+    int64_t t_us;                   // network time for CAP_DB
+    float db;
+    uint8_t level, beat;
+    uint32_t audio_t_us;
+    uint8_t count;
+    float prime[CAP_PRIME_MAX];
+} sound_update_t;
+
+static sound_update_t *updates;
+static int update_count, next_update;
+
+static sound_analysis_t analysis;
+static sound_features_t local, remote;
+static uint32_t sound_seq;          // updates applied
+
+static int64_t clock_us, clock_net_us; // what the hooks hand the render code
+static bool leader, standby, testing, switched_off;
+static bool verbose;
+
+typedef struct {
+    int frames, exact, close, different, show;
+    int keys, keys_drifted;
+    int touches, db_blocks, audio, battery, genomes, fireworks, flashes;
+    int64_t first_different_us;
+} stats_t;
+
+static stats_t st;
+
+
+static bool load(FILE *f) {
+    char line[256];
+    bool in_dump = false, found = false;
+    while (fgets(line, sizeof(line), f)) {
+        char *p;
+        if ((p = strstr(line, "capture begin "))) {
+            int version, len;
+            char where[8];
+            if (sscanf(p, "capture begin %d %7s %d", &version, where, &len) == 3 && version == CAP_VERSION &&
+                len >= 0 && len <= MAX_CAPTURE) {
+                in_dump = true;
+                data_len = len;
+                memset(data, 0, sizeof(data));
+            }
+        } else if (!in_dump) {
+            continue;
+        } else if (strstr(line, "capture end")) {
+            in_dump = false;
+            found = true;
+        } else if ((p = strstr(line, "cp "))) {
+            unsigned off;
+            char hex[80];
+            if (sscanf(p, "cp %x %79s", &off, hex) != 2) continue;
+            for (const char *h = hex; h[0] && h[1] && off < (unsigned)data_len; h += 2, off++) {
+                unsigned b;
+                if (sscanf(h, "%2x", &b) != 1) break;
+                data[off] = (uint8_t)b;
+            }
+        }
+    }
+    return found;
+}
+
+
+// ---- Hooks ----
+
+int64_t render_hal_time_us(void) {
+    return clock_us;
+}
+
+
+int64_t render_hal_network_time_us(void) {
+    return clock_net_us;
+}
+
+
+float render_hal_sound_level(uint32_t now_us) {
+    return sound_mix(&local, &remote, now_us);
+}
+
+
+bool render_hal_show(uint8_t *framebuffer, int loop) {
+    // Show frames are skipped before they get here
+    return false;
+}
+
+
+// ---- Sound ----
+
+static int by_seq(const void *a, const void *b) {
+    const sound_update_t *x = a, *y = b;
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+
+// All sound updates after the first key, sorted by number: the microphone and radio
+// tasks record them as they come, which isn't always the order they were numbered in
+static void collect_sound(void) {
+    capture_chain_t chain = { 0 };
+    capture_record_t r = { 0 };
+    int off = 0, max = 0;
+    while (off < data_len && capture_decode(data, data_len, &off, &chain, &r)) {
+        if (!chain.synced || (r.tag != CAP_DB && r.tag != CAP_PRIME && r.tag != CAP_AUDIO)) continue;
+        if (update_count == max) {
+            max = max ? max * 2 : 1024;
+            updates = realloc(updates, max * sizeof(*updates));
+            if (!updates) exit(1);
+        }
+        sound_update_t *u = &updates[update_count++];
+        memset(u, 0, sizeof(*u));
+        u->seq = r.seq;
+        u->tag = r.tag;
+        if (r.tag == CAP_DB) {
+            u->t_us = r.t_us + r.net_offset_us;
+            u->db = r.db;
+        } else if (r.tag == CAP_AUDIO) {
+            u->level = r.audio.level;
+            u->beat = r.audio.beat;
+            u->audio_t_us = r.audio.t_us;
+        } else {
+            u->count = r.prime.count;
+            memcpy(u->prime, r.prime.db, sizeof(u->prime));
+        }
+    }
+    qsort(updates, update_count, sizeof(*updates), by_seq);
+}
+
+
+// Applies the updates numbered up to seq
+static void apply_sound(uint32_t seq) {
+    for (; next_update < update_count && updates[next_update].seq <= seq; next_update++) {
+        const sound_update_t *u = &updates[next_update];
+        if (u->seq <= sound_seq) continue;
+        switch (u->tag) {
+            case CAP_DB: sound_block(&analysis, u->db, u->t_us, &local); break;
+            case CAP_PRIME: sound_prime(&analysis, u->prime, u->count); break;
+            case CAP_AUDIO: sound_remote(&remote, u->level, u->beat, u->audio_t_us); break;
+        }
+        sound_seq = u->seq;
+    }
+}
+
+
+// ---- State ----
+
+static void load_key(const capture_key_t *k) {
+    settings.pattern_id = k->pattern_id;
+    settings.brightness = k->brightness_index;
+    set_pattern(k->pattern_id);
+    set_brightness(k->brightness_index);
+    effective_brightness = k->effective_brightness;
+    flash_active = k->flags & CAP_F_FLASH;
+    flash_end_time = k->flash_end_ms;
+    limit_brightness = k->flags & CAP_F_LIMIT_BRIGHTNESS;
+    force_safety_pattern = k->flags & CAP_F_SAFETY_PATTERN;
+    current_battery_voltage = k->battery_mv;
+    show_battery_meter = k->flags & CAP_F_BATTERY_METER;
+    battery_meter_start_time = k->battery_meter_start_ms;
+    show_firework_notification = k->flags & CAP_F_FIREWORK;
+    firework_notification_start_time = k->firework_start_ms;
+    leader = k->flags & CAP_F_SHOW_LEADER;
+    vu_meter_set_level(k->vu_level);
+    analysis = k->sound;
+    local = k->local;
+    remote = k->remote;
+    sound_seq = k->sound_seq;
+    memcpy(patterns, k->patterns, sizeof(patterns));
+    // The lighting task writes keys, so it was running
+    standby = testing = false;
+}
+
+
+// What of the replayed state differs from the key, empty if nothing
+static void compare_key(const capture_key_t *k, char *out, int len) {
+    apply_sound(k->sound_seq);
+    int n = 0;
+    out[0] = '\0';
+#define DIFF(cond, what) \
+    if ((cond) && n < len) n += snprintf(&out[n], len - n, "%s%s", n ? ", " : "", what)
+    DIFF(settings.pattern_id != k->pattern_id, "pattern");
+    DIFF(render_brightness_index() != k->brightness_index, "brightness");
+    DIFF(effective_brightness != k->effective_brightness, "effective brightness");
+    DIFF(flash_active != !!(k->flags & CAP_F_FLASH) || (flash_active && flash_end_time != k->flash_end_ms), "flash");
+    DIFF(limit_brightness != !!(k->flags & CAP_F_LIMIT_BRIGHTNESS), "brightness limit");
+    DIFF(force_safety_pattern != !!(k->flags & CAP_F_SAFETY_PATTERN), "safety pattern");
+    DIFF(show_battery_meter != !!(k->flags & CAP_F_BATTERY_METER), "battery meter");
+    DIFF(show_firework_notification != !!(k->flags & CAP_F_FIREWORK), "firework");
+    DIFF(leader != !!(k->flags & CAP_F_SHOW_LEADER), "show leader");
+    DIFF(vu_meter_level() != k->vu_level, "VU level");
+    DIFF(sound_seq != k->sound_seq, "sound updates missing");
+    DIFF(memcmp(&analysis, &k->sound, sizeof(analysis)), "sound analysis");
+    DIFF(memcmp(&local, &k->local, sizeof(local)) || memcmp(&remote, &k->remote, sizeof(remote)), "sound features");
+    DIFF(memcmp(patterns, k->patterns, sizeof(patterns)), "genomes");
+#undef DIFF
+}
+
+
+static void act_on_touch(const capture_record_t *r) {
+    gesture_out_t out = { .type = r->touch.type, .pad = r->touch.pad, .due_us = r->t_us - r->touch.age_us };
+    int action = touch_action(&out, testing, standby);
+    if (verbose && action != TOUCH_NONE) {
+        printf("%10.3f touch: gesture %u on pad %u, action %d\n", r->t_us / 1e6, r->touch.type, r->touch.pad, action);
+    }
+    // As handle_touch_action() and act_on_gesture() in main/touch_input.c
+    switch (action) {
+        case 0: settings.pattern_id = (settings.pattern_id + 1) % NUM_PATTERNS;
+                set_pattern(settings.pattern_id);
+                break;
+        case 1: settings.brightness = (settings.brightness + 1) % NUM_BRIGHTNESS_LEVELS;
+                set_brightness(settings.brightness);
+                break;
+        case 2: // the genome follows in a CAP_GENOME record, a leader's flash in a CAP_FLASH one
+                if (!leader) flash_feedback_pattern();
+                break;
+        case 3: switched_off = true; break;
+        case 4: show_battery_meter = true;
+                battery_meter_start_time = r->t_us / 1000;
+                break;
+        case SHOW_ACTION:
+                leader = !leader;
+                flash_feedback_pattern();
+                break;
+        case TOUCH_TEST: testing = true; break;
+        case TOUCH_STANDBY: standby = true; break;
+        case TOUCH_WAKE: standby = false; break;
+    }
+}
+
+
+static void replay_frame(const capture_record_t *r) {
+    static uint8_t framebuffer[LED_COUNT * 3];
+    const capture_frame_t *f = &r->frame;
+    // A frame means the testing routine is over, it doesn't record when
+    testing = false;
+    st.frames++;
+    if (f->flags & RENDER_SHOW) {
+        st.show++;
+        return;
+    }
+    apply_sound(f->sound_seq);
+    clock_net_us = r->t_us + r->net_offset_us;
+    uint8_t flags = render_frame(framebuffer, f->loop);
+    uint32_t sum, checksum = capture_checksum(framebuffer, sizeof(framebuffer), &sum);
+    if (checksum == f->checksum && flags == f->flags) {
+        st.exact++;
+        return;
+    }
+    int64_t diff = (int64_t)sum - f->sum;
+    if (flags == f->flags && diff >= -ROUNDING_SUM && diff <= ROUNDING_SUM) {
+        st.close++;
+        return;
+    }
+    if (!st.different++) st.first_different_us = r->t_us;
+    if (verbose) {
+        printf("%10.3f frame %3u different: flags %02x, badge %02x, channel sum %" PRIu32 ", badge %" PRIu32 "\n",
+               r->t_us / 1e6, f->loop, flags, f->flags, sum, f->sum);
+    }
+}
+
+
+int main(int argc, char **argv) {
+    int arg = 1;
+    if (argc > 1 && !strcmp(argv[1], "-v")) {
+        verbose = true;
+        arg++;
+    }
+    if (argc != arg + 1 || !strcmp(argv[arg], "-h")) {
+        fprintf(stderr, "usage: %s [-v] LOG (- for stdin)\n", argv[0]);
+        return argc == arg + 1 ? 0 : 1;
+    }
+    led_layout_init();
+    FILE *f = strcmp(argv[arg], "-") ? fopen(argv[arg], "r") : stdin;
+    if (!f) {
+        perror(argv[arg]);
+        return 1;
+    }
+    bool found = load(f);
+    if (f != stdin) fclose(f);
+    if (!found) {
+        fprintf(stderr, "%s: no complete capture dump in it\n", argv[arg]);
+        return 1;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    collect_sound();
+
+    static capture_key_t key;
+    capture_chain_t chain = { 0 };
+    capture_record_t r = { .key = &key };
+    int off = 0, before_key = 0, damaged = 0;
+    int64_t first_us = 0, last_us = 0;
+    char drift[256];
+    while (off < data_len) {
+        int at = off;
+        if (!capture_decode(data, data_len, &off, &chain, &r)) {
+            if (off == at) break;
+            damaged++;
+            continue;
+        }
+        if (!chain.synced) {
+            before_key++;
+            continue;
+        }
+        clock_us = last_us = r.t_us;
+        if (!st.keys && r.tag != CAP_KEY) continue;
+        switch (r.tag) {
+            case CAP_KEY:
+                if (!st.keys++) {
+                    first_us = r.t_us;
+                } else {
+                    compare_key(&key, drift, sizeof(drift));
+                    if (drift[0]) {
+                        st.keys_drifted++;
+                        if (verbose) printf("%10.3f key differs: %s\n", r.t_us / 1e6, drift);
+                    }
+                }
+                load_key(&key);
+                break;
+            case CAP_FRAME: replay_frame(&r); break;
+            case CAP_DB: st.db_blocks++; break;
+            case CAP_PRIME: break;
+            case CAP_AUDIO: st.audio++; break;
+            case CAP_BATTERY:
+                st.battery++;
+                if (battery_policy_update(r.battery_mv)) switched_off = true;
+                break;
+            case CAP_TOUCH:
+                st.touches++;
+                act_on_touch(&r);
+                break;
+            case CAP_GENOME:
+                st.genomes++;
+                if (r.genome.slot < NUM_PATTERNS) patterns[r.genome.slot] = r.genome.g;
+                break;
+            case CAP_FIREWORK:
+                st.fireworks++;
+                firework_notification_start(r.t_us / 1000);
+                break;
+            case CAP_FLASH:
+                st.flashes++;
+                flash_feedback_pattern();
+                break;
+        }
+        if (switched_off) break;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (!st.keys) {
+        fprintf(stderr, "%s: no key record in the capture, nothing to replay from\n", argv[arg]);
+        return 1;
+    }
+    double span = (last_us - first_us) / 1e6;
+    double took = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("capture: %d bytes, %.1f s from %.3f s after boot", data_len, span, first_us / 1e6);
+    if (before_key) printf(", %d records before the first key skipped", before_key);
+    if (damaged) printf(", %d damaged records", damaged);
+    printf("\n");
+    printf("inputs: %d touches, %d dB blocks, %d remote audio events, %d battery readings, %d genomes, "
+           "%d fireworks, %d show flashes\n",
+           st.touches, st.db_blocks, st.audio, st.battery, st.genomes, st.fireworks, st.flashes);
+    printf("frames: %d, %d identical, %d within rounding, %d different", st.frames, st.exact, st.close, st.different);
+    if (st.show) printf(", %d show mode (skipped)", st.show);
+    printf("\n");
+    if (st.different) printf("first different frame at %.3f s\n", st.first_different_us / 1e6);
+    printf("keys: %d, %d differed from the replayed state\n", st.keys - 1, st.keys_drifted);
+    if (switched_off) printf("the badge switched off at %.3f s\n", last_us / 1e6);
+    printf("replayed in %.3f s, %.0fx real time\n", took, took > 0 ? span / took : 0);
+    free(updates);
+    return st.different ? 2 : 0;
+}
@@ -0,0 +1,1262 @@
+// Discrete-event simulator for the badge ESP-NOW protocol.
+//
+// Links the real now_proto.c / now_dedup.c through now_hal.h, places N virtual
+// badges in a field and plays fireworks launched at random times and places.
+// The radio model is a distance/loss model with ideal carrier sense, hidden-terminal
+// collisions and half-duplex radios. Airtime uses the same estimate as the badge.
+// Every badge has its own drifting clock, so time sync is measured against truth:
+// the protocol only ever sees local time.
+// With -S badge 0 also leads a show (show.c) and the badges near it follow; their
+// rendered state is compared with what the leader itself renders, and that with its script.
+// With -U badge 0 runs a newer firmware image (now_ota.c) and the rest fetch it
+// from each other; what lands in their "flash" is checked byte for byte, and the
+// flash writer takes as long to store a page and check the image as on the badge.
+// With -G every badge gossips its favourite genomes (now_gossip.c); badge 0 picks
+// a new favourite partway through and its spread across the field is timed.
+// With -A speakers play music in the field; every badge runs the real sound analysis
+// (sound.c) on what its mic would hear and offers audio events like microphone.c.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "now_proto.h"
+#include "now_hal.h"
+#include "sound.h"
+
+#define SLOT_US 20          // 802.11b slot time
+#define DIFS_US 50
+#define CW_SLOTS 32         // contention window for the random back-off
+#define COLLIDED_HISTORY 4
+#define SYNC_SAMPLE_US 1000000  // how often sync error is measured
+#define SYNC_OK_US 1000         // a badge within this of the root counts as synced
+#define SYNC_LINK_MIN 0.5       // delivery a link needs to carry time sync
+#define SHOW_FRAME_US 20000     // lighting task frame period
+#define SHOW_START_US 10000000  // leader starts the show once time sync had a chance
+#define SHOW_SETTLE_US 5000000  // show error is measured from this long after the start
+#define SHOW_SCENE_MS 10000     // leader changes pattern and genome this often
+#define SHOW_FLASH_MS 15000     // and flashes everyone this often
+#define SHOW_OFF_LEVELS 8       // a follower further off than this in any channel looks out of sync
+#define SHOW_PATTERNS 5         // NUM_PATTERNS on the badge
+#define GOSSIP_PICK_US 20000000 // badge 0 picks a new favourite, once the boot-time gossip settled
+#define OTA_PAGE_WRITE_US 60000 // sector erase, 16 programs and the NVS progress commit
+#define OTA_CHECK_US_PER_KB 100 // reading the image back through SHA-256
+#define OTA_VERIFY_US 30000     // a P-256 signature check in software
+#define AUDIO_BLOCK_US 20000    // a mic block, 50 a second like on the badge
+#define AUDIO_OFFER_MS 100      // AUDIO_LEVEL_INTERVAL_MS in microphone.c
+#define AUDIO_BUDGET_US 20000   // AUDIO_LATENCY_BUDGET_US in microphone.h
+#define AUDIO_SETTLE_US 10000000 // audio is measured once time sync had a chance
+#define SPEAKER_DB 115.0        // dB SPL at 1 m
+#define CROWD_DB 55.0           // crowd noise everywhere
+#define MUSIC_BEAT_US 500000    // 120 bpm
+
+typedef struct {
+    now_proto_t np;
+    double x, y;
+    int *nbr;                // badges within max range
+    float *nbr_dist;
+    int nbr_count;
+    int64_t timer_at;        // pending EV_TIMER, INT64_MAX if none
+    int64_t nav_until;       // medium busy as heard by this badge
+    int64_t tx_start, tx_until;  // our own last transmission (half duplex)
+    int rx_frame;            // frame currently arriving, -1 if none
+    int64_t rx_until;
+    int collided[COLLIDED_HISTORY];  // frames recently lost to a collision here
+    int collided_idx;
+    double clock_ppm;        // crystal error
+    int64_t clock_offset_us; // local time at simulation start
+    bool reachable;          // connected to badge 0 (the time sync root) over usable links
+    show_follower_t show;
+    bool follower;           // in radio range of the show leader
+    bool ota_corrupt;        // a page written didn't match the image
+    int64_t ota_start_us;    // first heard of the new image, -1 if not yet
+    int64_t ota_done_us;     // image verified, -1 if not yet
+    int64_t gossip_got_us;   // badge 0's new favourite reached our pool, -1 if not yet
+    sound_analysis_t sound;  // -A: the badge's own analysis of what its mic hears
+    sound_features_t sound_local;
+    float mic_offset_db;     // mics aren't calibrated
+    int64_t audio_offered_ms; // network time we last offered an event to the radio
+    int64_t audio_heard_us;  // last audio event from a nearby badge, -1 if none
+    uint8_t audio_seq;
+} badge_t;
+
+typedef struct {
+    int sender;
+    int64_t start, end;
+    int len;
+    uint8_t data[NOW_MAX_FRAME_LEN];
+} frame_t;
+
+enum { EV_LAUNCH, EV_TIMER, EV_TX_END, EV_SYNC_SAMPLE, EV_SHOW_FRAME, EV_GOSSIP_PICK, EV_AUDIO_BLOCK, EV_OTA_FLASH, EV_OTA_CHECK };
+
+typedef struct {
+    int64_t t;
+    uint64_t seq;            // keeps same-time events in insertion order
+    int type;
+    int badge;
+    int frame;
+} event_t;
+
+typedef struct {
+    uint32_t msg_id;
+    int origin;
+    int64_t launch_us;
+    int delivered;
+} firework_t;
+
+// ---- Simulation parameters ----
+static int num_badges = 200;
+static int num_fireworks = 50;
+static double field_m = 200.0;     // square field side
+static double range_good_m = 30.0; // full delivery (minus base loss) up to here
+static double range_max_m = 60.0;  // no delivery beyond here; also carrier sense range
+static double base_loss = 0.02;
+static double duration_s = 60.0;   // fireworks are launched within this window
+static double run_s = 0.0;         // total simulated time, 0 = duration_s + 10
+static double clock_ppm = 40.0;    // badge clocks are off by up to +/- this
+static int show_interval_ms = 0;   // leader keyframe interval, 0 = no show
+static int ota_kb = 0;             // firmware image badge 0 hands out, 0 = no OTA
+static bool gossip = false;        // genome gossip between badges
+static int audio_speakers = 0;     // speakers playing music in the field, 0 = no sound
+static uint64_t seed = 1;
+static bool csv = false;
+
+// ---- Simulation state ----
+static int64_t sim_now = 0;
+static int64_t end_us;
+static badge_t *cur;               // badge whose protocol code is running, for now_hal_time_us()
+static uint64_t rng_state;
+static badge_t *badges;
+static frame_t *frames;
+static int frame_count, frame_cap;
+static event_t *heap;
+static int heap_len, heap_cap;
+static uint64_t event_seq;
+
+static firework_t *fireworks;
+static int firework_count;
+static int *firework_map;          // msg_id hash -> firework index, -1 empty
+static int firework_map_size;
+static uint8_t *delivered_bits;    // fireworks x badges
+
+static int64_t *latencies;
+static int latency_count, latency_cap;
+
+static uint64_t airtime_total_us;
+static uint32_t frames_on_air, frame_receptions, frames_lost, frames_collided;
+static uint32_t duplicate_triggers, rate_limited;
+
+static int64_t *sync_errors;       // |error| per reachable badge at the last sample
+static int sync_error_count;
+static int reachable_count;
+static int64_t sync_converged_us = -1;
+
+static show_leader_t show_leader;
+static show_follower_t show_self;  // the leader renders its own keyframes like everyone else
+static uint64_t show_leader_frames, show_leader_off; // leader's rendering against the script
+static int show_leader_err_max;
+static int64_t show_next_flash_us = SHOW_START_US + (int64_t)SHOW_FLASH_MS * 1000;
+static int show_followers;
+static uint32_t show_overlays_sent;
+static uint64_t show_overlays_fired;
+static uint8_t *show_errors;       // worst channel error per follower frame, 8 bit levels
+static size_t show_error_count, show_error_cap;
+static uint64_t show_frames, show_frames_off, show_frames_dark;
+
+static uint32_t ota_pages_corrupt;
+
+static uint16_t gossip_pick_id;    // badge 0's new favourite, 0 until picked
+
+static double *speaker_x, *speaker_y;
+static int64_t *speaker_phase_us;  // each speaker's beat, they don't play in step
+static uint32_t *audio_latencies;  // block to reception, us
+static size_t audio_latency_count, audio_latency_cap;
+static uint64_t audio_blocks, audio_blocks_covered;
+
+
+static uint64_t rng_next(void) {
+    // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+static double rng_uniform(void) {
+    return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void *xrealloc(void *p, size_t size) {
+    p = realloc(p, size);
+    if (!p) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+
+// ---- Event heap ----
+
+static bool event_before(const event_t *a, const event_t *b) {
+    return a->t < b->t || (a->t == b->t && a->seq < b->seq);
+}
+
+static void event_push(int64_t t, int type, int badge, int frame) {
+    if (heap_len == heap_cap) {
+        heap_cap = heap_cap ? heap_cap * 2 : 1024;
+        heap = xrealloc(heap, heap_cap * sizeof(event_t));
+    }
+    event_t ev = { .t = t, .seq = event_seq++, .type = type, .badge = badge, .frame = frame };
+    int i = heap_len++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!event_before(&ev, &heap[parent])) break;
+        heap[i] = heap[parent];
+        i = parent;
+    }
+    heap[i] = ev;
+}
+
+static event_t event_pop(void) {
+    event_t top = heap[0];
+    event_t last = heap[--heap_len];
+    int i = 0;
+    while (1) {
+        int child = 2 * i + 1;
+        if (child >= heap_len) break;
+        if (child + 1 < heap_len && event_before(&heap[child + 1], &heap[child])) child++;
+        if (!event_before(&heap[child], &last)) break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = last;
+    return top;
+}
+
+
+// ---- Firework bookkeeping ----
+
+static int firework_lookup(uint32_t msg_id, bool insert) {
+    uint32_t i = (msg_id * 2654435761u) & (firework_map_size - 1);
+    while (firework_map[i] >= 0) {
+        if (fireworks[firework_map[i]].msg_id == msg_id) return firework_map[i];
+        i = (i + 1) & (firework_map_size - 1);
+    }
+    if (!insert) return -1;
+    firework_map[i] = firework_count;
+    return firework_count++;
+}
+
+static void badge_mac(int idx, uint8_t mac[6]) {
+    mac[0] = 0x02; // locally administered
+    mac[1] = 0xB1;
+    mac[2] = 0x00;
+    mac[3] = 0x00;
+    mac[4] = (uint8_t)(idx >> 8);
+    mac[5] = (uint8_t)idx;
+}
+
+
+// ---- Badge clocks ----
+
+static int64_t local_time(const badge_t *b, int64_t t) {
+    return b->clock_offset_us + t + (int64_t)(t * b->clock_ppm * 1e-6);
+}
+
+// First simulation time at which the badge's clock reads local_us
+static int64_t sim_time(const badge_t *b, int64_t local_us) {
+    int64_t t = (int64_t)ceil((local_us - b->clock_offset_us) / (1.0 + b->clock_ppm * 1e-6));
+    while (local_time(b, t) < local_us) t++;
+    while (t > 0 && local_time(b, t - 1) >= local_us) t--;
+    return t;
+}
+
+
+// ---- now_hal.h ----
+
+int64_t now_hal_time_us(void) {
+    return cur ? local_time(cur, sim_now) : sim_now;
+}
+
+uint32_t now_hal_random(void) {
+    return (uint32_t)(rng_next() >> 32);
+}
+
+static int64_t max64(int64_t a, int64_t b) {
+    return a > b ? a : b;
+}
+
+bool now_hal_send(now_proto_t *np, const uint8_t *frame, int len) {
+    badge_t *b = np->user;
+    int idx = (int)(b - badges);
+
+    // CSMA: wait for the medium as we hear it, then a random back-off
+    int64_t start = max64(sim_now, max64(b->nav_until, b->tx_until));
+    start += DIFS_US + SLOT_US * (int64_t)(rng_next() % CW_SLOTS);
+    int64_t end = start + now_proto_frame_airtime_us(len);
+
+    if (frame_count == frame_cap) {
+        frame_cap = frame_cap ? frame_cap * 2 : 1024;
+        frames = xrealloc(frames, frame_cap * sizeof(frame_t));
+    }
+    int f = frame_count++;
+    frames[f] = (frame_t){ .sender = idx, .start = start, .end = end, .len = len };
+    memcpy(frames[f].data, frame, len);
+
+    b->tx_start = start;
+    b->tx_until = end;
+
+    for (int n = 0; n < b->nbr_count; n++) {
+        badge_t *r = &badges[b->nbr[n]];
+        r->nav_until = max64(r->nav_until, end);
+
+        // Overlapping arrivals destroy each other at this receiver (hidden terminals)
+        if (r->rx_frame >= 0 && start < r->rx_until) {
+            r->collided[r->collided_idx++ % COLLIDED_HISTORY] = r->rx_frame;
+            r->collided[r->collided_idx++ % COLLIDED_HISTORY] = f;
+        }
+        if (end > r->rx_until) {
+            r->rx_frame = f;
+            r->rx_until = end;
+        }
+    }
+
+    airtime_total_us += end - start;
+    frames_on_air++;
+    event_push(end, EV_TX_END, idx, f);
+    return true;
+}
+
+void now_hal_audio(now_proto_t *np, const audio_packet_t *pkt) {
+    badge_t *b = np->user;
+    b->audio_heard_us = sim_now;
+    if (sim_now < AUDIO_SETTLE_US) return;
+    if (audio_latency_count == audio_latency_cap) {
+        audio_latency_cap = audio_latency_cap ? audio_latency_cap * 2 : 65536;
+        audio_latencies = xrealloc(audio_latencies, audio_latency_cap * sizeof(uint32_t));
+    }
+    // Same measure as handle_audio(): our network time against the publisher's block
+    audio_latencies[audio_latency_count++] = (uint32_t)now_proto_network_time_us(np, local_time(b, sim_now)) - pkt->t_us;
+}
+
+void now_hal_show(now_proto_t *np, const uint8_t src_addr[6], const show_keyframe_t *pkt, int64_t rx_us) {
+    badge_t *b = np->user;
+    show_follower_rx(&b->show, src_addr, pkt, (uint32_t)(now_proto_network_time_us(np, rx_us) / 1000));
+}
+
+// Firmware images are made up: every byte follows from the version and offset
+static uint8_t ota_byte(uint16_t version, uint32_t offset) {
+    uint32_t x = (offset + 1) * 0x9E3779B1u ^ version * 0x85EBCA6Bu;
+    return (uint8_t)(x >> 24);
+}
+
+// and so are signatures: a hash of what's signed stands in for ECDSA
+static void ota_sign(now_ota_image_t *image) {
+    const uint8_t *p = (const uint8_t *)image;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < OTA_SIGNED_LEN; i++) h = (h ^ p[i]) * 16777619u;
+    for (int i = 0; i < OTA_SIG_LEN; i++) image->sig[i] = ota_byte((uint16_t)h, h % 4096 + i);
+}
+
+bool now_hal_ota_read(now_proto_t *np, uint32_t offset, uint8_t *buf, int len) {
+    for (int i = 0; i < len; i++) buf[i] = ota_byte(np->ota.own.version, offset + i);
+    return true;
+}
+
+// Checked on the writer task, the answer comes back once the check's time has passed
+bool now_hal_ota_verify(now_proto_t *np, const now_ota_image_t *image) {
+    badge_t *b = np->user;
+    now_ota_image_t signed_image = *image;
+    ota_sign(&signed_image);
+    bool ok = memcmp(signed_image.sig, image->sig, OTA_SIG_LEN) == 0;
+    event_push(sim_now + OTA_VERIFY_US, EV_OTA_CHECK, (int)(b - badges), ok);
+    return true;
+}
+
+// The flash writer reports back once the flash time has passed
+bool now_hal_ota_write(now_proto_t *np, const now_ota_image_t *image, uint16_t page, const uint8_t *data, int len) {
+    badge_t *b = np->user;
+    uint32_t offset = (uint32_t)page * OTA_PAGE_LEN;
+    for (int i = 0; i < len; i++) {
+        if (data[i] != ota_byte(image->version, offset + i)) {
+            b->ota_corrupt = true;
+            ota_pages_corrupt++;
+            break;
+        }
+    }
+    event_push(sim_now + OTA_PAGE_WRITE_US, EV_OTA_FLASH, (int)(b - badges), 1);
+    return true;
+}
+
+bool now_hal_ota_finish(now_proto_t *np, const now_ota_image_t *image) {
+    badge_t *b = np->user;
+    // The SHA-256 check on the badge
+    event_push(sim_now + (int64_t)image->size / 1024 * OTA_CHECK_US_PER_KB, EV_OTA_FLASH, (int)(b - badges), !b->ota_corrupt);
+    return true;
+}
+
+void now_hal_genome(now_proto_t *np, const genome *g, uint16_t born_min) {
+    badge_t *b = np->user;
+    uint8_t packed[GOSSIP_PACKED_LEN];
+    if (gossip_pick_id && genome_pack(g, packed) && genome_id(packed) == gossip_pick_id && b->gossip_got_us < 0) {
+        b->gossip_got_us = sim_now;
+    }
+}
+
+void now_hal_firework(now_proto_t *np, const firework_packet_t *pkt) {
+    int idx = (int)((badge_t *)np->user - badges);
+    int fw = firework_lookup(pkt->msg_id, false);
+    if (fw < 0) return;
+
+    size_t bit = (size_t)fw * num_badges + idx;
+    if (delivered_bits[bit / 8] & (1 << (bit % 8))) {
+        duplicate_triggers++;
+        return;
+    }
+    delivered_bits[bit / 8] |= 1 << (bit % 8);
+    fireworks[fw].delivered++;
+
+    if (latency_count == latency_cap) {
+        latency_cap = latency_cap ? latency_cap * 2 : 4096;
+        latencies = xrealloc(latencies, latency_cap * sizeof(int64_t));
+    }
+    latencies[latency_count++] = sim_now - fireworks[fw].launch_us;
+}
+
+
+// ---- Simulation ----
+
+static void schedule_poll(badge_t *b) {
+    cur = b;
+    now_proto_poll(&b->np);
+    if (b->np.tx_in_flight) return; // EV_TX_END polls again
+
+    int64_t next = now_proto_next_due_us(&b->np);
+    if (next == INT64_MAX) return;
+    next = sim_time(b, next);
+    if (next < sim_now) next = sim_now;
+    if (b->timer_at == INT64_MAX || b->timer_at < sim_now || next < b->timer_at) {
+        b->timer_at = next;
+        event_push(next, EV_TIMER, (int)(b - badges), -1);
+    }
+}
+
+static bool frame_collided_at(const badge_t *r, int f) {
+    for (int i = 0; i < COLLIDED_HISTORY; i++) {
+        if (r->collided[i] == f) return true;
+    }
+    return false;
+}
+
+static double delivery_probability(float d) {
+    if (d <= range_good_m) return 1.0 - base_loss;
+    if (d >= range_max_m) return 0.0;
+    return (1.0 - base_loss) * (range_max_m - d) / (range_max_m - range_good_m);
+}
+
+// Log-distance path loss, about -90 dBm at the default maximum range
+static int rssi_at(float d) {
+    if (d < 1.0f) d = 1.0f;
+    return (int)(-40.0 - 28.0 * log10(d));
+}
+
+static void handle_tx_end(const event_t *ev) {
+    // Copy: relays sent from here grow (and may move) the frame array
+    const frame_t frame = frames[ev->frame];
+    const frame_t *fr = &frame;
+    badge_t *s = &badges[fr->sender];
+    uint8_t src[6];
+    badge_mac(fr->sender, src);
+
+    cur = s;
+    now_proto_send_done(&s->np, true, local_time(s, sim_now));
+    if (s->ota_start_us < 0 && s->np.ota.downloading) s->ota_start_us = sim_now;
+
+    for (int n = 0; n < s->nbr_count; n++) {
+        int ri = s->nbr[n];
+        badge_t *r = &badges[ri];
+
+        if (r->rx_frame == ev->frame) r->rx_frame = -1;
+        if (frame_collided_at(r, ev->frame)) {
+            frames_collided++;
+            continue;
+        }
+        if (r->tx_start < fr->end && r->tx_until > fr->start) {
+            frames_lost++; // we were transmitting ourselves
+            continue;
+        }
+        if (rng_uniform() >= delivery_probability(s->nbr_dist[n])) {
+            frames_lost++;
+            continue;
+        }
+        frame_receptions++;
+
+        cur = r;
+        int64_t rx_us = local_time(r, sim_now);
+        int off = 0;
+        while (off < fr->len) {
+            int msg_len = now_proto_msg_len(fr->data[off]);
+            if (msg_len == 0 || off + msg_len > fr->len) break;
+            now_proto_rx_msg(&r->np, src, rssi_at(s->nbr_dist[n]), rx_us, &fr->data[off], msg_len);
+            off += msg_len;
+        }
+        if (r->ota_start_us < 0 && r->np.ota.downloading) r->ota_start_us = sim_now;
+        schedule_poll(r);
+    }
+    schedule_poll(s);
+}
+
+static void handle_launch(const event_t *ev) {
+    badge_t *b = &badges[ev->badge];
+    firework_packet_t pkt;
+    cur = b;
+    if (!now_proto_launch_firework(&b->np, &pkt)) {
+        rate_limited++;
+        return;
+    }
+
+    int fw = firework_lookup(pkt.msg_id, true);
+    fireworks[fw] = (firework_t){ .msg_id = pkt.msg_id, .origin = ev->badge, .launch_us = sim_now };
+
+    // Same repeats as now_send_firework() on the badge
+    now_tx_item_t item = {
+        .enqueue_us = sim_now,
+        .interval_ms = FIREWORK_RETRY_DELAY_MS,
+        .repeats = FIREWORK_RETRIES,
+        .len = sizeof(pkt),
+    };
+    memcpy(item.data, &pkt, sizeof(pkt));
+    item.enqueue_us = local_time(b, sim_now);
+    now_proto_submit(&b->np, &item);
+
+    // The launcher counts as delivered to itself
+    size_t bit = (size_t)fw * num_badges + ev->badge;
+    delivered_bits[bit / 8] |= 1 << (bit % 8);
+    schedule_poll(b);
+}
+
+// ---- Genome gossip ----
+
+// What generate_gene() on the badge can come up with
+static void random_genome(genome *g) {
+    g->cd_period = 1 + rng_next() % 6;
+    g->cd_rate = (uint8_t)rng_next();
+    g->cd_dir = (uint8_t)rng_next();
+    g->sat = 200 + rng_next() % 56;
+    g->hue_base = (uint8_t)rng_next();
+    g->hue_rate = 1 + rng_next() % 4;
+    g->hue_dir = rng_next() & 1;
+    g->hue_bound = (uint8_t)rng_next();
+    g->lin = 0;
+    g->nonlin = (uint8_t)rng_next();
+}
+
+// The wearer of badge 0 finds a pattern they like on pad 2
+static void handle_gossip_pick(void) {
+    badge_t *b = &badges[0];
+    genome g;
+    uint8_t packed[GOSSIP_PACKED_LEN];
+    random_genome(&g);
+    genome_pack(&g, packed);
+    gossip_pick_id = genome_id(packed);
+    b->gossip_got_us = sim_now;
+
+    cur = b;
+    int64_t now = local_time(b, sim_now);
+    uint16_t born = (uint16_t)(now_proto_network_time_us(&b->np, now) / 60000000);
+    now_gossip_set_own(&b->np.gossip, 0, &g, born ? born : 1, now, now_hal_random());
+    schedule_poll(b);
+}
+
+
+// ---- Music ----
+
+// What a badge's mic hears: every speaker with its kick drum and a phrase swelling
+// over 16 s, falling off with distance, over the crowd
+static float heard_db(const badge_t *b) {
+    double power = pow(10.0, CROWD_DB / 10.0);
+    for (int i = 0; i < audio_speakers; i++) {
+        double d = hypot(b->x - speaker_x[i], b->y - speaker_y[i]);
+        double since_beat = (double)((sim_now + speaker_phase_us[i]) % MUSIC_BEAT_US);
+        double db = SPEAKER_DB - 20.0 * log10(d < 1.0 ? 1.0 : d) + 4.0 * sin(2 * M_PI * sim_now / 16e6) +
+                    12.0 * exp(-since_beat / 40000.0) - 12.0;
+        power += pow(10.0, db / 10.0);
+    }
+    return (float)(10.0 * log10(power) + b->mic_offset_db + (rng_uniform() - 0.5) * 3.0);
+}
+
+// The flash writer is done with a page or the image check
+static void handle_ota_flash(const event_t *ev) {
+    badge_t *b = &badges[ev->badge];
+    cur = b;
+    bool last = b->np.ota.page == now_ota_pages(&b->np.ota.target);
+    now_proto_ota_flash_done(&b->np, ev->frame);
+    if (last && ev->frame) b->ota_done_us = sim_now;
+    schedule_poll(b);
+}
+
+// The writer is done with an advert's signature
+static void handle_ota_check(const event_t *ev) {
+    badge_t *b = &badges[ev->badge];
+    cur = b;
+    now_proto_ota_checked(&b->np, ev->frame);
+    schedule_poll(b);
+}
+
+// One mic block on one badge, offered to the radio like update_local_features() does
+static void handle_audio_block(const event_t *ev) {
+    badge_t *b = &badges[ev->badge];
+    cur = b;
+    int64_t now = local_time(b, sim_now);
+    int64_t block_us = now_proto_network_time_us(&b->np, now);
+    float db = heard_db(b);
+    uint8_t beat = sound_block(&b->sound, db, block_us, &b->sound_local);
+    int64_t now_ms = block_us / 1000;
+    if (beat || now_ms - b->audio_offered_ms >= AUDIO_OFFER_MS) {
+        b->audio_offered_ms = now_ms;
+        audio_packet_t pkt = {
+            .type = AUDIO_MSG,
+            .seq = b->audio_seq++,
+            .db = db < 0.0f ? 0 : db > 255.0f ? 255 : (uint8_t)db,
+            .level = (uint8_t)(b->sound.smooth_level * 255.0f),
+            .beat = beat,
+            .t_us = (uint32_t)block_us,
+        };
+        now_tx_item_t item = { .enqueue_us = now, .repeats = 1, .len = sizeof(pkt) };
+        memcpy(item.data, &pkt, sizeof(pkt));
+        now_proto_submit(&b->np, &item);
+        schedule_poll(b);
+    }
+
+    // Someone around (or we ourselves) keeps the music going for this badge
+    if (sim_now >= AUDIO_SETTLE_US) {
+        audio_blocks++;
+        bool heard = b->audio_heard_us >= 0 && sim_now - b->audio_heard_us < (int64_t)REMOTE_HOLD_MS * 1000;
+        bool sent = b->np.stats.audio_sent && now - b->np.audio_sent_us < (int64_t)REMOTE_HOLD_MS * 1000;
+        if (heard || sent) audio_blocks_covered++;
+    }
+    event_push(sim_now + AUDIO_BLOCK_US, EV_AUDIO_BLOCK, ev->badge, -1);
+}
+
+
+static void place_badges(void) {
+    badges = calloc(num_badges, sizeof(badge_t));
+    if (!badges) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (int i = 0; i < num_badges; i++) {
+        badge_t *b = &badges[i];
+        b->x = rng_uniform() * field_m;
+        b->y = rng_uniform() * field_m;
+        b->timer_at = INT64_MAX;
+        b->rx_frame = -1;
+        b->ota_start_us = -1;
+        b->ota_done_us = -1;
+        b->gossip_got_us = -1;
+        b->audio_heard_us = -1;
+        for (int c = 0; c < COLLIDED_HISTORY; c++) b->collided[c] = -1;
+    }
+    for (int i = 0; i < num_badges; i++) {
+        badge_t *b = &badges[i];
+        for (int j = 0; j < num_badges; j++) {
+            if (i == j) continue;
+            double d = hypot(b->x - badges[j].x, b->y - badges[j].y);
+            if (d >= range_max_m) continue;
+            b->nbr = xrealloc(b->nbr, (b->nbr_count + 1) * sizeof(int));
+            b->nbr_dist = xrealloc(b->nbr_dist, (b->nbr_count + 1) * sizeof(float));
+            b->nbr[b->nbr_count] = j;
+            b->nbr_dist[b->nbr_count] = (float)d;
+            b->nbr_count++;
+        }
+    }
+
+    // Badges that can't reach badge 0 through a chain of usable links never sync to it:
+    // a sample takes two beacons in a row from the same parent, which a link at the
+    // fringe of the range almost never delivers
+    int *stack = xrealloc(NULL, num_badges * sizeof(int));
+    int top = 0;
+    badges[0].reachable = true;
+    stack[top++] = 0;
+    while (top > 0) {
+        badge_t *b = &badges[stack[--top]];
+        reachable_count++;
+        for (int n = 0; n < b->nbr_count; n++) {
+            badge_t *o = &badges[b->nbr[n]];
+            if (!o->reachable && delivery_probability(b->nbr_dist[n]) >= SYNC_LINK_MIN) {
+                o->reachable = true;
+                stack[top++] = b->nbr[n];
+            }
+        }
+    }
+    free(stack);
+    sync_errors = xrealloc(NULL, num_badges * sizeof(int64_t));
+
+    // After placement so the same seed gives the same field as before clocks were modelled
+    for (int i = 0; i < num_badges; i++) {
+        badge_t *b = &badges[i];
+        b->clock_ppm = (rng_uniform() * 2.0 - 1.0) * clock_ppm;
+        b->clock_offset_us = (int64_t)(rng_uniform() * 3600e6); // booted up to an hour apart
+
+        uint8_t mac[6];
+        badge_mac(i, mac);
+        b->np.user = b;
+        cur = b;
+        now_proto_init(&b->np, mac);
+        if (ota_kb > 0) {
+            now_ota_image_t own = { .version = i == 0 ? 2 : 1, .size = (uint32_t)ota_kb * 1024 };
+            own.sha[0] = (uint8_t)own.version;
+            ota_sign(&own);
+            now_ota_init(&b->np.ota, &own, true, local_time(b, sim_now), now_hal_random());
+        }
+        if (gossip) {
+            now_gossip_init(&b->np.gossip, local_time(b, sim_now), now_hal_random());
+            for (int slot = 0; slot < GOSSIP_OWN; slot++) {
+                genome g;
+                random_genome(&g);
+                now_gossip_set_own(&b->np.gossip, slot, &g, 0, local_time(b, sim_now), now_hal_random());
+            }
+        }
+        schedule_poll(b); // arms the first time sync beacon
+        if (audio_speakers > 0) {
+            sound_init(&b->sound);
+            b->mic_offset_db = (float)((rng_uniform() - 0.5) * 4.0);
+            event_push((int64_t)(rng_uniform() * AUDIO_BLOCK_US), EV_AUDIO_BLOCK, i, -1);
+        }
+    }
+
+    // Show keyframes are single hop; the audience is everyone in solid range of the
+    // leader (-l raises the loss on those links)
+    if (show_interval_ms > 0) {
+        show_leader_init(&show_leader, (uint16_t)show_interval_ms);
+        show_follower_init(&show_self);
+        for (int n = 0; n < badges[0].nbr_count; n++) {
+            if (badges[0].nbr_dist[n] > range_good_m) continue;
+            badge_t *b = &badges[badges[0].nbr[n]];
+            b->follower = true;
+            show_follower_init(&b->show);
+            show_followers++;
+        }
+    }
+}
+
+
+// Network time error of every reachable badge against badge 0, which has the
+// lowest MAC and so ends up as the root
+static void handle_sync_sample(void) {
+    const badge_t *root = &badges[0];
+    int64_t root_time = now_proto_network_time_us(&root->np, local_time(root, sim_now));
+    int synced = 0;
+
+    sync_error_count = 0;
+    for (int i = 0; i < num_badges; i++) {
+        const badge_t *b = &badges[i];
+        if (!b->reachable) continue;
+        int64_t err = now_proto_network_time_us(&b->np, local_time(b, sim_now)) - root_time;
+        if (memcmp(b->np.sync.root, root->np.own_mac, 6) != 0) err = INT64_MAX; // not following the root yet
+        err = err < 0 ? -err : err;
+        sync_errors[sync_error_count++] = err;
+        if (err <= SYNC_OK_US) synced++;
+    }
+    if (sync_converged_us < 0 && synced * 100 >= reachable_count * 95) sync_converged_us = sim_now;
+    event_push(sim_now + SYNC_SAMPLE_US, EV_SYNC_SAMPLE, -1, -1);
+}
+
+// ---- Show mode ----
+
+// The leader's show: a new pattern and genome every scene with brightness,
+// saturation and hue drifting continuously in between
+static void show_script(uint32_t t_ms, show_state_t *s) {
+    uint32_t scene = t_ms / SHOW_SCENE_MS;
+    double t = t_ms / 1000.0;
+    s->pattern = scene % SHOW_PATTERNS;
+    s->level = (uint8_t)(128 + 100 * sin(2 * M_PI * t / 4.0));
+    s->g.cd_period = 1 + scene % 6;
+    s->g.cd_rate = (uint8_t)(scene * 37);
+    s->g.cd_dir = (uint8_t)(scene * 91);
+    s->g.sat = (uint8_t)(200 + 50 * sin(2 * M_PI * t / 3.0));
+    s->g.hue_base = (uint8_t)(100 + 80 * sin(2 * M_PI * t / 7.0));
+    s->g.hue_rate = 1 + scene % 4;
+    s->g.hue_dir = scene & 1;
+    s->g.hue_bound = s->g.hue_base + 60;
+    s->g.lin = 0;
+    s->g.nonlin = (uint8_t)(scene * 53);
+}
+
+static int abs_diff(uint8_t a, uint8_t b) {
+    return a > b ? a - b : b - a;
+}
+
+// Worst channel a follower is off by; a wrong pattern or animation counts as fully off
+static int show_error(const show_state_t *got, const show_state_t *want) {
+    if (got->pattern != want->pattern || got->g.cd_rate != want->g.cd_rate) return 255;
+    int err = abs_diff(got->level, want->level);
+    int e;
+    if ((e = abs_diff(got->g.sat, want->g.sat)) > err) err = e;
+    if ((e = abs_diff(got->g.hue_base, want->g.hue_base)) > err) err = e;
+    if ((e = abs_diff(got->g.hue_bound, want->g.hue_bound)) > err) err = e;
+    if ((e = abs_diff(got->g.cd_period, want->g.cd_period) * 32) > err) err = e; // whole waves along the strip
+    return err > 255 ? 255 : err;
+}
+
+// One lighting frame on the leader and every follower
+static void handle_show_frame(void) {
+    badge_t *lb = &badges[0];
+    uint32_t leader_ms = (uint32_t)(now_proto_network_time_us(&lb->np, local_time(lb, sim_now)) / 1000);
+    if (sim_now >= show_next_flash_us && sim_now + SHOW_LEAD_MS * 1000 < end_us) {
+        show_leader_overlay(&show_leader, SHOW_OVERLAY_FLASH);
+        show_overlays_sent++;
+        show_next_flash_us += (int64_t)SHOW_FLASH_MS * 1000;
+    }
+    show_state_t own;
+    show_keyframe_t pkt;
+    show_script(leader_ms, &own);
+    if (show_leader_poll(&show_leader, &own, leader_ms, &pkt)) {
+        // Same repeats as now_send_show() on the badge
+        now_tx_item_t item = {
+            .enqueue_us = local_time(lb, sim_now),
+            .interval_ms = SHOW_REPEAT_MS,
+            .repeats = pkt.overlay != SHOW_OVERLAY_NONE ? SHOW_OVERLAY_REPEATS : SHOW_REPEATS,
+            .len = sizeof(pkt),
+        };
+        memcpy(item.data, &pkt, sizeof(pkt));
+        cur = lb;
+        now_proto_submit(&lb->np, &item);
+        schedule_poll(lb);
+        uint8_t self[6];
+        badge_mac(0, self);
+        show_follower_rx(&show_self, self, &pkt, leader_ms);
+    }
+
+    // What everyone should show now: what the leader shows. Against its script that
+    // is SHOW_LEAD_MS behind and sampled at the keyframe interval, so a step change
+    // (pattern, animation period) lands up to an interval off the script's moment
+    show_state_t want, script;
+    uint8_t leader_overlay;
+    show_follower_eval(&show_self, leader_ms, &want, &leader_overlay);
+    show_script(leader_ms - SHOW_LEAD_MS, &script);
+    bool measure = sim_now >= SHOW_START_US + SHOW_SETTLE_US;
+    if (measure) {
+        int err = show_error(&want, &script);
+        show_leader_frames++;
+        if (err > SHOW_OFF_LEVELS) show_leader_off++;
+        if (err > show_leader_err_max) show_leader_err_max = err;
+    }
+
+    for (int i = 1; i < num_badges; i++) {
+        badge_t *b = &badges[i];
+        if (!b->follower) continue;
+        show_state_t got;
+        uint8_t overlay;
+        uint32_t now_ms = (uint32_t)(now_proto_network_time_us(&b->np, local_time(b, sim_now)) / 1000);
+        bool active = show_follower_eval(&b->show, now_ms, &got, &overlay);
+        if (overlay != SHOW_OVERLAY_NONE) show_overlays_fired++;
+        if (!measure) continue;
+
+        show_frames++;
+        if (!active) {
+            show_frames_dark++;
+            continue;
+        }
+        int err = show_error(&got, &want);
+        if (err > SHOW_OFF_LEVELS) show_frames_off++;
+        if (show_error_count == show_error_cap) {
+            show_error_cap = show_error_cap ? show_error_cap * 2 : 65536;
+            show_errors = xrealloc(show_errors, show_error_cap);
+        }
+        show_errors[show_error_count++] = (uint8_t)err;
+    }
+    event_push(sim_now + SHOW_FRAME_US, EV_SHOW_FRAME, -1, -1);
+}
+
+static int cmp_u8(const void *a, const void *b) {
+    return *(const uint8_t *)a - *(const uint8_t *)b;
+}
+
+static int show_error_pct(int pct) {
+    return show_error_count ? show_errors[((show_error_count - 1) * pct) / 100] : 0;
+}
+
+static int cmp_i64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static double audio_latency_pct(int pct) {
+    return audio_latency_count ? audio_latencies[((audio_latency_count - 1) * pct) / 100] / 1000.0 : 0.0;
+}
+
+static double sync_error_pct(int pct) {
+    if (sync_error_count == 0) return 0.0;
+    int64_t e = sync_errors[((sync_error_count - 1) * pct) / 100];
+    return e == INT64_MAX ? INFINITY : e / 1.0;
+}
+
+// Seconds until pct % of the badges that could update had the new image
+static double ota_done_pct(const int64_t *done, int count, int targets, int pct) {
+    int need = (targets * pct + 99) / 100;
+    if (need == 0) return 0.0;
+    return need <= count ? done[need - 1] / 1e6 : INFINITY;
+}
+
+static void report(void) {
+    uint64_t deliveries = 0;
+    for (int i = 0; i < firework_count; i++) deliveries += fireworks[i].delivered;
+    uint64_t targets = (uint64_t)firework_count * (num_badges - 1);
+    double ratio = targets ? (double)deliveries / targets : 0.0;
+
+    qsort(latencies, latency_count, sizeof(int64_t), cmp_i64);
+    double lat_mean = 0;
+    for (int i = 0; i < latency_count; i++) lat_mean += latencies[i];
+    lat_mean = latency_count ? lat_mean / latency_count / 1000.0 : 0.0;
+    double lat_p50 = latency_count ? latencies[latency_count / 2] / 1000.0 : 0.0;
+    double lat_p95 = latency_count ? latencies[(latency_count * 95) / 100] / 1000.0 : 0.0;
+    double lat_max = latency_count ? latencies[latency_count - 1] / 1000.0 : 0.0;
+
+    uint64_t redundant = 0, relays = 0, suppressed = 0, evictions = 0, sync_airtime = 0, device_err = 0;
+    int device_synced = 0;
+    uint64_t show_airtime = 0, show_heard = 0, show_late = 0;
+    uint64_t ota_airtime = 0, gossip_airtime = 0, audio_airtime = 0;
+    uint64_t audio_sent = 0, audio_yielded = 0, audio_unchanged = 0, audio_capped = 0;
+    int audio_publishers = 0;
+    now_ota_stats_t ota = {0};
+    now_gossip_stats_t gs = {0};
+    double avg_nbrs = 0;
+    for (int i = 0; i < num_badges; i++) {
+        sync_airtime += badges[i].np.stats.sync_airtime_us;
+        show_airtime += badges[i].np.stats.show_airtime_us;
+        ota_airtime += badges[i].np.stats.ota_airtime_us;
+        gossip_airtime += badges[i].np.stats.gossip_airtime_us;
+        const now_stats_t *st = &badges[i].np.stats;
+        audio_airtime += st->audio_airtime_us;
+        audio_sent += st->audio_sent;
+        audio_yielded += st->audio_yielded;
+        audio_unchanged += st->audio_unchanged;
+        audio_capped += st->audio_capped;
+        if (st->audio_sent) audio_publishers++;
+        const now_gossip_stats_t *bgs = &badges[i].np.gossip.stats;
+        gs.digests_sent += bgs->digests_sent;
+        gs.reqs_sent += bgs->reqs_sent;
+        gs.reqs_suppressed += bgs->reqs_suppressed;
+        gs.genomes_sent += bgs->genomes_sent;
+        gs.sends_suppressed += bgs->sends_suppressed;
+        gs.genomes_heard += bgs->genomes_heard;
+        gs.genomes_learned += bgs->genomes_learned;
+        gs.genomes_bad += bgs->genomes_bad;
+        const now_ota_stats_t *os = &badges[i].np.ota.stats;
+        ota.req_sent += os->req_sent;
+        ota.nacks_sent += os->nacks_sent;
+        ota.chunks_sent += os->chunks_sent;
+        ota.chunks_used += os->chunks_used;
+        ota.chunks_bad += os->chunks_bad;
+        ota.verify_failed += os->verify_failed;
+        ota.source_changes += os->source_changes;
+        ota.sig_bad += os->sig_bad;
+        ota.chunks_capped += os->chunks_capped;
+        if (badges[i].follower) {
+            show_heard += badges[i].np.stats.show_heard;
+            show_late += badges[i].show.stats.late;
+        }
+        const now_sync_t *sy = &badges[i].np.sync;
+        if (sy->stats.synced && sy->stats.hops > 0) {
+            device_err += sy->stats.error_avg_us;
+            device_synced++;
+        }
+        redundant += badges[i].np.dedup.stats.duplicates;
+        evictions += badges[i].np.dedup.stats.evictions;
+        relays += badges[i].np.stats.relays_sent;
+        suppressed += badges[i].np.stats.relays_suppressed;
+        avg_nbrs += badges[i].nbr_count;
+    }
+    avg_nbrs /= num_badges;
+    double airtime_per_fw_ms = firework_count ? (airtime_total_us - sync_airtime - show_airtime - ota_airtime - gossip_airtime - audio_airtime) / 1000.0 / firework_count : 0.0;
+
+    qsort(sync_errors, sync_error_count, sizeof(int64_t), cmp_i64);
+    double converge_s = sync_converged_us >= 0 ? sync_converged_us / 1e6 : INFINITY;
+    double sync_duty_pct = sim_now ? 100.0 * sync_airtime / ((double)sim_now * num_badges) : 0.0;
+
+    qsort(show_errors, show_error_count, 1, cmp_u8);
+    double show_s = sim_now > SHOW_START_US ? (sim_now - SHOW_START_US) / 1e6 : 0.0;
+    double show_bps = show_followers && show_s > 0 ? show_heard * sizeof(show_keyframe_t) / (show_followers * show_s) : 0.0;
+    double show_off_pct = show_frames ? 100.0 * show_frames_off / show_frames : 0.0;
+    double show_dark_pct = show_frames ? 100.0 * show_frames_dark / show_frames : 0.0;
+    double show_duty_pct = show_s > 0 ? 100.0 * show_airtime / (show_s * 1e6) : 0.0;
+
+    // Badge 0 starts out with the image, everyone it can reach should end up with it
+    int64_t *ota_done = xrealloc(NULL, num_badges * sizeof(int64_t));
+    int ota_updated = 0, ota_targets = ota_kb > 0 ? reachable_count - 1 : 0;
+    double ota_kbps = 0.0;
+    for (int i = 1; i < num_badges && ota_kb > 0; i++) {
+        const badge_t *b = &badges[i];
+        if (b->ota_done_us < 0) continue;
+        ota_done[ota_updated++] = b->ota_done_us;
+        ota_kbps += ota_kb * 1024.0 / 1000.0 / ((b->ota_done_us - b->ota_start_us) / 1e6);
+    }
+    qsort(ota_done, ota_updated, sizeof(int64_t), cmp_i64);
+    if (ota_updated) ota_kbps /= ota_updated;
+    double ota_t50 = ota_done_pct(ota_done, ota_updated, ota_targets, 50);
+    double ota_t95 = ota_done_pct(ota_done, ota_updated, ota_targets, 95);
+    double ota_tall = ota_done_pct(ota_done, ota_updated, ota_targets, 100);
+    double ota_sent_per_used = ota.chunks_used ? (double)ota.chunks_sent / ota.chunks_used : 0.0;
+    double ota_duty_pct = sim_now ? 100.0 * ota_airtime / (double)sim_now : 0.0;
+    free(ota_done);
+
+    // Spread of badge 0's new favourite to everyone connected to it
+    int64_t *gossip_got = xrealloc(NULL, num_badges * sizeof(int64_t));
+    int gossip_reached = 0, gossip_targets = gossip ? reachable_count - 1 : 0;
+    for (int i = 1; i < num_badges && gossip; i++) {
+        if (badges[i].gossip_got_us >= 0) gossip_got[gossip_reached++] = badges[i].gossip_got_us - GOSSIP_PICK_US;
+    }
+    qsort(gossip_got, gossip_reached, sizeof(int64_t), cmp_i64);
+    double gossip_t50 = ota_done_pct(gossip_got, gossip_reached, gossip_targets, 50);
+    double gossip_t95 = ota_done_pct(gossip_got, gossip_reached, gossip_targets, 95);
+    double gossip_ms_per_hour = sim_now ? gossip_airtime / 1000.0 / num_badges / (sim_now / 3600e6) : 0.0;
+    free(gossip_got);
+
+    // Update airtime a badge shares the channel with, over the time the update took
+    double ota_around_avg = 0, ota_around_max = 0;
+    int64_t ota_span_us = ota_updated == ota_targets && ota_targets > 0 ? (int64_t)(ota_tall * 1e6) : sim_now;
+    for (int i = 0; i < num_badges && ota_kb > 0 && ota_span_us > 0; i++) {
+        const badge_t *b = &badges[i];
+        uint64_t around = b->np.stats.ota_airtime_us;
+        for (int n = 0; n < b->nbr_count; n++) around += badges[b->nbr[n]].np.stats.ota_airtime_us;
+        double duty = 100.0 * around / (double)ota_span_us;
+        ota_around_avg += duty / num_badges;
+        if (duty > ota_around_max) ota_around_max = duty;
+    }
+
+    // Audio airtime a badge shares the channel with: its own and its neighbours'
+    double audio_duty_avg = 0, audio_duty_max = 0;
+    for (int i = 0; i < num_badges && audio_speakers > 0 && sim_now > 0; i++) {
+        const badge_t *b = &badges[i];
+        uint64_t around = b->np.stats.audio_airtime_us;
+        for (int n = 0; n < b->nbr_count; n++) around += badges[b->nbr[n]].np.stats.audio_airtime_us;
+        double duty = 100.0 * around / (double)sim_now;
+        audio_duty_avg += duty / num_badges;
+        if (duty > audio_duty_max) audio_duty_max = duty;
+    }
+    qsort(audio_latencies, audio_latency_count, sizeof(uint32_t), cmp_u32);
+    size_t audio_over = 0;
+    while (audio_over < audio_latency_count && audio_latencies[audio_latency_count - 1 - audio_over] > AUDIO_BUDGET_US) audio_over++;
+    double audio_over_pct = audio_latency_count ? 100.0 * audio_over / audio_latency_count : 0.0;
+    double audio_covered_pct = audio_blocks ? 100.0 * audio_blocks_covered / audio_blocks : 0.0;
+    double audio_s = sim_now > AUDIO_SETTLE_US ? (sim_now - AUDIO_SETTLE_US) / 1e6 : 0.0;
+
+    if (csv) {
+        printf("badges,fireworks,delivery_ratio,lat_mean_ms,lat_p95_ms,lat_max_ms,duplicate_triggers,"
+               "redundant_copies,frames,relays,suppressed,collided,airtime_ms,airtime_per_firework_ms,"
+               "sync_converge_s,sync_err_p50_us,sync_err_p95_us,sync_err_max_us,sync_airtime_pct,"
+               "show_interval_ms,show_followers,show_bytes_per_s,show_err_p50,show_err_p95,show_off_pct,show_dark_pct,"
+               "ota_kb,ota_updated,ota_targets,ota_t50_s,ota_t95_s,ota_all_s,ota_kb_per_s,ota_sent_per_used,ota_nacks,ota_airtime_pct,"
+               "gossip,gossip_reached,gossip_targets,gossip_t50_s,gossip_t95_s,gossip_ms_per_badge_hour,gossip_genomes_sent,"
+               "audio_speakers,audio_publishers,audio_sent,audio_airtime_avg_pct,audio_airtime_max_pct,"
+               "audio_lat_p50_ms,audio_lat_p95_ms,audio_over_budget_pct,audio_covered_pct,"
+               "ota_airtime_around_avg_pct,ota_airtime_around_max_pct,ota_chunks_capped\n");
+        printf("%d,%d,%.4f,%.1f,%.1f,%.1f,%" PRIu32 ",%" PRIu64 ",%" PRIu32 ",%" PRIu64 ",%" PRIu64 ",%" PRIu32 ",%.1f,%.2f,"
+               "%.1f,%.0f,%.0f,%.0f,%.4f,%d,%d,%.1f,%d,%d,%.2f,%.2f,%d,%d,%d,%.1f,%.1f,%.1f,%.2f,%.3f,%" PRIu32 ",%.2f,"
+               "%d,%d,%d,%.1f,%.1f,%.1f,%" PRIu32 ",%d,%d,%" PRIu64 ",%.3f,%.3f,%.2f,%.2f,%.2f,%.1f,%.2f,%.2f,%" PRIu32 "\n",
+               num_badges, firework_count, ratio, lat_mean, lat_p95, lat_max, duplicate_triggers,
+               redundant, frames_on_air, relays, suppressed, frames_collided,
+               airtime_total_us / 1000.0, airtime_per_fw_ms,
+               converge_s, sync_error_pct(50), sync_error_pct(95), sync_error_pct(100), sync_duty_pct,
+               show_interval_ms, show_followers, show_bps, show_error_pct(50), show_error_pct(95), show_off_pct, show_dark_pct,
+               ota_kb, ota_updated, ota_targets, ota_t50, ota_t95, ota_tall, ota_kbps, ota_sent_per_used, ota.nacks_sent, ota_duty_pct,
+               gossip, gossip_reached, gossip_targets, gossip_t50, gossip_t95, gossip_ms_per_hour, gs.genomes_sent,
+               audio_speakers, audio_publishers, audio_sent, audio_duty_avg, audio_duty_max,
+               audio_latency_pct(50), audio_latency_pct(95), audio_over_pct, audio_covered_pct,
+               ota_around_avg, ota_around_max, ota.chunks_capped);
+        return;
+    }
+
+    printf("badges             %d in %.0fx%.0f m, range %.0f/%.0f m, %.1f neighbours avg\n",
+           num_badges, field_m, field_m, range_good_m, range_max_m, avg_nbrs);
+    printf("fireworks          %d launched, %" PRIu32 " rate limited\n", firework_count, rate_limited);
+    printf("delivery ratio     %.2f %%\n", ratio * 100.0);
+    printf("latency            mean %.1f ms, p50 %.1f ms, p95 %.1f ms, max %.1f ms\n",
+           lat_mean, lat_p50, lat_p95, lat_max);
+    printf("duplicate triggers %" PRIu32 "\n", duplicate_triggers);
+    printf("redundant copies   %" PRIu64 " (dedup evictions %" PRIu64 ")\n", redundant, evictions);
+    printf("frames on air      %" PRIu32 " (%" PRIu64 " relays, %" PRIu64 " suppressed)\n",
+           frames_on_air, relays, suppressed);
+    printf("receptions         %" PRIu32 " ok, %" PRIu32 " lost, %" PRIu32 " collided\n",
+           frame_receptions, frames_lost, frames_collided);
+    printf("airtime            %.1f ms total, %.2f ms per firework\n",
+           airtime_total_us / 1000.0, airtime_per_fw_ms);
+    printf("time sync          %d/%d badges reachable from the root, 95%% within %d us after %.1f s\n",
+           reachable_count, num_badges, SYNC_OK_US, converge_s);
+    printf("sync error         p50 %.0f us, p95 %.0f us, max %.0f us (badges' own estimate %.0f us avg over %d synced)\n",
+           sync_error_pct(50), sync_error_pct(95), sync_error_pct(100), device_synced ? (double)device_err / device_synced : 0.0,
+           device_synced);
+    printf("sync airtime       %.1f ms total, %.4f %% duty per badge\n", sync_airtime / 1000.0, sync_duty_pct);
+    if (ota_kb > 0) {
+        printf("firmware update    %d/%d badges got the %d KB image; 50%% after %.1f s, 95%% after %.1f s, all after %.1f s\n",
+               ota_updated, ota_targets, ota_kb, ota_t50, ota_t95, ota_tall);
+        printf("update transfer    %.2f KB/s per badge avg, %.3f chunks sent per chunk stored, %" PRIu32 " requests (%" PRIu32 " NACKs)\n",
+               ota_kbps, ota_sent_per_used, ota.req_sent, ota.nacks_sent);
+        printf("update errors      %" PRIu32 " bad CRCs, %" PRIu32 " corrupt pages, %" PRIu32 " failed verifies, %" PRIu32 " bad signatures, %" PRIu32 " source changes\n",
+               ota.chunks_bad, ota_pages_corrupt, ota.verify_failed, ota.sig_bad, ota.source_changes);
+        printf("update airtime     %.1f ms total; around a badge %.1f %% of the channel avg, %.1f %% max while it ran (cap %d %%, %" PRIu32 " waits)\n",
+               ota_airtime / 1000.0, ota_around_avg, ota_around_max, OTA_AIRTIME_PCT, ota.chunks_capped);
+    }
+    if (gossip) {
+        printf("genome gossip      new favourite reached %d/%d badges; 50%% after %.1f s, 95%% after %.1f s\n",
+               gossip_reached, gossip_targets, gossip_t50, gossip_t95);
+        printf("gossip traffic     %" PRIu32 " digests, %" PRIu32 " requests (%" PRIu32 " suppressed), %" PRIu32 " genomes sent (%" PRIu32 " suppressed)\n",
+               gs.digests_sent, gs.reqs_sent, gs.reqs_suppressed, gs.genomes_sent, gs.sends_suppressed);
+        printf("gossip pools       %" PRIu32 " genomes heard, %" PRIu32 " learned, %" PRIu32 " bad\n",
+               gs.genomes_heard, gs.genomes_learned, gs.genomes_bad);
+        printf("gossip airtime     %.1f ms total, %.1f ms per badge per hour\n", gossip_airtime / 1000.0, gossip_ms_per_hour);
+    }
+    if (audio_speakers > 0) {
+        printf("audio              %d speakers; %d/%d badges published, %.1f events/s in all (%" PRIu64 " yielded, %" PRIu64 " unchanged, %" PRIu64 " capped)\n",
+               audio_speakers, audio_publishers, num_badges, audio_s > 0 ? audio_sent / (sim_now / 1e6) : 0.0,
+               audio_yielded, audio_unchanged, audio_capped);
+        printf("audio airtime      %.1f ms total; around a badge %.3f %% of the channel avg, %.3f %% max\n",
+               audio_airtime / 1000.0, audio_duty_avg, audio_duty_max);
+        printf("audio latency      p50 %.2f ms, p95 %.2f ms, max %.2f ms; %.2f %% over the %d ms budget; music shared around %.1f %% of the time\n",
+               audio_latency_pct(50), audio_latency_pct(95), audio_latency_pct(100), audio_over_pct, AUDIO_BUDGET_US / 1000,
+               audio_covered_pct);
+    }
+    if (show_interval_ms == 0) return;
+    printf("show               %d followers, keyframes every %d ms, %.1f B/s per follower, leader %.3f %% duty\n",
+           show_followers, show_interval_ms, show_bps, show_duty_pct);
+    printf("show error         p50 %d, p95 %d, max %d levels off the leader; %.2f %% of frames off by more than %d, %.2f %% dark\n",
+           show_error_pct(50), show_error_pct(95), show_error_pct(100), show_off_pct, SHOW_OFF_LEVELS, show_dark_pct);
+    printf("show sampling      leader off its script by more than %d in %.2f %% of frames, max %d\n", SHOW_OFF_LEVELS,
+           show_leader_frames ? 100.0 * show_leader_off / show_leader_frames : 0.0, show_leader_err_max);
+    printf("show loss          %" PRIu64 " keyframes late, %" PRIu64 "/%" PRIu64 " flashes shown\n",
+           show_late, show_overlays_fired, (uint64_t)show_overlays_sent * show_followers);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -n N     number of badges (default %d)\n"
+        "  -f N     number of fireworks (default %d)\n"
+        "  -a M     field side in metres (default %.0f)\n"
+        "  -r M     full-delivery range in metres (default %.0f)\n"
+        "  -R M     maximum range in metres (default %.0f)\n"
+        "  -l P     base frame loss probability (default %.2f)\n"
+        "  -d S     launch window in seconds (default %.0f)\n"
+        "  -T S     total simulated seconds (default launch window + 10)\n"
+        "  -p PPM   clock error range, +/- (default %.0f)\n"
+        "  -S MS    badge 0 leads a show with keyframes at most every MS (default off)\n"
+        "  -U KB    badge 0 hands a KB firmware image to everyone else (default off)\n"
+        "  -G       badges gossip their favourite genomes (default off)\n"
+        "  -A N     N speakers play music in the field, badges share what they hear (default off)\n"
+        "  -s SEED  random seed (default %" PRIu64 ")\n"
+        "  -c       print a CSV summary\n",
+        prog, num_badges, num_fireworks, field_m, range_good_m, range_max_m, base_loss, duration_s, clock_ppm, seed);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:f:a:r:R:l:d:T:p:S:U:GA:s:ch")) != -1) {
+        switch (opt) {
+            case 'n': num_badges = atoi(optarg); break;
+            case 'f': num_fireworks = atoi(optarg); break;
+            case 'a': field_m = atof(optarg); break;
+            case 'r': range_good_m = atof(optarg); break;
+            case 'R': range_max_m = atof(optarg); break;
+            case 'l': base_loss = atof(optarg); break;
+            case 'd': duration_s = atof(optarg); break;
+            case 'T': run_s = atof(optarg); break;
+            case 'p': clock_ppm = atof(optarg); break;
+            case 'S': show_interval_ms = atoi(optarg); break;
+            case 'U': ota_kb = atoi(optarg); break;
+            case 'G': gossip = true; break;
+            case 'A': audio_speakers = atoi(optarg); break;
+            case 's': seed = strtoull(optarg, NULL, 0); break;
+            case 'c': csv = true; break;
+            default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (num_badges < 2 || num_badges > 65535 || num_fireworks < 0 || range_max_m <= range_good_m ||
+        show_interval_ms < 0 || show_interval_ms > 65535 || ota_kb < 0 || ota_kb > 4096 || audio_speakers < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    rng_state = seed * 0x9E3779B97F4A7C15ULL + 1;
+    if (run_s <= 0) run_s = duration_s + 10.0;
+
+    place_badges();
+    if (audio_speakers > 0) {
+        speaker_x = xrealloc(NULL, audio_speakers * sizeof(double));
+        speaker_y = xrealloc(NULL, audio_speakers * sizeof(double));
+        speaker_phase_us = xrealloc(NULL, audio_speakers * sizeof(int64_t));
+        for (int i = 0; i < audio_speakers; i++) {
+            speaker_x[i] = rng_uniform() * field_m;
+            speaker_y[i] = rng_uniform() * field_m;
+            speaker_phase_us[i] = (int64_t)(rng_uniform() * MUSIC_BEAT_US);
+        }
+    }
+
+    fireworks = calloc(num_fireworks + 1, sizeof(firework_t));
+    firework_map_size = 1;
+    while (firework_map_size < num_fireworks * 4) firework_map_size <<= 1;
+    firework_map = malloc(firework_map_size * sizeof(int));
+    memset(firework_map, 0xff, firework_map_size * sizeof(int));
+    delivered_bits = calloc(((size_t)num_fireworks * num_badges + 7) / 8 + 1, 1);
+    if (!fireworks || !firework_map || !delivered_bits) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    for (int i = 0; i < num_fireworks; i++) {
+        int64_t t = (int64_t)(rng_uniform() * duration_s * 1e6);
+        event_push(t, EV_LAUNCH, (int)(rng_next() % num_badges), -1);
+    }
+    event_push(SYNC_SAMPLE_US, EV_SYNC_SAMPLE, -1, -1);
+    if (show_interval_ms > 0) event_push(SHOW_START_US, EV_SHOW_FRAME, -1, -1);
+    if (gossip) event_push(GOSSIP_PICK_US, EV_GOSSIP_PICK, -1, -1);
+
+    // Beacons keep the event queue busy forever, so stop on time
+    end_us = (int64_t)(run_s * 1e6);
+    while (heap_len > 0 && heap[0].t <= end_us) {
+        event_t ev = event_pop();
+        sim_now = ev.t;
+        switch (ev.type) {
+            case EV_LAUNCH:
+                handle_launch(&ev);
+                break;
+            case EV_TIMER:
+                if (badges[ev.badge].timer_at != ev.t) break; // superseded
+                badges[ev.badge].timer_at = INT64_MAX;
+                schedule_poll(&badges[ev.badge]);
+                break;
+            case EV_TX_END:
+                handle_tx_end(&ev);
+                break;
+            case EV_SYNC_SAMPLE:
+                handle_sync_sample();
+                break;
+            case EV_SHOW_FRAME:
+                handle_show_frame();
+                break;
+            case EV_GOSSIP_PICK:
+                handle_gossip_pick();
+                break;
+            case EV_AUDIO_BLOCK:
+                handle_audio_block(&ev);
+                break;
+            case EV_OTA_FLASH:
+                handle_ota_flash(&ev);
+                break;
+            case EV_OTA_CHECK:
+                handle_ota_check(&ev);
+                break;
+        }
+    }
+
+    report();
+    return 0;
+}
@@ -0,0 +1,217 @@
+// Decodes the badge's `telemetry` console dump (main/telemetry.c) from a saved monitor
+// log; other log lines around the dump are skipped, and with several dumps in the log
+// the last one wins.
+//
+//   ./telemetry-parse monitor.log          summary per boot
+//   ./telemetry-parse -c monitor.log       every minute as CSV, for plotting
+//
+// The summary has the reset reason and firmware of every boot, the voltage curve's ends,
+// minutes dimmed, on the safety pattern and in standby, frame rate and sound exposure.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "telemetry_format.h"
+
+#define MAX_SECTORS 64
+#define LOUD_DB 85                  // minutes averaging at least this count as loud
+
+typedef struct {
+    bool seen;
+    uint32_t seq;
+    uint8_t data[TLOG_SECTOR_SIZE];
+} sector_t;
+
+typedef struct {
+    tlog_boot_t info;
+    bool have_info;                 // its boot record is still in the log
+    uint32_t minutes;
+    uint32_t first_minute, last_minute;
+    uint16_t first_mv, last_mv, min_mv;
+    uint32_t dimmed, safety, standby, mic_on, leader, loud;
+    uint64_t fps_sum, db_sum;
+    uint8_t db_max;
+} boot_summary_t;
+
+static sector_t sectors[MAX_SECTORS];
+static int sector_count;
+
+// esp_reset_reason_t, as reset_reason_str() in main/testing_routine.c names them
+static const char *const reset_reasons[] = {
+    "Unknown", "Power-on", "External pin", "Software restart", "Exception/Panic", "Interrupt Watchdog",
+    "Task Watchdog", "Other Watchdog", "Wake from Deep Sleep", "Brownout (low voltage)", "SDIO", "USB",
+    "JTAG", "eFuse Error", "Power Glitch", "CPU Lockup",
+};
+
+static bool load(FILE *f) {
+    char line[256];
+    bool in_dump = false, found = false;
+    while (fgets(line, sizeof(line), f)) {
+        char *p;
+        if ((p = strstr(line, "telemetry begin "))) {
+            int version, count, size;
+            if (sscanf(p, "telemetry begin %d %d %d", &version, &count, &size) == 3 && version == 1 &&
+                size == TLOG_SECTOR_SIZE && count > 0 && count <= MAX_SECTORS) {
+                in_dump = true;
+                sector_count = count;
+                for (int s = 0; s < MAX_SECTORS; s++) {
+                    sectors[s].seen = false;
+                    memset(sectors[s].data, 0xff, TLOG_SECTOR_SIZE);
+                }
+            }
+        } else if (!in_dump) {
+            continue;
+        } else if (strstr(line, "telemetry end")) {
+            in_dump = false;
+            found = true;
+        } else if ((p = strstr(line, "tl "))) {
+            int s, n = 0;
+            unsigned off;
+            char hex[80];
+            if (sscanf(p, "tl %d %x %79s", &s, &off, hex) != 3 || s < 0 || s >= sector_count) continue;
+            for (const char *h = hex; h[0] && h[1] && off + n < TLOG_SECTOR_SIZE; h += 2, n++) {
+                unsigned b;
+                if (sscanf(h, "%2x", &b) != 1) break;
+                sectors[s].data[off + n] = (uint8_t)b;
+            }
+            sectors[s].seen = true;
+        }
+    }
+    return found;
+}
+
+static int by_seq(const void *a, const void *b) {
+    const sector_t *x = *(const sector_t *const *)a, *y = *(const sector_t *const *)b;
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static boot_summary_t *summary_for(boot_summary_t *boots, int *count, int max, uint16_t boot) {
+    for (int i = 0; i < *count; i++) {
+        if (boots[i].info.boot == boot) return &boots[i];
+    }
+    if (*count == max) return NULL;
+    boot_summary_t *b = &boots[(*count)++];
+    memset(b, 0, sizeof(*b));
+    b->info.boot = boot;
+    return b;
+}
+
+static void add_sample(boot_summary_t *b, const tlog_sample_t *s) {
+    if (!b->minutes) {
+        b->first_minute = s->minute;
+        b->first_mv = b->min_mv = s->voltage_mv;
+    }
+    b->minutes++;
+    b->last_minute = s->minute;
+    b->last_mv = s->voltage_mv;
+    if (s->voltage_mv < b->min_mv) b->min_mv = s->voltage_mv;
+    if (s->flags & TLOG_F_LIMIT_BRIGHTNESS) b->dimmed++;
+    if (s->flags & TLOG_F_SAFETY_PATTERN) b->safety++;
+    if (s->flags & TLOG_F_STANDBY) b->standby++;
+    if (s->flags & TLOG_F_SHOW_LEADER) b->leader++;
+    if (s->flags & TLOG_F_MIC_ON) {
+        b->mic_on++;
+        b->db_sum += s->loud_avg_db;
+        if (s->loud_avg_db >= LOUD_DB) b->loud++;
+        if (s->loud_max_db > b->db_max) b->db_max = s->loud_max_db;
+    }
+    b->fps_sum += s->fps;
+}
+
+static void print_summary(const boot_summary_t *b) {
+    printf("boot %u", b->info.boot);
+    if (b->have_info) {
+        unsigned r = b->info.reset_reason;
+        printf(": %s, firmware %" PRIu32, r < sizeof(reset_reasons) / sizeof(reset_reasons[0]) ? reset_reasons[r] : "Invalid",
+               b->info.fw_version);
+    }
+    printf("\n");
+    if (!b->minutes) {
+        printf("  no samples\n");
+        return;
+    }
+    printf("  minutes %" PRIu32 "-%" PRIu32 " (%" PRIu32 " logged)\n", b->first_minute, b->last_minute, b->minutes);
+    printf("  battery %u -> %u mV, lowest %u mV\n", b->first_mv, b->last_mv, b->min_mv);
+    printf("  dimmed %" PRIu32 " min, safety pattern %" PRIu32 " min, standby %" PRIu32 " min, leading a show %" PRIu32 " min\n",
+           b->dimmed, b->safety, b->standby, b->leader);
+    printf("  %.1f fps average\n", (double)b->fps_sum / b->minutes);
+    if (b->mic_on) {
+        printf("  mic on %" PRIu32 " min: %.1f dB average, %u dB peak, %" PRIu32 " min at %d dB or more\n", b->mic_on,
+               (double)b->db_sum / b->mic_on, b->db_max, b->loud, LOUD_DB);
+    }
+}
+
+int main(int argc, char **argv) {
+    bool csv = false;
+    int arg = 1;
+    if (argc > 1 && !strcmp(argv[1], "-c")) {
+        csv = true;
+        arg++;
+    }
+    if (argc != arg + 1 || !strcmp(argv[arg], "-h")) {
+        fprintf(stderr, "usage: %s [-c] LOG (- for stdin)\n", argv[0]);
+        return argc == arg + 1 ? 0 : 1;
+    }
+    FILE *f = strcmp(argv[arg], "-") ? fopen(argv[arg], "r") : stdin;
+    if (!f) {
+        perror(argv[arg]);
+        return 1;
+    }
+    bool found = load(f);
+    if (f != stdin) fclose(f);
+    if (!found) {
+        fprintf(stderr, "%s: no complete telemetry dump in it\n", argv[arg]);
+        return 1;
+    }
+
+    sector_t *order[MAX_SECTORS];
+    int n = 0;
+    for (int s = 0; s < sector_count; s++) {
+        tlog_sector_header_t h;
+        memcpy(&h, sectors[s].data, sizeof(h));
+        if (!sectors[s].seen || h.magic != TLOG_MAGIC) continue;
+        sectors[s].seq = h.seq;
+        order[n++] = &sectors[s];
+    }
+    qsort(order, n, sizeof(order[0]), by_seq);
+
+    static boot_summary_t boots[1024];
+    int boot_count = 0, records = 0, damaged = 0;
+    if (csv) printf("boot,minute,voltage_mv,dimmed,safety,standby,mic_on,leader,fps,loud_avg_db,loud_max_db,brightness,pattern\n");
+    for (int i = 0; i < n; i++) {
+        tlog_sample_t state = { 0 };
+        tlog_record_t r;
+        int off = sizeof(tlog_sector_header_t), end = off;
+        while (tlog_decode(order[i]->data, TLOG_SECTOR_SIZE, &off, &state, &r)) {
+            end = off;
+            records++;
+            boot_summary_t *b = summary_for(boots, &boot_count, sizeof(boots) / sizeof(boots[0]),
+                                            r.tag == TLOG_BOOT ? r.boot.boot : r.sample.boot);
+            if (!b) continue;
+            if (r.tag == TLOG_BOOT) {
+                b->info = r.boot;
+                b->have_info = true;
+                continue;
+            }
+            const tlog_sample_t *s = &r.sample;
+            add_sample(b, s);
+            if (csv) {
+                printf("%u,%" PRIu32 ",%u,%d,%d,%d,%d,%d,%u,%u,%u,%u,%u\n", s->boot, s->minute, s->voltage_mv,
+                       !!(s->flags & TLOG_F_LIMIT_BRIGHTNESS), !!(s->flags & TLOG_F_SAFETY_PATTERN),
+                       !!(s->flags & TLOG_F_STANDBY), !!(s->flags & TLOG_F_MIC_ON), !!(s->flags & TLOG_F_SHOW_LEADER),
+                       s->fps, s->loud_avg_db, s->loud_max_db, s->settings >> 4, s->settings & 0x0f);
+            }
+        }
+        // Records end at erased flash; anything else is a record a power loss cut short
+        if (end < TLOG_SECTOR_SIZE && order[i]->data[end] != TLOG_END) damaged++;
+    }
+
+    if (!csv) {
+        for (int i = 0; i < boot_count; i++) print_summary(&boots[i]);
+    }
+    fprintf(stderr, "%d sectors, %d records, %d boots%s\n", n, records, boot_count, damaged ? ", damaged tail" : "");
+    return 0;
+}
@@ -0,0 +1,157 @@
+// Turns the badge's `trace` console dump (main/trace.c) into Chrome trace JSON, for
+// chrome://tracing or ui.perfetto.dev. Feed it a saved monitor log; other log lines
+// around the dump are skipped, and with several dumps in the log the last one wins.
+//
+//   ./trace-decode monitor.log > trace.json
+//
+// Each core gets a row per kind of event (frames, RMT, audio, radio...). Times are
+// microseconds of esp_timer time, so they line up with the timestamps in ESP_LOG lines.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "trace.h"
+
+#define MAX_CORES 2
+#define MAX_RECORDS (MAX_CORES * TRACE_RING_LEN)
+
+#define TRACE_NAME(id, name, kind) name,
+#define TRACE_KIND(id, name, kind) kind,
+static const char *const event_names[TRACE_EVENT_COUNT] = { TRACE_EVENTS(TRACE_NAME) };
+static const char event_kinds[TRACE_EVENT_COUNT] = { TRACE_EVENTS(TRACE_KIND) };
+
+typedef struct {
+    int core;
+    uint32_t cycles;
+    uint16_t id;
+    uint16_t arg;
+    double t_us;
+} record_t;
+
+typedef struct {
+    bool seen;
+    uint32_t cycles;
+    int64_t us;
+} anchor_t;
+
+static record_t records[MAX_RECORDS];
+static int record_count;
+static anchor_t anchors[MAX_CORES];
+static int cpu_mhz;
+
+static bool load(FILE *f) {
+    char line[256];
+    bool in_dump = false, found = false;
+    while (fgets(line, sizeof(line), f)) {
+        // The monitor may prefix lines (timestamps, colour codes), so look for the tag anywhere
+        char *p;
+        if ((p = strstr(line, "trace begin "))) {
+            int version, cores;
+            if (sscanf(p, "trace begin %d %d %d", &version, &cpu_mhz, &cores) == 3 && version == 1 && cpu_mhz > 0) {
+                in_dump = true;
+                record_count = 0;
+                memset(anchors, 0, sizeof(anchors));
+            }
+        } else if (!in_dump) {
+            continue;
+        } else if ((p = strstr(line, "trace end"))) {
+            in_dump = false;
+            found = true;
+        } else if ((p = strstr(line, "trace core "))) {
+            int core;
+            uint32_t cycles, count;
+            int64_t us;
+            if (sscanf(p, "trace core %d %" SCNx32 " %" SCNd64 " %" SCNu32, &core, &cycles, &us, &count) == 4 &&
+                core >= 0 && core < MAX_CORES) {
+                anchors[core] = (anchor_t){ true, cycles, us };
+            }
+        } else if ((p = strstr(line, "tr "))) {
+            int core;
+            uint32_t cycles;
+            unsigned id, arg;
+            if (sscanf(p, "tr %d %" SCNx32 " %u %u", &core, &cycles, &id, &arg) == 4 && core >= 0 && core < MAX_CORES &&
+                id < TRACE_EVENT_COUNT && record_count < MAX_RECORDS) {
+                records[record_count++] = (record_t){ .core = core, .cycles = cycles, .id = (uint16_t)id, .arg = (uint16_t)arg };
+            }
+        }
+    }
+    return found;
+}
+
+// Records of a core come oldest first. Walking back from the anchor, a step of more than
+// half the counter range forward is a wrap rather than time going backwards; small steps
+// back are records an ISR wrote between a task's timestamp and its write
+static void place_in_time(void) {
+    for (int core = 0; core < MAX_CORES; core++) {
+        if (!anchors[core].seen) continue;
+        int64_t back = 0;           // cycles before the anchor
+        uint32_t later = anchors[core].cycles;
+        for (int i = record_count - 1; i >= 0; i--) {
+            record_t *r = &records[i];
+            if (r->core != core) continue;
+            back += (int32_t)(later - r->cycles);
+            later = r->cycles;
+            r->t_us = anchors[core].us - (double)back / cpu_mhz;
+        }
+    }
+}
+
+static int by_time(const void *a, const void *b) {
+    const record_t *x = a, *y = b;
+    return x->t_us < y->t_us ? -1 : x->t_us > y->t_us;
+}
+
+// Row within a core: one per event name, so spans of different kinds never have to nest
+static int row(const record_t *r) {
+    for (int id = 0; id < TRACE_EVENT_COUNT; id++) {
+        if (!strcmp(event_names[id], event_names[r->id])) return r->core * TRACE_EVENT_COUNT + id;
+    }
+    return r->core * TRACE_EVENT_COUNT;
+}
+
+static void write_json(FILE *out) {
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    bool named[MAX_CORES * TRACE_EVENT_COUNT] = { false };
+    for (int i = 0; i < record_count; i++) {
+        const record_t *r = &records[i];
+        if (!anchors[r->core].seen) continue;
+        int tid = row(r);
+        if (!named[tid]) {
+            named[tid] = true;
+            fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"core %d %s\"}}",
+                    first ? "" : ",\n", tid, r->core, event_names[r->id]);
+            first = false;
+        }
+        char kind = event_kinds[r->id];
+        fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":0,\"tid\":%d%s,\"args\":{\"arg\":%u}}",
+                event_names[r->id], kind == 'I' ? 'i' : kind, r->t_us, tid, kind == 'I' ? ",\"s\":\"t\"" : "", r->arg);
+    }
+    fprintf(out, "\n]}\n");
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2 || !strcmp(argv[1], "-h")) {
+        fprintf(stderr, "usage: %s LOG (- for stdin) > trace.json\n", argv[0]);
+        return argc == 2 ? 0 : 1;
+    }
+    FILE *f = strcmp(argv[1], "-") ? fopen(argv[1], "r") : stdin;
+    if (!f) {
+        perror(argv[1]);
+        return 1;
+    }
+    bool found = load(f);
+    if (f != stdin) fclose(f);
+    if (!found) {
+        fprintf(stderr, "%s: no complete trace dump in it\n", argv[1]);
+        return 1;
+    }
+    place_in_time();
+    qsort(records, record_count, sizeof(records[0]), by_time);
+    write_json(stdout);
+    fprintf(stderr, "%d events, %d MHz\n", record_count, cpu_mhz);
+    return 0;
+}